@@ -0,0 +1,67 @@
+#include "ActivityDetector.h"
+
+#include <algorithm>
+#include <time.h>
+
+constexpr double ActivityDetector::HYSTERESIS;
+
+namespace {
+double getTime(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+}
+
+ActivityDetector::ActivityDetector():
+    mLevel(0),
+    mAfter(0),
+    mSilent(0),
+    mIdle(false),
+    mLastWall(getTime(CLOCK_MONOTONIC)),
+    mLastCpu(getTime(CLOCK_PROCESS_CPUTIME_ID))
+{
+    for (int i = 0; i < 2; i++) {
+        mWall[i] = 0;
+        mCpu[i] = 0;
+    }
+}
+
+void ActivityDetector::configure(double level, double after) {
+    mLevel = level;
+    mAfter = after;
+}
+
+bool ActivityDetector::update(double recorded, double expected, double dt) {
+    // whatever's been used since last time goes to however it was then
+    const double wall = getTime(CLOCK_MONOTONIC), cpu = getTime(CLOCK_PROCESS_CPUTIME_ID);
+    const bool was = mIdle;
+    mWall[was].store(mWall[was].load(std::memory_order_relaxed) + wall - mLastWall,
+                     std::memory_order_relaxed);
+    mCpu[was].store(mCpu[was].load(std::memory_order_relaxed) + cpu - mLastCpu,
+                    std::memory_order_relaxed);
+    mLastWall = wall;
+    mLastCpu = cpu;
+
+    const double power = std::max(recorded, expected);
+    if (mLevel <= 0 || mAfter <= 0 || power >= mLevel) {
+        mSilent = 0;
+        mIdle = false;
+    } else if (power < mLevel*HYSTERESIS) {
+        mSilent = std::min(mSilent + dt, mAfter);
+        if (mSilent >= mAfter) {
+            mIdle = true;
+        }
+    } else if (!was) {
+        // not loud enough to wake it, but not quiet enough to count either
+        mSilent = 0;
+    }
+    return mIdle;
+}
+
+ActivityDetector::Usage ActivityDetector::usage(bool idle) const {
+    Usage u;
+    u.wall = mWall[idle].load(std::memory_order_relaxed);
+    u.cpu = mCpu[idle].load(std::memory_order_relaxed);
+    return u;
+}
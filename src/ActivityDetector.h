@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+
+/*! @brief Works out whether anything's going on in the room
+ *
+ *  Goes by the recorded and expected power each cycle, with some
+ *  hysteresis: anything at or over the level wakes it straight away, but
+ *  it only counts as silence once both are well under it, and it only goes
+ *  idle once it's been silent for long enough. In between, it just stays
+ *  however it was.
+ *
+ *  It also keeps track of how long it's spent in each state, and how much
+ *  CPU time the whole process used meanwhile, so that the saving can be
+ *  reported.
+ */
+class ActivityDetector {
+public:
+    //! How far under the level it has to get to count as silence, as a fraction of it
+    static constexpr double HYSTERESIS = 0.5;
+
+    //! Time spent in a state, and the process CPU time used during it, in seconds
+    struct Usage {
+        double wall, cpu;
+        //! CPU use, as a fraction of a core
+        double load() const { return wall > 0 ? cpu/wall : 0; }
+    };
+
+    ActivityDetector();
+
+    /*! @brief Set the thresholds
+     *
+     *  @param level The power that counts as activity; 0 or less to never go idle
+     *  @param after How long it has to be silent before going idle, in seconds;
+     *      0 or less to never go idle
+     */
+    void configure(double level, double after);
+
+    /*! @brief Go by a cycle's worth of levels (one thread only)
+     *
+     *  @param recorded Recorded power
+     *  @param expected Expected power
+     *  @param dt How long they cover, in seconds
+     *  @returns whether it's idle
+     */
+    bool update(double recorded, double expected, double dt);
+
+    bool idle() const { return mIdle; }
+
+    //! The usage while active or idle so far, from any thread
+    Usage usage(bool idle) const;
+
+private:
+    double mLevel, mAfter;
+    //! How long it's been silent, in seconds
+    double mSilent;
+    std::atomic<bool> mIdle;
+
+    //! When the usage was last brought up to date, by the clock and by the CPU, in seconds
+    double mLastWall, mLastCpu;
+    //! Usage while active and idle
+    std::atomic<double> mWall[2], mCpu[2];
+};
@@ -0,0 +1,136 @@
+#include "AudioDevice.h"
+
+#include <boost/throw_exception.hpp>
+
+#include <alsa/asoundlib.h>
+
+#include <algorithm>
+#include <ctime>
+#include <stdexcept>
+
+namespace {
+class AlsaDevice final: public AudioDevice {
+public:
+    AlsaDevice(const std::string& name, bool capture): mName(name), mCapture(capture) {
+        int err;
+        if ((err = snd_pcm_open(&mPcm, name.c_str(),
+                                capture ? SND_PCM_STREAM_CAPTURE : SND_PCM_STREAM_PLAYBACK, 0)) < 0) {
+            BOOST_THROW_EXCEPTION(std::runtime_error("Couldn't open " + name + " for " + direction()
+                                                     + ": " + snd_strerror(err)));
+        }
+    }
+
+    ~AlsaDevice() {
+        snd_pcm_close(mPcm);
+    }
+
+    void configure(size_t channels, unsigned int sampleRate, unsigned int latency) override {
+        snd_pcm_drop(mPcm);
+        int err;
+        if ((err = snd_pcm_set_params(mPcm, SND_PCM_FORMAT_S16, SND_PCM_ACCESS_RW_INTERLEAVED,
+                                      channels, sampleRate, 1, latency)) < 0) {
+            BOOST_THROW_EXCEPTION(std::runtime_error("Couldn't configure " + mName + " for "
+                                                     + direction() + ": " + snd_strerror(err)));
+        }
+    }
+
+    void wait() override {
+        snd_pcm_wait(mPcm, -1);
+    }
+
+    long read(int16_t *data, size_t frames) override {
+        return snd_pcm_readi(mPcm, data, frames);
+    }
+
+    long write(const int16_t *data, size_t frames) override {
+        return snd_pcm_writei(mPcm, data, frames);
+    }
+
+    int recover(int err) override {
+        return snd_pcm_recover(mPcm, err, 0);
+    }
+
+    void drop() override {
+        snd_pcm_drop(mPcm);
+    }
+
+    void prepare() override {
+        snd_pcm_prepare(mPcm);
+    }
+
+    bool ready(size_t frames) override {
+        // a stream that's stopped starts on the next transfer, and one that's
+        // had an xrun gets recovered by it
+        if (snd_pcm_state(mPcm) != SND_PCM_STATE_RUNNING) {
+            return true;
+        }
+        const snd_pcm_sframes_t avail = snd_pcm_avail_update(mPcm);
+        return avail < 0 || static_cast<size_t>(avail) >= frames;
+    }
+
+    void pollDescriptors(std::vector<struct pollfd>& fds) override {
+        const int n = std::max(0, snd_pcm_poll_descriptors_count(mPcm));
+        fds.resize(fds.size() + n);
+        snd_pcm_poll_descriptors(mPcm, &fds[fds.size() - n], n);
+    }
+
+    bool params(long& bufferSize, long& periodSize) override {
+        snd_pcm_uframes_t buffer, period;
+        if (snd_pcm_get_params(mPcm, &buffer, &period) < 0) {
+            return false;
+        }
+        bufferSize = buffer;
+        periodSize = period;
+        return true;
+    }
+
+    bool enableTimestamps() override {
+        snd_pcm_sw_params_t *params;
+        snd_pcm_sw_params_alloca(&params);
+        return snd_pcm_sw_params_current(mPcm, params) >= 0
+            && snd_pcm_sw_params_set_tstamp_mode(mPcm, params, SND_PCM_TSTAMP_ENABLE) >= 0
+            && snd_pcm_sw_params_set_tstamp_type(mPcm, params, SND_PCM_TSTAMP_TYPE_MONOTONIC) >= 0
+            && snd_pcm_sw_params(mPcm, params) >= 0;
+    }
+
+    bool timestamp(long& avail, double& time) override {
+        snd_pcm_uframes_t a;
+        snd_htimestamp_t ts;
+        // a stream that hasn't started yet has no timestamp
+        if (snd_pcm_htimestamp(mPcm, &a, &ts) < 0 || !(ts.tv_sec || ts.tv_nsec)) {
+            return false;
+        }
+        avail = a;
+        time = ts.tv_sec + ts.tv_nsec*1e-9;
+        return true;
+    }
+
+    bool delay(long& frames) override {
+        snd_pcm_sframes_t d;
+        if (snd_pcm_delay(mPcm, &d) < 0) {
+            return false;
+        }
+        frames = d;
+        return true;
+    }
+
+    double now() const override {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec*1e-9;
+    }
+
+private:
+    std::string mName;
+    bool mCapture;
+    snd_pcm_t *mPcm;
+
+    const char *direction() const {
+        return mCapture ? "capture" : "playback";
+    }
+};
+}
+
+AudioDevice::Ptr AudioDevice::alsa(const std::string& name, bool capture) {
+    return Ptr(new AlsaDevice(name, capture));
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <poll.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*! @brief One direction of a sound card, as the loop sees it
+ *
+ *  Everything run() does to its capture and playback devices goes through
+ *  here, so that it can run against something other than ALSA, e.g. the
+ *  simulated room (see RoomSimulator). The calls follow the ALSA ones they
+ *  stand for, down to returning negative error codes from transfers, since
+ *  the xrun handling depends on exactly how those behave.
+ */
+class AudioDevice {
+public:
+    typedef std::unique_ptr<AudioDevice> Ptr;
+
+    virtual ~AudioDevice() {}
+
+    /*! @brief Set up 16-bit interleaved transfers
+     *
+     *  Any stream in progress is dropped. Throws if the device won't do it.
+     *
+     *  @param latency The buffering to ask for, in microseconds
+     */
+    virtual void configure(size_t channels, unsigned int sampleRate, unsigned int latency) = 0;
+
+    //! Wait until the device is ready for a transfer
+    virtual void wait() = 0;
+
+    //! As snd_pcm_readi(): frames read, or a negative error code
+    virtual long read(int16_t *data, size_t frames) = 0;
+
+    //! As snd_pcm_writei(): frames written, or a negative error code
+    virtual long write(const int16_t *data, size_t frames) = 0;
+
+    //! As snd_pcm_recover(): 0 if the stream is ready to go again after the error
+    virtual int recover(int err) = 0;
+
+    //! Stop the stream, throwing away anything queued
+    virtual void drop() = 0;
+
+    //! Get a stopped stream ready to start on the next transfer
+    virtual void prepare() = 0;
+
+    //! Whether a transfer of this many frames would go through without waiting
+    virtual bool ready(size_t frames) = 0;
+
+    //! Add whatever to poll() on until ready() changes, if anything
+    virtual void pollDescriptors(std::vector<struct pollfd>& fds) = 0;
+
+    //! The buffer and period sizes as configured, in frames
+    virtual bool params(long& bufferSize, long& periodSize) = 0;
+
+    //! Have the device timestamp its pointer updates
+    virtual bool enableTimestamps() = 0;
+
+    /*! @brief As snd_pcm_htimestamp()
+     *
+     *  @param avail Set to the frames that can be transferred without waiting
+     *  @param time Set to when that was so, on the same clock as now()
+     *  @returns false if there's no timestamp (yet)
+     */
+    virtual bool timestamp(long& avail, double& time) = 0;
+
+    //! As snd_pcm_delay(), as of now()
+    virtual bool delay(long& frames) = 0;
+
+    //! The time on the device's clock, in seconds
+    virtual double now() const = 0;
+
+    /*! @brief Open an ALSA device
+     *
+     *  @param name The ALSA device name
+     *  @param capture Whether to open it for capture (otherwise playback)
+     */
+    static Ptr alsa(const std::string& name, bool capture);
+};
@@ -0,0 +1,89 @@
+#include "AutoTuner.h"
+
+namespace {
+//! How much of the period the processing may take before it's cutting it too fine
+const double BUDGET = 0.75;
+//! How many cycles can go over budget, as a fraction
+const double MAX_OVER_BUDGET = 0.01;
+//! How long to run the configured settings before jumping to the bottom, in seconds
+const double WARMUP = 1.0;
+}
+
+AutoTuner::AutoTuner(unsigned int sampleRate, size_t period, int latency,
+                     double settleTime, size_t minPeriod):
+    mSampleRate(sampleRate),
+    mSettleFrames(sampleRate*settleTime),
+    mLevel(0),
+    mStarted(false),
+    mStable(false),
+    mElapsed(0),
+    mCycles(0),
+    mOverBudget(0),
+    mXruns(0),
+    mXrunCount(0),
+    mLastXruns(0),
+    mLastOverBudget(0)
+{
+    mLevels.push_back(Setting{period, latency});
+    while (period/2 >= minPeriod) {
+        period /= 2;
+        latency /= 2;
+        mLevels.push_back(Setting{period, latency});
+    }
+}
+
+void AutoTuner::enter(size_t level, size_t xruns) {
+    mLastXruns = mXrunCount;
+    mLastOverBudget = overBudget();
+
+    mLevel = level;
+    mStable = false;
+    mElapsed = 0;
+    mCycles = mOverBudget = 0;
+    mXruns = xruns;
+    mXrunCount = 0;
+}
+
+void AutoTuner::settled(size_t xruns) {
+    mElapsed = 0;
+    mCycles = mOverBudget = 0;
+    mXruns = xruns;
+    mXrunCount = 0;
+}
+
+AutoTuner::Action AutoTuner::update(size_t frames, double cycleTime, size_t xruns) {
+    mElapsed += frames;
+
+    if (!mStarted) {
+        // the configured settings are the known-good ones, and where the
+        // calibration happened; give them a moment before going low
+        if (mElapsed < mSampleRate*WARMUP) {
+            return A_NONE;
+        }
+        mStarted = true;
+        if (mLevels.size() < 2) {
+            return A_NONE;
+        }
+        enter(mLevels.size() - 1, xruns);
+        return A_CHANGE;
+    }
+
+    ++mCycles;
+    if (cycleTime > BUDGET*current().period/mSampleRate) {
+        ++mOverBudget;
+    }
+    mXrunCount = xruns - mXruns;
+
+    const bool trouble = mXrunCount > 0
+        || (mCycles >= 100 && overBudget() > MAX_OVER_BUDGET);
+    if (trouble && mLevel > 0) {
+        enter(mLevel - 1, xruns);
+        return A_CHANGE;
+    }
+
+    if (!mStable && mElapsed >= mSettleFrames) {
+        mStable = true;
+        return A_STABLE;
+    }
+    return A_NONE;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+/*! @brief Finds the lowest buffer settings the machine can keep up with
+ *
+ *  Works down a ladder of settings, each level halving the period and the
+ *  ALSA latency of the one before, from the configured ones (which are
+ *  assumed to be safe) down to a minimum period. It starts at the bottom
+ *  and steps back up whenever there are xruns or too many cycles run short
+ *  on headroom, and never comes back down; a level that goes long enough
+ *  without trouble is reported as stable.
+ */
+class AutoTuner {
+public:
+    //! One rung of the ladder
+    struct Setting {
+        //! Frames per cycle
+        size_t period;
+        //! Requested ALSA latency, in microseconds
+        int latency;
+    };
+
+    enum Action {
+        A_NONE,
+        //! Switch to current()
+        A_CHANGE,
+        //! current() has just been running cleanly for the settle time
+        A_STABLE
+    };
+
+    /*! @param sampleRate The sample rate
+     *  @param period The configured period, in frames
+     *  @param latency The configured ALSA latency, in microseconds
+     *  @param settleTime How long a level has to run cleanly to count as stable, in seconds
+     *  @param minPeriod The smallest period to try
+     */
+    AutoTuner(unsigned int sampleRate, size_t period, int latency,
+              double settleTime = 30, size_t minPeriod = 64);
+
+    /*! @brief Account for a cycle
+     *
+     *  @param frames Frames processed in this cycle
+     *  @param cycleTime How long the processing took, in seconds
+     *  @param xruns How many xruns the devices have had so far
+     *  @returns what to do about it
+     */
+    Action update(size_t frames, double cycleTime, size_t xruns);
+
+    /*! @brief Start the current level's statistics over
+     *
+     *  For once the devices have settled after a change, so that the
+     *  xruns that come of changing don't count against the new level.
+     *
+     *  @param xruns How many xruns the devices have had so far
+     */
+    void settled(size_t xruns);
+
+    //! The setting to use now
+    const Setting& current() const { return mLevels[mLevel]; }
+
+    //! Xruns at the level we last moved away from
+    size_t lastXruns() const { return mLastXruns; }
+
+    //! Fraction of cycles that ran short on headroom at the level we last moved away from
+    double lastOverBudget() const { return mLastOverBudget; }
+
+private:
+    unsigned int mSampleRate;
+    size_t mSettleFrames;
+    std::vector<Setting> mLevels;
+    size_t mLevel;
+
+    //! Whether we've made the initial jump to the bottom of the ladder
+    bool mStarted;
+    //! Whether the current level has been reported stable
+    bool mStable;
+
+    //! Statistics for the current level
+    size_t mElapsed;
+    size_t mCycles, mOverBudget;
+    size_t mXruns, mXrunCount;
+
+    size_t mLastXruns;
+    double mLastOverBudget;
+
+    double overBudget() const { return mCycles ? mOverBudget*1.0/mCycles : 0; }
+
+    //! Start over at a new level
+    void enter(size_t level, size_t xruns);
+};
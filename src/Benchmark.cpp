@@ -0,0 +1,915 @@
+#include "Benchmark.h"
+#include "Buffer.h"
+#include "Drum.h"
+#include "ControlServer.h"
+#include "Engine.h"
+#include "Equalizer.h"
+#include "Limiter.h"
+#include "LoudnessMeter.h"
+#include "Metrics.h"
+#include "Offscreen.h"
+#include "Resampler.h"
+#include "RoomSimulator.h"
+#include "Spectrogram.h"
+#include "Stretcher.h"
+#include "Visualizer.h"
+#include "WaveOverview.h"
+#include "WorkerPool.h"
+
+#include <GL/glew.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <time.h>
+#include <vector>
+
+namespace {
+double getTime() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+//! CPU time used by the whole process, in seconds
+double getCpuTime() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+void fillNoise(Buffer& buf, std::mt19937& rng) {
+    std::uniform_int_distribution<int> dist(-8192, 8191);
+    for (auto& s : buf) {
+        s = dist(rng);
+    }
+}
+
+//! Report the cost of processing a given number of frames
+void report(const std::string& what, size_t channels, size_t frames,
+            unsigned int sampleRate, double elapsed) {
+    std::cout << what << ": " << channels << " channels, "
+              << elapsed*1e9/frames/channels << " ns/frame/channel, "
+              << frames*1.0/sampleRate/elapsed << "x realtime" << std::endl;
+}
+
+int benchResampler(const Repeater::Options& opts, const std::string&) {
+    const size_t seconds = 60;
+    std::mt19937 rng(1);
+
+    for (size_t channels : {1, 2, 4, 8}) {
+        Resampler rs(channels, opts.bufSize);
+        Buffer in(NULL, opts.bufSize, channels),
+            out(NULL, rs.maxOutput(opts.bufSize), channels);
+        fillNoise(in, rng);
+
+        const size_t cycles = seconds*opts.sampleRate/opts.bufSize;
+        size_t produced = 0;
+        double start = getTime();
+        for (size_t i = 0; i < cycles; i++) {
+            // wander around a realistic drift range
+            rs.setRatio(1 + 1e-4*((i % 200) < 100 ? 1 : -1));
+            produced += rs.process(in, opts.bufSize, out);
+        }
+        report("resampler", channels, produced, opts.sampleRate, getTime() - start);
+    }
+    return 0;
+}
+
+int benchSpectrogram(const Repeater::Options& opts, const std::string&) {
+    const size_t seconds = 60;
+    const size_t channels = 2;
+    std::mt19937 rng(1);
+
+    Buffer played(NULL, opts.bufSize, channels), recorded(NULL, opts.bufSize, channels);
+    fillNoise(played, rng);
+    fillNoise(recorded, rng);
+
+    for (size_t hop : {1024, 256, 64}) {
+        Spectrogram spec(opts.sampleRate, opts.bufSize, hop, 1024);
+
+        const size_t cycles = seconds*opts.sampleRate/opts.bufSize;
+        size_t rows = 0;
+        double start = getTime();
+        for (size_t i = 0; i < cycles; i++) {
+            spec.push(played, recorded, opts.bufSize);
+            rows += spec.process();
+        }
+        const double elapsed = getTime() - start;
+        report("spectrogram, hop " + std::to_string(hop), channels, cycles*opts.bufSize,
+               opts.sampleRate, elapsed);
+        std::cout << "    " << elapsed*1e6/rows << " usec/row" << std::endl;
+    }
+    return 0;
+}
+
+/*! Measure a cycle's recorded and expected levels the way the volume
+ *  models get them: plain RMS, or from the loudness meters.
+ */
+int benchLoudness(const Repeater::Options& opts, const std::string&) {
+    const size_t seconds = 60;
+    std::mt19937 rng(1);
+
+    for (size_t channels : {1, 2, 8}) {
+        Buffer in(NULL, opts.bufSize, channels), expected(NULL, opts.bufSize, channels);
+        fillNoise(in, rng);
+        fillNoise(expected, rng);
+        const size_t cycles = seconds*opts.sampleRate/opts.bufSize;
+
+        double total = 0;
+        double start = getTime();
+        for (size_t i = 0; i < cycles; i++) {
+            total += in.power(opts.bufSize) + expected.power(opts.bufSize);
+            for (size_t c = 0; c < channels; c++) {
+                total += in.power(opts.bufSize, 0, c) + expected.power(opts.bufSize, 0, c);
+            }
+        }
+        report("rms", channels, cycles*opts.bufSize, opts.sampleRate, getTime() - start);
+
+        LoudnessMeter recMeter(opts.sampleRate, channels), listenMeter(opts.sampleRate, channels);
+        recMeter.configure(30, -70);
+        listenMeter.configure(30, -70);
+        start = getTime();
+        for (size_t i = 0; i < cycles; i++) {
+            recMeter.push(in, opts.bufSize);
+            listenMeter.push(expected, opts.bufSize);
+            total += recMeter.power() + listenMeter.power();
+            for (size_t c = 0; c < channels; c++) {
+                total += recMeter.power(c) + listenMeter.power(c);
+            }
+        }
+        report("loudness", channels, cycles*opts.bufSize, opts.sampleRate, getTime() - start);
+
+        // keep the measurements from getting optimized away
+        if (total < 0) {
+            std::cout << total << std::endl;
+        }
+    }
+    return 0;
+}
+
+/*! Run EQ cascades of various depths at small periods, against the
+ *  obvious one-section-at-a-time cascade for comparison. The bands get
+ *  moved every so often, so some of the time goes into coefficient ramps.
+ */
+int benchEqualizer(const Repeater::Options& opts, const std::string&) {
+    const size_t seconds = 30;
+    std::mt19937 rng(1);
+
+    std::array<Equalizer::Band, Equalizer::MAX_SECTIONS> bands;
+    for (size_t b = 0; b < bands.size(); b++) {
+        bands[b].type = b == 0 ? Equalizer::T_HIGH_PASS
+            : b == 1 ? Equalizer::T_LOW_SHELF : b == 2 ? Equalizer::T_HIGH_SHELF
+            : Equalizer::T_PEAK;
+        bands[b].freq = 60*pow(1.4, b);
+        bands[b].gain = b % 2 ? -6 : 3;
+        bands[b].q = 2;
+    }
+
+    for (size_t channels : {2, 8}) {
+        for (size_t sections : {4, 10, 16}) {
+            for (size_t period : {32, 64, 128}) {
+                const size_t cycles = seconds*opts.sampleRate/period;
+                Buffer buf(NULL, period, channels);
+                fillNoise(buf, rng);
+
+                Equalizer eq(opts.sampleRate, channels, sections, opts.sampleRate/50);
+                double start = getTime();
+                for (size_t i = 0; i < cycles; i++) {
+                    if (i % 1000 == 0) {
+                        bands[0].freq = i % 2000 ? 40 : 80;
+                        eq.configure(&bands[0], bands.size());
+                    }
+                    eq.process(buf, period);
+                }
+                report("eq, " + std::to_string(sections) + " sections, period " + std::to_string(period),
+                       channels, cycles*period, opts.sampleRate, getTime() - start);
+
+                // direct form I, one section and one channel at a time; pass-through
+                // coefficients, but the arithmetic is the same whatever they are
+                std::vector<float> coeffs(sections*5), state(sections*channels*4);
+                for (size_t s = 0; s < sections; s++) {
+                    coeffs[s*5] = 1;
+                }
+                start = getTime();
+                for (size_t i = 0; i < cycles; i++) {
+                    for (size_t s = 0; s < sections; s++) {
+                        const float *k = &coeffs[s*5];
+                        for (size_t c = 0; c < channels; c++) {
+                            float *z = &state[(s*channels + c)*4];
+                            for (auto iter = buf.at(0) + c; iter < buf.at(period); iter += channels) {
+                                const float x = *iter;
+                                const float y = k[0]*x + k[1]*z[0] + k[2]*z[1] - k[3]*z[2] - k[4]*z[3];
+                                z[1] = z[0];
+                                z[0] = x;
+                                z[3] = z[2];
+                                z[2] = y;
+                                *iter = std::max(-32768.0f, std::min(32767.0f, y));
+                            }
+                        }
+                    }
+                }
+                report("    one at a time", channels, cycles*period, opts.sampleRate, getTime() - start);
+            }
+        }
+    }
+    return 0;
+}
+
+/*! Measure the levels and work out the gains for a cycle, then read it
+ *  through the limiter, once with every channel mixed together (one power
+ *  figure each way, and the same gain for the lot, the way it used to be
+ *  done) and once with each channel on its own. The limiter keeps its
+ *  peaks per channel either way, so the difference is what independent
+ *  control costs.
+ */
+int benchGain(const Repeater::Options& opts, const std::string&) {
+    const size_t seconds = 30;
+    const size_t lookahead = opts.sampleRate*0.005;
+    std::mt19937 rng(1);
+
+    for (size_t channels : {2, 8}) {
+        Drum drum(opts.sampleRate*10, channels);
+        fillNoise(drum, rng);
+        for (size_t period : {64, 256, 1024}) {
+            Buffer in(NULL, period, channels), listen(NULL, period, channels),
+                out(NULL, period, channels);
+            fillNoise(in, rng);
+            fillNoise(listen, rng);
+            const size_t cycles = seconds*opts.sampleRate/period;
+            std::vector<double> gain0(channels, 0.5), gain1(channels);
+
+            double elapsed[2];
+            for (int perChannel = 0; perChannel < 2; perChannel++) {
+                Limiter limiter(channels, period, lookahead, opts.sampleRate*0.05);
+                limiter.setCeiling(1);
+                size_t pos = 0;
+                const double start = getTime();
+                for (size_t i = 0; i < cycles; i++) {
+                    if (perChannel) {
+                        for (size_t c = 0; c < channels; c++) {
+                            gain1[c] = std::min(1.0, 1/std::max(0.01, in.power(period, 0, c)
+                                                                + listen.power(period, 0, c)));
+                        }
+                    } else {
+                        std::fill(gain1.begin(), gain1.end(), std::min(1.0,
+                            1/std::max(0.01, in.power(period) + listen.power(period))));
+                    }
+                    pos = limiter.read(drum, out, pos, period, &gain0[0], &gain1[0]);
+                }
+                elapsed[perChannel] = getTime() - start;
+            }
+
+            report("gain, mixed, period " + std::to_string(period), channels, cycles*period,
+                   opts.sampleRate, elapsed[0]);
+            report("    per channel", channels, cycles*period, opts.sampleRate, elapsed[1]);
+            std::cout << "    " << elapsed[1]/elapsed[0] << "x the mixed cost" << std::endl;
+        }
+    }
+    return 0;
+}
+
+/*! Read a loop of noise with loud bursts in it through the limiter, with
+ *  the gain well over what the ceiling allows, resetting it or jumping the
+ *  read head every so often the way resyncs and loop delay changes do.
+ *  Besides the cost, this checks that nothing gets over the ceiling,
+ *  including straight after a reset; it fails if anything does.
+ */
+int benchLimiter(const Repeater::Options& opts, const std::string&) {
+    const size_t seconds = 30;
+    const size_t channels = 2;
+    const double ceiling = 0.5;
+    const size_t lookahead = opts.sampleRate*0.005;
+    std::mt19937 rng(1);
+
+    Drum drum(opts.sampleRate*10, channels);
+    fillNoise(drum, rng);
+    std::uniform_int_distribution<size_t> where(0, drum.count() - 1);
+    for (size_t i = 0; i < 200; i++) {
+        auto burst = drum.at(where(rng));
+        for (size_t j = 0; j < 64 && burst != drum.end(); j++) {
+            *burst++ = j % 2 ? 32767 : -32768;
+        }
+    }
+
+    int failed = 0;
+    for (size_t period : {64, 256, 1024}) {
+        Limiter limiter(channels, period, lookahead, opts.sampleRate*0.05);
+        limiter.setCeiling(ceiling);
+        Buffer buf(NULL, period, channels);
+        const std::vector<double> gain(channels, 4);
+
+        const size_t cycles = seconds*opts.sampleRate/period;
+        size_t pos = 0;
+        int peak = 0, peakAfterReset = 0;
+        double elapsed = 0;
+        for (size_t i = 0; i < cycles; i++) {
+            const bool fresh = i % 50 == 0;
+            if (i % 100 == 0) {
+                limiter.reset();
+            } else if (i % 100 == 50) {
+                pos = where(rng);
+            }
+
+            const double start = getTime();
+            pos = limiter.read(drum, buf, pos, period, &gain[0], &gain[0]);
+            elapsed += getTime() - start;
+
+            for (int16_t s : buf) {
+                peak = std::max(peak, std::abs(static_cast<int>(s)));
+                if (fresh) {
+                    peakAfterReset = std::max(peakAfterReset, std::abs(static_cast<int>(s)));
+                }
+            }
+        }
+
+        report("limiter, period " + std::to_string(period), channels, cycles*period,
+               opts.sampleRate, elapsed);
+        const int limit = lrint(ceiling*32767);
+        std::cout << "    peak " << peak << ", straight after a reset " << peakAfterReset
+                  << ", ceiling " << limit << std::endl;
+        if (peak > limit) {
+            std::cout << "    over the ceiling!" << std::endl;
+            failed = 1;
+        }
+    }
+    return failed;
+}
+
+/*! Run noise through a simulated room with nothing but the delays, the
+ *  crosstalk and the reverb, and check what comes out against convolving
+ *  with the impulse response directly. Fails if any sample is out by more
+ *  than rounding.
+ */
+int benchRoom(const Repeater::Options& opts, const std::string&) {
+    const size_t channels = 2;
+    const size_t period = opts.bufSize;
+    const size_t frames = opts.sampleRate*2/period*period;
+    std::mt19937 rng(1);
+
+    RoomSimulator::Params params;
+    params.noise = 0;
+    params.resonance = 0;
+    params.events = 0;
+    RoomSimulator room(params, opts.sampleRate, channels, period);
+    const std::vector<float> ir = room.impulse();
+
+    Buffer played(NULL, frames, channels), captured(NULL, frames, channels);
+    fillNoise(played, rng);
+    Buffer in(NULL, period, channels), out(NULL, period, channels);
+    double elapsed = 0;
+    for (size_t pos = 0; pos < frames; pos += period) {
+        std::copy(played.at(pos), played.at(pos + period), in.begin());
+        const double start = getTime();
+        room.process(in, out);
+        elapsed += getTime() - start;
+        std::copy(out.begin(), out.end(), captured.at(pos));
+    }
+    report("room, " + std::to_string(ir.size()) + " frame impulse response", channels, frames,
+           opts.sampleRate, elapsed);
+
+    // what each microphone hears before the room gets to it
+    const size_t delay = params.delay*opts.sampleRate;
+    std::vector<std::vector<double>> mix(channels, std::vector<double>(frames));
+    for (size_t i = 0; i < frames; i++) {
+        for (size_t c = 0; c < channels; c++) {
+            for (size_t s = 0; s < channels; s++) {
+                mix[c][i] += played.at(i)[s]*(s == c ? 1 : params.crosstalk)*params.gain/32768;
+            }
+        }
+    }
+
+    int worst = 0;
+    for (size_t i = delay; i < frames; i++) {
+        for (size_t c = 0; c < channels; c++) {
+            double wet = 0;
+            for (size_t k = 0; k < ir.size() && k <= i - delay; k++) {
+                wet += ir[k]*mix[c][i - delay - k];
+            }
+            const int expected = std::max(-32768.0, std::min(32767.0, round(wet*32768)));
+            worst = std::max(worst, std::abs(expected - captured.at(i)[c]));
+        }
+    }
+    std::cout << "    worst difference from direct convolution: " << worst << std::endl;
+    if (worst > 1) {
+        std::cout << "    more than rounding!" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+/*! Run the loop in a simulated room for a minute with a trace going,
+ *  replay the trace, and check that the replay plays exactly what the loop
+ *  did: calibration, xruns, latency changes and all. The replay starts from
+ *  the default options, so anything the trace leaves out shows up. Fails if
+ *  a single sample differs.
+ */
+int benchReplay(const Repeater::Options& opts, const std::string&) {
+    const std::string base = "/tmp/whatwesaidwillbe-replay-" + std::to_string(getpid());
+    const std::string traceFile = base + ".trace", liveFile = base + "-live.raw",
+        replayFile = base + "-replay.raw";
+
+    Repeater::Options o = opts;
+    o.metricsName.clear();
+    o.jackClient.clear();
+    o.recDumpFile.clear();
+    o.listenDumpFile.clear();
+    o.traceFile = traceFile;
+    o.playDumpFile = liveFile;
+    RoomSimulator::Params room;
+    // plenty of xruns to make up for
+    room.stalls = 4;
+    {
+        Repeater rr(o, Repeater::Knobs());
+        if (rr.simulate(room, 60, 60)) {
+            return 1;
+        }
+    }
+
+    // everything the replay needs has to come from the trace, not from opts
+    Repeater::Options r;
+    r.metricsName.clear();
+    r.playDumpFile = replayFile;
+    {
+        Repeater rr(r, Repeater::Knobs());
+        rr.replay(traceFile, "", "");
+    }
+
+    std::ifstream live(liveFile, std::ios::binary), replayed(replayFile, std::ios::binary);
+    const std::vector<char> a((std::istreambuf_iterator<char>(live)), std::istreambuf_iterator<char>()),
+        b((std::istreambuf_iterator<char>(replayed)), std::istreambuf_iterator<char>());
+    remove(traceFile.c_str());
+    remove(liveFile.c_str());
+    remove(replayFile.c_str());
+
+    // the simulated room is stereo
+    const size_t frameBytes = 2*sizeof(int16_t);
+    const size_t same = std::mismatch(a.begin(), a.begin() + std::min(a.size(), b.size()), b.begin()).first
+        - a.begin();
+    std::cout << "replay: played " << a.size()/frameBytes << " frames live, " << b.size()/frameBytes
+              << " replayed";
+    if (a.empty() || same < std::max(a.size(), b.size())) {
+        std::cout << "; first difference at frame " << same/frameBytes << std::endl;
+        return 1;
+    }
+    std::cout << ", identical" << std::endl;
+    return 0;
+}
+
+/*! Stretch a loop of noise at 48KHz stereo, at various speeds and pitches
+ *  and periods, the way the stretch stage does: enough each cycle for the
+ *  period plus the limiter's lookahead. The worst cycle is what has to fit
+ *  in the period, since grains don't line up with periods.
+ */
+int benchStretch(const Repeater::Options&, const std::string&) {
+    const unsigned int sampleRate = 48000;
+    const size_t seconds = 30;
+    const size_t channels = 2;
+    const size_t lookahead = sampleRate*0.005;
+    std::mt19937 rng(1);
+
+    Drum drum(sampleRate*20, channels);
+    fillNoise(drum, rng);
+
+    const double settings[][2] = { {1, 0}, {1, 7}, {0.75, 0}, {1.5, -5}, {2, 12} };
+    for (const auto& setting : settings) {
+        for (size_t period : {64, 256, 1024}) {
+            Stretcher st(sampleRate, channels, sampleRate*4);
+            st.configure(setting[0], setting[1], 1);
+
+            const size_t cycles = seconds*sampleRate/period;
+            size_t playPos = 0, readPos = 0;
+            double worst = 0;
+            double start = getTime();
+            for (size_t i = 0; i < cycles; i++) {
+                const double before = getTime();
+                st.render(drum, playPos, playPos + sampleRate*10, readPos, period + lookahead);
+                worst = std::max(worst, getTime() - before);
+                playPos = (playPos + period) % drum.count();
+                readPos = (readPos + period) % st.output().count();
+            }
+            const double elapsed = getTime() - start;
+
+            std::ostringstream what;
+            what << "stretch, speed " << setting[0] << ", pitch " << setting[1] << ", period " << period;
+            report(what.str(), channels, cycles*period, sampleRate, elapsed);
+            std::cout << "    worst cycle " << worst*1e6 << " usec, "
+                      << worst*sampleRate*100/period << "% of the period" << std::endl;
+        }
+    }
+    return 0;
+}
+
+/*! Run a loop on a thread of its own, and measure the process CPU time it
+ *  uses over some seconds once it's got past calibration. The CPU time that
+ *  excluded() reports gets taken back out, and sample() is called at the end
+ *  of the measurement.
+ *
+ *  @returns The load as a fraction of one core, or a negative number if the
+ *  loop never got going
+ */
+double runLoad(Repeater& rr, const std::function<int()>& run, double seconds,
+               const std::function<double()>& excluded, const std::function<void()>& sample) {
+    std::atomic<bool> done(false);
+    std::thread loop([&]() {
+            run();
+            done = true;
+        });
+    while (rr.getState() == Repeater::S_STARTUP && !done) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    double load = -1;
+    if (!done) {
+        const double start = getTime(), cpu = getCpuTime() - excluded();
+        std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+        load = (getCpuTime() - excluded() - cpu)/(getTime() - start);
+        sample();
+    }
+    rr.shutdown();
+    loop.join();
+    return load;
+}
+
+/*! Compare how much CPU the loop takes running on ALSA with how much it
+ *  takes in JACK's callback, as a percentage of one core.
+ *
+ *  The ALSA loop goes through run() against a simulated room paced to the
+ *  wall clock, so that its reads block the way a sound card's do; the room's
+ *  own CPU time is taken back out. It runs once with the DSP on the audio
+ *  thread, and once handed over to a worker. JACK goes through a running
+ *  server if there is one, at the server's period, and its own estimate of
+ *  its load gets printed too; if there isn't, the callback gets called
+ *  directly instead, at each period.
+ */
+int benchCallback(const Repeater::Options& opts, const std::string&) {
+    const double seconds = 5;
+    const size_t channels = 2;
+    std::mt19937 rng(1);
+    auto none = []() { return 0.0; };
+    auto nothing = []() {};
+
+    Repeater::Options o = opts;
+    o.metricsName.clear();
+    o.traceFile.clear();
+    o.recDumpFile.clear();
+    o.listenDumpFile.clear();
+    o.playDumpFile.clear();
+    o.calibrationCache.clear();
+    o.jackClient.clear();
+
+    for (size_t period : {64, 128, 256, 512, 1024}) {
+        o.bufSize = period;
+        const double budget = period*1.0/o.sampleRate;
+
+        for (bool worker : {false, true}) {
+            RoomSimulator room(RoomSimulator::Params(), o.sampleRate, channels, period);
+            room.pace(true);
+            std::unique_ptr<WorkerPool> pool;
+            Repeater rr(o, Repeater::Knobs());
+            if (worker) {
+                pool.reset(new WorkerPool(1));
+                rr.setWorkerPool(pool.get());
+            }
+
+            const double load = runLoad(rr, [&]() { return rr.run(room); }, seconds,
+                                        [&room]() { return room.cpuTime(); }, nothing);
+            std::cout << "ALSA loop" << (worker ? " with a worker" : "") << ", period " << period;
+            if (load < 0) {
+                std::cout << ": didn't start" << std::endl;
+                return 1;
+            }
+            std::cout << ": load " << load*100 << "%" << std::endl;
+            if (!worker) {
+                for (const ProcessGraph::Timing& t : rr.getStageTimings()) {
+                    std::cout << "    " << t.name << ": "
+                              << t.total/std::max<uint64_t>(t.runs, 1)/budget*100
+                              << "%, max " << t.max/budget*100 << "%" << std::endl;
+                }
+            }
+        }
+    }
+
+    Repeater::Options jo = opts;
+    jo.jackClient = "whatwesaidwillbe-benchmark";
+    jo.metricsName = "/whatwesaidwillbe-benchmark";
+    {
+        Repeater rr(jo, Repeater::Knobs());
+        Metrics::Snapshot snap;
+        const double load = runLoad(rr, [&rr]() { return rr.run(); }, seconds, none, [&]() {
+                try {
+                    Metrics(jo.metricsName, false).read(snap);
+                } catch (const std::exception&) {
+                }
+            });
+        if (load >= 0) {
+            std::cout << "JACK callback, period " << snap.period*o.sampleRate << ": load "
+                      << load*100 << "%, server's estimate " << snap.dspLoad << "%" << std::endl;
+            return 0;
+        }
+    }
+
+    std::cout << "No JACK server, so calling its callback directly" << std::endl;
+    for (size_t period : {64, 128, 256, 512, 1024}) {
+        o.bufSize = period;
+        const size_t cycles = seconds*o.sampleRate/period;
+
+        Buffer in(NULL, period, channels);
+        fillNoise(in, rng);
+        std::vector<std::vector<float>> fin(channels, std::vector<float>(period)),
+            fout(channels, std::vector<float>(period));
+        for (size_t c = 0; c < channels; c++) {
+            for (size_t i = 0; i < period; i++) {
+                fin[c][i] = in.at(i)[c]/32768.0f;
+            }
+        }
+        const float *const fi[] = { &fin[0][0], &fin[1][0] };
+        float *const fo[] = { &fout[0][0], &fout[1][0] };
+
+        Repeater rr(o, Repeater::Knobs());
+        rr.startCallback(channels, period*3);
+        const double start = getCpuTime();
+        for (size_t i = 0; i < cycles; i++) {
+            rr.callback(fi, fo, period);
+        }
+        const double elapsed = getCpuTime() - start;
+        rr.stopCallback();
+
+        std::cout << "JACK callback, period " << period << ": load "
+                  << elapsed/(cycles*period*1.0/o.sampleRate)*100 << "%" << std::endl;
+    }
+    return 0;
+}
+
+//! Build an OSC message with a single float argument
+std::vector<uint8_t> oscMessage(const std::string& address, float value) {
+    std::vector<uint8_t> msg(address.begin(), address.end());
+    msg.resize((msg.size() + 4) & ~3);
+    const char tags[4] = { ',', 'f', 0, 0 };
+    msg.insert(msg.end(), tags, tags + 4);
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    bits = htonl(bits);
+    const uint8_t *b = reinterpret_cast<const uint8_t *>(&bits);
+    msg.insert(msg.end(), b, b + 4);
+    return msg;
+}
+
+/*! Flood the control server with knob changes and measure how long they
+ *  take from leaving the client to being picked up by a simulated audio
+ *  thread running at the configured buffer period.
+ */
+int benchControl(const Repeater::Options& opts, const std::string&) {
+    const double period = opts.bufSize*1.0/opts.sampleRate;
+
+    for (size_t rate : {10, 100, 1000, 10000}) {
+        Repeater::Ptr rr = std::make_shared<Repeater>(opts, Repeater::Knobs());
+        ControlServer server(rr, 0);
+        server.start();
+
+        const size_t count = std::max<size_t>(rate*2, 100);
+        std::vector<double> sent(count + 1);
+        std::vector<double> latencies;
+        latencies.reserve(count);
+        std::atomic<bool> done(false);
+
+        std::thread audio([&]() {
+                while (!done) {
+                    std::this_thread::sleep_for(std::chrono::duration<double>(period));
+                    if (rr->receiveKnobs()) {
+                        size_t idx = rr->activeKnobs().levels[Repeater::M_GAIN];
+                        if (idx > 0 && idx <= count) {
+                            latencies.push_back(getTime() - sent[idx]);
+                        }
+                    }
+                }
+            });
+
+        int sock = socket(AF_INET, SOCK_DGRAM, 0);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(server.port());
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        const double start = getTime();
+        for (size_t i = 1; i <= count; i++) {
+            const double when = start + i*1.0/rate;
+            double now;
+            while ((now = getTime()) < when) {
+                std::this_thread::sleep_for(std::chrono::duration<double>(when - now));
+            }
+            std::vector<uint8_t> msg = oscMessage("/gain", i);
+            sent[i] = getTime();
+            sendto(sock, &msg[0], msg.size(), 0,
+                   reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+        }
+        std::this_thread::sleep_for(std::chrono::duration<double>(period*4));
+        done = true;
+        audio.join();
+        close(sock);
+        server.stop();
+
+        std::sort(latencies.begin(), latencies.end());
+        std::cout << "control: " << rate << " msg/s, " << latencies.size() << "/" << count
+                  << " updates seen by audio thread";
+        if (!latencies.empty()) {
+            std::cout << ", latency ms p50=" << latencies[latencies.size()/2]*1e3
+                      << " p99=" << latencies[latencies.size()*99/100]*1e3
+                      << " max=" << latencies.back()*1e3;
+        }
+        std::cout << " (period " << period*1e3 << "ms)" << std::endl;
+    }
+    return 0;
+}
+
+//! Made-up engine data for exercising the visualizer
+class SyntheticEngine final: public Engine {
+public:
+    SyntheticEngine(const Repeater::Options& opts): mSampleRate(opts.sampleRate), mCycle(0) {
+        mHistory.history.resize(opts.historySize);
+        mHistory.channels = 2;
+        advance();
+
+        {
+            // phrases of a wobbly tone, fading in and out around the loop
+            const size_t frames = opts.sampleRate*opts.loopDelay*2;
+            mOverview.reset(new WaveOverview(frames, 2));
+            mOverview->reset(2);
+            Drum drum(frames, 2);
+            drum.setOverview(mOverview.get());
+            Buffer buf(NULL, opts.bufSize, 2);
+            for (size_t pos = 0; pos < frames; pos += opts.bufSize) {
+                for (size_t i = 0; i < opts.bufSize; i++) {
+                    const double t = (pos + i)*1.0/opts.sampleRate;
+                    const double envelope = std::max(0.0, sin(t*1.3))*(0.6 + 0.4*sin(t*0.2));
+                    const double tone = sin(t*2*M_PI*(150 + 50*sin(t*3)));
+                    buf.at(i)[0] = 20000*envelope*tone;
+                    buf.at(i)[1] = 16000*envelope*tone*cos(t*0.7);
+                }
+                drum.write(buf, pos, std::min(opts.bufSize, frames - pos));
+            }
+        }
+
+        if (opts.spectrogram) {
+            // a noise floor with a couple of sweeping tones
+            const size_t rows = 1024, hop = 256;
+            mSpectrogram.reset(new Spectrogram(opts.sampleRate, opts.bufSize, hop, rows));
+            Buffer played(NULL, opts.bufSize, 2), recorded(NULL, opts.bufSize, 2);
+            std::mt19937 rng(1);
+            std::uniform_int_distribution<int> noise(-300, 300);
+            size_t t = 0;
+            while (mSpectrogram->rowCount() < rows) {
+                for (size_t i = 0; i < opts.bufSize; i++, t++) {
+                    const double f = 200 + 4000*(0.5 + 0.5*sin(t*2e-5));
+                    const int16_t tone = 8000*sin(t*2*M_PI*f/opts.sampleRate);
+                    for (size_t c = 0; c < 2; c++) {
+                        recorded.at(i)[c] = tone + noise(rng);
+                        played.at(i)[c] = tone/2 + noise(rng);
+                    }
+                }
+                mSpectrogram->push(played, recorded, opts.bufSize);
+                mSpectrogram->process();
+            }
+        }
+    }
+
+    //! Move things along as if a cycle had gone by
+    void advance() {
+        const size_t n = mHistory.history.size();
+        for (size_t i = 0; i < n; i++) {
+            const double x = i*2*M_PI/n;
+            const double wobble = 0.5 + 0.5*sin(x*7 + mCycle*0.05);
+            Repeater::History::DataPoint& dp = mHistory.history[i];
+            dp.mode = Repeater::M_FEEDBACK;
+            dp.recordedPower = 0.05 + 0.1*wobble*(0.5 + 0.5*sin(x*61));
+            dp.expectedPower = 0.05 + 0.1*wobble;
+            dp.limitPower = 0.2;
+            dp.targetGain = 1 + 0.3*sin(x*3);
+            dp.actualGain = 1 + 0.25*sin(x*3 - 0.1);
+        }
+        mHistory.recordPos = mCycle % n;
+        mHistory.playPos = (mCycle + n/2) % n;
+        ++mCycle;
+    }
+
+    void getHistory(Repeater::History& h) const override { h = mHistory; }
+    Repeater::State getState() const override { return Repeater::S_RUNNING; }
+    Repeater::Knobs getKnobs() const override { return mKnobs; }
+    void changeKnobs(const std::function<void(Repeater::Knobs&)>& change) override {
+        change(mKnobs);
+    }
+    void shutdown() override {}
+    unsigned int getSampleRate() const override { return mSampleRate; }
+    const Spectrogram *getSpectrogram() const override { return mSpectrogram.get(); }
+    const WaveOverview *getOverview() const override { return mOverview.get(); }
+
+private:
+    unsigned int mSampleRate;
+    size_t mCycle;
+    Repeater::History mHistory;
+    Repeater::Knobs mKnobs;
+    std::unique_ptr<Spectrogram> mSpectrogram;
+    std::unique_ptr<WaveOverview> mOverview;
+};
+
+/*! Render the visualizer offscreen with synthetic history data, and report
+ *  how long frames take. With an output prefix, every 30th frame is also
+ *  saved as a PNG.
+ */
+int benchRender(const Repeater::Options& opts, const std::string& output) {
+    const int width = 1280, height = 720;
+    const size_t frames = 300, warmup = 10;
+
+    Offscreen context(width, height);
+    glewInit();
+
+    std::shared_ptr<SyntheticEngine> engine = std::make_shared<SyntheticEngine>(opts);
+    Visualizer vis(engine);
+    vis.onInit();
+    vis.onResize(width, height);
+
+    std::vector<double> times;
+    for (size_t i = 0; i < warmup + frames; i++) {
+        engine->advance();
+        const double start = getTime();
+        vis.draw(false);
+        context.finish();
+        const double elapsed = getTime() - start;
+        if (i >= warmup) {
+            times.push_back(elapsed);
+        }
+
+        if (!output.empty() && i % 30 == 0) {
+            char suffix[16];
+            snprintf(suffix, sizeof(suffix), "-%04zu.png", i);
+            context.savePNG(output + suffix);
+        }
+    }
+
+    std::sort(times.begin(), times.end());
+    auto pct = [&times](double p) { return times[std::min(times.size() - 1,
+                                                           static_cast<size_t>(p*times.size()))]*1e3; };
+    double total = 0;
+    for (double t : times) {
+        total += t;
+    }
+    std::cout << "render: " << width << 'x' << height << ", historySize "
+              << opts.historySize << (opts.spectrogram ? ", spectrogram" : "") << ": "
+              << frames/total << " fps; frame time p50 " << pct(0.5)
+              << " ms, p90 " << pct(0.9) << " ms, p99 " << pct(0.99)
+              << " ms, max " << times.back()*1e3 << " ms" << std::endl;
+    return 0;
+}
+
+typedef std::function<int(const Repeater::Options&, const std::string&)> Bench;
+
+const std::map<std::string, Bench>& benchmarks() {
+    static const std::map<std::string, Bench> b = {
+        { "callback", benchCallback },
+        { "control", benchControl },
+        { "eq", benchEqualizer },
+        { "gain", benchGain },
+        { "limiter", benchLimiter },
+        { "loudness", benchLoudness },
+        { "render", benchRender },
+        { "replay", benchReplay },
+        { "resampler", benchResampler },
+        { "room", benchRoom },
+        { "spectrogram", benchSpectrogram },
+        { "stretch", benchStretch },
+    };
+    return b;
+}
+}
+
+int runBenchmark(const std::string& name, const Repeater::Options& opts,
+                 const std::string& output) {
+    auto iter = benchmarks().find(name);
+    if (iter == benchmarks().end()) {
+        std::cerr << "Known benchmarks:";
+        for (const auto& b : benchmarks()) {
+            std::cerr << ' ' << b.first;
+        }
+        std::cerr << std::endl;
+        return name != "list";
+    }
+    return iter->second(opts, output);
+}
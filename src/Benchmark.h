@@ -0,0 +1,16 @@
+#pragma once
+
+#include "Repeater.h"
+
+#include <string>
+
+/*! @brief Run a named offline benchmark of one of the processing stages
+ *
+ *  @param name Which benchmark to run; "list" shows them all
+ *  @param opts The startup options (for sample rate, buffer size, etc.)
+ *  @param output Where to save anything the benchmark produces (e.g. rendered
+ *      frames); empty for nowhere
+ *  @returns the process exit status
+ */
+int runBenchmark(const std::string& name, const Repeater::Options& opts,
+                 const std::string& output = "");
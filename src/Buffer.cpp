@@ -1,15 +1,20 @@
+#include "AudioDevice.h"
 #include "Buffer.h"
 
 #include <boost/throw_exception.hpp>
 
+#include <alsa/asoundlib.h>
+
+#include <algorithm>
 #include <cmath>
 #include <stdexcept>
 
-Buffer::Buffer(snd_pcm_t* pipe,
+Buffer::Buffer(AudioDevice* pipe,
                size_t samples,
                size_t channels):
     mPipe(pipe),
     mChannels(channels),
+    mXruns(0),
     mData(samples*channels)
 {}
 
@@ -23,10 +28,45 @@ double Buffer::power(size_t count, size_t offset) const {
     return sqrt(ttl/count);
 }
 
-int Buffer::record() {
-    int frames = snd_pcm_readi(mPipe, &*begin(), count());
+double Buffer::power(size_t count, size_t offset, size_t channel) const {
+    double ttl = 0;
+    for (const_iterator iter = at(offset) + channel; iter < at(offset + count); iter += mChannels) {
+        double moment = *iter*1.0/32768;
+        ttl += moment*moment;
+    }
+
+    return sqrt(ttl*mChannels/count);
+}
+
+void Buffer::ramp(size_t offset, size_t n, double gain0, double gain1) {
+    const double step = n ? (gain1 - gain0)/n : 0;
+    double gain = gain0;
+    for (iterator iter = at(offset); iter != at(offset + n); iter += mChannels) {
+        for (size_t c = 0; c < mChannels; c++) {
+            iter[c] = iter[c]*gain;
+        }
+        gain += step;
+    }
+}
+
+void Buffer::mix(const Buffer& other, size_t offset, size_t n, double gain0, double gain1) {
+    const double step = n ? (gain1 - gain0)/n : 0;
+    double gain = gain0;
+    const_iterator src = other.at(offset);
+    for (iterator iter = at(offset); iter != at(offset + n); iter += mChannels, src += mChannels) {
+        for (size_t c = 0; c < mChannels; c++) {
+            const int32_t v = iter[c] + static_cast<int32_t>(src[c]*gain);
+            iter[c] = std::max(-32768, std::min(32767, v));
+        }
+        gain += step;
+    }
+}
+
+int Buffer::record(size_t n) {
+    int frames = mPipe->read(&*begin(), std::min(n, count()));
     if (frames < 0) {
-        frames = snd_pcm_recover(mPipe, frames, 0);
+        ++mXruns;
+        frames = mPipe->recover(frames);
     }
     if (frames < 0) {
         BOOST_THROW_EXCEPTION(std::runtime_error(snd_strerror(frames)));
@@ -35,9 +75,20 @@ int Buffer::record() {
 }
 
 int Buffer::play(size_t n) const {
-    int frames = snd_pcm_writei(mPipe, &*begin(), n);
+    int frames = mPipe->write(&*begin(), n);
     if (frames < 0) {
-        frames = snd_pcm_recover(mPipe, frames, 0);
+        ++mXruns;
+        frames = mPipe->recover(frames);
+        if (frames == 0) {
+            // don't drop this buffer too, or the stream falls even further behind
+            frames = mPipe->write(&*begin(), n);
+            if (frames < 0) {
+                // still no good, so this one's lost after all; get the stream
+                // ready for the next, and only give up if that can't be done
+                ++mXruns;
+                frames = mPipe->recover(frames);
+            }
+        }
     }
     if (frames < 0) {
         BOOST_THROW_EXCEPTION(std::runtime_error(snd_strerror(frames)));
@@ -1,18 +1,18 @@
 #pragma once
 
-#include <alsa/asoundlib.h>
-
 #include <cstddef>
 #include <cstdint>
 #include <vector>
 
+class AudioDevice;
+
 class Buffer {
 public:
     typedef std::vector<int16_t> Storage;
     typedef Storage::iterator iterator;
     typedef Storage::const_iterator const_iterator;
 
-    Buffer(snd_pcm_t* pipe, size_t samples, size_t channels);
+    Buffer(AudioDevice* pipe, size_t samples, size_t channels);
 
     //! The number of samples
     size_t count() const { return mData.size() / mChannels; }
@@ -36,11 +36,29 @@ public:
     //! Current stored power level
     double power(size_t count, size_t offset = 0) const;
 
-    int record();
+    /*! @brief Current stored power level of a single channel
+     *
+     *  Scaled so that it matches power() when every channel is the same.
+     */
+    double power(size_t count, size_t offset, size_t channel) const;
+
+    //! Scale a run of samples by a gain that ramps linearly from gain0 to gain1
+    void ramp(size_t offset, size_t n, double gain0, double gain1);
+
+    //! Add in a run of another buffer, scaled by a gain that ramps linearly from gain0 to gain1
+    void mix(const Buffer& other, size_t offset, size_t n, double gain0, double gain1);
+
+    int record() { return record(count()); }
+    //! Record only the first n frames' worth
+    int record(size_t n);
     int play(size_t count) const;
 
+    //! How many xruns have been recovered from
+    size_t xruns() const { return mXruns; }
+
 private:
-    snd_pcm_t *mPipe;
+    AudioDevice *mPipe;
     size_t mChannels;
+    mutable size_t mXruns;
     std::vector<int16_t> mData;
 };
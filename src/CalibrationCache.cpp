@@ -0,0 +1,113 @@
+#include "CalibrationCache.h"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+CalibrationCache::CalibrationCache(const std::string& path):
+    mPath(path)
+{}
+
+std::string CalibrationCache::format(const Key& key) {
+    std::ostringstream out;
+    out << key.captureDevice << '\t' << key.playbackDevice << '\t'
+        << key.sampleRate << '\t' << key.bufSize << '\t' << key.latencyALSA;
+    return out.str();
+}
+
+bool CalibrationCache::lookup(const Key& key, Entry& entry) const {
+    if (mPath.empty()) {
+        return false;
+    }
+
+    const std::string prefix = format(key) + '\t';
+    std::ifstream in(mPath);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.compare(0, prefix.size(), prefix) == 0) {
+            std::istringstream fields(line.substr(prefix.size()));
+            Entry e;
+            if (fields >> e.latency >> e.quietPower) {
+                // older entries stop there
+                int offset;
+                while (fields >> offset) {
+                    e.channelOffsets.push_back(offset);
+                }
+                entry = e;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool CalibrationCache::store(const Key& key, const Entry& entry) const {
+    if (mPath.empty()) {
+        return true;
+    }
+
+    // several loops can be storing at once, in this process or others; the
+    // lock keeps them from reading the file while another one replaces it,
+    // and from dropping each other's entries. It goes on a file of its own,
+    // since the cache file itself gets swapped out from under it.
+    const std::string lockPath = mPath + ".lock";
+    const int lockFd = open(lockPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lockFd < 0) {
+        return false;
+    }
+    if (flock(lockFd, LOCK_EX) < 0) {
+        close(lockFd);
+        return false;
+    }
+
+    // keep every other entry as it was
+    const std::string prefix = format(key) + '\t';
+    std::vector<std::string> lines;
+    {
+        std::ifstream in(mPath);
+        std::string line;
+        while (std::getline(in, line)) {
+            if (!line.empty() && line.compare(0, prefix.size(), prefix) != 0) {
+                lines.push_back(line);
+            }
+        }
+    }
+
+    std::ostringstream out;
+    out.precision(17);
+    for (const auto& line : lines) {
+        out << line << '\n';
+    }
+    out << prefix << entry.latency << '\t' << entry.quietPower;
+    for (int offset : entry.channelOffsets) {
+        out << '\t' << offset;
+    }
+    out << '\n';
+    const std::string text = out.str();
+
+    // write then rename, so a power cut can't leave a partial file
+    std::vector<char> tmp(mPath.begin(), mPath.end());
+    const char suffix[] = ".XXXXXX";
+    tmp.insert(tmp.end(), suffix, suffix + sizeof(suffix));
+    bool ok = false;
+    const int fd = mkstemp(&tmp[0]);
+    if (fd >= 0) {
+        ok = write(fd, text.data(), text.size()) == static_cast<ssize_t>(text.size())
+            && fchmod(fd, 0644) == 0
+            && fsync(fd) == 0;
+        ok = close(fd) == 0 && ok;
+        ok = ok && rename(&tmp[0], mPath.c_str()) == 0;
+        if (!ok) {
+            unlink(&tmp[0]);
+        }
+    }
+
+    close(lockFd);
+    return ok;
+}
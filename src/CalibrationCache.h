@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/*! @brief Remembers calibration results between runs
+ *
+ *  Results are keyed by everything that could change them: the devices,
+ *  the sample rate and the buffer and ALSA latency settings. The file is
+ *  plain text, one tab-separated entry per line.
+ */
+class CalibrationCache {
+public:
+    struct Key {
+        std::string captureDevice, playbackDevice;
+        unsigned int sampleRate;
+        size_t bufSize;
+        int latencyALSA;
+    };
+
+    struct Entry {
+        //! Round-trip latency, in frames
+        int latency;
+        //! Quiescent recording power
+        double quietPower;
+        //! How far each channel's latency is off from the overall one; empty if unknown
+        std::vector<int> channelOffsets;
+    };
+
+    //! @param path The cache file; empty to disable caching
+    explicit CalibrationCache(const std::string& path);
+
+    //! Look up a cached result; returns false if there isn't one
+    bool lookup(const Key&, Entry&) const;
+
+    /*! @brief Store a result, replacing any previous one for the same key
+     *
+     *  Safe to call from several threads or processes at once; each one's
+     *  entry makes it into the file.
+     *
+     *  @returns false on failure
+     */
+    bool store(const Key&, const Entry&) const;
+
+private:
+    std::string mPath;
+
+    static std::string format(const Key&);
+};
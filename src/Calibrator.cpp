@@ -1,39 +1,49 @@
 #include "Buffer.h"
 #include "Calibrator.h"
+#include "FFT.h"
 
 #include <boost/throw_exception.hpp>
 
 #include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <random>
 #include <stdexcept>
 #include <iostream>
 
+namespace {
+//! How long each channel's noise goes on for, in frames
+const size_t NOISE_FRAMES = 16384;
+//! How loud the noise is, as a fraction of full scale
+const double NOISE_LEVEL = 0.25;
+//! How far from the overall latency to look for each path, in frames (about 90ms at 44.1KHz)
+const int PATH_SPREAD = 4096;
+//! How far a path's correlation peak has to stand out from the rest to count
+const double MIN_CLARITY = 8;
+}
+
 Calibrator::Calibrator():
     mTrials(0),
     mTotalLatency(0),
     mMaxQuiet(0)
 {}
 
-void Calibrator::go(Buffer& recBuf, Buffer& playBuf) {
-    // autocalibrate the latency
-    int latencyAdjust = 0;
-    int frames;
-
-    // get a quiescent reading
-    std::cout << "Obtaining quiescent power level...";
-    std::cout.flush();
-
+double Calibrator::quiet(Buffer& recBuf, Buffer& playBuf, size_t buffers) {
     std::fill(playBuf.begin(), playBuf.end(), 0);
     double quietPower = 0;
-    for (size_t i = 0; i < 10; i++) {
-        frames = recBuf.record();
+    for (size_t i = 0; i < buffers; i++) {
+        int frames = recBuf.record();
         quietPower = std::max(quietPower, recBuf.power(frames));
         playBuf.play(frames);
     }
-    std::cout << quietPower << std::endl;
+    return quietPower;
+}
+
+int Calibrator::burst(Buffer& recBuf, Buffer& playBuf, double quietPower, size_t maxFrames) {
+    int latencyAdjust = 0;
+    int frames;
 
     // send a brief burst of a tonal sound thing
-    std::cout << "Waiting for burst...";
-    std::cout.flush();
     Buffer::iterator out = playBuf.begin();
     size_t period = playBuf.count()*playBuf.channels();
     for (size_t i = 0; i < period; i++) {
@@ -47,9 +57,10 @@ void Calibrator::go(Buffer& recBuf, Buffer& playBuf) {
         frames = recBuf.record();
         playBuf.play(frames);
         latencyAdjust += frames;
-    } while (recBuf.power(frames) < 2*quietPower && time(NULL) < startTime + 2);
+    } while (recBuf.power(frames) < 2*quietPower && time(NULL) < startTime + 2
+             && static_cast<size_t>(latencyAdjust) < maxFrames);
     if (recBuf.power(frames) < 2*quietPower) {
-        BOOST_THROW_EXCEPTION(std::runtime_error("Timed out waiting for calibration burst"));
+        return -1;
     }
 
     std::cout << "Burst detected, power=" << recBuf.power(frames)/quietPower << "x" << std::endl;
@@ -67,18 +78,187 @@ void Calibrator::go(Buffer& recBuf, Buffer& playBuf) {
         }
         lastVal = val;
     }
-    latencyAdjust -= frames - maxPos;
+    return latencyAdjust - (frames - maxPos);
+}
 
-    // wait for silence to return
+void Calibrator::settle(Buffer& recBuf, Buffer& playBuf, double quietPower) {
     std::fill(playBuf.begin(), playBuf.end(), 0);
+    int frames;
     do {
         frames = recBuf.record();
         playBuf.play(frames);
     } while (recBuf.power(frames) >= quietPower*1.5);
+}
+
+void Calibrator::go(Buffer& recBuf, Buffer& playBuf) {
+    // get a quiescent reading
+    std::cout << "Obtaining quiescent power level...";
+    std::cout.flush();
+    double quietPower = quiet(recBuf, playBuf, 10);
+    std::cout << quietPower << std::endl;
+
+    // autocalibrate the latency
+    std::cout << "Waiting for burst...";
+    std::cout.flush();
+    int latencyAdjust = burst(recBuf, playBuf, quietPower, std::numeric_limits<size_t>::max());
+    if (latencyAdjust < 0) {
+        BOOST_THROW_EXCEPTION(std::runtime_error("Timed out waiting for calibration burst"));
+    }
+
+    // wait for silence to return
+    settle(recBuf, playBuf, quietPower);
     std::cout << "Result: " << latencyAdjust << std::endl;
 
     mTotalLatency += latencyAdjust;
     mMaxQuiet = std::max(mMaxQuiet, quietPower);
     ++mTrials;
+
+    // the burst comes back from every speaker at once, so it only tells us
+    // roughly when the nearest one got there
+    std::cout << "Measuring each channel...";
+    std::cout.flush();
+    std::vector<int> latencies;
+    mChannelOffsets.clear();
+    if (paths(recBuf, playBuf, getLatency(), latencies)) {
+        // the correlation pins them down far better than the burst's onset
+        // does, so their average becomes this trial's latency, and they're
+        // relative to that; the overall latency (which the latency tracker
+        // keeps refining) then stays in the middle of them
+        double mean = 0;
+        for (int l : latencies) {
+            mean += l*1.0/latencies.size();
+        }
+        mTotalLatency += lround(mean) - latencyAdjust;
+        for (int l : latencies) {
+            std::cout << ' ' << l;
+            mChannelOffsets.push_back(lround(l - mean));
+        }
+        std::cout << std::endl;
+    } else {
+        std::cout << "couldn't tell the channels apart; using the overall latency for all of them"
+                  << std::endl;
+    }
+    settle(recBuf, playBuf, quietPower);
+}
+
+bool Calibrator::paths(Buffer& recBuf, Buffer& playBuf, int latency, std::vector<int>& latencies) {
+    const size_t channels = playBuf.channels();
+    if (recBuf.channels() != channels) {
+        return false;
+    }
+    const size_t minDelay = std::max(0, latency - PATH_SPREAD), maxDelay = latency + PATH_SPREAD;
+
+    // a different random sequence of steps for each channel
+    std::vector<std::vector<float>> sent(channels, std::vector<float>(NOISE_FRAMES)), heard(channels);
+    for (size_t c = 0; c < channels; c++) {
+        std::mt19937 rng(c + 1);
+        for (auto& x : sent[c]) {
+            x = (rng() & 1) ? 1 : -1;
+        }
+    }
+
+    // record until the last of it has had time to come back
+    const size_t total = maxDelay + NOISE_FRAMES;
+    size_t played = 0;
+    time_t startTime = time(NULL);
+    while (heard[0].size() < total) {
+        if (time(NULL) > startTime + 5) {
+            return false;
+        }
+
+        const int frames = recBuf.record();
+        Buffer::iterator out = playBuf.begin();
+        for (int i = 0; i < frames; i++, played++) {
+            for (size_t c = 0; c < channels; c++) {
+                *out++ = played < NOISE_FRAMES ? sent[c][played]*NOISE_LEVEL*32767 : 0;
+            }
+        }
+        playBuf.play(frames);
+
+        Buffer::const_iterator in = recBuf.begin();
+        for (int i = 0; i < frames; i++) {
+            for (size_t c = 0; c < channels; c++) {
+                heard[c].push_back(*in++);
+            }
+        }
+    }
+
+    latencies.resize(channels);
+    bool clear = true;
+    for (size_t c = 0; c < channels; c++) {
+        double clarity;
+        latencies[c] = findDelay(sent[c], heard[c], minDelay, maxDelay, clarity);
+        clear = clear && clarity >= MIN_CLARITY;
+    }
+    return clear;
 }
 
+int Calibrator::findDelay(const std::vector<float>& sent, const std::vector<float>& heard,
+                          size_t minDelay, size_t maxDelay, double& clarity) {
+    size_t n = 1;
+    while (n < sent.size() + heard.size()) {
+        n *= 2;
+    }
+    maxDelay = std::min(maxDelay, heard.size());
+
+    // correlating is multiplying one spectrum by the conjugate of the other
+    FFT fft(n);
+    std::vector<FFT::Complex> h(n), s(n);
+    std::copy(heard.begin(), heard.end(), h.begin());
+    std::copy(sent.begin(), sent.end(), s.begin());
+    fft.forward(&h[0]);
+    fft.forward(&s[0]);
+    for (size_t i = 0; i < n; i++) {
+        h[i] *= std::conj(s[i]);
+    }
+    fft.inverse(&h[0]);
+
+    // a speaker wired backwards comes back upside down
+    size_t best = minDelay;
+    double peak = 0, total = 0;
+    for (size_t d = minDelay; d < maxDelay; d++) {
+        const double v = std::abs(h[d].real());
+        total += v*v;
+        if (v > peak) {
+            peak = v;
+            best = d;
+        }
+    }
+    const double rms = maxDelay > minDelay ? sqrt(total/(maxDelay - minDelay)) : 0;
+    clarity = rms > 0 ? peak/rms : 0;
+    return best;
+}
+
+bool Calibrator::check(Buffer& recBuf, Buffer& playBuf, int latency, double quietPower,
+                       const std::vector<int>& channelOffsets) {
+    const int slack = recBuf.count()/2;
+
+    std::cout << "Checking cached calibration (latency " << latency << ")...";
+    std::cout.flush();
+
+    // the room can't have got much noisier, or the burst won't be heard
+    const double nowQuiet = quiet(recBuf, playBuf, 2);
+    if (nowQuiet > quietPower*4) {
+        std::cout << "too noisy (" << nowQuiet << ")" << std::endl;
+        return false;
+    }
+
+    const int measured = burst(recBuf, playBuf, std::max(quietPower, nowQuiet),
+                               latency + recBuf.count()*2);
+    if (measured < 0 || abs(measured - latency) > slack) {
+        std::cout << "latency doesn't match (" << measured << ")" << std::endl;
+        return false;
+    }
+    settle(recBuf, playBuf, std::max(quietPower, nowQuiet));
+    std::cout << "OK" << std::endl;
+
+    assume(latency, quietPower, channelOffsets);
+    return true;
+}
+
+void Calibrator::assume(int latency, double quietPower, const std::vector<int>& channelOffsets) {
+    mTotalLatency += latency;
+    mMaxQuiet = std::max(mMaxQuiet, quietPower);
+    ++mTrials;
+    mChannelOffsets = channelOffsets;
+}
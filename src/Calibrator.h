@@ -2,18 +2,86 @@
 
 #include "Buffer.h"
 
+#include <vector>
+
 class Calibrator {
 public:
     Calibrator();
 
+    /*! @brief Calibrate from scratch
+     *
+     *  Takes a quiet reading, finds the overall latency with a burst on
+     *  every speaker at once, and then measures each speaker's own path to
+     *  its microphone (see getChannelOffsets()).
+     */
     void go(Buffer& rec, Buffer& play);
 
+    /*! @brief Quickly confirm a previous calibration still holds
+     *
+     *  Takes a short quiet reading and sends a single burst, which has to
+     *  come back at about the given latency. On success the result is taken
+     *  as this calibration's.
+     *
+     *  @returns whether the previous result still holds
+     */
+    bool check(Buffer& rec, Buffer& play, int latency, double quietPower,
+               const std::vector<int>& channelOffsets);
+
+    //! Take a previous result as-is, without checking it
+    void assume(int latency, double quietPower, const std::vector<int>& channelOffsets);
+
     int getLatency() const { return mTotalLatency/mTrials; }
     double getQuietPower() const { return mMaxQuiet; }
 
+    /*! @brief How much longer each channel's path takes than the others, on average
+     *
+     *  Speakers at different distances from their microphones don't all
+     *  come back at getLatency(); this is how far each one is off from it,
+     *  in frames. Empty if the paths couldn't be told apart.
+     */
+    const std::vector<int>& getChannelOffsets() const { return mChannelOffsets; }
+
+    /*! @brief Find where a signal shows up in a recording, by cross-correlation
+     *
+     *  @param sent What was played
+     *  @param heard What was recorded, starting when the first of it was played
+     *  @param minDelay Where to start looking, in frames
+     *  @param maxDelay Where to stop looking, in frames
+     *  @param clarity Set to how far the peak stands out from the rest of the correlation
+     *  @returns the delay, in frames
+     */
+    static int findDelay(const std::vector<float>& sent, const std::vector<float>& heard,
+                         size_t minDelay, size_t maxDelay, double& clarity);
+
 private:
     size_t mTrials;
     int mTotalLatency;
     double mMaxQuiet;
-};
+    std::vector<int> mChannelOffsets;
+
+    //! Get the quiescent power level over a number of buffers
+    static double quiet(Buffer& rec, Buffer& play, size_t buffers);
+
+    /*! @brief Send a burst and see how long it takes to come back
+     *
+     *  @param maxFrames Give up after this many frames
+     *  @returns the latency, or -1 on timeout
+     */
+    static int burst(Buffer& rec, Buffer& play, double quietPower, size_t maxFrames);
 
+    //! Wait for the burst to die down
+    static void settle(Buffer& rec, Buffer& play, double quietPower);
+
+    /*! @brief Measure each channel's latency on its own
+     *
+     *  Every channel plays its own pseudo-random noise, all at the same
+     *  time. The sequences don't correlate with each other, so correlating
+     *  each microphone with its own speaker's sequence picks out that path
+     *  even though every microphone hears every speaker.
+     *
+     *  @param latency The overall latency, which the paths should be near
+     *  @param latencies Set to each channel's latency, in frames
+     *  @returns whether every channel's path stood out clearly
+     */
+    static bool paths(Buffer& rec, Buffer& play, int latency, std::vector<int>& latencies);
+};
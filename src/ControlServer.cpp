@@ -0,0 +1,294 @@
+#include "ControlServer.h"
+#include "Stretcher.h"
+
+#include <boost/throw_exception.hpp>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+//! Length of an OSC string including its padding, or 0 if unterminated
+size_t oscStringLength(const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (!data[i]) {
+            return (i + 4) & ~3;
+        }
+    }
+    return 0;
+}
+
+uint32_t readBE32(const uint8_t *p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+//! Handle /eq/<band>/<field>; the type can be given by name or number
+bool setEqBand(const std::string& address, double value, const std::string& text,
+               Repeater::Knobs& k) {
+    char *field;
+    const size_t b = strtoul(address.c_str() + 4, &field, 10);
+    if (b >= k.eq.size() || *field != '/') {
+        return false;
+    }
+    Equalizer::Band& band = k.eq[b];
+    const std::string name(field + 1);
+
+    if (name == "type") {
+        if (!text.empty()) {
+            return Equalizer::parseType(text, band.type);
+        }
+        if (value < 0 || value >= Equalizer::T_COUNT) {
+            return false;
+        }
+        band.type = static_cast<Equalizer::Type>(value);
+    } else if (name == "channel") {
+        band.channel = std::max(-1, static_cast<int>(value));
+    } else if (name == "freq") {
+        band.freq = std::max(10.0, value);
+    } else if (name == "gain") {
+        band.gain = std::max(-48.0, std::min(24.0, value));
+    } else if (name == "q") {
+        band.q = std::max(0.05, std::min(50.0, value));
+    } else {
+        return false;
+    }
+    return true;
+}
+}
+
+ControlServer::ControlServer(const Repeater::Ptr& rep, int port):
+    mRepeater(rep),
+    mPort(port),
+    mSocket(-1),
+    mRunning(false)
+{}
+
+ControlServer::~ControlServer() {
+    stop();
+}
+
+void ControlServer::start() {
+    mSocket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (mSocket < 0) {
+        BOOST_THROW_EXCEPTION(std::runtime_error(std::string("socket: ") + strerror(errno)));
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(mPort);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(mSocket, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0) {
+        int err = errno;
+        close(mSocket);
+        mSocket = -1;
+        BOOST_THROW_EXCEPTION(std::runtime_error(std::string("bind: ") + strerror(err)));
+    }
+
+    // find out which port we actually got, in case we asked for any
+    socklen_t addrLen = sizeof(addr);
+    getsockname(mSocket, reinterpret_cast<struct sockaddr *>(&addr), &addrLen);
+    mPort = ntohs(addr.sin_port);
+
+    mRunning = true;
+    mThread = std::thread([this]() { worker(); });
+}
+
+void ControlServer::stop() {
+    mRunning = false;
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+    if (mSocket >= 0) {
+        close(mSocket);
+        mSocket = -1;
+    }
+}
+
+void ControlServer::worker() {
+    std::vector<uint8_t> packet(65536);
+    std::vector<std::vector<uint8_t>> batch;
+
+    while (mRunning) {
+        struct pollfd pfd = { mSocket, POLLIN, 0 };
+        if (poll(&pfd, 1, 100) <= 0) {
+            continue;
+        }
+
+        // drain everything that's arrived, then apply it as one change
+        batch.clear();
+        ssize_t len;
+        while ((len = recv(mSocket, &packet[0], packet.size(), MSG_DONTWAIT)) >= 0) {
+            batch.push_back(std::vector<uint8_t>(packet.begin(), packet.begin() + len));
+        }
+        if (batch.empty()) {
+            continue;
+        }
+
+        bool shutdown = false;
+        mRepeater->changeKnobs([&](Repeater::Knobs& k) {
+                for (const auto& p : batch) {
+                    if (!handlePacket(&p[0], p.size(), k, shutdown)) {
+                        std::cerr << "Ignoring malformed control packet" << std::endl;
+                    }
+                }
+            });
+        if (shutdown) {
+            mRepeater->shutdown();
+        }
+    }
+}
+
+bool ControlServer::handlePacket(const uint8_t *data, size_t len,
+                                 Repeater::Knobs& k, bool& shutdown) {
+    static const char bundleTag[] = "#bundle";
+    if (len >= 16 && !memcmp(data, bundleTag, sizeof(bundleTag))) {
+        // skip the tag and the time tag; we apply everything immediately
+        size_t pos = 16;
+        while (pos + 4 <= len) {
+            size_t elemLen = readBE32(data + pos);
+            pos += 4;
+            if (elemLen > len - pos
+                || !handlePacket(data + pos, elemLen, k, shutdown)) {
+                return false;
+            }
+            pos += elemLen;
+        }
+        return pos == len;
+    }
+    return handleMessage(data, len, k, shutdown);
+}
+
+bool ControlServer::handleMessage(const uint8_t *data, size_t len,
+                                  Repeater::Knobs& k, bool& shutdown) {
+    size_t addrLen = oscStringLength(data, len);
+    if (!addrLen || addrLen > len) {
+        return false;
+    }
+    const std::string address(reinterpret_cast<const char *>(data));
+
+    size_t pos = addrLen;
+    std::string tags;
+    if (pos < len && data[pos] == ',') {
+        size_t tagLen = oscStringLength(data + pos, len - pos);
+        if (!tagLen || pos + tagLen > len) {
+            return false;
+        }
+        tags = reinterpret_cast<const char *>(data + pos + 1);
+        pos += tagLen;
+    }
+
+    if (address == "/shutdown") {
+        shutdown = true;
+        return true;
+    }
+
+    if (tags.empty()) {
+        return false;
+    }
+
+    // only the first argument means anything to us
+    double value = 0;
+    std::string text;
+    switch (tags[0]) {
+    case 'f':
+    case 'i': {
+        if (pos + 4 > len) {
+            return false;
+        }
+        uint32_t bits = readBE32(data + pos);
+        if (tags[0] == 'i') {
+            value = static_cast<int32_t>(bits);
+        } else {
+            float f;
+            memcpy(&f, &bits, sizeof(f));
+            value = f;
+        }
+        break;
+    }
+    case 'd': {
+        if (pos + 8 > len) {
+            return false;
+        }
+        uint64_t bits = (uint64_t(readBE32(data + pos)) << 32) | readBE32(data + pos + 4);
+        memcpy(&value, &bits, sizeof(value));
+        break;
+    }
+    case 's': {
+        size_t strLen = oscStringLength(data + pos, len - pos);
+        if (!strLen || pos + strLen > len) {
+            return false;
+        }
+        text = reinterpret_cast<const char *>(data + pos);
+        break;
+    }
+    default:
+        return false;
+    }
+
+    if (address == "/mode") {
+        return Repeater::parseMode(text, k.mode);
+    } else if (address == "/power") {
+        return Repeater::parsePowerSource(text, k.power);
+    } else if (address == "/loudnessGate") {
+        k.loudnessGate = std::max(-100.0, std::min(0.0, value));
+    } else if (address == "/gain") {
+        k.mode = Repeater::M_GAIN;
+        k.levels[k.mode] = std::max(0.0, value);
+    } else if (address == "/target") {
+        k.mode = Repeater::M_TARGET;
+        k.levels[k.mode] = std::max(0.0, std::min(1.0, value));
+    } else if (address == "/feedback") {
+        k.mode = Repeater::M_FEEDBACK;
+        k.levels[k.mode] = std::max(0.0, std::min(1.0, value));
+    } else if (address == "/peak") {
+        k.mode = Repeater::M_LIMITER;
+        k.levels[k.mode] = std::max(0.0, value);
+    } else if (address == "/compressor") {
+        k.mode = Repeater::M_COMPRESSOR;
+        k.levels[k.mode] = std::max(1e-6, std::min(1.0, value));
+    } else if (address == "/ceiling") {
+        k.ceiling = std::max(0.01, std::min(1.0, value));
+    } else if (address == "/lookahead") {
+        k.lookahead = std::max(0.0, std::min(1.0, value));
+    } else if (address == "/ratio") {
+        k.ratio = std::max(1.0, value);
+    } else if (address == "/attack") {
+        k.attack = std::max(1e-4, value);
+    } else if (address == "/release") {
+        k.release = std::max(1e-4, value);
+    } else if (address == "/dampen") {
+        k.dampen = std::max(0.0, std::min(1.0, value));
+    } else if (address == "/threshold") {
+        k.feedbackThreshold = std::max(1e-6, std::min(1.0, value));
+    } else if (address == "/limit") {
+        k.limitPower = std::max(0.01, std::min(1.0, value));
+    } else if (address == "/loopDelay") {
+        k.loopDelay = std::max(0.0, value);
+    } else if (address == "/speed") {
+        k.speed = std::max(Stretcher::MIN_SPEED, std::min(Stretcher::MAX_SPEED, value));
+    } else if (address == "/pitch") {
+        k.pitch = std::max(-Stretcher::MAX_PITCH, std::min(Stretcher::MAX_PITCH, value));
+    } else if (address == "/stretchRange") {
+        k.stretchRange = std::max(0.0, value);
+    } else if (address == "/idleLevel") {
+        k.idleLevel = std::max(1e-6, std::min(1.0, value));
+    } else if (address == "/idleAfter") {
+        k.idleAfter = std::max(0.0, value);
+    } else if (address.compare(0, 4, "/eq/") == 0) {
+        return setEqBand(address, value, text, k);
+    } else {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "Repeater.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+/*! @brief Accepts knob changes as OSC messages over UDP on localhost
+ *
+ *  Recognized addresses, each taking a single numeric argument unless
+ *  noted:
+ *
+ *  - /mode (string: see Repeater::modeName)
+ *  - /power (string: see Repeater::powerSourceName)
+ *  - /gain, /target, /feedback, /peak, /compressor: set the level and
+ *    switch to that mode
+ *  - /dampen, /threshold, /limit, /ceiling, /lookahead, /ratio, /attack,
+ *    /release, /loopDelay, /loudnessGate
+ *  - /speed, /pitch, /stretchRange: only heard with --stretch
+ *  - /idleLevel, /idleAfter
+ *  - /eq/N/type (string or number: see Equalizer::typeName), /eq/N/freq,
+ *    /eq/N/gain, /eq/N/q, /eq/N/channel: set EQ band N
+ *  - /shutdown (no arguments)
+ *
+ *  Everything that arrives together is applied to the Repeater as a
+ *  single knob change.
+ */
+class ControlServer {
+public:
+    ControlServer(const Repeater::Ptr&, int port);
+    ~ControlServer();
+
+    //! Start listening
+    void start();
+
+    //! Stop listening
+    void stop();
+
+    //! The port we're bound to
+    int port() const { return mPort; }
+
+private:
+    Repeater::Ptr mRepeater;
+    int mPort;
+    int mSocket;
+
+    std::atomic<bool> mRunning;
+    std::thread mThread;
+
+    void worker();
+
+    //! Apply a packet (message or bundle); returns false if malformed
+    bool handlePacket(const uint8_t *data, size_t len, Repeater::Knobs&, bool& shutdown);
+    bool handleMessage(const uint8_t *data, size_t len, Repeater::Knobs&, bool& shutdown);
+};
@@ -0,0 +1,44 @@
+#include "DriftEstimator.h"
+
+#include <algorithm>
+
+DriftEstimator::DriftEstimator(unsigned int sampleRate, double settleTime):
+    mSampleRate(sampleRate),
+    mSettleFrames(sampleRate*settleTime),
+    mElapsed(0),
+    mReference(0),
+    mError(0),
+    mIntegral(0),
+    mRatio(1)
+{}
+
+void DriftEstimator::restart() {
+    mElapsed = 0;
+    mReference = 0;
+    mError = 0;
+}
+
+double DriftEstimator::update(long queued, size_t frames) {
+    if (!settled()) {
+        // average the fill level while everything settles down
+        mReference = (mReference*mElapsed + queued*1.0*frames)/(mElapsed + frames);
+        mElapsed += frames;
+        return mRatio;
+    }
+
+    // the fill level jitters by up to a period, so smooth it heavily
+    const double dt = frames*1.0/mSampleRate;
+    const double alpha = std::min(1.0, dt/1.0);
+    mError += (queued - mReference - mError)*alpha;
+
+    // PI controller; the proportional term settles over about 20 seconds,
+    // and the integral term takes out the steady-state error over a minute
+    // or so, so that the fill level ends up back on the reference
+    const double kp = 1/(mSampleRate*20.0);
+    const double ki = kp/30;
+    mIntegral += mError*dt;
+    mIntegral = std::max(-0.005/ki, std::min(0.005/ki, mIntegral));
+
+    mRatio = 1 - kp*mError - ki*mIntegral;
+    return mRatio;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+
+/*! @brief Tracks the relative drift between the capture and playback clocks
+ *
+ *  Fed the total number of frames queued in the capture and playback
+ *  devices once per cycle, this establishes a reference fill level and then
+ *  steers a resampling ratio (output frames per input frame) to hold the
+ *  fill level there.
+ */
+class DriftEstimator {
+public:
+    /*! @param sampleRate The nominal sample rate
+     *  @param settleTime How long to average for the reference level, in seconds
+     */
+    DriftEstimator(unsigned int sampleRate, double settleTime = 2.0);
+
+    /*! @brief Update with the current device fill level
+     *
+     *  @param queued Frames pending in capture plus frames pending in playback
+     *  @param frames Frames processed in this cycle
+     *  @returns the new resampling ratio
+     */
+    double update(long queued, size_t frames);
+
+    //! Establish a new reference level (e.g. after an xrun), keeping the current ratio
+    void restart();
+
+    //! Current resampling ratio
+    double getRatio() const { return mRatio; }
+
+    //! Current estimated drift, in parts per million
+    double getDriftPPM() const { return (1 - mRatio)*1e6; }
+
+    //! Smoothed deviation from the reference fill level, in frames
+    double getError() const { return mError; }
+
+    //! Whether the reference level has been established yet
+    bool settled() const { return mElapsed >= mSettleFrames; }
+
+private:
+    unsigned int mSampleRate;
+    size_t mSettleFrames;
+    size_t mElapsed;
+
+    double mReference;
+    double mError;
+    double mIntegral;
+    double mRatio;
+};
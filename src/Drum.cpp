@@ -1,11 +1,14 @@
 #include "Drum.h"
+#include "WaveOverview.h"
 
 #include <boost/throw_exception.hpp>
 
 #include <algorithm>
+#include <cmath>
 #include <stdexcept>
 
-Drum::Drum(size_t samples, size_t channels): Buffer(NULL, samples, channels)
+Drum::Drum(size_t samples, size_t channels): Buffer(NULL, samples, channels),
+                                              mOverview(NULL)
 {}
 
 size_t Drum::write(const Buffer& buf, size_t offset, size_t n) {
@@ -21,10 +24,12 @@ size_t Drum::write(const Buffer& buf, size_t offset, size_t n) {
     const size_t second = n - first;
     std::copy(buf.begin(), buf.at(first), at(start));
     if (second) {
-        std::copy(buf.at(first), buf.end(), begin());
-        return second;
+        std::copy(buf.at(first), buf.at(n), begin());
     }
-    return start + first;
+    if (mOverview) {
+        mOverview->update(*this, start, n);
+    }
+    return second ? second : start + first;
 }
 
 size_t Drum::read(Buffer& buf, ssize_t offset, size_t n) const {
@@ -46,53 +51,89 @@ size_t Drum::read(Buffer& buf, ssize_t offset, size_t n) const {
     return start + first;
 }
 
-size_t Drum::read(Buffer& buf, ssize_t offset, size_t n, double gain0, double gain1) const {
+void Drum::readChannel(Buffer& buf, ssize_t offset, size_t n, size_t channel) const {
     if (buf.channels() != channels()) {
         BOOST_THROW_EXCEPTION(std::runtime_error("Mismatched channel count"));
     }
+    n = std::min(n, buf.count());
 
     const size_t channels = buf.channels();
-   
-    int64_t curGain = gain0*(1 << 24);
-    int64_t gainStep = ((gain1 - gain0)*(1 << 24))/buf.count();
-
-    size_t start = (offset + count()) % count();
-
-    Buffer::const_iterator in = at(start);
-    Buffer::iterator out = buf.begin();
-
-    for (size_t i = 0; i < n; i++) {
-        for (size_t k = 0; k < channels; k++) {
-            int64_t val = (*in++)*curGain >> 24;
-            *out++ = std::max(-32768L, std::min(32767L, val));
-            if (in >= end()) {
-                in = begin();
-            }
+    const size_t bufSz = count();
+    size_t pos = (offset + bufSz) % bufSz;
+
+    Buffer::const_iterator in = at(pos) + channel;
+    Buffer::iterator out = buf.begin() + channel;
+    for (size_t i = 0; i < n; i++, out += channels) {
+        *out = *in;
+        if (++pos == bufSz) {
+            pos = 0;
+            in = begin() + channel;
+        } else {
+            in += channels;
         }
-        curGain += gainStep;
     }
+}
 
-    return (start + n) % count();
+void Drum::rampAt(size_t offset, size_t n, double gain0, double gain1) {
+    n = std::min(n, count());
+    const size_t start = offset % count();
+    const size_t first = std::min(n, count() - start);
+    const double split = n ? gain0 + (gain1 - gain0)*first/n : gain0;
+    ramp(start, first, gain0, split);
+    ramp(0, n - first, split, gain1);
+    if (mOverview) {
+        mOverview->update(*this, start, n);
+    }
 }
 
-double Drum::maxGain(size_t offset, size_t n) const {
-    size_t start = offset % count();
-    int16_t minVal, maxVal;
+void Drum::silenceAt(size_t offset, size_t n) {
+    n = std::min(n, count());
+    const size_t start = offset % count();
+    const size_t first = std::min(n, count() - start);
+    std::fill(at(start), at(start + first), 0);
+    std::fill(begin(), at(n - first), 0);
+    if (mOverview) {
+        mOverview->update(*this, start, n);
+    }
+}
 
-    Buffer::const_iterator rp = at(start);
-    minVal = maxVal = *rp++;
-    for (size_t i = 0; i < n; i++) {
-        if (rp == end()) {
-            rp = begin();
-        }
+double Drum::powerAt(size_t offset, size_t n) const {
+    const size_t bufSz = count();
+    n = std::min(n, bufSz);
+    if (!n) {
+        return 0;
+    }
 
-        minVal = std::min(minVal, *rp);
-        maxVal = std::max(maxVal, *rp);
-        ++rp;
+    const size_t start = offset % bufSz;
+    const size_t first = std::min(n, bufSz - start);
+    const size_t second = n - first;
+
+    // Buffer::power gives the RMS; recombine the two halves' mean squares
+    double p1 = power(first, start);
+    double ttl = p1*p1*first;
+    if (second) {
+        double p2 = power(second, 0);
+        ttl += p2*p2*second;
+    }
+    return sqrt(ttl/n);
+}
+
+double Drum::powerAt(size_t offset, size_t n, size_t channel) const {
+    const size_t bufSz = count();
+    n = std::min(n, bufSz);
+    if (!n) {
+        return 0;
     }
 
-    if (minVal || maxVal) {
-        return 32768.0/std::max(abs(maxVal), abs(minVal));
+    const size_t start = offset % bufSz;
+    const size_t first = std::min(n, bufSz - start);
+    const size_t second = n - first;
+
+    double p1 = power(first, start, channel);
+    double ttl = p1*p1*first;
+    if (second) {
+        double p2 = power(second, 0, channel);
+        ttl += p2*p2*second;
     }
-    return 0;
+    return sqrt(ttl/n);
 }
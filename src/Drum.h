@@ -2,10 +2,17 @@
 
 #include "Buffer.h"
 
+#include <sys/types.h>
+
+class WaveOverview;
+
 class Drum: public Buffer {
 public:
     Drum(size_t samples, size_t channels);
 
+    //! Keep an overview up to date with everything that changes; NULL for none
+    void setOverview(WaveOverview *overview) { mOverview = overview; }
+
     /*! @brief Write from a buffer
      *
      *  @param buf The buffer
@@ -24,13 +31,24 @@ public:
      */
     size_t read(Buffer& buf, ssize_t offset, size_t n) const;
 
-    /*! @brief read into a buffer, with gain attenuation
+    /*! @brief Read a single channel into the same channel of a buffer
      *
-     *  @param gain0 Start gain value
-     *  @param gain1 End gain value
+     *  The buffer's other channels are left as they were.
      */
-    size_t read(Buffer& buf, ssize_t offset, size_t n, double gain0, double gain1) const;
+    void readChannel(Buffer& buf, ssize_t offset, size_t n, size_t channel) const;
+
+    //! Apply a linear gain ramp to a segment, wrapping around the end
+    void rampAt(size_t offset, size_t n, double gain0, double gain1);
+
+    //! Silence a segment, wrapping around the end
+    void silenceAt(size_t offset, size_t n);
+
+    //! Get the power level of a segment, wrapping around the end
+    double powerAt(size_t offset, size_t n) const;
+
+    //! Get the power level of a segment of a single channel, wrapping around the end
+    double powerAt(size_t offset, size_t n, size_t channel) const;
 
-    //! Get the maximum allowable gain for a segment
-    double maxGain(size_t offset, size_t n) const;
+private:
+    WaveOverview *mOverview;
 };
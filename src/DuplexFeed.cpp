@@ -0,0 +1,32 @@
+#include "DuplexFeed.h"
+
+#include <algorithm>
+
+DuplexFeed::DuplexFeed(size_t capacity, size_t maxFrames):
+    mRing(capacity),
+    mScratch(maxFrames),
+    mOverflow(false)
+{}
+
+void DuplexFeed::push(const Buffer& played, const Buffer& recorded, size_t frames, float scale) {
+    frames = std::min(frames, mScratch.size());
+    const size_t channels = played.channels();
+
+    Buffer::const_iterator pi = played.begin(), ri = recorded.begin();
+    for (size_t i = 0; i < frames; i++) {
+        float p = 0, r = 0;
+        for (size_t c = 0; c < channels; c++) {
+            p += *pi++;
+            r += *ri++;
+        }
+        mScratch[i].played = p*scale;
+        mScratch[i].recorded = r*scale;
+    }
+
+    // all or nothing, so the two streams stay aligned
+    if (mRing.writeAvailable() < frames) {
+        mOverflow = true;
+        return;
+    }
+    mRing.write(&mScratch[0], frames);
+}
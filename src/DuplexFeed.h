@@ -0,0 +1,55 @@
+#pragma once
+
+#include "Buffer.h"
+#include "RingBuffer.h"
+
+#include <atomic>
+#include <vector>
+
+/*! @brief Hands what was played and recorded over to a worker thread
+ *
+ *  The audio thread pushes each cycle's audio, which gets downmixed to one
+ *  played and one recorded sample per frame and goes through a lock-free
+ *  ring. If the worker has fallen behind, the cycle is dropped and the
+ *  worker gets told its history has a gap in it.
+ */
+class DuplexFeed {
+public:
+    struct Frame {
+        float played, recorded;
+    };
+
+    /*! @param capacity Frames the ring holds
+     *  @param maxFrames The most frames that will be pushed in one cycle
+     */
+    DuplexFeed(size_t capacity, size_t maxFrames);
+
+    /*! @brief Hand over a cycle's worth of audio (audio thread only)
+     *
+     *  @param played What was sent to the speakers
+     *  @param recorded What came back from the microphones
+     *  @param frames The number of frames in each
+     *  @param scale What to scale the sum of the channels by
+     */
+    void push(const Buffer& played, const Buffer& recorded, size_t frames, float scale = 1);
+
+    //! Mark the history as having a gap, e.g. when the heads moved
+    void interrupt() { mOverflow = true; }
+
+    //! Whether there's been a gap since the last call (worker only)
+    bool interrupted() { return mOverflow.exchange(false); }
+
+    //! The number of frames waiting to be read (worker only)
+    size_t readAvailable() const { return mRing.readAvailable(); }
+
+    /*! @brief Read frames (worker only)
+     *  @returns the number actually read
+     */
+    size_t read(Frame *out, size_t n) { return mRing.read(out, n); }
+
+private:
+    RingBuffer<Frame> mRing;
+    std::vector<Frame> mScratch;
+    //! Set when a cycle was dropped and the worker's history is no longer contiguous
+    std::atomic<bool> mOverflow;
+};
@@ -0,0 +1,168 @@
+#include "Engine.h"
+#include "EngineLink.h"
+
+#include <ctime>
+
+namespace {
+double getTime() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+class LocalEngine final: public Engine {
+public:
+    LocalEngine(const Repeater::Ptr& rep): mRepeater(rep) {}
+
+    void getHistory(Repeater::History& h) const override {
+        mRepeater->getHistory(h);
+    }
+
+    Repeater::State getState() const override {
+        return mRepeater->getState();
+    }
+
+    Repeater::Knobs getKnobs() const override {
+        return mRepeater->getKnobs();
+    }
+
+    void changeKnobs(const std::function<void(Repeater::Knobs&)>& change) override {
+        mRepeater->changeKnobs(change);
+    }
+
+    void shutdown() override {
+        mRepeater->shutdown();
+    }
+
+    unsigned int getSampleRate() const override {
+        return mRepeater->getOptions().sampleRate;
+    }
+
+    const Spectrogram *getSpectrogram() const override {
+        return mRepeater->getSpectrogram();
+    }
+
+    const WaveOverview *getOverview() const override {
+        return mRepeater->getOverview();
+    }
+
+private:
+    Repeater::Ptr mRepeater;
+};
+
+class RemoteEngine final: public Engine {
+public:
+    RemoteEngine(const std::string& name): mName(name), mSequence(0), mLastChange(0),
+                                           mRequestTime(-1), mShutdownRequested(false) {}
+
+    void getHistory(Repeater::History& h) const override {
+        refresh(&h);
+    }
+
+    Repeater::State getState() const override {
+        refresh(NULL);
+        if (mStatus.state == Repeater::S_GONE && !mShutdownRequested) {
+            // somebody else stopped it; wait around for the next one
+            mLink.reset();
+            mStatus = EngineLink::Status();
+        }
+        return mStatus.state;
+    }
+
+    Repeater::Knobs getKnobs() const override {
+        refresh(NULL);
+        return pendingRequest() ? mRequested : mStatus.knobs;
+    }
+
+    void changeKnobs(const std::function<void(Repeater::Knobs&)>& change) override {
+        Repeater::Knobs k = getKnobs();
+        change(k);
+        if (mLink) {
+            mLink->requestKnobs(k);
+            mRequested = k;
+            mRequestTime = getTime();
+        }
+    }
+
+    void shutdown() override {
+        if (mLink) {
+            mLink->requestShutdown();
+            mShutdownRequested = true;
+        }
+    }
+
+    unsigned int getSampleRate() const override {
+        refresh(NULL);
+        return mStatus.sampleRate;
+    }
+
+    const Spectrogram *getSpectrogram() const override {
+        // the spectrogram stays in the engine process
+        return NULL;
+    }
+
+    const WaveOverview *getOverview() const override {
+        // and so does the drum
+        return NULL;
+    }
+
+private:
+    //! How long the engine can go without publishing before we look for a new one
+    static constexpr double TIMEOUT = 2;
+
+    std::string mName;
+    mutable std::unique_ptr<EngineLink> mLink;
+    mutable EngineLink::Status mStatus;
+    mutable uint64_t mSequence;
+    mutable double mLastChange;
+
+    //! The last knobs we asked for, until the engine has had time to publish them
+    Repeater::Knobs mRequested;
+    double mRequestTime;
+
+    //! Whether we stopped the engine, so that we should stop when it does
+    bool mShutdownRequested;
+
+    bool pendingRequest() const {
+        return mRequestTime >= 0 && getTime() - mRequestTime < 0.5;
+    }
+
+    //! Pick up the latest from the engine, (re)attaching as necessary
+    void refresh(Repeater::History *history, bool retry = true) const {
+        const double now = getTime();
+        if (!mLink) {
+            try {
+                mLink.reset(new EngineLink(mName, false));
+            } catch (const std::exception&) {
+                // not running (yet)
+                return;
+            }
+            mSequence = 0;
+            mLastChange = now;
+        }
+
+        const uint64_t seq = mLink->read(mStatus, history);
+        if (seq && seq != mSequence) {
+            mSequence = seq;
+            mLastChange = now;
+        } else if (now - mLastChange > TIMEOUT) {
+            // the engine went away; wait for the next one
+            mLink.reset();
+            mStatus = EngineLink::Status();
+            if (retry) {
+                refresh(history, false);
+            }
+        }
+    }
+};
+
+constexpr double RemoteEngine::TIMEOUT;
+}
+
+Engine::Ptr Engine::local(const Repeater::Ptr& rep) {
+    return std::make_shared<LocalEngine>(rep);
+}
+
+Engine::Ptr Engine::remote(const std::string& name) {
+    return std::make_shared<RemoteEngine>(name);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "Repeater.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+
+class Spectrogram;
+class WaveOverview;
+
+/*! @brief What the visualizer watches and controls
+ *
+ *  Usually that's a Repeater running in the same process, but it can just
+ *  as well be one running in another process, or something feeding it
+ *  made-up data, e.g. for benchmarking the rendering.
+ */
+class Engine {
+public:
+    typedef std::shared_ptr<Engine> Ptr;
+
+    virtual ~Engine() {}
+
+    //! Get a copy of the current history snapshot
+    virtual void getHistory(Repeater::History&) const = 0;
+
+    virtual Repeater::State getState() const = 0;
+
+    //! Get the knobs as most recently set
+    virtual Repeater::Knobs getKnobs() const = 0;
+
+    //! Atomically modify the knobs
+    virtual void changeKnobs(const std::function<void(Repeater::Knobs&)>&) = 0;
+
+    //! Ask the engine to shut down
+    virtual void shutdown() = 0;
+
+    virtual unsigned int getSampleRate() const = 0;
+
+    //! The live spectrogram, if there is one
+    virtual const Spectrogram *getSpectrogram() const = 0;
+
+    //! The overview of the loop's waveform, if there is one
+    virtual const WaveOverview *getOverview() const = 0;
+
+    //! Watch a Repeater running in this process
+    static Ptr local(const Repeater::Ptr&);
+
+    /*! @brief Watch an engine running in another process
+     *
+     *  @param name The engine's shared memory segment (see EngineLink); it
+     *  doesn't have to exist yet, and the engine can come and go
+     */
+    static Ptr remote(const std::string& name);
+};
@@ -0,0 +1,239 @@
+#include "EngineLink.h"
+#include "SeqLock.h"
+
+#include <boost/throw_exception.hpp>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+
+namespace {
+//! The request sequence's count; the rest is who's writing, while it's odd
+const uint64_t COUNT_MASK = 0xffffffff;
+}
+
+EngineLink::Status::Status():
+    sampleRate(0),
+    state(Repeater::S_STARTUP),
+    playPos(0),
+    recordPos(0),
+    channels(0),
+    clockDrift(0),
+    latency(0),
+    latencyConfidence(0),
+    controlLatency(0),
+    idle(0)
+{}
+
+EngineLink::EngineLink(const std::string& name, bool writer, size_t historySize):
+    mName(name),
+    mWriter(writer),
+    mSegment(NULL),
+    mSize(0),
+    mStatusWords(SeqLock::wordsFor(sizeof(Status))),
+    mHistoryWords(0),
+    mKnobsWords(SeqLock::wordsFor(sizeof(Repeater::Knobs))),
+    mRequestSeen(0)
+{
+    static_assert(std::is_trivially_copyable<Status>::value, "Status must be copyable as bytes");
+    static_assert(std::is_trivially_copyable<Repeater::History::DataPoint>::value,
+                  "DataPoint must be copyable as bytes");
+
+    int fd;
+    if (writer) {
+        // always start on a fresh segment, so that visualizers still mapping
+        // the last engine's don't see this one change size under them
+        shm_unlink(name.c_str());
+        fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    } else {
+        fd = shm_open(name.c_str(), O_RDWR, 0);
+    }
+    if (fd < 0) {
+        BOOST_THROW_EXCEPTION(std::runtime_error("Couldn't open engine segment " + name
+                                                 + ": " + strerror(errno)));
+    }
+
+    if (writer) {
+        mHistoryWords = SeqLock::wordsFor(historySize*sizeof(Repeater::History::DataPoint));
+        mSize = sizeof(Segment) + (mStatusWords + mHistoryWords + mKnobsWords)*sizeof(uint64_t);
+        if (ftruncate(fd, mSize) < 0) {
+            int err = errno;
+            close(fd);
+            BOOST_THROW_EXCEPTION(std::runtime_error("Couldn't size engine segment " + name
+                                                     + ": " + strerror(err)));
+        }
+    } else {
+        struct stat st;
+        if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(Segment)) {
+            close(fd);
+            BOOST_THROW_EXCEPTION(std::runtime_error("Engine segment " + name + " isn't ready"));
+        }
+        mSize = st.st_size;
+    }
+
+    void *addr = mmap(NULL, mSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        BOOST_THROW_EXCEPTION(std::runtime_error("Couldn't map engine segment " + name
+                                                 + ": " + strerror(errno)));
+    }
+    mSegment = static_cast<Segment *>(addr);
+
+    if (writer) {
+        mSegment->statusSize = sizeof(Status);
+        mSegment->pointSize = sizeof(Repeater::History::DataPoint);
+        mSegment->knobsSize = sizeof(Repeater::Knobs);
+        mSegment->historySize = historySize;
+        mSegment->sequence.store(0, std::memory_order_relaxed);
+        mSegment->requestSequence.store(0, std::memory_order_relaxed);
+        mSegment->shutdownRequested.store(0, std::memory_order_relaxed);
+        mSegment->version = VERSION;
+        std::atomic_thread_fence(std::memory_order_release);
+        mSegment->magic = MAGIC;
+    } else {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        mHistoryWords = SeqLock::wordsFor(mSegment->historySize*sizeof(Repeater::History::DataPoint));
+        if (mSegment->magic != MAGIC || mSegment->version != VERSION
+            || mSegment->statusSize != sizeof(Status)
+            || mSegment->pointSize != sizeof(Repeater::History::DataPoint)
+            || mSegment->knobsSize != sizeof(Repeater::Knobs)
+            || mSize < sizeof(Segment) + (mStatusWords + mHistoryWords + mKnobsWords)*sizeof(uint64_t)) {
+            munmap(mSegment, mSize);
+            BOOST_THROW_EXCEPTION(std::runtime_error("Engine segment " + name
+                                                     + " has an unknown layout"));
+        }
+    }
+}
+
+EngineLink::~EngineLink() {
+    munmap(mSegment, mSize);
+    if (mWriter) {
+        shm_unlink(mName.c_str());
+    }
+}
+
+std::atomic<uint64_t> *EngineLink::words() const {
+    return reinterpret_cast<std::atomic<uint64_t> *>(mSegment + 1);
+}
+
+void EngineLink::publish(const Repeater& rep) {
+    rep.getHistory(mHistory);
+
+    Status status;
+    status.sampleRate = rep.getOptions().sampleRate;
+    status.state = rep.getState();
+    status.knobs = rep.getKnobs();
+    status.playPos = mHistory.playPos;
+    status.recordPos = mHistory.recordPos;
+    status.channels = mHistory.channels;
+    status.clockDrift = mHistory.clockDrift;
+    status.latency = mHistory.latency;
+    status.latencyConfidence = mHistory.latencyConfidence;
+    status.controlLatency = mHistory.controlLatency;
+    status.idle = mHistory.idle;
+
+    const size_t points = std::min<size_t>(mHistory.history.size(), mSegment->historySize);
+
+    SeqLock::write(mSegment->sequence, [&]() {
+        SeqLock::storeWords(words(), &status, sizeof(status));
+        SeqLock::storeWords(words() + mStatusWords, mHistory.history.data(),
+                            points*sizeof(Repeater::History::DataPoint));
+    });
+}
+
+bool EngineLink::poll(Repeater& rep) {
+    bool any = false;
+
+    if (mSegment->shutdownRequested.exchange(0, std::memory_order_relaxed)) {
+        rep.shutdown();
+        any = true;
+    }
+
+    const uint64_t before = mSegment->requestSequence.load(std::memory_order_acquire);
+    if (before != mRequestSeen && !(before & 1)) {
+        Repeater::Knobs knobs;
+        SeqLock::loadWords(&knobs, words() + mStatusWords + mHistoryWords, sizeof(knobs));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // if a visualizer was partway through writing, try again next time
+        if (mSegment->requestSequence.load(std::memory_order_relaxed) == before) {
+            mRequestSeen = before;
+            rep.changeKnobs([&knobs](Repeater::Knobs& k) { k = knobs; });
+            any = true;
+        }
+    }
+
+    return any;
+}
+
+uint64_t EngineLink::read(Status& status, Repeater::History *history) const {
+    const size_t points = mSegment->historySize;
+    if (history) {
+        history->history.resize(points);
+    }
+
+    const uint64_t seq = SeqLock::read(mSegment->sequence, [&]() {
+        SeqLock::loadWords(&status, words(), sizeof(status));
+        if (history) {
+            SeqLock::loadWords(history->history.data(), words() + mStatusWords,
+                               points*sizeof(Repeater::History::DataPoint));
+        }
+    });
+    if (!seq) {
+        return 0;
+    }
+
+    if (history) {
+        history->playPos = status.playPos;
+        history->recordPos = status.recordPos;
+        history->channels = status.channels;
+        history->clockDrift = status.clockDrift;
+        history->latency = status.latency;
+        history->latencyConfidence = status.latencyConfidence;
+        history->controlLatency = status.controlLatency;
+        history->idle = status.idle;
+    }
+    return seq/2;
+}
+
+void EngineLink::requestKnobs(const Repeater::Knobs& knobs) {
+    // claim the request slot; another visualizer might be writing it too, or
+    // might have died partway through, in which case we take over from it
+    const uint64_t self = static_cast<uint64_t>(getpid()) << 32;
+    uint64_t cur = mSegment->requestSequence.load(std::memory_order_relaxed), count;
+    for (size_t tries = 0; ; tries++) {
+        if (tries >= SeqLock::MAX_TRIES) {
+            return;
+        }
+        count = cur & COUNT_MASK;
+        if (count & 1) {
+            const pid_t owner = cur >> 32;
+            if (kill(owner, 0) == 0 || errno != ESRCH) {
+                std::this_thread::yield();
+                cur = mSegment->requestSequence.load(std::memory_order_relaxed);
+                continue;
+            }
+            // skip past its half-written request, staying odd while we write ours
+            count++;
+        }
+        if (mSegment->requestSequence.compare_exchange_weak(cur, self | ((count + 1) & COUNT_MASK),
+                                                            std::memory_order_relaxed)) {
+            break;
+        }
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    SeqLock::storeWords(words() + mStatusWords + mHistoryWords, &knobs, sizeof(knobs));
+    mSegment->requestSequence.store((count + 2) & COUNT_MASK, std::memory_order_release);
+}
+
+void EngineLink::requestShutdown() {
+    mSegment->shutdownRequested.store(1, std::memory_order_relaxed);
+}
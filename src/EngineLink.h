@@ -0,0 +1,106 @@
+#pragma once
+
+#include "Repeater.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/*! @brief Shares a running engine with visualizers in other processes
+ *
+ *  The engine process publishes its history, state and knobs to a POSIX
+ *  shared memory segment, and picks up knob changes and shutdown requests
+ *  from it. Visualizers can attach, detach and come back whenever they
+ *  like, and the engine never waits on any of them.
+ *
+ *  Both directions are seqlocks, like Metrics: the engine is the only one
+ *  writing its snapshot, and visualizers take turns writing knob requests
+ *  by claiming the request sequence number. A claim carries the claimant's
+ *  pid, so that if it dies before finishing, the next one can take over.
+ */
+class EngineLink {
+public:
+    //! Everything about the engine other than the history points
+    struct Status {
+        uint32_t sampleRate;
+        Repeater::State state;
+        Repeater::Knobs knobs;
+
+        //! The History fields that aren't points
+        uint64_t playPos, recordPos, channels;
+        double clockDrift;
+        int32_t latency;
+        double latencyConfidence;
+        double controlLatency;
+        uint64_t idle;
+
+        Status();
+    };
+
+    /*! @brief Open a link segment
+     *
+     *  @param name The POSIX shared memory name (e.g. "/whatwesaidwillbe-engine")
+     *  @param writer Whether we're the engine; the engine creates the segment,
+     *  and removes it when done
+     *  @param historySize How many history points to make room for (engine only)
+     */
+    EngineLink(const std::string& name, bool writer, size_t historySize = 0);
+    ~EngineLink();
+
+    //! Publish the engine's current state (engine only); never blocks
+    void publish(const Repeater&);
+
+    /*! @brief Apply any knob changes and shutdown requests (engine only)
+     *  @returns whether there were any
+     */
+    bool poll(Repeater&);
+
+    /*! @brief Read the latest snapshot (visualizer only)
+     *
+     *  @param status Filled in with the engine status
+     *  @param history Filled in with the history, if not NULL
+     *  @returns the snapshot's sequence number, which goes up with every
+     *  publish; 0 if the engine hasn't published anything yet, or is stuck
+     *  partway through publishing
+     */
+    uint64_t read(Status& status, Repeater::History *history) const;
+
+    //! Ask the engine to switch to these knobs (visualizer only)
+    void requestKnobs(const Repeater::Knobs&);
+
+    //! Ask the engine to shut down (visualizer only)
+    void requestShutdown();
+
+private:
+    enum {
+        MAGIC = 0x7777656c,
+        VERSION = 2
+    };
+
+    struct Segment {
+        uint32_t magic;
+        uint32_t version;
+        //! Size of the things being shared, to catch mismatched builds
+        uint32_t statusSize, pointSize, knobsSize;
+        uint32_t historySize;
+        //! Engine snapshot seqlock
+        std::atomic<uint64_t> sequence;
+        //! Knob request seqlock; the count is in the low half, and the pid
+        //! of whoever's writing is in the high half while the count is odd
+        std::atomic<uint64_t> requestSequence;
+        std::atomic<uint64_t> shutdownRequested;
+        // followed by the status, history and knob request words
+    };
+
+    std::string mName;
+    bool mWriter;
+    Segment *mSegment;
+    size_t mSize;
+    size_t mStatusWords, mHistoryWords, mKnobsWords;
+    //! The last knob request the engine picked up
+    uint64_t mRequestSeen;
+    //! Scratch copy of the history, for publishing
+    Repeater::History mHistory;
+
+    std::atomic<uint64_t> *words() const;
+};
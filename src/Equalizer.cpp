@@ -0,0 +1,220 @@
+#include "Equalizer.h"
+
+#include <algorithm>
+#include <cmath>
+
+constexpr size_t Equalizer::MAX_SECTIONS;
+
+namespace {
+const char *typeNames[Equalizer::T_COUNT] = {
+    "off",
+    "peak",
+    "lowshelf",
+    "highshelf",
+    "lowpass",
+    "highpass"
+};
+
+//! Keeps the filter state out of denormal territory during digital silence
+const float DENORMAL_GUARD = 1e-18f;
+}
+
+const char *Equalizer::typeName(Type type) {
+    return type < T_COUNT ? typeNames[type] : "unknown";
+}
+
+bool Equalizer::parseType(const std::string& name, Type& type) {
+    for (size_t t = 0; t < T_COUNT; t++) {
+        if (name == typeNames[t]) {
+            type = static_cast<Type>(t);
+            return true;
+        }
+    }
+    return false;
+}
+
+Equalizer::Band::Band():
+    type(T_OFF),
+    channel(-1),
+    freq(1000),
+    gain(0),
+    q(0.707f)
+{}
+
+Equalizer::Equalizer(unsigned int sampleRate, size_t channels, size_t sections, size_t ramp):
+    mSampleRate(sampleRate),
+    mChannels(channels),
+    mSections(std::min(sections, MAX_SECTIONS)),
+    mLanes(mSections*channels),
+    mRamp(ramp),
+    mRampLeft(0),
+    mB0(mLanes, 1), mB1(mLanes), mB2(mLanes), mA1(mLanes), mA2(mLanes),
+    mTB0(mLanes, 1), mTB1(mLanes), mTB2(mLanes), mTA1(mLanes), mTA2(mLanes),
+    mDB0(mLanes), mDB1(mLanes), mDB2(mLanes), mDA1(mLanes), mDA2(mLanes),
+    mZ1(mLanes), mZ2(mLanes), mX(mLanes), mY(mLanes)
+{}
+
+void Equalizer::configure(const Band *bands, size_t count) {
+    const Coeffs passThrough = { 1, 0, 0, 0, 0 };
+    bool changed = false;
+
+    for (size_t c = 0; c < mChannels; c++) {
+        size_t s = 0;
+        for (size_t b = 0; b < count && s < mSections; b++) {
+            const Band& band = bands[b];
+            if (band.type != T_OFF && band.type < T_COUNT
+                && (band.channel < 0 || static_cast<size_t>(band.channel) == c)) {
+                changed |= retarget(s++*mChannels + c, design(band));
+            }
+        }
+        for (; s < mSections; s++) {
+            changed |= retarget(s*mChannels + c, passThrough);
+        }
+    }
+
+    if (!changed) {
+        // every knob change comes through here, not just the EQ ones
+        return;
+    }
+
+    // glide from wherever we are now, even if that's partway through a ramp
+    const float steps = std::max<size_t>(mRamp, 1);
+    for (size_t l = 0; l < mLanes; l++) {
+        mDB0[l] = (mTB0[l] - mB0[l])/steps;
+        mDB1[l] = (mTB1[l] - mB1[l])/steps;
+        mDB2[l] = (mTB2[l] - mB2[l])/steps;
+        mDA1[l] = (mTA1[l] - mA1[l])/steps;
+        mDA2[l] = (mTA2[l] - mA2[l])/steps;
+    }
+    mRampLeft = std::max<size_t>(mRamp, 1);
+}
+
+bool Equalizer::retarget(size_t lane, const Coeffs& k) {
+    if (mTB0[lane] == k.b0 && mTB1[lane] == k.b1 && mTB2[lane] == k.b2
+        && mTA1[lane] == k.a1 && mTA2[lane] == k.a2) {
+        return false;
+    }
+    mTB0[lane] = k.b0;
+    mTB1[lane] = k.b1;
+    mTB2[lane] = k.b2;
+    mTA1[lane] = k.a1;
+    mTA2[lane] = k.a2;
+    return true;
+}
+
+Equalizer::Coeffs Equalizer::design(const Band& band) const {
+    // from Robert Bristow-Johnson's Audio EQ Cookbook
+    const double freq = std::max(10.0, std::min<double>(band.freq, mSampleRate*0.49));
+    const double q = std::max(0.05f, band.q);
+    const double w0 = 2*M_PI*freq/mSampleRate;
+    const double cw = cos(w0), alpha = sin(w0)/(2*q);
+    const double A = pow(10, band.gain/40.0), sa = 2*sqrt(A)*alpha;
+
+    double b0, b1, b2, a0, a1, a2;
+    switch (band.type) {
+    case T_PEAK:
+        b0 = 1 + alpha*A;
+        b1 = -2*cw;
+        b2 = 1 - alpha*A;
+        a0 = 1 + alpha/A;
+        a1 = -2*cw;
+        a2 = 1 - alpha/A;
+        break;
+    case T_LOW_SHELF:
+        b0 = A*((A + 1) - (A - 1)*cw + sa);
+        b1 = 2*A*((A - 1) - (A + 1)*cw);
+        b2 = A*((A + 1) - (A - 1)*cw - sa);
+        a0 = (A + 1) + (A - 1)*cw + sa;
+        a1 = -2*((A - 1) + (A + 1)*cw);
+        a2 = (A + 1) + (A - 1)*cw - sa;
+        break;
+    case T_HIGH_SHELF:
+        b0 = A*((A + 1) + (A - 1)*cw + sa);
+        b1 = -2*A*((A - 1) + (A + 1)*cw);
+        b2 = A*((A + 1) + (A - 1)*cw - sa);
+        a0 = (A + 1) - (A - 1)*cw + sa;
+        a1 = 2*((A - 1) - (A + 1)*cw);
+        a2 = (A + 1) - (A - 1)*cw - sa;
+        break;
+    case T_LOW_PASS:
+        b0 = b2 = (1 - cw)/2;
+        b1 = 1 - cw;
+        a0 = 1 + alpha;
+        a1 = -2*cw;
+        a2 = 1 - alpha;
+        break;
+    case T_HIGH_PASS:
+        b0 = b2 = (1 + cw)/2;
+        b1 = -(1 + cw);
+        a0 = 1 + alpha;
+        a1 = -2*cw;
+        a2 = 1 - alpha;
+        break;
+    default:
+        b0 = a0 = 1;
+        b1 = b2 = a1 = a2 = 0;
+        break;
+    }
+
+    const Coeffs k = {
+        static_cast<float>(b0/a0), static_cast<float>(b1/a0), static_cast<float>(b2/a0),
+        static_cast<float>(a1/a0), static_cast<float>(a2/a0)
+    };
+    return k;
+}
+
+void Equalizer::process(Buffer& buf, size_t n) {
+    if (!mSections) {
+        return;
+    }
+    n = std::min(n, buf.count());
+
+    const size_t channels = mChannels, lanes = mLanes, last = (mSections - 1)*channels;
+    float *b0 = &mB0[0], *b1 = &mB1[0], *b2 = &mB2[0], *a1 = &mA1[0], *a2 = &mA2[0];
+    float *z1 = &mZ1[0], *z2 = &mZ2[0], *x = &mX[0], *y = &mY[0];
+
+    Buffer::iterator frame = buf.begin();
+    for (size_t i = 0; i < n; i++, frame += channels) {
+        if (mRampLeft) {
+            const float *db0 = &mDB0[0], *db1 = &mDB1[0], *db2 = &mDB2[0],
+                *da1 = &mDA1[0], *da2 = &mDA2[0];
+#pragma omp simd
+            for (size_t l = 0; l < lanes; l++) {
+                b0[l] += db0[l];
+                b1[l] += db1[l];
+                b2[l] += db2[l];
+                a1[l] += da1[l];
+                a2[l] += da2[l];
+            }
+            if (!--mRampLeft) {
+                // don't let rounding leave us just off the target
+                mB0 = mTB0;
+                mB1 = mTB1;
+                mB2 = mTB2;
+                mA1 = mTA1;
+                mA2 = mTA2;
+            }
+        }
+
+        // each section takes what the one before it put out on the last
+        // step, and the first one takes the new frame
+        std::copy(y, y + lanes - channels, x + channels);
+        for (size_t c = 0; c < channels; c++) {
+            x[c] = frame[c] + DENORMAL_GUARD;
+        }
+
+#pragma omp simd
+        for (size_t l = 0; l < lanes; l++) {
+            const float in = x[l];
+            const float out = b0[l]*in + z1[l];
+            z1[l] = b1[l]*in - a1[l]*out + z2[l];
+            z2[l] = b2[l]*in - a2[l]*out;
+            y[l] = out;
+        }
+
+        for (size_t c = 0; c < channels; c++) {
+            const long v = lrintf(y[last + c]);
+            frame[c] = std::max(-32768L, std::min(32767L, v));
+        }
+    }
+}
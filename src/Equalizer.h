@@ -0,0 +1,104 @@
+#pragma once
+
+#include "Buffer.h"
+
+#include <string>
+#include <vector>
+
+/*! @brief A cascade of biquad filters on each channel, for taming feedback
+ *
+ *  Every channel gets the same number of sections, and all the sections of
+ *  all the channels run side by side: each section works on the sample
+ *  that came out of the previous one on the last step, so one step of the
+ *  whole cascade is a single vectorizable pass with no dependencies between
+ *  lanes. The price is that the output lags the input by one sample per
+ *  section after the first; see latency().
+ *
+ *  Coefficient changes glide linearly over a short ramp rather than
+ *  jumping, so that moving a band doesn't click or zipper.
+ */
+class Equalizer {
+public:
+    //! The most sections a channel can have
+    static constexpr size_t MAX_SECTIONS = 16;
+
+    enum Type {
+        T_OFF, //!< Pass straight through
+        T_PEAK, //!< Peaking (bell) boost or cut
+        T_LOW_SHELF, //!< Boost or cut everything below the frequency
+        T_HIGH_SHELF, //!< Boost or cut everything above the frequency
+        T_LOW_PASS, //!< Cut everything above the frequency
+        T_HIGH_PASS, //!< Cut everything below the frequency
+        T_COUNT
+    };
+
+    //! Human-readable name of a filter type
+    static const char *typeName(Type);
+
+    //! Look up a filter type by name; returns false if there's no such type
+    static bool parseType(const std::string& name, Type& type);
+
+    //! One filter, as set from the knobs
+    struct Band {
+        Type type;
+        //! Which channel it goes on; -1 for all of them
+        int channel;
+        //! Center or corner frequency, in Hz
+        float freq;
+        //! Boost (or cut, if negative) in dB; only for peaks and shelves
+        float gain;
+        //! Bandwidth; 0.707 gives a flat pass band for the passes and shelves
+        float q;
+
+        Band();
+    };
+
+    /*! @param sampleRate The sample rate
+     *  @param channels Channel count
+     *  @param sections How many sections each channel gets
+     *  @param ramp How long a coefficient change takes, in frames
+     */
+    Equalizer(unsigned int sampleRate, size_t channels, size_t sections, size_t ramp);
+
+    /*! @brief Set the bands (audio thread only)
+     *
+     *  Each channel takes the bands that apply to it, in order, until it
+     *  runs out of sections; any left over pass straight through.
+     *
+     *  @param bands The bands
+     *  @param count How many there are
+     */
+    void configure(const Band *bands, size_t count);
+
+    //! Filter a run of frames in place
+    void process(Buffer& buf, size_t n);
+
+    //! How far the output lags the input, in frames
+    size_t latency() const { return mSections ? mSections - 1 : 0; }
+
+    size_t sections() const { return mSections; }
+
+private:
+    unsigned int mSampleRate;
+    size_t mChannels, mSections, mLanes;
+    size_t mRamp, mRampLeft;
+
+    //! Per lane (section-major, then channel): the current coefficients
+    //! (normalized so that a0 = 1), where they're headed, and the per-step change
+    std::vector<float> mB0, mB1, mB2, mA1, mA2;
+    std::vector<float> mTB0, mTB1, mTB2, mTA1, mTA2;
+    std::vector<float> mDB0, mDB1, mDB2, mDA1, mDA2;
+
+    //! Transposed direct form II state, and each lane's input and output for the step
+    std::vector<float> mZ1, mZ2, mX, mY;
+
+    struct Coeffs {
+        float b0, b1, b2, a1, a2;
+    };
+
+    //! Work out the coefficients for a band
+    Coeffs design(const Band&) const;
+
+    //! Point a lane at new coefficients; returns whether they changed
+    bool retarget(size_t lane, const Coeffs&);
+};
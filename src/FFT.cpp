@@ -0,0 +1,87 @@
+#include "FFT.h"
+
+#include <boost/throw_exception.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+FFT::FFT(size_t n):
+    mSize(n),
+    mTwiddle(n),
+    mReverse(n),
+    mScratch(n)
+{
+    if (n < 2 || (n & (n - 1))) {
+        BOOST_THROW_EXCEPTION(std::runtime_error("FFT size must be a power of two"));
+    }
+
+    // the twiddles for each stage, one after the other (the stage with
+    // butterflies half apart uses mTwiddle[half..2*half))
+    for (size_t half = 1; half < n; half <<= 1) {
+        for (size_t k = 0; k < half; k++) {
+            mTwiddle[half + k] = std::polar(1.0f, static_cast<float>(-M_PI*k/half));
+        }
+    }
+
+    size_t bits = 0;
+    while ((1u << bits) < n) {
+        ++bits;
+    }
+    for (size_t i = 0; i < n; i++) {
+        size_t r = 0;
+        for (size_t b = 0; b < bits; b++) {
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        mReverse[i] = r;
+    }
+}
+
+void FFT::forward(Complex *data) const {
+    const size_t n = mSize;
+    for (size_t i = 0; i < n; i++) {
+        if (i < mReverse[i]) {
+            std::swap(data[i], data[mReverse[i]]);
+        }
+    }
+
+    float *d = reinterpret_cast<float *>(data);
+    for (size_t half = 1; half < n; half <<= 1) {
+        // this stage's twiddles are laid out contiguously, starting at half
+        const float *w = reinterpret_cast<const float *>(&mTwiddle[half]);
+        for (size_t i = 0; i < n; i += 2*half) {
+            float *a = d + 2*i;
+            float *b = a + 2*half;
+            // spelled out, since std::complex's operator* has to care about NaNs
+#pragma omp simd
+            for (size_t k = 0; k < half; k++) {
+                const float tr = b[2*k]*w[2*k] - b[2*k + 1]*w[2*k + 1];
+                const float ti = b[2*k]*w[2*k + 1] + b[2*k + 1]*w[2*k];
+                b[2*k] = a[2*k] - tr;
+                b[2*k + 1] = a[2*k + 1] - ti;
+                a[2*k] += tr;
+                a[2*k + 1] += ti;
+            }
+        }
+    }
+}
+
+void FFT::inverse(Complex *data) const {
+    const size_t n = mSize;
+    for (size_t i = 0; i < n; i++) {
+        data[i] = std::conj(data[i]);
+    }
+    forward(data);
+    const float scale = 1.0f/n;
+    for (size_t i = 0; i < n; i++) {
+        data[i] = std::conj(data[i])*scale;
+    }
+}
+
+void FFT::forward(const float *in, Complex *out) {
+    for (size_t i = 0; i < mSize; i++) {
+        mScratch[i] = Complex(in[i], 0);
+    }
+    forward(&mScratch[0]);
+    std::copy(mScratch.begin(), mScratch.begin() + mSize/2 + 1, out);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <complex>
+#include <vector>
+
+/*! @brief A reusable radix-2 FFT plan
+ *
+ *  The twiddle factors and bit-reversal order are worked out once up
+ *  front, so a transform doesn't allocate or call any trig functions.
+ */
+class FFT {
+public:
+    typedef std::complex<float> Complex;
+
+    //! @param n The transform size; must be a power of two
+    explicit FFT(size_t n);
+
+    size_t size() const { return mSize; }
+
+    //! In-place forward transform of size() values
+    void forward(Complex *data) const;
+
+    //! In-place inverse transform of size() values, scaled by 1/size()
+    void inverse(Complex *data) const;
+
+    /*! @brief Forward transform of real input
+     *
+     *  @param in size() samples
+     *  @param out size()/2 + 1 bins
+     */
+    void forward(const float *in, Complex *out);
+
+private:
+    size_t mSize;
+    std::vector<Complex> mTwiddle;
+    std::vector<size_t> mReverse;
+    std::vector<Complex> mScratch;
+};
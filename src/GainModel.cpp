@@ -0,0 +1,210 @@
+#include "Drum.h"
+#include "GainModel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+//! Fixed gain
+class Gain final: public GainModel::Specialized<Gain> {
+public:
+    void configure(const Repeater::Knobs& k, unsigned int) override {
+        mLevel = k.levels[Repeater::M_GAIN];
+    }
+
+    double target(const Input&) {
+        return mLevel;
+    }
+
+private:
+    double mLevel;
+};
+
+//! Make quiet stuff louder and loud stuff quieter
+class Target final: public GainModel::Specialized<Target> {
+public:
+    void configure(const Repeater::Knobs& k, unsigned int) override {
+        mLevel = k.levels[Repeater::M_TARGET];
+        mThreshold = k.feedbackThreshold;
+    }
+
+    double target(const Input& in) {
+        return mLevel/std::max(0.00001, in.actual - mThreshold);
+    }
+
+private:
+    double mLevel, mThreshold;
+};
+
+//! Try to keep what comes back at a fixed ratio of what we played
+class Feedback final: public GainModel::Specialized<Feedback> {
+public:
+    void configure(const Repeater::Knobs& k, unsigned int) override {
+        mLevel = k.levels[Repeater::M_FEEDBACK];
+        mThreshold = k.feedbackThreshold;
+    }
+
+    double target(const Input& in) {
+        if (in.expected > mThreshold && in.actual > mThreshold) {
+            // we have sound, and we are expecting sound
+            return (in.expected - mThreshold)*mLevel/(in.actual - mThreshold) + mThreshold;
+        } else if (in.expected < mThreshold) {
+            // we have no sound yet, so just set the gain to 1
+            return 1;
+        }
+        // we are not expecting sound, so keep it the same
+        return in.curGain;
+    }
+
+private:
+    double mLevel, mThreshold;
+};
+
+/*! @brief Fixed gain, pulled down ahead of time for peaks that are coming up
+ *
+ *  The window from the play head to the end of the lookahead mostly just
+ *  slides along from one cycle to the next, so its peak comes from a
+ *  monotonic queue (as in Limiter) that only takes in what's come into the
+ *  window and lets go of what's gone out of it. What's ahead of the play
+ *  head was recorded a loop delay ago and doesn't change before it gets
+ *  played, other than when the heads jump, which starts the window over.
+ */
+class PeakLimiter final: public GainModel::Specialized<PeakLimiter> {
+public:
+    PeakLimiter(): mDrum(NULL) {}
+
+    void configure(const Repeater::Knobs& k, unsigned int sampleRate) override {
+        mLevel = k.levels[Repeater::M_LIMITER];
+        mCeiling = k.ceiling;
+        mLookahead = k.lookahead*sampleRate;
+        mDrum = NULL;
+    }
+
+    double target(const Input& in) {
+        const Drum& drum = *in.drum;
+        const size_t drumSize = drum.count();
+        const size_t window = std::min(in.frames + mLookahead, drumSize);
+        if (mQueue.size() <= window) {
+            size_t qsize = 1;
+            while (qsize <= window) {
+                qsize <<= 1;
+            }
+            mQueue.resize(qsize);
+            mMask = qsize - 1;
+            mDrum = NULL;
+        }
+        if (&drum != mDrum || in.playPos % drumSize != mNextOffset || mStart + window < mEnd) {
+            mDrum = &drum;
+            mHead = mTail = 0;
+            mStart = mEnd = 0;
+            mEndOffset = in.playPos % drumSize;
+        }
+
+        // let go of what's gone out of the window, then take in what's come into it
+        while (mHead != mTail && mQueue[mHead].pos < mStart) {
+            mHead = (mHead + 1) & mMask;
+        }
+        Buffer::const_iterator sample = drum.at(mEndOffset) + in.channel;
+        for (; mEnd < mStart + window; ++mEnd) {
+            const int32_t peak = std::abs(static_cast<int32_t>(*sample));
+            // anything smaller than this peak can never be the maximum again
+            while (mTail != mHead && mQueue[(mTail - 1) & mMask].peak <= peak) {
+                mTail = (mTail - 1) & mMask;
+            }
+            mQueue[mTail] = Peak{mEnd, peak};
+            mTail = (mTail + 1) & mMask;
+
+            if (++mEndOffset == drumSize) {
+                mEndOffset = 0;
+                sample = drum.begin() + in.channel;
+            } else {
+                sample += drum.channels();
+            }
+        }
+        const int32_t peak = mHead != mTail ? mQueue[mHead].peak : 0;
+
+        // the next cycle's window starts where this one's playing leaves off
+        mStart += in.frames;
+        mNextOffset = (in.playPos + in.frames) % drumSize;
+
+        if (!peak) {
+            // nothing coming up to hold the gain down for
+            return mLevel;
+        }
+        return std::min(mLevel, mCeiling*(32768.0/peak));
+    }
+
+private:
+    double mLevel, mCeiling;
+    size_t mLookahead;
+
+    struct Peak {
+        size_t pos;
+        int32_t peak;
+    };
+    //! Monotonic queue of (position, peak) over the window, as a ring
+    std::vector<Peak> mQueue;
+    size_t mMask, mHead, mTail;
+
+    //! The drum the window is over; NULL to start it over on the next cycle
+    const Drum *mDrum;
+    //! Positions of the start of the window and of the next frame to take
+    //! in, counting from where the window was last started over
+    size_t mStart, mEnd;
+    //! Drum offset of mEnd
+    size_t mEndOffset;
+    //! Drum offset the play head should be at next cycle, if it hasn't jumped
+    size_t mNextOffset;
+};
+
+//! RMS compressor on the signal we're about to play
+class Compressor final: public GainModel::Specialized<Compressor> {
+public:
+    Compressor(): mEnvelope(0) {}
+
+    void configure(const Repeater::Knobs& k, unsigned int) override {
+        mThreshold = std::max(1e-6, k.levels[Repeater::M_COMPRESSOR]);
+        mSlope = 1 - 1/std::max(1.0, k.ratio);
+        mAttack = std::max(1e-4, k.attack);
+        mRelease = std::max(1e-4, k.release);
+    }
+
+    double target(const Input& in) {
+        const double level = in.drum->powerAt(in.playPos, in.frames, in.channel);
+        const double tc = level > mEnvelope ? mAttack : mRelease;
+        mEnvelope += (level - mEnvelope)*(1 - exp(-in.dt/tc));
+
+        if (mEnvelope <= mThreshold) {
+            return 1;
+        }
+        // pull everything above the threshold down by the ratio
+        return pow(mThreshold/mEnvelope, mSlope);
+    }
+
+private:
+    double mThreshold, mSlope, mAttack, mRelease;
+    double mEnvelope;
+};
+
+}
+
+GainModel::Ptr GainModel::create(Repeater::Mode mode) {
+    switch (mode) {
+    case Repeater::M_GAIN:
+        return Ptr(new Gain);
+    case Repeater::M_TARGET:
+        return Ptr(new Target);
+    case Repeater::M_FEEDBACK:
+        return Ptr(new Feedback);
+    case Repeater::M_LIMITER:
+        return Ptr(new PeakLimiter);
+    case Repeater::M_COMPRESSOR:
+        return Ptr(new Compressor);
+    case Repeater::M_COUNT:
+        break;
+    }
+    return Ptr();
+}
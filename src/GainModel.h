@@ -0,0 +1,85 @@
+#pragma once
+
+#include "Repeater.h"
+
+#include <memory>
+
+class Drum;
+
+/*! @brief A volume model: decides what gain the loop should be played back at
+ *
+ *  Each mode has its own implementation, and each channel gets its own
+ *  instance so that every speaker is controlled independently. The one for
+ *  the current mode is picked and configured whenever the knobs change, so
+ *  the per-cycle call does no lookups or mode switching of its own. Models
+ *  may keep state (envelopes and so on) across cycles.
+ *
+ *  The per-cycle work goes through targets(), whose loop over the channels
+ *  is compiled separately for each model, so each channel's target is an
+ *  inlined call rather than a virtual one.
+ *
+ *  To add a model, add a Repeater::Mode, derive the implementation from
+ *  GainModel::Specialized, and return it from create().
+ */
+class GainModel {
+public:
+    typedef std::unique_ptr<GainModel> Ptr;
+
+    //! Everything a model gets to look at each cycle
+    struct Input {
+        //! Which channel this is for
+        size_t channel;
+        //! Recorded power level
+        double actual;
+        //! Expected power level (what we played, as it should come back)
+        double expected;
+        //! Gain at the start of this cycle
+        double curGain;
+        //! The loop, and where we're about to play from
+        const Drum *drum;
+        size_t playPos;
+        //! Frames in this cycle
+        size_t frames;
+        //! Seconds in this cycle
+        double dt;
+    };
+
+    virtual ~GainModel() {}
+
+    //! Pick up new knob settings; called once per knob change
+    virtual void configure(const Repeater::Knobs&, unsigned int sampleRate) = 0;
+
+    /*! @brief Compute this cycle's target gains for a run of channels
+     *
+     *  Called on any one of the models, and every one of them has to be of
+     *  the same type as it.
+     *
+     *  @param models The models
+     *  @param in What each of them gets to look at
+     *  @param out Set to each one's target gain
+     *  @param n How many there are
+     */
+    virtual void targets(GainModel *const *models, const Input *in, double *out, size_t n) = 0;
+
+    //! Create the model for a mode
+    static Ptr create(Repeater::Mode);
+
+    /*! @brief Base for the implementations, which supplies targets() for them
+     *
+     *  Model has to be final and have a non-virtual
+     *  <tt>double target(const Input&)</tt> for the gain on one channel.
+     */
+    template<typename Model>
+    class Specialized;
+};
+
+template<typename Model>
+class GainModel::Specialized: public GainModel {
+public:
+    void targets(GainModel *const *models, const Input *in, double *out,
+                 size_t n) override final {
+        for (size_t i = 0; i < n; i++) {
+            out[i] = static_cast<Model *>(models[i])->target(in[i]);
+        }
+    }
+};
@@ -0,0 +1,178 @@
+#include "JackClient.h"
+
+#ifdef HAVE_JACK
+#include <jack/jack.h>
+#endif
+
+#include <boost/throw_exception.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+#ifdef HAVE_JACK
+namespace {
+jack_client_t *client(void *c) {
+    return static_cast<jack_client_t *>(c);
+}
+
+jack_port_t *port(void *p) {
+    return static_cast<jack_port_t *>(p);
+}
+}
+
+JackClient::JackClient(const std::string& name, size_t channels):
+    mIn(channels),
+    mOut(channels),
+    mActive(false),
+    mZombified(false)
+{
+    jack_status_t status;
+    mClient = jack_client_open(name.c_str(), JackNoStartServer, &status);
+    if (!mClient) {
+        BOOST_THROW_EXCEPTION(std::runtime_error("Couldn't connect to the JACK server"));
+    }
+
+    for (size_t c = 0; c < channels; c++) {
+        const std::string in = "in_" + std::to_string(c + 1), out = "out_" + std::to_string(c + 1);
+        jack_port_t *ip = jack_port_register(client(mClient), in.c_str(),
+                                             JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+        jack_port_t *op = jack_port_register(client(mClient), out.c_str(),
+                                             JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+        if (!ip || !op) {
+            jack_client_close(client(mClient));
+            BOOST_THROW_EXCEPTION(std::runtime_error("Couldn't register JACK ports"));
+        }
+        mInputs.push_back(ip);
+        mOutputs.push_back(op);
+    }
+
+    jack_set_process_callback(client(mClient), &JackClient::onProcess, this);
+    jack_on_shutdown(client(mClient), &JackClient::onShutdown, this);
+}
+
+JackClient::~JackClient() {
+    stop();
+    jack_client_close(client(mClient));
+}
+
+unsigned int JackClient::sampleRate() const {
+    return jack_get_sample_rate(client(mClient));
+}
+
+size_t JackClient::bufferSize() const {
+    return jack_get_buffer_size(client(mClient));
+}
+
+int JackClient::onProcess(uint32_t frames, void *arg) {
+    JackClient *self = static_cast<JackClient *>(arg);
+    for (size_t c = 0; c < self->mIn.size(); c++) {
+        self->mIn[c] = static_cast<const float *>(jack_port_get_buffer(port(self->mInputs[c]), frames));
+        self->mOut[c] = static_cast<float *>(jack_port_get_buffer(port(self->mOutputs[c]), frames));
+    }
+    self->mProcess(&self->mIn[0], &self->mOut[0], frames);
+    return 0;
+}
+
+void JackClient::onShutdown(void *arg) {
+    static_cast<JackClient *>(arg)->mZombified = true;
+}
+
+void JackClient::start(const Process& process, const std::string& capture,
+                       const std::string& playback) {
+    mProcess = process;
+    if (jack_activate(client(mClient))) {
+        BOOST_THROW_EXCEPTION(std::runtime_error("Couldn't activate the JACK client"));
+    }
+    mActive = true;
+
+    connect(capture, true);
+    connect(playback, false);
+}
+
+void JackClient::stop() {
+    if (mActive) {
+        jack_deactivate(client(mClient));
+        mActive = false;
+    }
+}
+
+void JackClient::connect(const std::string& pattern, bool capture) {
+    // what we record from are other clients' outputs, and vice versa
+    unsigned long flags = capture ? JackPortIsOutput : JackPortIsInput;
+    if (pattern.empty()) {
+        flags |= JackPortIsPhysical;
+    }
+    const char **ports = jack_get_ports(client(mClient), pattern.empty() ? NULL : pattern.c_str(),
+                                        JACK_DEFAULT_AUDIO_TYPE, flags);
+    const std::vector<void *>& ours = capture ? mInputs : mOutputs;
+
+    size_t n = 0;
+    for (; ports && ports[n] && n < ours.size(); n++) {
+        const char *mine = jack_port_name(port(ours[n]));
+        if (capture ? jack_connect(client(mClient), ports[n], mine)
+            : jack_connect(client(mClient), mine, ports[n])) {
+            std::cerr << "Couldn't connect " << mine << " to " << ports[n] << std::endl;
+        }
+    }
+    if (n < ours.size()) {
+        std::cerr << "Only found " << n << " JACK " << (capture ? "capture" : "playback")
+                  << " ports to connect to" << std::endl;
+    }
+    jack_free(ports);
+}
+
+int JackClient::latency() const {
+    // the worst case over all the channels, from the outside world to our
+    // inputs and from our outputs back out to it
+    jack_nframes_t capture = 0, playback = 0;
+    for (void *p : mInputs) {
+        jack_latency_range_t range;
+        jack_port_get_latency_range(port(p), JackCaptureLatency, &range);
+        capture = std::max(capture, range.max);
+    }
+    for (void *p : mOutputs) {
+        jack_latency_range_t range;
+        jack_port_get_latency_range(port(p), JackPlaybackLatency, &range);
+        playback = std::max(playback, range.max);
+    }
+    return capture + playback;
+}
+
+double JackClient::cpuLoad() const {
+    return jack_cpu_load(client(mClient));
+}
+#else
+JackClient::JackClient(const std::string&, size_t):
+    mClient(NULL),
+    mActive(false),
+    mZombified(false)
+{
+    BOOST_THROW_EXCEPTION(std::runtime_error("Built without JACK support"));
+}
+
+JackClient::~JackClient() {
+}
+
+unsigned int JackClient::sampleRate() const {
+    return 0;
+}
+
+size_t JackClient::bufferSize() const {
+    return 0;
+}
+
+void JackClient::start(const Process&, const std::string&, const std::string&) {
+}
+
+void JackClient::stop() {
+}
+
+int JackClient::latency() const {
+    return 0;
+}
+
+double JackClient::cpuLoad() const {
+    return 0;
+}
+#endif
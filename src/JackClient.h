@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/*! @brief A JACK client with a set of audio inputs and outputs
+ *
+ *  Works with jackd as well as PipeWire's JACK implementation. JACK calls
+ *  us from its own real-time thread, once per period, with the inputs and
+ *  outputs for that period; whatever runs there must not block or allocate.
+ */
+class JackClient {
+public:
+    /*! @brief Process one period (JACK's thread)
+     *
+     *  @param in One buffer per input channel
+     *  @param out One buffer per output channel
+     *  @param frames The number of frames in each
+     */
+    typedef std::function<void(const float *const *in, float *const *out, size_t frames)> Process;
+
+    /*! @brief Connect to the JACK server
+     *
+     *  @param name The client name
+     *  @param channels How many inputs and outputs to register
+     */
+    JackClient(const std::string& name, size_t channels);
+    ~JackClient();
+
+    unsigned int sampleRate() const;
+
+    //! The current period, in frames
+    size_t bufferSize() const;
+
+    /*! @brief Start processing, and connect to the given ports
+     *
+     *  @param process What to call every period
+     *  @param capture Regular expression for the ports to record from; empty for the physical ones
+     *  @param playback Likewise, for the ports to play to
+     */
+    void start(const Process& process, const std::string& capture, const std::string& playback);
+
+    //! Stop processing
+    void stop();
+
+    /*! @brief The round trip through the ports we're connected to, in frames
+     *
+     *  As reported by the server; this doesn't include the trip through the
+     *  air, which the latency tracker picks up.
+     */
+    int latency() const;
+
+    //! JACK's own estimate of how busy it is, in percent
+    double cpuLoad() const;
+
+    //! Whether the server shut us down
+    bool zombified() const { return mZombified; }
+
+private:
+    void *mClient;
+    std::vector<void *> mInputs, mOutputs;
+    //! Per-period port buffers, preallocated so the callback doesn't have to
+    std::vector<const float *> mIn;
+    std::vector<float *> mOut;
+    Process mProcess;
+    bool mActive;
+    std::atomic<bool> mZombified;
+
+    static int onProcess(uint32_t frames, void *arg);
+    static void onShutdown(void *arg);
+
+    //! Connect our ports to whatever matches the pattern
+    void connect(const std::string& pattern, bool capture);
+};
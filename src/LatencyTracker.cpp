@@ -0,0 +1,143 @@
+#include "LatencyTracker.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+LatencyTracker::LatencyTracker(unsigned int sampleRate, size_t maxFrames,
+                               int latency, size_t searchRange):
+    mSampleRate(sampleRate),
+    mSearchRange(searchRange),
+    mWindow(sampleRate/4),
+    mFeed(sampleRate*2, maxFrames),
+    mLatency(latency),
+    mShift(0),
+    mConfidence(0),
+    mEstimate(latency),
+    mRunning(false)
+{}
+
+LatencyTracker::~LatencyTracker() {
+    stop();
+}
+
+void LatencyTracker::start() {
+    if (mRunning) {
+        return;
+    }
+    mRunning = true;
+    mThread = std::thread([this]() { worker(); });
+
+    // stay out of the way of everything else
+    struct sched_param param = {};
+    pthread_setschedparam(mThread.native_handle(), SCHED_IDLE, &param);
+}
+
+void LatencyTracker::stop() {
+    mRunning = false;
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+}
+
+void LatencyTracker::push(const Buffer& played, const Buffer& recorded, size_t frames) {
+    mFeed.push(played, recorded, frames);
+}
+
+void LatencyTracker::shift(int delta) {
+    mShift += delta;
+    mLatency += delta;
+    mFeed.interrupt();
+}
+
+void LatencyTracker::worker() {
+    std::vector<DuplexFeed::Frame> chunk(mSampleRate/10);
+    size_t fresh = 0;
+
+    while (mRunning) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        if (mFeed.interrupted()) {
+            mPlayed.clear();
+            mRecorded.clear();
+            fresh = 0;
+        }
+        if (const int delta = mShift.exchange(0)) {
+            mEstimate += delta;
+            mLatency = lrint(mEstimate);
+        }
+
+        size_t n;
+        while ((n = mFeed.read(&chunk[0], chunk.size())) > 0) {
+            for (size_t i = 0; i < n; i++) {
+                mPlayed.push_back(chunk[i].played);
+                mRecorded.push_back(chunk[i].recorded);
+            }
+            fresh += n;
+        }
+
+        // only keep as much history as the search can reach
+        const size_t keep = mWindow + std::max(0, mLatency.load()) + 2*mSearchRange;
+        if (mPlayed.size() > keep*2) {
+            const size_t drop = mPlayed.size() - keep;
+            mPlayed.erase(mPlayed.begin(), mPlayed.begin() + drop);
+            mRecorded.erase(mRecorded.begin(), mRecorded.begin() + drop);
+        }
+
+        // measure about once a second
+        if (fresh >= mSampleRate && mPlayed.size() >= keep) {
+            fresh = 0;
+            measure();
+        }
+    }
+}
+
+void LatencyTracker::measure() {
+    const size_t len = mRecorded.size();
+    const float *rec = &mRecorded[len - mWindow];
+
+    double recEnergy = 0;
+    for (size_t i = 0; i < mWindow; i++) {
+        recEnergy += rec[i]*rec[i];
+    }
+    if (recEnergy <= 0) {
+        return;
+    }
+
+    const int center = mLatency;
+    int bestLag = center;
+    double best = 0;
+    for (int lag = center - (int)mSearchRange; lag <= center + (int)mSearchRange; lag++) {
+        const ptrdiff_t start = (ptrdiff_t)(len - mWindow) - lag;
+        if (lag < 0 || start < 0) {
+            continue;
+        }
+        const float *play = &mPlayed[start];
+
+        float dot = 0, energy = 0;
+#pragma omp simd reduction(+:dot,energy)
+        for (size_t i = 0; i < mWindow; i++) {
+            dot += rec[i]*play[i];
+            energy += play[i]*play[i];
+        }
+        if (energy > 0) {
+            double corr = dot/sqrt(recEnergy*energy);
+            if (corr > best) {
+                best = corr;
+                bestLag = lag;
+            }
+        }
+    }
+
+    mConfidence = best;
+
+    // anything weakly correlated is more likely the room than our own output
+    if (best < 0.3) {
+        return;
+    }
+    mEstimate += (bestLag - mEstimate)*0.25*best;
+    mLatency = lrint(mEstimate);
+}
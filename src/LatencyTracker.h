@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Buffer.h"
+#include "DuplexFeed.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/*! @brief Keeps track of the round-trip latency while the loop is running
+ *
+ *  The audio thread hands over what it played and what it recorded each
+ *  cycle; a low-priority worker thread cross-correlates the two around the
+ *  current estimate and nudges the estimate towards what it finds.
+ */
+class LatencyTracker {
+public:
+    /*! @param sampleRate The sample rate
+     *  @param maxFrames The most frames that will be pushed in one cycle
+     *  @param latency The initial (calibrated) latency, in frames
+     *  @param searchRange How far to either side of the estimate to look, in frames
+     */
+    LatencyTracker(unsigned int sampleRate, size_t maxFrames,
+                   int latency, size_t searchRange);
+    ~LatencyTracker();
+
+    //! Start the worker thread
+    void start();
+
+    //! Stop the worker thread
+    void stop();
+
+    /*! @brief Hand over a cycle's worth of audio (audio thread only)
+     *
+     *  @param played What was sent to the speakers
+     *  @param recorded What came back from the microphones
+     *  @param frames The number of frames in each
+     */
+    void push(const Buffer& played, const Buffer& recorded, size_t frames);
+
+    //! Current smoothed latency estimate, in frames
+    int getLatency() const { return mLatency; }
+
+    /*! @brief Move the estimate by a known amount (audio thread only)
+     *
+     *  For when the devices get reconfigured; the history from before the
+     *  change gets thrown away.
+     */
+    void shift(int delta);
+
+    //! Confidence of the most recent measurement (peak normalized correlation)
+    double getConfidence() const { return mConfidence; }
+
+private:
+    unsigned int mSampleRate;
+    size_t mSearchRange;
+    size_t mWindow;
+
+    DuplexFeed mFeed;
+
+    std::atomic<int> mLatency;
+    //! Shifts the worker hasn't applied to its estimate yet
+    std::atomic<int> mShift;
+    std::atomic<double> mConfidence;
+    double mEstimate;
+
+    std::atomic<bool> mRunning;
+    std::thread mThread;
+
+    //! Worker-side history
+    std::vector<float> mPlayed, mRecorded;
+
+    void worker();
+    void measure();
+};
@@ -0,0 +1,164 @@
+#include "Drum.h"
+#include "Limiter.h"
+
+#include <boost/throw_exception.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+Limiter::Limiter(size_t channels, size_t maxFrames, size_t lookahead, size_t release):
+    mChannels(channels),
+    mLookahead(std::max<size_t>(lookahead, 2)),
+    mReleaseCoeff(1 - exp(-1.0/std::max<size_t>(release, 1))),
+    mCeiling(32767),
+    mChans(channels),
+    mGains(maxFrames*channels)
+{
+    // the window never holds more than mLookahead + 2 entries; round the
+    // ring up to a power of two so wrapping is just a mask
+    size_t qsize = 1;
+    while (qsize < mLookahead + 3) {
+        qsize <<= 1;
+    }
+    mQueueMask = qsize - 1;
+    for (auto& ch : mChans) {
+        ch.queue.resize(qsize);
+    }
+    reset();
+}
+
+void Limiter::setCeiling(double ceiling) {
+    mCeiling = std::max(0.01, std::min(1.0, ceiling))*32767;
+}
+
+void Limiter::reset() {
+    for (auto& ch : mChans) {
+        ch.head = ch.tail = 0;
+        ch.pushPos = 0;
+        ch.envelope = 1;
+        ch.attackStep = 0;
+        ch.attackTarget = ch.envelope;
+        ch.applied = 0;
+    }
+    mReadPos = 0;
+    mExpectedOffset = 0;
+    mPrimed = false;
+}
+
+void Limiter::push(Channel& ch, size_t channel, const Drum& drum, size_t drumSize,
+                   size_t startOffset, size_t upTo) {
+    if (ch.pushPos >= upTo) {
+        return;
+    }
+
+    size_t ofs = (startOffset + (ch.pushPos - mReadPos)) % drumSize;
+    Buffer::const_iterator sample = drum.at(ofs) + channel;
+    while (ch.pushPos < upTo) {
+        const int32_t peak = std::abs(static_cast<int32_t>(*sample));
+
+        // anything smaller than this peak can never be the maximum again
+        while (ch.tail != ch.head && ch.queue[(ch.tail - 1) & mQueueMask].peak <= peak) {
+            ch.tail = (ch.tail - 1) & mQueueMask;
+        }
+        ch.queue[ch.tail] = Peak{ch.pushPos, peak};
+        ch.tail = (ch.tail + 1) & mQueueMask;
+        ++ch.pushPos;
+
+        if (++ofs == drumSize) {
+            ofs = 0;
+            sample = drum.begin() + channel;
+        } else {
+            sample += mChannels;
+        }
+    }
+}
+
+void Limiter::prime(const Drum& drum, size_t drumSize, size_t start) {
+    // there's no time to ramp down to anything that's already in the window,
+    // so start out under all of it; whatever comes in after that has the
+    // usual half lookahead
+    for (size_t c = 0; c < mChannels; c++) {
+        Channel& ch = mChans[c];
+        push(ch, c, drum, drumSize, start, mLookahead + 1);
+        ch.envelope = mCeiling/std::max<int32_t>(ch.queue[ch.head].peak, 1);
+        ch.attackTarget = ch.envelope;
+    }
+}
+
+size_t Limiter::read(const Drum& drum, Buffer& buf, size_t offset, size_t n,
+                     const double *gain0, const double *gain1) {
+    if (buf.channels() != mChannels || drum.channels() != mChannels) {
+        BOOST_THROW_EXCEPTION(std::runtime_error("Mismatched channel count"));
+    }
+    n = std::min(n, buf.count());
+    if (n*mChannels > mGains.size()) {
+        mGains.resize(n*mChannels);
+    }
+
+    const size_t drumSize = drum.count();
+    const size_t start = offset % drumSize;
+    if (!mPrimed || start != mExpectedOffset) {
+        reset();
+        prime(drum, drumSize, start);
+        mPrimed = true;
+    }
+
+    const size_t halfLook = mLookahead/2;
+
+    // work out the gain for every sample
+    for (size_t c = 0; c < mChannels; c++) {
+        Channel& ch = mChans[c];
+        const double gainStep = n ? (gain1[c] - gain0[c])/n : 0;
+
+        for (size_t i = 0; i < n; i++) {
+            const size_t pos = mReadPos + i;
+            push(ch, c, drum, drumSize, start, pos + mLookahead + 1);
+
+            while (ch.queue[ch.head].pos < pos) {
+                ch.head = (ch.head + 1) & mQueueMask;
+            }
+            const int32_t peak = std::max<int32_t>(ch.queue[ch.head].peak, 1);
+            const double limit = mCeiling/peak;
+
+            if (limit < ch.envelope) {
+                // a new peak entered the window; get down to it within half
+                // the lookahead, which is before it can reach the play head
+                if (limit < ch.attackTarget || ch.attackStep == 0) {
+                    ch.attackTarget = limit;
+                    ch.attackStep = (ch.envelope - limit)/halfLook;
+                }
+                ch.envelope = std::max(limit, ch.envelope - ch.attackStep);
+            } else {
+                ch.attackStep = 0;
+                ch.attackTarget = limit;
+                ch.envelope += (limit - ch.envelope)*mReleaseCoeff;
+            }
+
+            mGains[i*mChannels + c] = std::min(gain0[c] + gainStep*i, ch.envelope);
+        }
+        if (n) {
+            ch.applied = mGains[(n - 1)*mChannels + c];
+        }
+    }
+
+    // apply them, a contiguous run at a time
+    const size_t first = std::min(n, drumSize - start);
+    const float *gains = &mGains[0];
+    for (size_t run = 0; run < 2; run++) {
+        const size_t len = (run ? n - first : first)*mChannels;
+        const size_t skip = (run ? first : 0)*mChannels;
+        const int16_t *in = &*drum.at(run ? 0 : start);
+        int16_t *out = &*buf.begin() + skip;
+#pragma omp simd
+        for (size_t i = 0; i < len; i++) {
+            float v = in[i]*gains[skip + i];
+            v = std::max(-32768.0f, std::min(32767.0f, v));
+            out[i] = lrintf(v);
+        }
+    }
+
+    mReadPos += n;
+    mExpectedOffset = (start + n) % drumSize;
+    return mExpectedOffset;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "Buffer.h"
+
+#include <cstdint>
+#include <vector>
+
+class Drum;
+
+/*! @brief Per-sample lookahead peak limiter reading straight from the Drum
+ *
+ *  Since everything we're about to play is already sitting in the drum,
+ *  the limiter can see peaks coming without adding any latency. It keeps a
+ *  running maximum over the next few milliseconds (using a monotonic queue,
+ *  updated incrementally as the play head advances) and ramps the gain
+ *  down in time for each peak to land under the ceiling, then releases
+ *  smoothly afterwards. Each channel is limited independently.
+ */
+class Limiter {
+public:
+    /*! @param channels Channel count
+     *  @param maxFrames Most frames that are expected to be read in one go
+     *  @param lookahead How far ahead to look, in frames
+     *  @param release Release time constant, in frames
+     */
+    Limiter(size_t channels, size_t maxFrames, size_t lookahead, size_t release);
+
+    //! Set the ceiling, as a fraction of full scale
+    void setCeiling(double ceiling);
+
+    /*! @brief Read from the drum, applying a gain ramp and the limiter
+     *
+     *  @param drum The drum to read from
+     *  @param buf The buffer to read into
+     *  @param offset Where to read from
+     *  @param n The number of frames to read
+     *  @param gain0 Start gain value for each channel
+     *  @param gain1 End gain value for each channel
+     *  @returns next read position
+     */
+    size_t read(const Drum& drum, Buffer& buf, size_t offset, size_t n,
+                const double *gain0, const double *gain1);
+
+    //! The gain that was applied to the last frame read on a channel
+    double appliedGain(size_t channel) const { return mChans[channel].applied; }
+
+    /*! @brief Forget everything, e.g. when the read head jumps
+     *
+     *  The next read starts out with the gain already under the loudest
+     *  peak in its lookahead window, so nothing gets through over the
+     *  ceiling while it catches up.
+     */
+    void reset();
+
+private:
+    size_t mChannels;
+    size_t mLookahead;
+    double mReleaseCoeff;
+    double mCeiling;
+
+    struct Peak {
+        size_t pos;
+        int32_t peak;
+    };
+
+    struct Channel {
+        //! Monotonic queue of (position, peak), preallocated as a ring
+        std::vector<Peak> queue;
+        size_t head, tail;
+
+        //! Absolute position of the next frame to go into the queue
+        size_t pushPos;
+
+        //! Current limiter gain, and how fast it's moving down
+        double envelope;
+        double attackStep;
+        double attackTarget;
+
+        double applied;
+    };
+    std::vector<Channel> mChans;
+    size_t mQueueMask;
+
+    //! Absolute position of the next frame that will be read
+    size_t mReadPos;
+    //! Drum offset corresponding to mReadPos, to notice jumps
+    size_t mExpectedOffset;
+    bool mPrimed;
+
+    //! Per-sample gains for the current read, interleaved like the audio
+    std::vector<float> mGains;
+
+    void push(Channel&, size_t channel, const Drum& drum, size_t drumSize,
+              size_t startOffset, size_t upTo);
+
+    //! Fill the window from a fresh start, and set the envelope to fit it
+    void prime(const Drum& drum, size_t drumSize, size_t start);
+};
@@ -0,0 +1,181 @@
+#include "LoudnessMeter.h"
+
+#include <algorithm>
+#include <cmath>
+
+constexpr double LoudnessMeter::BLOCK;
+constexpr size_t LoudnessMeter::MAX_BLOCKS;
+
+namespace {
+//! BS.1770's offset between the weighted mean square and LUFS
+const double LUFS_OFFSET = -0.691;
+}
+
+LoudnessMeter::LoudnessMeter(unsigned int sampleRate, size_t channels):
+    mChannels(channels),
+    mBlockFrames(std::max<size_t>(1, lround(sampleRate*BLOCK))),
+    mState(channels*4),
+    mBlocks(MAX_BLOCKS*channels),
+    mPassed(MAX_BLOCKS),
+    mHead(0),
+    mFilled(0),
+    mSum(channels),
+    mCount(0),
+    mPartial(channels),
+    mPartialFrames(0)
+{
+    // the filters as BS.1770 gives them for 48KHz, redesigned for whatever
+    // rate we're actually at
+    {
+        const double f0 = 1681.974450955533, gain = 3.999843853973347, q = 0.7071752369554196;
+        const double K = tan(M_PI*f0/sampleRate);
+        const double vh = pow(10, gain/20), vb = pow(vh, 0.4996667741545416);
+        const double a0 = 1 + K/q + K*K;
+        mShelfB[0] = (vh + vb*K/q + K*K)/a0;
+        mShelfB[1] = 2*(K*K - vh)/a0;
+        mShelfB[2] = (vh - vb*K/q + K*K)/a0;
+        mShelfA[0] = 1;
+        mShelfA[1] = 2*(K*K - 1)/a0;
+        mShelfA[2] = (1 - K/q + K*K)/a0;
+    }
+    {
+        const double f0 = 38.13547087602444, q = 0.5003270373238773;
+        const double K = tan(M_PI*f0/sampleRate);
+        const double a0 = 1 + K/q + K*K;
+        mPassB[0] = 1;
+        mPassB[1] = -2;
+        mPassB[2] = 1;
+        mPassA[0] = 1;
+        mPassA[1] = 2*(K*K - 1)/a0;
+        mPassA[2] = (1 - K/q + K*K)/a0;
+    }
+
+    configure(4, -70);
+}
+
+void LoudnessMeter::configure(size_t blocks, double gate) {
+    mWindow = std::max<size_t>(1, std::min(blocks, MAX_BLOCKS));
+    mGate = pow(10, (gate - LUFS_OFFSET)/10);
+
+    // this only happens when the knobs change, so it's fine to go over
+    // the stored blocks again
+    std::fill(mSum.begin(), mSum.end(), 0);
+    mCount = 0;
+    const size_t n = std::min(mWindow, mFilled);
+    for (size_t i = 1; i <= n; i++) {
+        const size_t b = (mHead + MAX_BLOCKS - i) % MAX_BLOCKS;
+        const double *squares = &mBlocks[b*mChannels];
+        mPassed[b] = passes(squares, mBlockFrames);
+        if (mPassed[b]) {
+            for (size_t c = 0; c < mChannels; c++) {
+                mSum[c] += squares[c];
+            }
+            ++mCount;
+        }
+    }
+}
+
+void LoudnessMeter::reset() {
+    std::fill(mState.begin(), mState.end(), 0);
+    mHead = mFilled = 0;
+    std::fill(mSum.begin(), mSum.end(), 0);
+    mCount = 0;
+    std::fill(mPartial.begin(), mPartial.end(), 0);
+    mPartialFrames = 0;
+}
+
+bool LoudnessMeter::passes(const double *squares, size_t frames) const {
+    double total = 0;
+    for (size_t c = 0; c < mChannels; c++) {
+        total += squares[c];
+    }
+    return frames && total/frames >= mGate;
+}
+
+void LoudnessMeter::push(const Buffer& buf, size_t n) {
+    n = std::min(n, buf.count());
+    Buffer::const_iterator frame = buf.begin();
+    for (size_t i = 0; i < n; i++, frame += mChannels) {
+        for (size_t c = 0; c < mChannels; c++) {
+            double *z = &mState[c*4];
+            // transposed direct form II, twice over
+            const double x = frame[c]*(1.0/32768);
+            const double s = mShelfB[0]*x + z[0];
+            z[0] = mShelfB[1]*x - mShelfA[1]*s + z[1];
+            z[1] = mShelfB[2]*x - mShelfA[2]*s;
+            const double y = mPassB[0]*s + z[2];
+            z[2] = mPassB[1]*s - mPassA[1]*y + z[3];
+            z[3] = mPassB[2]*s - mPassA[2]*y;
+            mPartial[c] += y*y;
+        }
+        if (++mPartialFrames == mBlockFrames) {
+            completeBlock();
+        }
+    }
+}
+
+void LoudnessMeter::completeBlock() {
+    // the block that's been in the window longest drops out of it
+    if (mFilled >= mWindow) {
+        const size_t old = (mHead + MAX_BLOCKS - mWindow) % MAX_BLOCKS;
+        if (mPassed[old]) {
+            for (size_t c = 0; c < mChannels; c++) {
+                mSum[c] = std::max(0.0, mSum[c] - mBlocks[old*mChannels + c]);
+            }
+            --mCount;
+        }
+    }
+
+    double *squares = &mBlocks[mHead*mChannels];
+    std::copy(mPartial.begin(), mPartial.end(), squares);
+    mPassed[mHead] = passes(squares, mBlockFrames);
+    if (mPassed[mHead]) {
+        for (size_t c = 0; c < mChannels; c++) {
+            mSum[c] += squares[c];
+        }
+        ++mCount;
+    }
+
+    mHead = (mHead + 1) % MAX_BLOCKS;
+    mFilled = std::min(mFilled + 1, MAX_BLOCKS);
+    std::fill(mPartial.begin(), mPartial.end(), 0);
+    mPartialFrames = 0;
+}
+
+double LoudnessMeter::windowSquares(size_t channel, double& frames) const {
+    double squares = mSum[channel];
+    frames = mCount*mBlockFrames;
+
+    // as the block in progress fills up, the oldest one gives way to it
+    if (mPartialFrames && passes(&mPartial[0], mPartialFrames)) {
+        squares += mPartial[channel];
+        frames += mPartialFrames;
+    }
+    if (mFilled >= mWindow) {
+        const size_t old = (mHead + MAX_BLOCKS - mWindow) % MAX_BLOCKS;
+        if (mPassed[old]) {
+            const double fade = mPartialFrames*1.0/mBlockFrames;
+            squares -= mBlocks[old*mChannels + channel]*fade;
+            frames -= mBlockFrames*fade;
+        }
+    }
+    return std::max(0.0, squares);
+}
+
+double LoudnessMeter::power() const {
+    double total = 0, frames = 0;
+    for (size_t c = 0; c < mChannels; c++) {
+        total += windowSquares(c, frames);
+    }
+    return frames > 0 ? sqrt(total/frames) : 0;
+}
+
+double LoudnessMeter::power(size_t channel) const {
+    double frames;
+    const double squares = windowSquares(channel, frames);
+    return frames > 0 ? sqrt(squares*mChannels/frames) : 0;
+}
+
+double LoudnessMeter::lufs(double power) {
+    return LUFS_OFFSET + 20*log10(std::max(power, 1e-10));
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "Buffer.h"
+
+#include <vector>
+
+/*! @brief Streaming K-weighted loudness, per ITU-R BS.1770
+ *
+ *  The audio goes through the K-weighting filter (a high shelf for the
+ *  head, and a high pass for what's too low to hear as loud), and the
+ *  squares get summed into 100ms blocks. The meter keeps a running total
+ *  over the last so many blocks (4 for momentary loudness, 30 for short
+ *  term), adding each block as it completes and taking away the one that
+ *  drops out, so nothing ever gets summed over the whole window again. In
+ *  between blocks, the one in progress fades in as the oldest one fades
+ *  out, so readings move smoothly from cycle to cycle.
+ *
+ *  Blocks quieter than the gate don't count, so that pauses don't drag the
+ *  reading down. BS.1770's relative gate only makes sense for integrated
+ *  loudness over a whole programme, so there's just the absolute one.
+ *
+ *  Readings come out as the RMS level of the weighted signal, scaled the
+ *  same way as Buffer::power(), so they can stand in for it anywhere.
+ */
+class LoudnessMeter {
+public:
+    //! Length of a block, in seconds
+    static constexpr double BLOCK = 0.1;
+    //! The longest window, in blocks
+    static constexpr size_t MAX_BLOCKS = 30;
+
+    LoudnessMeter(unsigned int sampleRate, size_t channels);
+
+    /*! @brief Set what gets measured
+     *
+     *  @param blocks How many blocks to measure over; 4 is momentary
+     *      loudness, and 30 is short term
+     *  @param gate Blocks quieter than this, in LUFS, don't count
+     */
+    void configure(size_t blocks, double gate);
+
+    //! Forget everything measured so far
+    void reset();
+
+    //! Measure some more audio
+    void push(const Buffer& buf, size_t n);
+
+    //! The level over the window, over all channels
+    double power() const;
+
+    //! The level over the window of a single channel
+    double power(size_t channel) const;
+
+    //! Convert a level to loudness, in LUFS
+    static double lufs(double power);
+
+private:
+    size_t mChannels;
+    size_t mBlockFrames;
+
+    //! K-weighting coefficients (normalized so that a0 = 1) and per-channel state
+    double mShelfB[3], mShelfA[3], mPassB[3], mPassA[3];
+    std::vector<double> mState;
+
+    //! The last MAX_BLOCKS blocks' summed squares, per channel, and whether each got past the gate
+    std::vector<double> mBlocks;
+    std::vector<bool> mPassed;
+    //! Where the next block goes, and how many there have been (up to MAX_BLOCKS)
+    size_t mHead, mFilled;
+
+    size_t mWindow;
+    //! The gate, as a mean square over all channels
+    double mGate;
+
+    //! Summed squares of the gated blocks in the window, per channel, and how many there are
+    std::vector<double> mSum;
+    size_t mCount;
+
+    //! The block in progress
+    std::vector<double> mPartial;
+    size_t mPartialFrames;
+
+    //! Whether a block with these summed squares over this many frames gets past the gate
+    bool passes(const double *squares, size_t frames) const;
+
+    //! Finish the block in progress
+    void completeBlock();
+
+    //! Work out the window's summed squares and frame count for one channel
+    double windowSquares(size_t channel, double& frames) const;
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+
+/*! @brief Lock-free single-slot mailbox (triple buffer)
+ *
+ *  One producer posts whole values; one consumer picks up the most recent
+ *  one whenever it likes. Neither side ever blocks, and the consumer never
+ *  copies; intermediate values that the consumer never got around to
+ *  fetching are simply dropped.
+ */
+template<typename T>
+class Mailbox {
+public:
+    Mailbox(const T& initial): mFront(0), mMiddle(1), mBack(2) {
+        for (auto& s : mSlots) {
+            s = initial;
+        }
+    }
+
+    //! Post a new value (producer only)
+    void post(const T& value) {
+        mSlots[mBack] = value;
+        mBack = mMiddle.exchange(mBack | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    /*! @brief Switch to the most recently posted value (consumer only)
+     *  @returns whether there was a new value
+     */
+    bool fetch() {
+        if (!(mMiddle.load(std::memory_order_relaxed) & FRESH)) {
+            return false;
+        }
+        mFront = mMiddle.exchange(mFront, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+    //! The value most recently fetched (consumer only)
+    const T& current() const { return mSlots[mFront]; }
+
+private:
+    enum {
+        INDEX = 3,
+        FRESH = 4
+    };
+
+    T mSlots[3];
+    int mFront;
+    std::atomic<int> mMiddle;
+    int mBack;
+};
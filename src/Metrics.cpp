@@ -0,0 +1,116 @@
+#include "Metrics.h"
+#include "SeqLock.h"
+
+#include <boost/throw_exception.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+Metrics::Snapshot::Snapshot() {
+    memset(this, 0, sizeof(*this));
+}
+
+Metrics::Metrics(const std::string& name, bool writer):
+    mName(name),
+    mWriter(writer),
+    mSegment(NULL)
+{
+    static_assert(sizeof(Snapshot) % sizeof(uint64_t) == 0, "Snapshot must be all 8-byte fields");
+
+    int fd = shm_open(name.c_str(), writer ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+    if (fd < 0) {
+        BOOST_THROW_EXCEPTION(std::runtime_error("Couldn't open metrics segment " + name
+                                                 + ": " + strerror(errno)));
+    }
+    if (writer && ftruncate(fd, sizeof(Segment)) < 0) {
+        int err = errno;
+        close(fd);
+        BOOST_THROW_EXCEPTION(std::runtime_error("Couldn't size metrics segment " + name
+                                                 + ": " + strerror(err)));
+    }
+
+    void *addr = mmap(NULL, sizeof(Segment), writer ? (PROT_READ | PROT_WRITE) : PROT_READ,
+                      MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        BOOST_THROW_EXCEPTION(std::runtime_error("Couldn't map metrics segment " + name
+                                                 + ": " + strerror(errno)));
+    }
+    mSegment = static_cast<Segment *>(addr);
+
+    if (writer) {
+        mSegment->sequence.store(0, std::memory_order_relaxed);
+        mSegment->version = VERSION;
+        mSegment->magic = MAGIC;
+    } else if (mSegment->magic != MAGIC || mSegment->version != VERSION) {
+        munmap(mSegment, sizeof(Segment));
+        BOOST_THROW_EXCEPTION(std::runtime_error("Metrics segment " + name
+                                                 + " has an unknown layout"));
+    }
+}
+
+Metrics::~Metrics() {
+    munmap(mSegment, sizeof(Segment));
+    if (mWriter) {
+        shm_unlink(mName.c_str());
+    }
+}
+
+void Metrics::publish(const Snapshot& snap) {
+    SeqLock::write(mSegment->sequence, [&]() {
+        SeqLock::storeWords(mSegment->words, &snap, sizeof(snap));
+    });
+}
+
+bool Metrics::read(Snapshot& snap) const {
+    return SeqLock::read(mSegment->sequence, [&]() {
+        SeqLock::loadWords(&snap, mSegment->words, sizeof(snap));
+    }) != 0;
+}
+
+std::string Metrics::prometheus(const Snapshot& s) {
+    std::ostringstream out;
+    auto metric = [&out](const char *name, const char *type, const char *help, double value) {
+        out << "# HELP whatwesaidwillbe_" << name << ' ' << help << '\n'
+            << "# TYPE whatwesaidwillbe_" << name << ' ' << type << '\n'
+            << "whatwesaidwillbe_" << name << ' ' << value << '\n';
+    };
+
+    metric("uptime_seconds", "gauge", "Time since the engine started", s.uptime);
+    metric("state", "gauge", "Engine state", s.state);
+    metric("mode", "gauge", "Volume model", s.mode);
+    metric("recorded_power", "gauge", "Recorded power level", s.recordedPower);
+    metric("expected_power", "gauge", "Expected power level", s.expectedPower);
+    metric("limit_power", "gauge", "Limiter level", s.limitPower);
+    metric("target_gain", "gauge", "Gain requested by the volume model", s.targetGain);
+    metric("actual_gain", "gauge", "Gain after limiting and damping", s.actualGain);
+    metric("cycles_total", "counter", "Processing cycles", s.cycles);
+    metric("frames_total", "counter", "Frames processed", s.frames);
+    metric("capture_xruns_total", "counter", "Capture overruns", s.captureXruns);
+    metric("playback_xruns_total", "counter", "Playback underruns", s.playbackXruns);
+    metric("capture_lost_frames_total", "counter", "Frames lost to capture overruns", s.captureLost);
+    metric("playback_lost_frames_total", "counter", "Frames lost to playback underruns", s.playbackLost);
+    metric("cycle_seconds", "gauge", "Processing time of the last cycle", s.cycleTime);
+    metric("cycle_seconds_max", "gauge", "Longest processing time of a cycle", s.cycleTimeMax);
+    metric("period_seconds", "gauge", "Length of a buffer period", s.period);
+    metric("latency_frames", "gauge", "Round-trip latency estimate", s.latency);
+    metric("latency_confidence", "gauge", "Confidence of the latency estimate", s.latencyConfidence);
+    metric("clock_drift_ppm", "gauge", "Capture clock drift relative to playback", s.clockDrift);
+    metric("control_latency_seconds", "gauge", "Knob change delivery time", s.controlLatency);
+    metric("idle", "gauge", "Whether the optional processing is stopped for a silent room", s.idle);
+    metric("active_seconds_total", "counter", "Time spent with full processing", s.activeSeconds);
+    metric("active_cpu_seconds_total", "counter", "Process CPU time used with full processing",
+           s.activeCpuSeconds);
+    metric("idle_seconds_total", "counter", "Time spent idle", s.idleSeconds);
+    metric("idle_cpu_seconds_total", "counter", "Process CPU time used while idle", s.idleCpuSeconds);
+    metric("dsp_load_percent", "gauge", "The audio server's estimate of how busy it is (JACK only)",
+           s.dspLoad);
+
+    return out.str();
+}
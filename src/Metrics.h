@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/*! @brief Live engine metrics published through POSIX shared memory
+ *
+ *  The engine writes a snapshot once per cycle; any number of readers in
+ *  other processes can pick it up without the writer ever waiting on them.
+ *  The segment is a seqlock: the writer bumps a sequence number to odd,
+ *  stores the fields, and bumps it back to even; readers retry if the
+ *  number changed (or was odd) while they were copying.
+ */
+class Metrics {
+public:
+    //! One consistent set of metrics; every field is 8 bytes
+    struct Snapshot {
+        //! Seconds since the engine started
+        double uptime;
+        //! Repeater::State
+        uint64_t state;
+        //! Repeater::Mode
+        uint64_t mode;
+
+        double recordedPower;
+        double expectedPower;
+        double limitPower;
+        double targetGain;
+        double actualGain;
+
+        //! Cycles processed
+        uint64_t cycles;
+        //! Frames processed
+        uint64_t frames;
+        uint64_t captureXruns;
+        uint64_t playbackXruns;
+        //! Frames lost to xruns (and made up for by moving the heads)
+        uint64_t captureLost;
+        uint64_t playbackLost;
+
+        //! Processing time of the last cycle, in seconds
+        double cycleTime;
+        //! Longest processing time seen, in seconds
+        double cycleTimeMax;
+        //! Length of one buffer period, in seconds
+        double period;
+
+        //! Round-trip latency estimate, in frames
+        double latency;
+        double latencyConfidence;
+        //! Clock drift, in parts per million
+        double clockDrift;
+        double controlLatency;
+
+        //! Whether the optional processing is stopped for a silent room
+        uint64_t idle;
+        //! Time spent active and idle, and the process CPU time used in each, in seconds
+        double activeSeconds, activeCpuSeconds;
+        double idleSeconds, idleCpuSeconds;
+
+        //! The audio server's own estimate of how busy it is, in percent (JACK only)
+        double dspLoad;
+
+        Snapshot();
+    };
+
+    /*! @brief Open a metrics segment
+     *
+     *  @param name The POSIX shared memory name (e.g. "/whatwesaidwillbe")
+     *  @param writer Whether we're the (only) writer; the writer creates the
+     *  segment, and removes it when done
+     */
+    Metrics(const std::string& name, bool writer);
+    ~Metrics();
+
+    //! Publish a snapshot (writer only); never blocks
+    void publish(const Snapshot&);
+
+    /*! @brief Read the latest snapshot (reader only)
+     *  @returns false if the writer hasn't published anything yet, or is
+     *  stuck partway through publishing
+     */
+    bool read(Snapshot&) const;
+
+    //! Write the snapshot in Prometheus text exposition format
+    static std::string prometheus(const Snapshot&);
+
+private:
+    enum {
+        MAGIC = 0x77777362,
+        VERSION = 4,
+        WORDS = sizeof(Snapshot)/sizeof(uint64_t)
+    };
+
+    struct Segment {
+        uint32_t magic;
+        uint32_t version;
+        std::atomic<uint64_t> sequence;
+        std::atomic<uint64_t> words[WORDS];
+    };
+
+    std::string mName;
+    bool mWriter;
+    Segment *mSegment;
+};
@@ -0,0 +1,160 @@
+#include "Offscreen.h"
+
+#include <GL/glew.h>
+
+#ifdef HAVE_EGL
+#include <EGL/egl.h>
+#endif
+
+#include <boost/throw_exception.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef HAVE_EGL
+Offscreen::Offscreen(int width, int height):
+    mWidth(width),
+    mHeight(height),
+    mPixels(width*height*4)
+{
+    EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+        BOOST_THROW_EXCEPTION(std::runtime_error("Couldn't initialize EGL"));
+    }
+    mDisplay = display;
+
+    const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_ALPHA_SIZE, 8,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint numConfigs;
+    if (!eglChooseConfig(display, configAttribs, &config, 1, &numConfigs) || numConfigs < 1) {
+        BOOST_THROW_EXCEPTION(std::runtime_error("No suitable EGL config"));
+    }
+
+    const EGLint surfaceAttribs[] = {
+        EGL_WIDTH, width,
+        EGL_HEIGHT, height,
+        EGL_NONE
+    };
+    mSurface = eglCreatePbufferSurface(display, config, surfaceAttribs);
+    if (mSurface == EGL_NO_SURFACE) {
+        BOOST_THROW_EXCEPTION(std::runtime_error("Couldn't create EGL pbuffer"));
+    }
+
+    // the visualizer uses the compatibility profile, so it has to be desktop GL
+    eglBindAPI(EGL_OPENGL_API);
+    mContext = eglCreateContext(display, config, EGL_NO_CONTEXT, NULL);
+    if (mContext == EGL_NO_CONTEXT) {
+        BOOST_THROW_EXCEPTION(std::runtime_error("Couldn't create EGL context"));
+    }
+    if (!eglMakeCurrent(display, mSurface, mSurface, mContext)) {
+        BOOST_THROW_EXCEPTION(std::runtime_error("Couldn't make EGL context current"));
+    }
+}
+
+Offscreen::~Offscreen() {
+    eglMakeCurrent(mDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(mDisplay, mContext);
+    eglDestroySurface(mDisplay, mSurface);
+    eglTerminate(mDisplay);
+}
+#else
+Offscreen::Offscreen(int, int) {
+    BOOST_THROW_EXCEPTION(std::runtime_error("Built without EGL; offscreen rendering isn't available"));
+}
+
+Offscreen::~Offscreen() {
+}
+#endif
+
+void Offscreen::finish() {
+    glFinish();
+}
+
+namespace {
+uint32_t crc32(const uint8_t *data, size_t n, uint32_t crc = 0) {
+    crc = ~crc;
+    for (size_t i = 0; i < n; i++) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++) {
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+void put32(std::vector<uint8_t>& out, uint32_t v) {
+    out.push_back(v >> 24);
+    out.push_back(v >> 16);
+    out.push_back(v >> 8);
+    out.push_back(v);
+}
+
+void chunk(std::ostream& out, const char *type, const std::vector<uint8_t>& data) {
+    std::vector<uint8_t> buf;
+    put32(buf, data.size());
+    buf.insert(buf.end(), type, type + 4);
+    buf.insert(buf.end(), data.begin(), data.end());
+    put32(buf, crc32(&buf[4], buf.size() - 4));
+    out.write(reinterpret_cast<const char *>(&buf[0]), buf.size());
+}
+}
+
+void Offscreen::savePNG(const std::string& path) {
+    glReadPixels(0, 0, mWidth, mHeight, GL_RGBA, GL_UNSIGNED_BYTE, &mPixels[0]);
+
+    // scanlines top to bottom, each with a "no filter" byte in front
+    const size_t stride = mWidth*4;
+    std::vector<uint8_t> raw;
+    raw.reserve((stride + 1)*mHeight);
+    for (int y = mHeight - 1; y >= 0; y--) {
+        raw.push_back(0);
+        raw.insert(raw.end(), &mPixels[y*stride], &mPixels[y*stride] + stride);
+    }
+
+    // zlib stream of stored (uncompressed) deflate blocks; bigger files, no dependencies
+    std::vector<uint8_t> z = { 0x78, 0x01 };
+    uint32_t a = 1, b = 0;
+    for (size_t pos = 0; pos < raw.size(); ) {
+        const size_t n = std::min<size_t>(65535, raw.size() - pos);
+        z.push_back(pos + n == raw.size());
+        z.push_back(n & 0xff);
+        z.push_back(n >> 8);
+        z.push_back(~n & 0xff);
+        z.push_back((~n >> 8) & 0xff);
+        z.insert(z.end(), &raw[pos], &raw[pos] + n);
+        for (size_t i = 0; i < n; i++) {
+            a = (a + raw[pos + i]) % 65521;
+            b = (b + a) % 65521;
+        }
+        pos += n;
+    }
+    put32(z, (b << 16) | a);
+
+    std::vector<uint8_t> header;
+    put32(header, mWidth);
+    put32(header, mHeight);
+    header.push_back(8); // bit depth
+    header.push_back(6); // RGBA
+    header.push_back(0);
+    header.push_back(0);
+    header.push_back(0);
+
+    std::ofstream out(path, std::ios::binary);
+    static const char signature[] = "\x89PNG\r\n\x1a\n";
+    out.write(signature, 8);
+    chunk(out, "IHDR", header);
+    chunk(out, "IDAT", z);
+    chunk(out, "IEND", std::vector<uint8_t>());
+    if (!out) {
+        BOOST_THROW_EXCEPTION(std::runtime_error("Couldn't write " + path));
+    }
+}
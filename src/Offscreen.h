@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*! @brief An offscreen OpenGL context, for rendering without a display
+ *
+ *  Uses an EGL pbuffer, so it works with Mesa's software renderer on
+ *  machines with no GPU or X server (set EGL_PLATFORM=surfaceless if the
+ *  default platform can't find a display).
+ */
+class Offscreen {
+public:
+    //! Create the context and make it current
+    Offscreen(int width, int height);
+    ~Offscreen();
+
+    int width() const { return mWidth; }
+    int height() const { return mHeight; }
+
+    //! Wait for all rendering to finish
+    void finish();
+
+    //! Save what's been rendered as a PNG file
+    void savePNG(const std::string& path);
+
+private:
+    int mWidth, mHeight;
+    void *mDisplay, *mContext, *mSurface;
+    std::vector<uint8_t> mPixels;
+};
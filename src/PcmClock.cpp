@@ -0,0 +1,50 @@
+#include "AudioDevice.h"
+#include "PcmClock.h"
+
+#include <algorithm>
+#include <cmath>
+
+PcmClock::PcmClock(AudioDevice& device, bool capture, unsigned int sampleRate):
+    mDevice(device),
+    mCapture(capture),
+    mSampleRate(sampleRate),
+    mBufferSize(0),
+    mPeriodSize(0),
+    mTimestamped(false)
+{
+    enable();
+}
+
+void PcmClock::enable() {
+    if (!mDevice.params(mBufferSize, mPeriodSize)) {
+        mBufferSize = mPeriodSize = 0;
+    }
+
+    // the playback delay comes from the free space, so it needs the buffer size
+    mTimestamped = mBufferSize > 0 && mDevice.enableTimestamps();
+}
+
+bool PcmClock::read(long& delay, double& time) const {
+    long avail;
+    if (mTimestamped && mDevice.timestamp(avail, time)) {
+        delay = mCapture ? avail : mBufferSize - avail;
+        return true;
+    }
+
+    if (!mDevice.delay(delay)) {
+        return false;
+    }
+    time = mDevice.now();
+    return true;
+}
+
+long PcmClock::delayAt(double time) const {
+    long delay;
+    double then;
+    if (!read(delay, then)) {
+        return 0;
+    }
+    // capture fills up as time goes on, and playback drains, until it runs dry
+    const long moved = lround((time - then)*mSampleRate);
+    return mCapture ? delay + moved : std::max(0L, delay - moved);
+}
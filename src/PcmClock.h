@@ -0,0 +1,51 @@
+#pragma once
+
+class AudioDevice;
+
+/*! @brief Reads how much a device has queued, and when that was so
+ *
+ *  snd_pcm_delay() only moves when the hardware pointer does, which on a lot
+ *  of devices is once a period, so reading it "now" is out by anything up to
+ *  a period. snd_pcm_htimestamp() instead says when the pointer last moved,
+ *  on the same monotonic clock as everything else, so the reading can be
+ *  brought forward to whatever moment it's wanted for. Devices that don't
+ *  timestamp fall back to snd_pcm_delay(), as of when it was asked.
+ */
+class PcmClock {
+public:
+    /*! @param device The device
+     *  @param capture Whether it's a capture device (otherwise playback)
+     *  @param sampleRate The sample rate
+     */
+    PcmClock(AudioDevice& device, bool capture, unsigned int sampleRate);
+
+    //! Turn timestamping on; the device forgets it whenever it's reconfigured
+    void enable();
+
+    /*! @brief Read the delay
+     *
+     *  @param delay Set to the frames queued in the device
+     *  @param time Set to when that was so, in seconds on the device's clock
+     *  @returns false if the device couldn't say
+     */
+    bool read(long& delay, double& time) const;
+
+    //! The delay, brought forward to a given time; 0 if the device couldn't say
+    long delayAt(double time) const;
+
+    //! Whether readings come from the hardware timestamp
+    bool timestamped() const { return mTimestamped; }
+
+    //! How far off a reading can be when they don't, in frames
+    long granularity() const { return mTimestamped ? 0 : mPeriodSize; }
+
+private:
+    AudioDevice& mDevice;
+    bool mCapture;
+    unsigned int mSampleRate;
+
+    //! From the current hardware parameters; 0 if they couldn't be had
+    long mBufferSize, mPeriodSize;
+    //! Whether timestamping was turned on
+    bool mTimestamped;
+};
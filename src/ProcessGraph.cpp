@@ -0,0 +1,138 @@
+#include "Buffer.h"
+#include "ProcessGraph.h"
+
+#include <boost/throw_exception.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+#include <time.h>
+
+namespace {
+uint64_t getTimeNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*UINT64_C(1000000000) + ts.tv_nsec;
+}
+}
+
+ProcessGraph::ProcessGraph(size_t frames, size_t channels):
+    mFrames(frames),
+    mChannels(channels),
+    mIdle(false)
+{}
+
+ProcessGraph::~ProcessGraph() {}
+
+void ProcessGraph::add(const std::string& name, const Work& work,
+                       const std::vector<std::string>& after, bool optional) {
+    if (!mSchedule.empty()) {
+        BOOST_THROW_EXCEPTION(std::runtime_error("Can't add " + name + " to a graph that's already built"));
+    }
+    for (const auto& node : mNodes) {
+        if (node->name == name) {
+            BOOST_THROW_EXCEPTION(std::runtime_error("Duplicate stage " + name));
+        }
+    }
+
+    std::unique_ptr<Node> node(new Node);
+    node->name = name;
+    node->work = work;
+    node->after = after;
+    node->optional = optional;
+    mNodes.push_back(std::move(node));
+}
+
+Buffer& ProcessGraph::buffer(const std::string& name) {
+    std::unique_ptr<Buffer>& buf = mBuffers[name];
+    if (!buf) {
+        if (!mSchedule.empty()) {
+            BOOST_THROW_EXCEPTION(std::runtime_error("Can't allocate a buffer for " + name
+                                                     + " once the graph is built"));
+        }
+        buf.reset(new Buffer(NULL, mFrames, mChannels));
+    }
+    return *buf;
+}
+
+void ProcessGraph::build() {
+    for (const auto& buf : mBuffers) {
+        if (std::none_of(mNodes.begin(), mNodes.end(),
+                         [&](const std::unique_ptr<Node>& n) { return n->name == buf.first; })) {
+            BOOST_THROW_EXCEPTION(std::runtime_error("Buffer for unknown stage " + buf.first));
+        }
+    }
+
+    // take the first stage that's ready, over and over; there are only a
+    // handful of them, and this only happens once
+    std::vector<Node *> schedule;
+    std::vector<bool> done(mNodes.size());
+    while (schedule.size() < mNodes.size()) {
+        bool progress = false;
+        for (size_t i = 0; i < mNodes.size() && !progress; i++) {
+            if (done[i]) {
+                continue;
+            }
+            bool ready = true;
+            for (const std::string& dep : mNodes[i]->after) {
+                bool known = false, ran = false;
+                for (size_t j = 0; j < mNodes.size(); j++) {
+                    if (mNodes[j]->name == dep) {
+                        known = true;
+                        ran = done[j];
+                    }
+                }
+                if (!known) {
+                    BOOST_THROW_EXCEPTION(std::runtime_error(
+                            mNodes[i]->name + " comes after unknown stage " + dep));
+                }
+                ready = ready && ran;
+            }
+            if (ready) {
+                done[i] = true;
+                schedule.push_back(mNodes[i].get());
+                progress = true;
+            }
+        }
+        if (!progress) {
+            BOOST_THROW_EXCEPTION(std::runtime_error("Processing stages depend on each other in a circle"));
+        }
+    }
+    mSchedule.swap(schedule);
+}
+
+void ProcessGraph::run() {
+    // there's only ever the one writer, so nothing here has to be atomic
+    // other than the stores themselves
+    uint64_t start = getTimeNs();
+    for (Node *node : mSchedule) {
+        // a stage can change whether it's idle, and the ones after it go by that
+        if (mIdle && node->optional) {
+            continue;
+        }
+        node->work();
+
+        const uint64_t end = getTimeNs(), elapsed = end - start;
+        node->runs.store(node->runs.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        node->total.store(node->total.load(std::memory_order_relaxed) + elapsed,
+                          std::memory_order_relaxed);
+        node->last.store(elapsed, std::memory_order_relaxed);
+        if (elapsed > node->max.load(std::memory_order_relaxed)) {
+            node->max.store(elapsed, std::memory_order_relaxed);
+        }
+        start = end;
+    }
+}
+
+std::vector<ProcessGraph::Timing> ProcessGraph::timings() const {
+    std::vector<Timing> out;
+    for (const Node *node : mSchedule) {
+        Timing t;
+        t.name = node->name;
+        t.runs = node->runs.load(std::memory_order_relaxed);
+        t.total = node->total.load(std::memory_order_relaxed)*1e-9;
+        t.last = node->last.load(std::memory_order_relaxed)*1e-9;
+        t.max = node->max.load(std::memory_order_relaxed)*1e-9;
+        out.push_back(t);
+    }
+    return out;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Buffer;
+
+/*! @brief The per-cycle processing, as a graph of stages
+ *
+ *  Each stage is a node with a name, the work it does, and the names of
+ *  the stages that have to run before it. build() works out the order once,
+ *  up front; after that, run() just goes down the list, so a cycle never
+ *  allocates, locks or looks anything up. Stages that need somewhere to put
+ *  their output ask for a buffer of their own before the graph is built.
+ *  Other than that, the graph only sees to the order; the stages pass their
+ *  results on through whatever state their owner gives them.
+ *
+ *  Every stage times itself, and the timings can be read from any thread.
+ *
+ *  Stages that nothing audible depends on can be marked optional, and then
+ *  they get skipped for as long as the graph is set to idle.
+ */
+class ProcessGraph {
+public:
+    //! What a stage does each cycle; set once up front
+    typedef std::function<void()> Work;
+
+    //! How long a stage has been taking
+    struct Timing {
+        std::string name;
+        //! How many times it's run
+        uint64_t runs;
+        //! Total, most recent and longest run times, in seconds
+        double total, last, max;
+    };
+
+    /*! @param frames How many frames the stages' buffers hold
+     *  @param channels How many channels they have
+     */
+    ProcessGraph(size_t frames, size_t channels);
+    ~ProcessGraph();
+
+    /*! @brief Add a stage
+     *
+     *  @param name What to call it
+     *  @param work What it does
+     *  @param after The stages it has to come after
+     *  @param optional Whether it can be skipped while idle
+     */
+    void add(const std::string& name, const Work& work,
+             const std::vector<std::string>& after = std::vector<std::string>(),
+             bool optional = false);
+
+    //! The buffer that belongs to a stage, allocated the first time it's asked for (only before build())
+    Buffer& buffer(const std::string& name);
+
+    /*! @brief Put the stages in order
+     *
+     *  Stages run in the order they were added, other than where that would
+     *  put one ahead of something it has to come after. Throws if a stage
+     *  is missing or they can't be put in order.
+     */
+    void build();
+
+    //! Run every stage once, other than optional ones while idle (audio thread only)
+    void run();
+
+    //! Skip the optional stages from now on, or stop skipping them (audio thread only)
+    void setIdle(bool idle) { mIdle = idle; }
+
+    //! The stages, in the order they run, and how long each has been taking
+    std::vector<Timing> timings() const;
+
+private:
+    size_t mFrames, mChannels;
+
+    struct Node {
+        std::string name;
+        Work work;
+        std::vector<std::string> after;
+        bool optional;
+        //! Run count and times, in nanoseconds
+        std::atomic<uint64_t> runs, total, last, max;
+        Node(): optional(false), runs(0), total(0), last(0), max(0) {}
+    };
+    std::vector<std::unique_ptr<Node>> mNodes;
+    std::map<std::string, std::unique_ptr<Buffer>> mBuffers;
+
+    //! The nodes in the order they run; empty until build()
+    std::vector<Node *> mSchedule;
+    bool mIdle;
+};
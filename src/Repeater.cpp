@@ -1,25 +1,220 @@
+#include "ActivityDetector.h"
+#include "AudioDevice.h"
+#include "AutoTuner.h"
 #include "Buffer.h"
+#include "CalibrationCache.h"
 #include "Calibrator.h"
+#include "DriftEstimator.h"
 #include "Drum.h"
+#include "GainModel.h"
+#include "JackClient.h"
+#include "LatencyTracker.h"
+#include "Limiter.h"
+#include "LoudnessMeter.h"
+#include "Metrics.h"
+#include "PcmClock.h"
+#include "ProcessGraph.h"
 #include "Repeater.h"
+#include "Resampler.h"
+#include "Spectrogram.h"
+#include "Stretcher.h"
+#include "Trace.h"
+#include "WaveOverview.h"
+#include "WorkerPool.h"
+#include "XrunClock.h"
 
 #include <boost/throw_exception.hpp>
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
 #include <fstream>
 #include <iostream>
+#include <poll.h>
+#include <thread>
+#include <time.h>
+
+namespace {
+double getTime() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+//! How long a loop delay change takes to crossfade, in seconds
+const double DELAY_CROSSFADE = 0.1;
+
+//! How long EQ changes take to glide into place, in seconds
+const double EQ_RAMP = 0.02;
+
+//! The furthest ahead the stretched audio gets rendered for the volume models, in seconds
+const double STRETCH_LOOKAHEAD = 1;
+//! How much more stretched audio to keep around, for the latency to grow into, in seconds
+const double STRETCH_SLACK = 1;
+
+//! Gain and clipping statistics over a stretch of a simulation
+struct SoakStats {
+    size_t channels;
+    size_t cycles;
+    std::vector<double> minGain, maxGain, totalGain;
+    //! Cycles where the recorded level went over the limit
+    size_t runaway;
+    //! Cycles where the gain dropped to next to nothing
+    size_t collapsed;
+    uint64_t clippedIn, clippedOut;
+
+    SoakStats(size_t channels): channels(channels) {
+        reset();
+    }
+
+    void reset() {
+        cycles = runaway = collapsed = 0;
+        minGain.assign(channels, 1e9);
+        maxGain.assign(channels, 0);
+        totalGain.assign(channels, 0);
+        clippedIn = clippedOut = 0;
+    }
+
+    void add(const Repeater::History::DataPoint& fs, const Buffer& played, size_t frames) {
+        ++cycles;
+        bool dead = true;
+        for (size_t c = 0; c < channels; c++) {
+            const double gain = fs.channel[c].actualGain;
+            minGain[c] = std::min(minGain[c], gain);
+            maxGain[c] = std::max(maxGain[c], gain);
+            totalGain[c] += gain;
+            dead = dead && gain < 0.05;
+        }
+        runaway += fs.recordedPower > fs.limitPower;
+        collapsed += dead;
+        for (auto iter = played.begin(); iter != played.at(frames); ++iter) {
+            clippedOut += *iter >= 32767 || *iter <= -32768;
+        }
+    }
+
+    void print(std::ostream& out, const std::string& label) const {
+        out << label << ": gain";
+        for (size_t c = 0; c < channels; c++) {
+            out << ' ' << minGain[c] << '/' << totalGain[c]/std::max<size_t>(cycles, 1)
+                << '/' << maxGain[c];
+        }
+        out << " (min/mean/max), runaway " << runaway*100.0/std::max<size_t>(cycles, 1)
+            << "%, collapsed " << collapsed*100.0/std::max<size_t>(cycles, 1)
+            << "%, clipped " << clippedIn << " in, " << clippedOut << " out" << std::endl;
+    }
+};
+
+void reportLost(unsigned int sampleRate, const char *which, int lost, int64_t total) {
+    if (lost) {
+        std::cerr << which << " xrun lost " << lost << " frames ("
+                  << lost*1e3/sampleRate << "ms); " << total << " frames ("
+                  << total*1.0/sampleRate << "sec) in total" << std::endl;
+    }
+}
+
+std::string formatDuration(double seconds) {
+    const long s = lround(seconds);
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%ld:%02ld:%02ld", s/3600, s/60 % 60, s % 60);
+    return buf;
+}
+}
+
+constexpr size_t Repeater::History::MAX_CHANNELS;
 
 Repeater::Repeater(const Options& opts, const Knobs& knobs):
     mOptions(opts),
     mKnobs(knobs),
-    mKnobsNext(knobs),
-    mKnobsCurrent(false),
-    mState(S_STARTUP)
+    mKnobsMailbox(KnobsUpdate{knobs, 0}),
+    mControlLatency(0),
+    mState(S_STARTUP),
+    mWorkerPool(nullptr),
+    mMeterSource(P_RMS),
+    mStretchPos(0),
+    mActivity(new ActivityDetector),
+    mRoom(NULL)
 {
+    if (mOptions.spectrogram) {
+        // one trip around the drum per trip around the screen
+        const size_t rows = 1024;
+        mSpectrogram.reset(new Spectrogram(mOptions.sampleRate, mOptions.bufSize*2,
+                                           drumFrames()/rows, rows));
+    }
+    mOverview.reset(new WaveOverview(drumFrames(), History::MAX_CHANNELS));
+
+    if (mKnobs.loopDelay <= 0) {
+        mKnobs.loopDelay = mOptions.loopDelay;
+    }
+}
+
+Repeater::~Repeater() {
+}
+
+size_t Repeater::drumFrames() const {
+    const size_t loopOffset = mOptions.sampleRate*maxLoopDelay();
+    return std::max(mOptions.bufSize*4, loopOffset*2);
+}
+
+double Repeater::maxLoopDelay() const {
+    return std::max(mOptions.loopDelay, mOptions.maxLoopDelay);
+}
+
+namespace {
+const char *modeNames[Repeater::M_COUNT] = {
+    "gain",
+    "target",
+    "feedback",
+    "peak",
+    "compressor"
+};
+}
+
+const char *Repeater::modeName(Mode mode) {
+    return mode < M_COUNT ? modeNames[mode] : "unknown";
+}
+
+bool Repeater::parseMode(const std::string& name, Mode& mode) {
+    for (size_t m = 0; m < M_COUNT; m++) {
+        if (name == modeNames[m]) {
+            mode = static_cast<Mode>(m);
+            return true;
+        }
+    }
+    return false;
+}
+
+namespace {
+const char *powerSourceNames[Repeater::P_COUNT] = {
+    "rms",
+    "momentary",
+    "shortterm"
+};
+}
+
+const char *Repeater::powerSourceName(PowerSource source) {
+    return source < P_COUNT ? powerSourceNames[source] : "unknown";
+}
+
+bool Repeater::parsePowerSource(const std::string& name, PowerSource& source) {
+    for (size_t p = 0; p < P_COUNT; p++) {
+        if (name == powerSourceNames[p]) {
+            source = static_cast<PowerSource>(p);
+            return true;
+        }
+    }
+    return false;
 }
 
 Repeater::History::History():
     playPos(0),
-    recordPos(0)
+    recordPos(0),
+    clockDrift(0),
+    latency(0),
+    latencyConfidence(0),
+    controlLatency(0),
+    channels(0),
+    idle(false)
 {}
 
 Repeater::History::DataPoint::DataPoint():
@@ -30,6 +225,13 @@ Repeater::History::DataPoint::DataPoint():
     actualGain(0)
 {}
 
+Repeater::History::DataPoint::Channel::Channel():
+    recordedPower(0),
+    expectedPower(0),
+    targetGain(0),
+    actualGain(0)
+{}
+
 Repeater::State Repeater::getState() const {
     return mState;
 }    
@@ -43,254 +245,1647 @@ void Repeater::shutdown() {
     }
 }
 
+Repeater::Knobs Repeater::getKnobs() const {
+    std::lock_guard<std::mutex> lock(mKnobsMutex);
+    return mKnobs;
+}
+
 void Repeater::setKnobs(const Knobs& k) {
-    mKnobsNext = k;
-    mKnobsCurrent.clear();
+    std::lock_guard<std::mutex> lock(mKnobsMutex);
+    mKnobs = k;
+    postKnobs();
+}
+
+void Repeater::changeKnobs(const std::function<void(Knobs&)>& change) {
+    std::lock_guard<std::mutex> lock(mKnobsMutex);
+    change(mKnobs);
+    postKnobs();
+}
+
+void Repeater::postKnobs() {
+    // the drum only has room for so much
+    if (mKnobs.loopDelay <= 0) {
+        mKnobs.loopDelay = mOptions.loopDelay;
+    }
+    mKnobs.loopDelay = std::min(mKnobs.loopDelay, maxLoopDelay());
+
+    // the mutex keeps this single-producer as far as the mailbox is concerned
+    mKnobsMailbox.post(KnobsUpdate{mKnobs, getTime()});
+}
+
+bool Repeater::receiveKnobs() {
+    if (!mKnobsMailbox.fetch()) {
+        return false;
+    }
+    mControlLatency = getTime() - mKnobsMailbox.current().sent;
+    configureGainModel();
+    configureMeters();
+    if (mEqualizer) {
+        const Knobs& k = activeKnobs();
+        mEqualizer->configure(&k.eq[0], k.eq.size());
+    }
+    if (mStretcher) {
+        const Knobs& k = activeKnobs();
+        mStretcher->configure(k.speed, k.pitch, k.stretchRange);
+    }
+    mActivity->configure(activeKnobs().idleLevel, activeKnobs().idleAfter);
+    return true;
 }
 
+void Repeater::configureGainModel() {
+    const Knobs& k = activeKnobs();
+    for (size_t c = 0; c < mGainModels.size(); c++) {
+        mGainModel[c] = mGainModels[c][k.mode].get();
+        mGainModel[c]->configure(k, mOptions.sampleRate);
+    }
+}
+
+void Repeater::configureMeters() {
+    if (!mRecMeter) {
+        return;
+    }
+    const Knobs& k = activeKnobs();
+    if (mMeterSource == P_RMS && k.power != P_RMS) {
+        // they haven't been kept up to date, so start over
+        mRecMeter->reset();
+        mListenMeter->reset();
+    }
+    const size_t blocks = k.power == P_SHORT_TERM ? 30 : 4;
+    mRecMeter->configure(blocks, k.loudnessGate);
+    mListenMeter->configure(blocks, k.loudnessGate);
+    mMeterSource = k.power;
+}
+
+Repeater::Cycle::Cycle():
+    captured(nullptr),
+    in(nullptr),
+    play(nullptr),
+    frames(0),
+    latency(0),
+    heard(0)
+{}
+
 void Repeater::getHistory(History& out) const {
     std::lock_guard<std::mutex> lock(mHistoryMutex);
     out = mHistory;
 }
 
-int Repeater::run() {
-    const size_t channels = 2;
+void Repeater::prepare(size_t channels, int latency, const std::vector<int>& channelOffsets) {
+    const unsigned int sampleRate = mOptions.sampleRate;
+    const size_t bufSize = mOptions.bufSize;
+    const size_t loopOffset = sampleRate*mOptions.loopDelay;
+
+    if (channels > History::MAX_CHANNELS) {
+        BOOST_THROW_EXCEPTION(std::runtime_error("Too many channels"));
+    }
 
     mHistory.history.resize(mOptions.historySize);
+    mHistory.channels = channels;
+
+    mChannelOffsets.assign(channels, 0);
+    std::copy(channelOffsets.begin(), channelOffsets.begin() + std::min(channels, channelOffsets.size()),
+              mChannelOffsets.begin());
     mHistPos = 0;
     mCurDataSamples = 0;
 
-    std::ofstream recDump, listenDump;
     if (!mOptions.recDumpFile.empty()) {
-        recDump.open(mOptions.recDumpFile);
+        mRecDump.open(mOptions.recDumpFile);
     }
     if (!mOptions.listenDumpFile.empty()) {
-        listenDump.open(mOptions.listenDumpFile);
+        mListenDump.open(mOptions.listenDumpFile);
+    }
+    if (!mOptions.playDumpFile.empty()) {
+        mPlayDump.open(mOptions.playDumpFile);
     }
 
-    snd_pcm_t *capture, *playback;
+    mDrum.reset(new Drum(drumFrames(), channels));
+    if (mOverview->frames() != mDrum->count()) {
+        // replaying a trace can change the drum size; there's no visualizer then
+        mOverview.reset(new WaveOverview(mDrum->count(), History::MAX_CHANNELS));
+    }
+    mOverview->reset(channels);
+    mDrum->setOverview(mOverview.get());
 
+    mEqualizer.reset(new Equalizer(sampleRate, channels, mOptions.eqSections, sampleRate*EQ_RAMP));
     {
-        const Options &o = mOptions;
-        int err;
-        if ((err = snd_pcm_open(&capture, o.captureDevice.c_str(),
-                                SND_PCM_STREAM_CAPTURE, 0)) < 0) {
-            std::cerr << "Couldn't open " << o.captureDevice << " for capture: "
-                      << snd_strerror(err) << std::endl;
-            return 1;
+        const Knobs& k = activeKnobs();
+        mEqualizer->configure(&k.eq[0], k.eq.size());
+    }
+
+    // the EQ holds the recording back a little, on top of the round trip
+    mRecPos = loopOffset - latency - mEqualizer->latency();
+    mPlayPos = 0;
+    mPeriod = bufSize;
+    mRecFade = mPlayFade = 0;
+    mCurGain.assign(channels, 0);
+    mNextGain.assign(channels, 0);
+    mLimiter.reset(new Limiter(channels, bufSize*2,
+                               sampleRate*mOptions.limiterLookahead,
+                               sampleRate*mOptions.limiterLookahead*10));
+
+    mLoopFrames = loopOffset;
+    mFadeLimiter.reset(new Limiter(channels, bufSize*2,
+                                   sampleRate*mOptions.limiterLookahead,
+                                   sampleRate*mOptions.limiterLookahead*10));
+    mFadePos = 0;
+    mDelayFade = 0;
+    mDelayFadeFrames = std::max<size_t>(1, sampleRate*DELAY_CROSSFADE);
+    mListenShift = 0;
+    mListenHold = 0;
+
+    // it has to keep enough of what it's played for the room to still be
+    // hearing it, on top of what it's rendered ahead
+    if (mOptions.stretch) {
+        const size_t frames = latency + mEqualizer->latency() + bufSize*4
+            + sampleRate*(mOptions.limiterLookahead + STRETCH_LOOKAHEAD + STRETCH_SLACK);
+        mStretcher.reset(new Stretcher(sampleRate, channels, frames));
+        const Knobs& k = activeKnobs();
+        mStretcher->configure(k.speed, k.pitch, k.stretchRange);
+    } else {
+        mStretcher.reset();
+    }
+    mStretchPos = 0;
+
+    mGainModels.resize(channels);
+    mGainModel.resize(channels);
+    for (auto& models : mGainModels) {
+        for (size_t m = 0; m < M_COUNT; m++) {
+            models[m] = GainModel::create(static_cast<Mode>(m));
         }
+    }
+    configureGainModel();
+
+    mRecMeter.reset(new LoudnessMeter(sampleRate, channels));
+    mListenMeter.reset(new LoudnessMeter(sampleRate, channels));
+    mMeterSource = P_RMS;
+    configureMeters();
 
-        if ((err = snd_pcm_set_params(capture,
-                                      SND_PCM_FORMAT_S16, SND_PCM_ACCESS_RW_INTERLEAVED,
-                                      channels, o.sampleRate, 1, o.latencyALSA)) < 0) {
-            std::cerr << "Couldn't configure " << o.captureDevice << " for capture: "
-                      << snd_strerror(err) << std::endl;
-            return 1;
+    mActivity->configure(activeKnobs().idleLevel, activeKnobs().idleAfter);
+
+    buildGraph(channels);
+}
+
+void Repeater::buildGraph(size_t channels) {
+    const unsigned int sampleRate = mOptions.sampleRate;
+    mGraph.reset(new ProcessGraph(mOptions.bufSize*2, channels));
+    ProcessGraph& graph = *mGraph;
+
+    Buffer& eqBuf = graph.buffer("eq");
+    Buffer& listenBuf = graph.buffer("listen");
+    // the old play head's output, while a delay change crossfades
+    Buffer& fadeBuf = graph.buffer("play");
+
+    // they're added first, so they run first
+    addInputStages(graph);
+
+    // everything from here on works on the filtered capture, which lags
+    // what the room heard by the EQ's latency too
+    graph.add("eq", [this, &eqBuf]() {
+        Cycle& cy = mCycle;
+        if (mEqualizer->sections() > 0) {
+            cy.frames = std::min(cy.frames, eqBuf.count());
+            std::copy(cy.captured->begin(), cy.captured->at(cy.frames), eqBuf.begin());
+            mEqualizer->process(eqBuf, cy.frames);
+            cy.in = &eqBuf;
         }
+    });
 
-        if ((err = snd_pcm_open(&playback, o.captureDevice.c_str(),
-                                SND_PCM_STREAM_PLAYBACK, 0)) < 0) {
-            std::cerr << "Couldn't open " << o.playbackDevice << " for playback: "
-                      << snd_strerror(err) << std::endl;
-            return 1;
+    if (mRecDump.is_open()) {
+        graph.add("recDump", [this, channels]() {
+            const Cycle& cy = mCycle;
+            mRecDump.write(reinterpret_cast<const char *>(&*cy.captured->begin()),
+                           cy.frames*channels*sizeof(int16_t));
+            mRecDump.flush();
+        }, {"eq"});
+    }
+
+    // right after a delay change, the room is still hearing the old play
+    // head; and when the speakers are different distances from their
+    // microphones, each channel gets read from its own place. When it's
+    // being stretched, the room's hearing what the stretcher played
+    const bool offsets = std::any_of(mChannelOffsets.begin(), mChannelOffsets.end(),
+                                     [](int offset) { return offset != 0; });
+    graph.add("listen", [this, &listenBuf, offsets, channels]() {
+        const Cycle& cy = mCycle;
+        const size_t period = mPeriod;
+        if (!cy.frames) {
+            return;
+        }
+        const Drum& drum = mStretcher ? mStretcher->output() : *mDrum;
+        const ssize_t pos = (mStretcher ? mStretchPos : mPlayPos + mListenShift) - cy.heard - period/2;
+        if (!offsets) {
+            drum.read(listenBuf, pos, period*2);
+            return;
         }
+        for (size_t c = 0; c < channels; c++) {
+            drum.readChannel(listenBuf, pos - mChannelOffsets[c], period*2, c);
+        }
+    });
+
+    if (mStretcher) {
+        // far enough ahead for the limiter and the volume models to look at
+        graph.add("stretch", [this, sampleRate]() {
+            const Cycle& cy = mCycle;
+            const double lookahead = std::max(mOptions.limiterLookahead,
+                                              std::min(activeKnobs().lookahead, STRETCH_LOOKAHEAD));
+            mStretcher->render(*mDrum, mPlayPos, mRecPos, mStretchPos,
+                               std::max(cy.frames, mPeriod*2) + sampleRate*lookahead);
+        }, {"listen"});
+    }
 
-        if ((err = snd_pcm_set_params(playback,
-                                      SND_PCM_FORMAT_S16, SND_PCM_ACCESS_RW_INTERLEAVED,
-                                      channels, o.sampleRate, 1, o.latencyALSA)) < 0) {
-            std::cerr << "Couldn't configure " << o.playbackDevice << " for playback: "
-                      << snd_strerror(err) << std::endl;
-            return 1;
+    // compare the recorded power with the expected power, one speaker at a time
+    graph.add("power", [this, &listenBuf, channels]() {
+        Cycle& cy = mCycle;
+        const size_t frames = cy.frames;
+        if (!frames) {
+            return;
         }
+        const Buffer& inBuf = *cy.in;
+
+        // the loudness meters carry on from cycle to cycle, so they only get
+        // fed while they're in use
+        const bool loudness = activeKnobs().power != P_RMS;
+        if (loudness) {
+            mRecMeter->push(inBuf, frames);
+            mListenMeter->push(listenBuf, frames);
+            cy.stats.recordedPower = mRecMeter->power();
+            cy.stats.expectedPower = mListenMeter->power();
+        } else {
+            cy.stats.recordedPower = inBuf.power(frames);
+            cy.stats.expectedPower = listenBuf.power(frames);
+        }
+
+        for (size_t c = 0; c < channels; c++) {
+            cy.actual[c] = loudness ? mRecMeter->power(c) : inBuf.power(frames, 0, c);
+            cy.expected[c] = loudness ? mListenMeter->power(c) : listenBuf.power(frames, 0, c);
+            cy.stats.channel[c].recordedPower = cy.actual[c];
+            cy.stats.channel[c].expectedPower = cy.expected[c];
+        }
+    }, {"eq", "listen"});
+
+    if (mListenDump.is_open()) {
+        graph.add("listenDump", [this, &listenBuf, channels]() {
+            const Cycle& cy = mCycle;
+            if (cy.frames > 0) {
+                mListenDump.write(reinterpret_cast<const char *>(&*listenBuf.begin()),
+                                  cy.frames*channels*sizeof(int16_t));
+                mListenDump.flush();
+            }
+        }, {"listen"});
     }
 
-    snd_pcm_wait(capture, -1);
-    snd_pcm_wait(playback, -1);
+    // goes by plain RMS whatever the volume models are using, so that it
+    // wakes up on the cycle the sound comes back rather than once the
+    // loudness has caught up
+    graph.add("activity", [this, &listenBuf, sampleRate]() {
+        const Cycle& cy = mCycle;
+        if (!cy.frames) {
+            return;
+        }
+        const bool rms = activeKnobs().power == P_RMS;
+        const double recorded = rms ? cy.stats.recordedPower : cy.in->power(cy.frames);
+        const double expected = rms ? cy.stats.expectedPower : listenBuf.power(cy.frames);
+        mGraph->setIdle(mActivity->update(recorded, expected, cy.frames*1.0/sampleRate));
+    }, {"power"});
+
+    graph.add("gain", [this, sampleRate, channels]() {
+        Cycle& cy = mCycle;
+        const Knobs& k = activeKnobs();
+        const size_t frames = cy.frames;
 
-    const unsigned int sampleRate = mOptions.sampleRate;
-    const double loopDelay = mOptions.loopDelay;
-    const size_t bufSize = mOptions.bufSize;
+        // the channels with something to go by all get their targets in one go
+        GainModel *models[History::MAX_CHANNELS];
+        GainModel::Input inputs[History::MAX_CHANNELS];
+        double targets[History::MAX_CHANNELS];
+        size_t n = 0;
+        for (size_t c = 0; c < channels; c++) {
+            if (frames > 0 && cy.actual[c] > 0) {
+                GainModel::Input& in = inputs[n];
+                in.channel = c;
+                in.actual = cy.actual[c];
+                in.expected = cy.expected[c];
+                in.curGain = mCurGain[c];
+                in.drum = mStretcher ? &mStretcher->output() : mDrum.get();
+                in.playPos = mStretcher ? mStretchPos : mPlayPos;
+                in.frames = frames;
+                in.dt = frames*1.0/sampleRate;
+                models[n++] = mGainModel[c];
+            }
+        }
+        if (n) {
+            models[0]->targets(models, inputs, targets, n);
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            const size_t c = inputs[i].channel;
+            History::DataPoint::Channel& cs = cy.stats.channel[c];
+            const double actual = inputs[i].actual;
+            const double expected = inputs[i].expected;
+            double target = targets[i];
+
+            cs.targetGain = target;
+            cy.stats.limitPower = k.limitPower;
+
+            float cut = 1;
+            if (actual > k.limitPower) {
+                cut *= k.limitPower/actual;
+            }
+            if (expected > k.limitPower) {
+                cut *= k.limitPower/expected;
+            }
+            target *= cut;
+
+            double factor = k.dampen;
+            mNextGain[c] = mCurGain[c]*factor + target*(1 - factor);
+        }
+
+        if (mState == S_SHUTTING_DOWN) {
+            // we're shutting down so just fade out
+            bool silent = true;
+            for (size_t c = 0; c < channels; c++) {
+                mNextGain[c] = std::max(0.0, mCurGain[c] - mPeriod*1.0/sampleRate);
+                silent = silent && mNextGain[c] == 0;
+            }
+            if (silent) {
+                mState = S_GONE;
+            }
+        }
+    }, mStretcher ? std::vector<std::string>{"power", "stretch"} : std::vector<std::string>{"power"});
+
+    graph.add("delay", [this]() {
+        changeLoopDelay(mCycle.heard);
+    }, {"listen"});
+
+    graph.add("play", [this, &fadeBuf, channels]() {
+        Cycle& cy = mCycle;
+        const Knobs& k = activeKnobs();
+        const size_t frames = cy.frames;
+        Buffer& playBuf = *cy.play;
+
+        mLimiter->setCeiling(k.ceiling);
+        if (mStretcher) {
+            // the play head just keeps time for the stretcher
+            mStretchPos = mLimiter->read(mStretcher->output(), playBuf, mStretchPos, frames,
+                                         &mCurGain[0], &mNextGain[0]);
+            mPlayPos = (mPlayPos + frames) % mDrum->count();
+        } else {
+            mPlayPos = mLimiter->read(*mDrum, playBuf, mPlayPos, frames, &mCurGain[0], &mNextGain[0]);
+        }
+        if (mDelayFade) {
+            // the old head fades out as the new one fades in; the new head's
+            // limiter primed itself, so each side is under the ceiling from
+            // its first frame, and so is a linear fade between them
+            mFadeLimiter->setCeiling(k.ceiling);
+            mFadePos = mFadeLimiter->read(*mDrum, fadeBuf, mFadePos, frames, &mCurGain[0], &mNextGain[0]);
+            const size_t n = std::min(mDelayFade, frames);
+            const double g0 = mDelayFade*1.0/mDelayFadeFrames, g1 = (mDelayFade - n)*1.0/mDelayFadeFrames;
+            playBuf.ramp(0, n, 1 - g0, 1 - g1);
+            playBuf.mix(fadeBuf, 0, n, g0, g1);
+            mDelayFade -= n;
+        }
+        if (mListenHold) {
+            mListenHold -= std::min(mListenHold, frames);
+            if (!mListenHold) {
+                mListenShift = 0;
+            }
+        }
+        mCurGain = mNextGain;
+        if (mPlayFade) {
+            const size_t n = std::min(mPlayFade, frames);
+            playBuf.ramp(0, n, 0, 1);
+            mPlayFade = 0;
+        }
+
+        for (size_t c = 0; c < channels; c++) {
+            History::DataPoint::Channel& cs = cy.stats.channel[c];
+            cs.actualGain = mLimiter->appliedGain(c);
+            cy.stats.targetGain += cs.targetGain/channels;
+            cy.stats.actualGain += cs.actualGain/channels;
+        }
+    }, {"gain", "delay"});
+
+    if (mPlayDump.is_open()) {
+        graph.add("playDump", [this, channels]() {
+            const Cycle& cy = mCycle;
+            mPlayDump.write(reinterpret_cast<const char *>(&*cy.play->begin()),
+                            cy.frames*channels*sizeof(int16_t));
+            mPlayDump.flush();
+        }, {"play"});
+    }
+
+    // the recording goes in after everything that reads the drum
+    graph.add("record", [this]() {
+        const Cycle& cy = mCycle;
+        const size_t writePos = mRecPos;
+        mRecPos = mDrum->write(*cy.in, mRecPos, cy.frames);
+        if (mRecFade && cy.frames) {
+            // fade back in after the gap left by a resync
+            mDrum->rampAt(writePos, std::min(mRecFade, cy.frames), 0, 1);
+            mRecFade = 0;
+        }
+    }, {"eq", "listen", "play"});
+
+    // kept up while idle too, since the visualizer's heads and plot come from it
+    graph.add("history", [this, channels]() {
+        const Cycle& cy = mCycle;
+        const Drum& drum = *mDrum;
+
+        // never wait on the visualizer; if it's busy reading the history, this
+        // cycle's statistics just don't make it in
+        std::unique_lock<std::mutex> lock(mHistoryMutex, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            return;
+        }
+
+        size_t histSize = mHistory.history.size();
+        size_t dataPos = (mRecPos*histSize/drum.count()) % histSize;
+        if (dataPos != mHistPos) {
+            // fill in the history gap
+            History::DataPoint prev = mHistory.history[mHistPos];
+            while (mHistPos != dataPos) {
+                mHistPos = (mHistPos + 1) % histSize;
+                if (mHistPos != dataPos) {
+                    mHistory.history[mHistPos] = prev;
+                }
+            }
+
+            // start a new history recording
+            mCurData = History::DataPoint();
+            mCurDataSamples = 0;
+        }
+
+        History::DataPoint &dp = mHistory.history[mHistPos];
+        const History::DataPoint &fs = cy.stats;
+        dp.mode = activeKnobs().mode;
+
+        ++mCurDataSamples;
+        dp.recordedPower = (mCurData.recordedPower += fs.recordedPower)/mCurDataSamples;
+        dp.expectedPower = (mCurData.expectedPower += fs.expectedPower)/mCurDataSamples;
+        dp.limitPower = (mCurData.limitPower += fs.limitPower)/mCurDataSamples;
+        dp.targetGain = (mCurData.targetGain += fs.targetGain)/mCurDataSamples;
+        dp.actualGain = (mCurData.actualGain += fs.actualGain)/mCurDataSamples;
+        for (size_t c = 0; c < channels; c++) {
+            History::DataPoint::Channel& dc = dp.channel[c];
+            History::DataPoint::Channel& cc = mCurData.channel[c];
+            const History::DataPoint::Channel& fc = fs.channel[c];
+            dc.recordedPower = (cc.recordedPower += fc.recordedPower)/mCurDataSamples;
+            dc.expectedPower = (cc.expectedPower += fc.expectedPower)/mCurDataSamples;
+            dc.targetGain = (cc.targetGain += fc.targetGain)/mCurDataSamples;
+            dc.actualGain = (cc.actualGain += fc.actualGain)/mCurDataSamples;
+        }
+
+        size_t drumSize = drum.count();
+        const long drift = mStretcher ? lround(mStretcher->drift()) : 0;
+        const size_t heardPos = (mPlayPos + drumSize*2 + drift - cy.heard) % drumSize;
+        mHistory.playPos = (heardPos*histSize/drumSize) % histSize;
+        mHistory.recordPos = (mRecPos*histSize/drumSize) % histSize;
+        mHistory.latency = cy.latency;
+    }, {"power", "gain", "play", "record", "activity"});
+
+    addOutputStages(graph);
+    graph.build();
+}
+
+Repeater::History::DataPoint Repeater::process(const Buffer& captured, size_t frames,
+                                               Buffer& playBuf, int latency) {
+    switch (mState) {
+    case S_STARTUP:
+        mState = S_RUNNING;
+        break;
+    case S_RUNNING:
+        break;
+    case S_SHUTDOWN_REQUESTED:
+        mState = S_SHUTTING_DOWN;
+        break;
+    case S_SHUTTING_DOWN:
+    case S_GONE:
+        break;
+    }
+
+    Cycle& cy = mCycle;
+    cy.captured = cy.in = &captured;
+    cy.play = &playBuf;
+    cy.frames = frames;
+    cy.latency = latency;
+    cy.heard = latency + mEqualizer->latency();
+    cy.stats = History::DataPoint();
+
+    mGraph->run();
+
+    cy.stats.mode = activeKnobs().mode;
+    return cy.stats;
+}
+
+std::vector<ProcessGraph::Timing> Repeater::getStageTimings() const {
+    return mGraph ? mGraph->timings() : std::vector<ProcessGraph::Timing>();
+}
+
+namespace {
+//! Fill in how long it's spent active and idle, and the CPU time used in each
+void snapActivity(Metrics::Snapshot& snap, const ActivityDetector& activity) {
+    const ActivityDetector::Usage active = activity.usage(false), idle = activity.usage(true);
+    snap.idle = activity.idle();
+    snap.activeSeconds = active.wall;
+    snap.activeCpuSeconds = active.cpu;
+    snap.idleSeconds = idle.wall;
+    snap.idleCpuSeconds = idle.cpu;
+}
+}
+
+bool Repeater::isIdle() const {
+    return mActivity->idle();
+}
+
+void Repeater::reportActivity(bool& wasIdle) {
+    const bool idle = mActivity->idle();
+    if (idle == wasIdle) {
+        return;
+    }
+    wasIdle = idle;
+
+    // how it did in the state it's just left
+    const ActivityDetector::Usage u = mActivity->usage(!idle);
+    if (idle) {
+        std::cout << "Room's gone quiet; idling (CPU while active: ";
+    } else {
+        std::cout << "Room's woken up; back to full processing (CPU while idle: ";
+    }
+    std::cout << u.load()*100 << "% of a core over " << formatDuration(u.wall) << ")" << std::endl;
+}
+
+//! Everything run() keeps from one cycle to the next
+struct Repeater::Session {
+    AudioDevice::Ptr capture, playback;
+    const size_t channels;
+    const unsigned int sampleRate;
+    const size_t bufSize;
+
+    // when the devices run off different clocks, the capture side gets
+    // resampled onto the playback clock
+    const bool resample;
+    Resampler resampler;
+    DriftEstimator drift;
+    const size_t maxFrames;
+
+    // the device fill levels, as of the hardware timestamps rather than of
+    // whenever they happen to get asked for
+    PcmClock recStamp, playStamp;
+
+    Buffer recBuf, resampleBuf, playBuf;
+    const Buffer& inBuf;
+
+    //! What calibration found, kept up to date as auto-tuning changes things
+    int calibrated;
+    double quietPower;
+    std::vector<int> channelOffsets;
+
+    // the loop heads stay where calibration put them, but the comparison
+    // between expected and recorded follows the live latency estimate
+    std::unique_ptr<LatencyTracker> tracker;
+
+    std::unique_ptr<Metrics> metrics;
+    Metrics::Snapshot snap;
+    const double startTime;
+
+    std::unique_ptr<Trace::Writer> trace;
+    int tracedLatency;
+    bool tracedShutdown;
+
+    // xruns lose frames without the heads knowing, which would shift the
+    // loop delay, so keep track and move the heads to make up for it
+    XrunClock recClock, playClock;
+    int playbackLost;
+
+    // auto-tuning brings the period and the device latency down as far as
+    // they'll go; each change moves the round trip by however much the device
+    // buffering changed, and the heads have to move to make up for it
+    std::unique_ptr<AutoTuner> tuner;
+    //! Smoothed device delay plus a period, which is what the round trip follows
+    double deviceDelay;
+    //! After a change, frames left to let the devices settle and then to measure for
+    size_t retuneSettle, retuneMeasure;
+    double retuneSum;
+    size_t retuneFrames;
+    //! Writing the cache for a stable setting
+    std::thread cacheWriter;
+
+    //! The DSP part of each cycle, which runs on the worker pool if there is one
+    WorkerPool::Job dsp;
+
+    //! The cycle in progress
+    int frames;
+    int latency;
+    double cycleStart;
+    long queued;
+    History::DataPoint frameStats;
+    bool trackerIdle, reportedIdle;
+
+    Session(AudioDevice::Ptr captureDevice, AudioDevice::Ptr playbackDevice, size_t channels,
+            const Options& o):
+        capture(std::move(captureDevice)),
+        playback(std::move(playbackDevice)),
+        channels(channels),
+        sampleRate(o.sampleRate),
+        bufSize(o.bufSize),
+        resample(o.driftCompensation),
+        resampler(channels, bufSize),
+        drift(sampleRate),
+        maxFrames(resample ? resampler.maxOutput(bufSize) : bufSize),
+        recStamp(*capture, true, sampleRate),
+        playStamp(*playback, false, sampleRate),
+        recBuf(capture.get(), bufSize, channels),
+        resampleBuf(NULL, maxFrames, channels),
+        playBuf(playback.get(), maxFrames, channels),
+        inBuf(resample ? resampleBuf : recBuf),
+        calibrated(0),
+        quietPower(0),
+        startTime(getTime()),
+        tracedLatency(0),
+        tracedShutdown(false),
+        recClock(recStamp, true, sampleRate),
+        playClock(playStamp, false, sampleRate),
+        playbackLost(0),
+        deviceDelay(-1),
+        retuneSettle(0),
+        retuneMeasure(0),
+        retuneSum(0),
+        retuneFrames(0),
+        frames(0),
+        latency(0),
+        cycleStart(0),
+        queued(0),
+        trackerIdle(false),
+        reportedIdle(false)
+    {
+        snap.period = bufSize*1.0/sampleRate;
+    }
+
+    ~Session() {
+        if (cacheWriter.joinable()) {
+            cacheWriter.join();
+        }
+    }
+};
+
+int Repeater::run() {
+    if (!mOptions.jackClient.empty()) {
+        return runJack();
+    }
+    return runAll(std::vector<Repeater *>{this});
+}
+
+int Repeater::run(RoomSimulator& room) {
+    mRoom = &room;
+    const int ret = runAll(std::vector<Repeater *>{this});
+    mRoom = NULL;
+    return ret;
+}
+
+int Repeater::runAll(const std::vector<Repeater *>& loops) {
+    // they calibrate one at a time, or they'd hear each other's test bursts
+    int ret = 0;
+    std::vector<Repeater *> live;
+    for (Repeater *loop : loops) {
+        if (loop->open()) {
+            live.push_back(loop);
+        } else {
+            ret = 1;
+        }
+    }
+    if (live.size() > 1) {
+        // the ones that calibrated first have been sitting there meanwhile
+        for (Repeater *loop : live) {
+            loop->restartDevices();
+        }
+    }
+
+    std::vector<struct pollfd> fds;
+    for (Repeater *loop : live) {
+        loop->mSession->capture->pollDescriptors(fds);
+    }
+
+    std::vector<Repeater *> ready;
+    ready.reserve(live.size());
+    while (!live.empty()) {
+        // take every loop that has a period's worth waiting, so that all of
+        // their processing can go to the workers before anything waits on
+        // it; one on its own just waits in the read
+        ready.clear();
+        for (Repeater *loop : live) {
+            if (live.size() == 1 || loop->captureReady()) {
+                ready.push_back(loop);
+            }
+        }
+        if (ready.empty()) {
+            poll(&fds[0], fds.size(), 100);
+            continue;
+        }
 
-    const size_t loopOffset = sampleRate*loopDelay;
+        for (Repeater *loop : ready) {
+            loop->startCycle();
+        }
+        for (Repeater *loop : ready) {
+            loop->finishCycle();
+        }
+
+        for (auto iter = live.begin(); iter != live.end();) {
+            if ((*iter)->mState == S_GONE) {
+                (*iter)->close();
+                iter = live.erase(iter);
+            } else {
+                ++iter;
+            }
+        }
+    }
+    return ret;
+}
 
-    Drum drum(std::max(bufSize*4, loopOffset*2), channels);
-    Buffer recBuf(capture, bufSize, channels),
-        playBuf(playback, bufSize, channels),
-        listenBuf(NULL, bufSize*2, channels);
+bool Repeater::open() {
+    const size_t channels = 2;
+    const Options &o = mOptions;
 
-    int latencyAdjust;
+    AudioDevice::Ptr capture, playback;
     try {
+        capture = mRoom ? mRoom->device(true) : AudioDevice::alsa(o.captureDevice, true);
+        capture->configure(channels, o.sampleRate, o.latencyALSA);
+        playback = mRoom ? mRoom->device(false) : AudioDevice::alsa(o.playbackDevice, false);
+        playback->configure(channels, o.sampleRate, o.latencyALSA);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+
+    capture->wait();
+    playback->wait();
+
+    mSession.reset(new Session(std::move(capture), std::move(playback), channels, mOptions));
+    Session& s = *mSession;
+    const unsigned int sampleRate = s.sampleRate;
+    const size_t bufSize = s.bufSize;
+
+    int latencyAdjust = 0;
+    try {
+        const CalibrationCache cache(mOptions.calibrationCache);
+        const CalibrationCache::Key key{mOptions.captureDevice, mOptions.playbackDevice,
+                sampleRate, bufSize, mOptions.latencyALSA};
+        CalibrationCache::Entry cached;
+        const bool haveCached = !mOptions.recalibrate && cache.lookup(key, cached);
+
         Calibrator cc;
-        cc.go(recBuf, playBuf);
+        if (!haveCached || !cc.check(s.recBuf, s.playBuf, cached.latency, cached.quietPower,
+                                     cached.channelOffsets)) {
+            try {
+                cc.go(s.recBuf, s.playBuf);
+                if (!cache.store(key, CalibrationCache::Entry{cc.getLatency(), cc.getQuietPower(),
+                                cc.getChannelOffsets()})) {
+                    std::cerr << "Couldn't write calibration cache "
+                              << mOptions.calibrationCache << std::endl;
+                }
+            } catch (const std::exception& e) {
+                if (!haveCached) {
+                    throw;
+                }
+                // a noisy room is better off with the last known values than none
+                std::cerr << "Calibration failed (" << e.what()
+                          << "); using cached values" << std::endl;
+                cc = Calibrator();
+                cc.assume(cached.latency, cached.quietPower, cached.channelOffsets);
+            }
+        }
 
         latencyAdjust = cc.getLatency();
         std::cout << "Overall latency: " << latencyAdjust
                   << " (" << latencyAdjust*1.0/sampleRate << "sec)" << std::endl;
 
-        if (mKnobs.feedbackThreshold <= 0) {
-            mKnobs.feedbackThreshold = cc.getQuietPower()*3;
-            std::cout << "Feedback threshold: " << mKnobs.feedbackThreshold << std::endl;
+        s.channelOffsets = cc.getChannelOffsets();
+        if (!s.channelOffsets.empty()) {
+            std::cout << "Channel offsets:";
+            for (int offset : s.channelOffsets) {
+                std::cout << ' ' << offset;
+            }
+            std::cout << std::endl;
         }
+
+        const double quietPower = s.quietPower = cc.getQuietPower();
+        changeKnobs([quietPower](Knobs& k) {
+                if (k.feedbackThreshold <= 0) {
+                    k.feedbackThreshold = quietPower*3;
+                    std::cout << "Feedback threshold: " << k.feedbackThreshold << std::endl;
+                }
+                if (k.idleLevel <= 0) {
+                    k.idleLevel = quietPower*4;
+                    std::cout << "Idle level: " << k.idleLevel << std::endl;
+                }
+            });
     } catch (const std::exception& e) {
         std::cerr << "Calibration failed: " << e.what() << std::endl;
         mState = S_GONE;
     }
 
-    size_t recPos = loopOffset - latencyAdjust,
-        playPos = 0;
+    s.calibrated = latencyAdjust;
 
-    double curGain = 0, nextGain = 0;
+    if (s.resample) {
+        std::cout << "Clock drift compensation enabled" << std::endl;
+        latencyAdjust += s.resampler.latency();
+    }
 
-    while (mState != S_GONE) {
-        while (!mKnobsCurrent.test_and_set()) {
-            mKnobs = mKnobsNext;
+    s.tracker.reset(new LatencyTracker(sampleRate, s.maxFrames, latencyAdjust, bufSize));
+    prepare(channels, latencyAdjust, s.channelOffsets);
+
+    if (mOptions.latencyTracking) {
+        s.tracker->start();
+    }
+    if (mSpectrogram) {
+        mSpectrogram->start();
+    }
+
+    if (!mOptions.metricsName.empty()) {
+        try {
+            s.metrics.reset(new Metrics(mOptions.metricsName, true));
+        } catch (const std::exception& e) {
+            std::cerr << "Not publishing metrics: " << e.what() << std::endl;
         }
-        const Knobs& k = mKnobs;
+    }
 
-        switch (mState) {
-        case S_STARTUP:
-            mState = S_RUNNING;
-            break;
-        case S_RUNNING:
-            break;
-        case S_SHUTDOWN_REQUESTED:
-            mState = S_SHUTTING_DOWN;
-            break;
-        case S_SHUTTING_DOWN:
-        case S_GONE:
-            break;
-        }            
+    if (!mOptions.traceFile.empty()) {
+        Trace::Header h;
+        h.sampleRate = sampleRate;
+        h.channels = channels;
+        h.bufSize = bufSize;
+        h.maxFrames = s.maxFrames;
+        h.loopDelay = mOptions.loopDelay;
+        h.latency = latencyAdjust;
+        h.maxLoopDelay = mOptions.maxLoopDelay;
+        h.eqSections = mOptions.eqSections;
+        h.stretch = mOptions.stretch;
+        h.limiterLookahead = mOptions.limiterLookahead;
+        std::copy(s.channelOffsets.begin(),
+                  s.channelOffsets.begin() + std::min(s.channelOffsets.size(), History::MAX_CHANNELS),
+                  h.channelOffsets);
+        s.trace.reset(new Trace::Writer(mOptions.traceFile, h));
+        s.trace->knobs(getKnobs());
+    }
+    s.tracedLatency = latencyAdjust;
+    s.latency = latencyAdjust;
+
+    if (mOptions.autoTune) {
+        s.tuner.reset(new AutoTuner(sampleRate, bufSize, mOptions.latencyALSA,
+                                    mOptions.autoTuneSettle));
+    }
+
+    // resampling, tracing and latency tracking are stages of their own
+    s.dsp.work = [this, &s]() {
+        s.frameStats = process(s.inBuf, s.frames, s.playBuf, s.latency);
+    };
+    return true;
+}
+
+void Repeater::close() {
+    mSession->tracker->stop();
+    if (mSpectrogram) {
+        mSpectrogram->stop();
+    }
+    mSession.reset();
+}
+
+void Repeater::reconfigureDevices(int latencyALSA) {
+    Session& s = *mSession;
+    s.capture->configure(s.channels, s.sampleRate, latencyALSA);
+    s.playback->configure(s.channels, s.sampleRate, latencyALSA);
+
+    s.recStamp.enable();
+    s.playStamp.enable();
+
+    // the streams start over, and none of that is lost frames
+    s.recClock.restart();
+    s.playClock.restart();
+    s.drift.restart();
+}
+
+void Repeater::restartDevices() {
+    Session& s = *mSession;
+    s.capture->drop();
+    s.playback->drop();
+    s.capture->prepare();
+    s.playback->prepare();
+    s.recClock.restart();
+    s.playClock.restart();
+    s.drift.restart();
+}
+
+bool Repeater::captureReady() const {
+    return mSession->capture->ready(mPeriod);
+}
+
+void Repeater::startCycle() {
+    Session& s = *mSession;
+    const unsigned int sampleRate = s.sampleRate;
+
+    if (receiveKnobs() && s.trace) {
+        s.trace->knobs(activeKnobs());
+    }
 
-        History::DataPoint frameStats;
+    s.latency = s.tracker->getLatency();
+    if (s.trace && s.latency != s.tracedLatency) {
+        s.trace->latency(s.latency);
+        s.tracedLatency = s.latency;
+    }
 
-        int frames = recBuf.record();
+    s.frames = s.recBuf.record(mPeriod);
+    s.cycleStart = getTime();
 
-        if (recDump) {
-            recDump.write(reinterpret_cast<const char *>(&*recBuf.begin()),
-                          frames*channels*sizeof(int16_t));
-            recDump.flush();
+    const int captureLost = s.recClock.update(s.frames, s.recBuf.xruns());
+    if (captureLost || s.playbackLost) {
+        reportLost(sampleRate, "Capture", captureLost, s.recClock.totalLost());
+        reportLost(sampleRate, "Playback", s.playbackLost, s.playClock.totalLost());
+        resync(captureLost, s.playbackLost);
+        if (s.trace) {
+            s.trace->resync(captureLost, s.playbackLost);
         }
+        // the device fill levels start over after an xrun
+        s.drift.restart();
+        s.playbackLost = 0;
+    }
+
+    // both brought to the same moment, so the jitter of when each
+    // device last moved its pointer doesn't show up as drift
+    long capDelay = 0, playDelay = 0;
+    if ((s.resample || s.tuner) && s.frames > 0) {
+        const double now = s.capture->now();
+        capDelay = s.recStamp.delayAt(now);
+        playDelay = s.playStamp.delayAt(now);
+    }
+    s.queued = capDelay + playDelay + std::max(s.frames, 0);
+    if (s.resample && s.frames > 0) {
+        s.resampler.setRatio(s.drift.update(capDelay + playDelay, s.frames));
+    }
+
+    if (mWorkerPool) {
+        // it has to be done before the next buffer's worth comes in
+        mWorkerPool->submit(s.dsp, s.cycleStart + std::max(s.frames, 0)*1.0/sampleRate);
+    } else {
+        s.dsp.work();
+    }
+}
 
-        // compare the recorded power with the expected power
-        if (frames > 0) {
-            double expected, actual;
+void Repeater::finishCycle() {
+    Session& s = *mSession;
+    const unsigned int sampleRate = s.sampleRate;
 
-            actual = recBuf.power(frames);
+    if (mWorkerPool) {
+        mWorkerPool->wait(s.dsp);
+    }
 
-            drum.read(listenBuf, playPos - latencyAdjust - bufSize/2, bufSize*2);
-            expected = listenBuf.power(frames);
-            if (listenDump) {
-                listenDump.write(reinterpret_cast<const char *>(&*listenBuf.begin()),
-                                 frames*channels*sizeof(int16_t));
-                listenDump.flush();
-            }
+    const double cycleTime = getTime() - s.cycleStart;
+    s.frames = s.playBuf.play(s.frames);
+    s.playbackLost = s.playClock.update(s.frames, s.playBuf.xruns());
+    const int frames = s.frames;
 
-            frameStats.recordedPower = actual;
-            frameStats.expectedPower = expected;
-
-            if (actual > 0) {
-                double target;
-                double level = k.levels.find(k.mode)->second;
-                switch (k.mode) {
-                case M_GAIN:
-                    target = level;
-                    break;
-
-                case M_FEEDBACK:
-                    if (expected > k.feedbackThreshold && actual > k.feedbackThreshold) {
-                        // we have sound, and we are expecting sound
-                        target = (expected - k.feedbackThreshold)*level
-                            /(actual - k.feedbackThreshold) + k.feedbackThreshold;
-                    } else if (expected < k.feedbackThreshold) {
-                        // we have no sound yet, so just set the gain to 1
-                        target = 1;
-                    } else {
-                        // we are not expecting sound, so keep it the same
-                        target = curGain;
-                    }
-                    break;
+    if (s.tuner && frames > 0) {
+        if (s.retuneSettle) {
+            s.retuneSettle -= std::min<size_t>(s.retuneSettle, frames);
+        } else if (s.retuneMeasure) {
+            s.retuneSum += s.queued*1.0*frames;
+            s.retuneFrames += frames;
+            s.retuneMeasure -= std::min<size_t>(s.retuneMeasure, frames);
+            if (!s.retuneMeasure) {
+                const double measured = s.retuneSum/s.retuneFrames;
+                const int delta = lround(measured - s.deviceDelay);
+                s.deviceDelay = measured;
 
-                case M_TARGET:
-                    target = level/std::max(0.00001, actual - k.feedbackThreshold);
-                    break;
+                // more buffering means the play head has to get further
+                // ahead of the record head, and less means the opposite
+                if (delta > 0) {
+                    resync(0, delta);
+                } else if (delta < 0) {
+                    resync(-delta, 0);
+                }
+                if (s.trace && delta) {
+                    s.trace->resync(std::max(-delta, 0), std::max(delta, 0));
                 }
+                s.tracker->shift(delta);
+                s.calibrated += delta;
+                std::cout << "Auto-tune: round trip moved by " << delta
+                          << " frames, to " << s.calibrated << " ("
+                          << s.calibrated*1.0/sampleRate << "sec)" << std::endl;
 
-                frameStats.targetGain = target;
-                frameStats.limitPower = k.limitPower;
+                // whatever xruns the change itself caused are over with now
+                s.tuner->settled(s.recBuf.xruns() + s.playBuf.xruns());
+            }
+        } else {
+            // an average over about half a second
+            const double alpha = std::min(1.0, frames*2.0/sampleRate);
+            s.deviceDelay = s.deviceDelay < 0 ? s.queued
+                : s.deviceDelay + (s.queued - s.deviceDelay)*alpha;
 
-                float cut = 1;
-                if (actual > k.limitPower) {
-                    cut *= k.limitPower/actual;
+            const AutoTuner::Action action = s.tuner->update(
+                frames, cycleTime, s.recBuf.xruns() + s.playBuf.xruns());
+            const AutoTuner::Setting& setting = s.tuner->current();
+            if (action == AutoTuner::A_CHANGE) {
+                if (setting.period < mPeriod) {
+                    std::cout << "Auto-tune: trying";
+                } else {
+                    std::cout << "Auto-tune: " << s.tuner->lastXruns() << " xruns, "
+                              << s.tuner->lastOverBudget()*100
+                              << "% of cycles short on time; backing off to";
                 }
-                if (expected > k.limitPower) {
-                    cut *= k.limitPower/expected;
+                std::cout << " a period of " << setting.period << " frames and "
+                          << setting.latency << "us of latency" << std::endl;
+
+                reconfigureDevices(setting.latency);
+                mPeriod = setting.period;
+                s.snap.period = mPeriod*1.0/sampleRate;
+                if (s.trace) {
+                    s.trace->period(mPeriod);
                 }
-                target *= cut;
 
-                double factor = k.dampen;
-                nextGain = curGain*factor + target*(1 - factor);
+                // playback doesn't start until its buffer fills
+                s.retuneSettle = setting.latency*1e-6*sampleRate + sampleRate/4;
+                s.retuneMeasure = sampleRate/2;
+                s.retuneSum = 0;
+                s.retuneFrames = 0;
+            } else if (action == AutoTuner::A_STABLE) {
+                const int stable = s.calibrated - (s.resample ? s.resampler.latency() : 0);
+                std::cout << "Auto-tune: stable with --bufSize " << setting.period
+                          << " --latency " << setting.latency
+                          << " (overall latency " << stable << ")" << std::endl;
+
+                // so that starting with these settings can skip the calibration;
+                // the cache is a file, shared with other loops, so it gets
+                // written off to the side rather than holding up the audio
+                const std::string path = mOptions.calibrationCache;
+                const CalibrationCache::Key key{mOptions.captureDevice, mOptions.playbackDevice,
+                        sampleRate, setting.period, setting.latency};
+                const CalibrationCache::Entry entry{stable, s.quietPower, s.channelOffsets};
+                if (s.cacheWriter.joinable()) {
+                    // long since done; levels take a while to get stable
+                    s.cacheWriter.join();
+                }
+                s.cacheWriter = std::thread([path, key, entry]() {
+                        if (!CalibrationCache(path).store(key, entry)) {
+                            std::cerr << "Couldn't write calibration cache " << path << std::endl;
+                        }
+                    });
             }
         }
+    }
 
-        double maxGain = drum.maxGain(playPos, frames);
-        nextGain = std::min(maxGain, nextGain);
+    reportActivity(s.reportedIdle);
 
-        if (mState == S_SHUTTING_DOWN) {
-            // we're shutting down so just fade out
-            nextGain = curGain - bufSize*1.0/sampleRate;
-            if (nextGain <= 0) {
-                nextGain = 0;
-                mState = S_GONE;
+    {
+        std::lock_guard<std::mutex> lock(mHistoryMutex);
+        mHistory.clockDrift = s.drift.getDriftPPM();
+        mHistory.latencyConfidence = s.tracker->getConfidence();
+        mHistory.controlLatency = mControlLatency;
+        mHistory.idle = s.reportedIdle;
+    }
+
+    if (s.metrics) {
+        Metrics::Snapshot& snap = s.snap;
+        const History::DataPoint& frameStats = s.frameStats;
+        snap.uptime = getTime() - s.startTime;
+        snap.state = mState;
+        snap.mode = frameStats.mode;
+        snap.recordedPower = frameStats.recordedPower;
+        snap.expectedPower = frameStats.expectedPower;
+        snap.limitPower = frameStats.limitPower;
+        snap.targetGain = frameStats.targetGain;
+        snap.actualGain = frameStats.actualGain;
+        ++snap.cycles;
+        snap.frames += std::max(frames, 0);
+        snap.captureXruns = s.recBuf.xruns();
+        snap.playbackXruns = s.playBuf.xruns();
+        snap.captureLost = s.recClock.totalLost();
+        snap.playbackLost = s.playClock.totalLost();
+        snap.cycleTime = cycleTime;
+        snap.cycleTimeMax = std::max(snap.cycleTimeMax, cycleTime);
+        snap.latency = s.latency;
+        snap.latencyConfidence = s.tracker->getConfidence();
+        snap.clockDrift = s.drift.getDriftPPM();
+        snap.controlLatency = mControlLatency;
+        snapActivity(snap, *mActivity);
+        s.metrics->publish(snap);
+    }
+
+    if (mCycleObserver) {
+        mCycleObserver(s.frameStats, s.playBuf, std::max(frames, 0));
+    }
+}
+
+void Repeater::resync(int captureLost, int playbackLost) {
+    Drum& drum = *mDrum;
+    const size_t drumSize = drum.count();
+    const size_t fade = std::min<size_t>(mOptions.sampleRate/200, mOptions.bufSize);
+
+    // a capture overrun means the recording has fallen behind the room, so
+    // leave a gap where the missing audio would have gone; fade out into it
+    // and back in after it so that it doesn't click when it comes around
+    if (captureLost > 0) {
+        const size_t n = std::min<size_t>(captureLost, drumSize - fade);
+        drum.rampAt(mRecPos + drumSize - fade, fade, 1, 0);
+        drum.silenceAt(mRecPos, n);
+        mRecPos = (mRecPos + n) % drumSize;
+        mRecFade = fade;
+    }
+
+    // a playback underrun means what's coming out of the speakers has
+    // fallen behind, so skip ahead; the stream restarted from silence anyway.
+    // The limiters start over from the new position already under whatever
+    // peaks are coming up, so nothing gets out over the ceiling meanwhile
+    if (playbackLost > 0) {
+        mPlayPos = (mPlayPos + playbackLost) % drumSize;
+        mLimiter->reset();
+        mFadePos = (mFadePos + playbackLost) % drumSize;
+        mFadeLimiter->reset();
+        mPlayFade = fade;
+        if (mStretcher) {
+            mStretchPos = (mStretchPos + playbackLost) % mStretcher->output().count();
+            mStretcher->reset();
+        }
+    }
+}
+
+void Repeater::changeLoopDelay(int latency) {
+    const Knobs& k = activeKnobs();
+    const size_t loopFrames = mOptions.sampleRate*(k.loopDelay > 0 ? k.loopDelay : mOptions.loopDelay);
+    if (loopFrames == mLoopFrames || mDelayFade) {
+        // one change at a time; a newer one gets picked up once this one's done
+        return;
+    }
+
+    // move the play head rather than the record head, so that nothing
+    // that's been recorded gets lost; it has to stay a couple of periods
+    // behind the record head, and not wrap around to the front of it
+    const int drumSize = mDrum->count();
+    const int period = mPeriod;
+    const int distance = (mRecPos + drumSize - mPlayPos) % drumSize;
+    int shift = static_cast<int>(loopFrames) - static_cast<int>(mLoopFrames);
+    shift = std::max(shift, 2*period - distance);
+    shift = std::min(shift, drumSize - 2*period - distance);
+    mLoopFrames += shift;
+    if (!shift) {
+        return;
+    }
+
+    if (mStretcher) {
+        // the stretcher splices its way over to the new play head at its
+        // next seam, and the room goes on hearing what it played
+        mPlayPos = (mPlayPos + drumSize - shift) % drumSize;
+        return;
+    }
+
+    // the old head carries on with its own limiter while it fades out; the
+    // new one primes itself on its first read, starting out with the gain
+    // already under the loudest peak in its lookahead
+    std::swap(mLimiter, mFadeLimiter);
+    mLimiter->reset();
+    mFadePos = mPlayPos;
+    mPlayPos = (mPlayPos + drumSize - shift) % drumSize;
+    mDelayFade = mDelayFadeFrames;
+
+    mListenShift += shift;
+    mListenHold = latency + mDelayFadeFrames/2;
+}
+
+struct Repeater::CallbackState {
+    //! Interleaved copies of what comes in and goes out
+    Buffer in, out;
+    LatencyTracker tracker;
+    std::unique_ptr<Metrics> metrics;
+    Metrics::Snapshot snap;
+    double startTime;
+
+    //! The loudest the room got over the first second, before anything plays
+    std::atomic<double> quietPower;
+    size_t quietFrames;
+    std::atomic<bool> haveQuiet;
+
+    //! Whether the tracker's missed cycles while idle
+    bool trackerIdle;
+
+    //! The audio server's estimate of how busy it is, in percent
+    std::atomic<double> dspLoad;
+
+    CallbackState(unsigned int sampleRate, size_t bufSize, size_t channels, int latency):
+        in(NULL, bufSize, channels),
+        out(NULL, bufSize, channels),
+        tracker(sampleRate, bufSize, latency, bufSize),
+        startTime(getTime()),
+        quietPower(0),
+        quietFrames(0),
+        haveQuiet(false),
+        trackerIdle(false),
+        dspLoad(0)
+    {}
+};
+
+void Repeater::startCallback(size_t channels, int latency) {
+    // the graph feeds its tracker
+    mCallback.reset(new CallbackState(mOptions.sampleRate, mOptions.bufSize, channels, latency));
+    prepare(channels, latency, std::vector<int>());
+
+    if (!mOptions.metricsName.empty()) {
+        try {
+            mCallback->metrics.reset(new Metrics(mOptions.metricsName, true));
+        } catch (const std::exception& e) {
+            std::cerr << "Not publishing metrics: " << e.what() << std::endl;
+        }
+    }
+
+    if (mOptions.latencyTracking) {
+        mCallback->tracker.start();
+    }
+    if (mSpectrogram) {
+        mSpectrogram->start();
+    }
+}
+
+void Repeater::addInputStages(ProcessGraph& graph) {
+    if (!mSession) {
+        return;
+    }
+    Session& s = *mSession;
+
+    if (s.resample) {
+        graph.add("resample", [this, &s]() {
+            Cycle& cy = mCycle;
+            if (cy.frames > 0) {
+                cy.frames = s.frames = s.resampler.process(s.recBuf, cy.frames, s.resampleBuf);
+            }
+        });
+    }
+
+    // the trace gets opened after the graph's been built. A shutdown can be
+    // asked for at any time, but it's this cycle that starts the fade
+    graph.add("trace", [this, &s]() {
+        const Cycle& cy = mCycle;
+        if (!s.trace) {
+            return;
+        }
+        if (mState == S_SHUTTING_DOWN && !s.tracedShutdown) {
+            s.trace->shutdown();
+            s.tracedShutdown = true;
+        }
+        s.trace->cycle(*cy.captured, cy.frames);
+    }, s.resample ? std::vector<std::string>{"resample"} : std::vector<std::string>());
+}
+
+void Repeater::addOutputStages(ProcessGraph& graph) {
+    LatencyTracker *tracker = NULL;
+    bool *trackerIdle = NULL;
+    if (mSession) {
+        tracker = mSession->tracker.get();
+        trackerIdle = &mSession->trackerIdle;
+    } else if (mCallback) {
+        tracker = &mCallback->tracker;
+        trackerIdle = &mCallback->trackerIdle;
+    } else {
+        // a replay has neither
+        return;
+    }
+
+    // there's nothing for the tracker to line up while idle; it starts over
+    // on the first cycle back
+    if (mOptions.latencyTracking) {
+        graph.add("track", [this, tracker, trackerIdle]() {
+            const Cycle& cy = mCycle;
+            if (mActivity->idle()) {
+                *trackerIdle = true;
+                return;
+            }
+            if (*trackerIdle) {
+                tracker->shift(0);
+                *trackerIdle = false;
+            }
+            tracker->push(*cy.play, *cy.captured, cy.frames);
+        }, {"play", "activity"});
+    }
+
+    // and nobody's there to look at the spectrogram
+    if (mSpectrogram) {
+        graph.add("spectrogram", [this]() {
+            const Cycle& cy = mCycle;
+            mSpectrogram->push(*cy.play, *cy.captured, cy.frames);
+        }, {"play", "activity"}, true);
+    }
+}
+
+void Repeater::stopCallback() {
+    mCallback->tracker.stop();
+    if (mSpectrogram) {
+        mSpectrogram->stop();
+    }
+}
+
+void Repeater::callback(const float *const *in, float *const *out, size_t frames) {
+    CallbackState& cs = *mCallback;
+    const size_t channels = cs.in.channels();
+
+    // the period can be longer than what everything was allocated for, so
+    // take it a bufSize at a time
+    for (size_t done = 0; done < frames; ) {
+        const size_t n = std::min(frames - done, cs.in.count());
+
+        Buffer::iterator ip = cs.in.begin();
+        for (size_t i = done; i < done + n; i++) {
+            for (size_t c = 0; c < channels; c++) {
+                *ip++ = std::max(-32768L, std::min(32767L, lrintf(in[c][i]*32768)));
             }
         }
 
-        frameStats.actualGain = nextGain;
+        callback(cs.in, cs.out, n);
+
+        Buffer::const_iterator op = cs.out.begin();
+        for (size_t i = done; i < done + n; i++) {
+            for (size_t c = 0; c < channels; c++) {
+                out[c][i] = *op++*(1.0f/32768);
+            }
+        }
+        done += n;
+    }
+}
+
+void Repeater::callback(const Buffer& in, Buffer& out, size_t frames) {
+    CallbackState& cs = *mCallback;
+    const unsigned int sampleRate = mOptions.sampleRate;
+    const double cycleStart = getTime();
+
+    receiveKnobs();
+    mPeriod = frames;
+    const int latency = cs.tracker.getLatency();
+    const History::DataPoint frameStats = process(in, frames, out, latency);
 
-        playPos = drum.read(playBuf, playPos, frames, curGain, nextGain);
-        curGain = nextGain;
+    if (!cs.haveQuiet) {
+        cs.quietPower = std::max(cs.quietPower.load(), frameStats.recordedPower);
+        cs.quietFrames += frames;
+        cs.haveQuiet = cs.quietFrames >= sampleRate;
+    }
+
+    if (cs.metrics) {
+        Metrics::Snapshot& snap = cs.snap;
+        const double cycleTime = getTime() - cycleStart;
+        snap.uptime = getTime() - cs.startTime;
+        snap.state = mState;
+        snap.mode = frameStats.mode;
+        snap.recordedPower = frameStats.recordedPower;
+        snap.expectedPower = frameStats.expectedPower;
+        snap.limitPower = frameStats.limitPower;
+        snap.targetGain = frameStats.targetGain;
+        snap.actualGain = frameStats.actualGain;
+        ++snap.cycles;
+        snap.frames += frames;
+        snap.period = frames*1.0/sampleRate;
+        snap.cycleTime = cycleTime;
+        snap.cycleTimeMax = std::max(snap.cycleTimeMax, cycleTime);
+        snap.latency = latency;
+        snap.latencyConfidence = cs.tracker.getConfidence();
+        snap.controlLatency = mControlLatency;
+        snap.dspLoad = cs.dspLoad;
+        snapActivity(snap, *mActivity);
+        cs.metrics->publish(snap);
+    }
+}
 
-        recPos = drum.write(recBuf, recPos, frames);
+int Repeater::runJack() {
+    const size_t channels = 2;
+
+    std::unique_ptr<JackClient> jack;
+    try {
+        jack.reset(new JackClient(mOptions.jackClient, channels));
+    } catch (const std::exception& e) {
+        std::cerr << "Couldn't start JACK client " << mOptions.jackClient << ": "
+                  << e.what() << std::endl;
+        return 1;
+    }
+
+    const unsigned int sampleRate = mOptions.sampleRate;
+    if (jack->sampleRate() != sampleRate) {
+        std::cerr << "JACK is running at " << jack->sampleRate() << "Hz; use --rate "
+                  << jack->sampleRate() << std::endl;
+        return 1;
+    }
+
+    // file I/O has no business in a real-time callback
+    if (!mOptions.recDumpFile.empty() || !mOptions.listenDumpFile.empty()
+        || !mOptions.playDumpFile.empty()
+        || !mOptions.traceFile.empty()) {
+        std::cerr << "Dumps and traces aren't available through JACK; ignoring them" << std::endl;
+        mOptions.recDumpFile.clear();
+        mOptions.listenDumpFile.clear();
+        mOptions.playDumpFile.clear();
+        mOptions.traceFile.clear();
+    }
+
+    // the ports have to be connected before they can tell us their latency,
+    // so stay quiet until everything is set up
+    std::atomic<bool> ready(false);
+    jack->start([this, &ready, channels](const float *const *in, float *const *out, size_t frames) {
+            if (ready.load(std::memory_order_acquire)) {
+                callback(in, out, frames);
+            } else {
+                for (size_t c = 0; c < channels; c++) {
+                    std::fill(out[c], out[c] + frames, 0);
+                }
+            }
+        },
+        mOptions.captureDevice == "default" ? "" : mOptions.captureDevice,
+        mOptions.playbackDevice == "default" ? "" : mOptions.playbackDevice);
 
-        frames = playBuf.play(frames);
+    // there's no calibration burst; the server knows the latency through the
+    // hardware, and the latency tracker finds the trip through the air
+    const int latency = jack->latency();
+    std::cout << "JACK period: " << jack->bufferSize() << " frames; overall latency: "
+              << latency << " (" << latency*1.0/sampleRate << "sec) plus the room" << std::endl;
+
+    startCallback(channels, latency);
+    ready = true;
+
+    CallbackState& cs = *mCallback;
+    bool haveQuiet = false, reportedIdle = false;
+    while (mState != S_GONE) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        if (jack->zombified()) {
+            std::cerr << "The JACK server shut us down" << std::endl;
+            mState = S_GONE;
+            break;
+        }
+
+        if (!haveQuiet && cs.haveQuiet) {
+            haveQuiet = true;
+            const double quietPower = cs.quietPower;
+            std::cout << "Quiescent power level: " << quietPower << std::endl;
+            changeKnobs([quietPower](Knobs& k) {
+                    if (k.feedbackThreshold <= 0) {
+                        k.feedbackThreshold = quietPower*3;
+                        std::cout << "Feedback threshold: " << k.feedbackThreshold << std::endl;
+                    }
+                    if (k.idleLevel <= 0) {
+                        k.idleLevel = quietPower*4;
+                        std::cout << "Idle level: " << k.idleLevel << std::endl;
+                    }
+                });
+        }
+
+        reportActivity(reportedIdle);
+        cs.dspLoad = jack->cpuLoad();
 
         {
             std::lock_guard<std::mutex> lock(mHistoryMutex);
+            mHistory.latencyConfidence = cs.tracker.getConfidence();
+            mHistory.controlLatency = mControlLatency;
+            mHistory.idle = reportedIdle;
+        }
+    }
 
-            size_t histSize = mHistory.history.size();
-            size_t dataPos = (recPos*histSize/drum.count()) % histSize;
-            if (dataPos != mHistPos) {
-                // fill in the history gap
-                History::DataPoint prev = mHistory.history[mHistPos];
-                while (mHistPos != dataPos) {
-                    mHistPos = (mHistPos + 1) % histSize;
-                    if (mHistPos != dataPos) {
-                        mHistory.history[mHistPos] = prev;
-                    }
-                }
+    ready = false;
+    jack->stop();
+    stopCallback();
+    return 0;
+}
 
-                // start a new history recording
-                mCurData = History::DataPoint();
-                mCurDataSamples = 0;
-            }
+int Repeater::simulate(const RoomSimulator::Params& params, double duration,
+                       double reportInterval) {
+    const size_t channels = 2;
+    RoomSimulator room(params, mOptions.sampleRate, channels, mOptions.bufSize);
+    // the cached calibrations are for real sound cards
+    mOptions.calibrationCache.clear();
 
-            History::DataPoint &dp = mHistory.history[mHistPos];
-            const History::DataPoint &fs = frameStats;
-            dp.mode = k.mode;
-  
-            ++mCurDataSamples;
-            dp.recordedPower = (mCurData.recordedPower += fs.recordedPower)/mCurDataSamples;
-            dp.expectedPower = (mCurData.expectedPower += fs.expectedPower)/mCurDataSamples;
-            dp.limitPower = (mCurData.limitPower += fs.limitPower)/mCurDataSamples;
-            dp.targetGain = (mCurData.targetGain += fs.targetGain)/mCurDataSamples;
-            dp.actualGain = (mCurData.actualGain += fs.actualGain)/mCurDataSamples;
+    SoakStats interval(channels), total(channels);
+    bool started = false, stopping = false;
+    uint64_t clipped = 0;
+    double nextReport = reportInterval;
+    mCycleObserver = [&](const History::DataPoint& fs, const Buffer& played, size_t frames) {
+        if (!started) {
+            // calibration's done, so the room can start giving it trouble
+            started = true;
+            room.enableStalls(true);
+            clipped = room.clipped();
+        }
+        interval.clippedIn += room.clipped() - clipped;
+        total.clippedIn += room.clipped() - clipped;
+        clipped = room.clipped();
+        interval.add(fs, played, frames);
+        total.add(fs, played, frames);
 
-            size_t drumSize = drum.count();
-            mHistory.playPos = ((playPos - latencyAdjust + drumSize)*histSize/drumSize) % histSize;
-            mHistory.recordPos = (recPos*histSize/drumSize) % histSize;
+        if (room.now() >= nextReport) {
+            interval.print(std::cout, formatDuration(nextReport));
+            interval.reset();
+            nextReport += reportInterval;
+        }
+        if (room.now() >= duration && !stopping) {
+            stopping = true;
+            shutdown();
         }
+    };
+
+    const double startTime = getTime();
+    const int ret = run(room);
+    mCycleObserver = nullptr;
+
+    const double elapsed = getTime() - startTime;
+    const double simulated = room.now();
+    total.print(std::cout, "Overall");
+    std::cout << "Simulated " << formatDuration(simulated) << " in " << elapsed << " sec, "
+              << simulated/elapsed << "x realtime" << std::endl;
+    return ret;
+}
+
+int Repeater::replay(const std::string& traceFile,
+                     const std::string& outFile,
+                     const std::string& historyFile) {
+    Trace::Reader trace(traceFile);
+    const Trace::Header& h = trace.header();
+
+    mOptions.sampleRate = h.sampleRate;
+    mOptions.bufSize = h.bufSize;
+    mOptions.loopDelay = h.loopDelay;
+    mOptions.maxLoopDelay = h.maxLoopDelay;
+    mOptions.eqSections = h.eqSections;
+    mOptions.stretch = h.stretch;
+    mOptions.limiterLookahead = h.limiterLookahead;
+
+    std::ofstream out, hist;
+    if (!outFile.empty()) {
+        out.open(outFile, std::ios::binary);
     }
+    if (!historyFile.empty()) {
+        hist.open(historyFile);
+        hist << "cycle,mode,latency,recordedPower,expectedPower,limitPower,targetGain,actualGain";
+        for (size_t c = 0; c < h.channels; c++) {
+            hist << ",targetGain" << c << ",actualGain" << c;
+        }
+        hist << std::endl;
+        hist.precision(17);
+    }
+
+    Buffer playBuf(NULL, h.maxFrames, h.channels);
+    int latency = h.latency;
+    const std::vector<int> channelOffsets(h.channelOffsets, h.channelOffsets + h.channels);
+    prepare(h.channels, latency, channelOffsets);
+
+    size_t cycles = 0, frames = 0;
+    const double startTime = getTime();
+
+    Trace::Event ev;
+    while ((ev = trace.next()) != Trace::E_END && mState != S_GONE) {
+        switch (ev) {
+        case Trace::E_KNOBS:
+            setKnobs(trace.knobs());
+            break;
+
+        case Trace::E_LATENCY:
+            latency = trace.latency();
+            break;
+
+        case Trace::E_RESYNC:
+            resync(trace.captureLost(), trace.playbackLost());
+            break;
+
+        case Trace::E_PERIOD:
+            mPeriod = trace.period();
+            break;
+
+        case Trace::E_SHUTDOWN:
+            shutdown();
+            break;
+
+        case Trace::E_CYCLE: {
+            receiveKnobs();
+            const size_t n = trace.frames();
+            const History::DataPoint fs = process(trace.buffer(), n, playBuf, latency);
 
-    snd_pcm_close(capture);
-    snd_pcm_close(playback);
+            if (out) {
+                out.write(reinterpret_cast<const char *>(&*playBuf.begin()),
+                          n*h.channels*sizeof(int16_t));
+            }
+            if (hist) {
+                hist << cycles << ',' << fs.mode << ',' << latency << ','
+                     << fs.recordedPower << ',' << fs.expectedPower << ','
+                     << fs.limitPower << ',' << fs.targetGain << ','
+                     << fs.actualGain;
+                for (size_t c = 0; c < h.channels; c++) {
+                    hist << ',' << fs.channel[c].targetGain << ',' << fs.channel[c].actualGain;
+                }
+                hist << '\n';
+            }
+            ++cycles;
+            frames += n;
+            break;
+        }
+
+        case Trace::E_END:
+            break;
+        }
+    }
+
+    const double elapsed = getTime() - startTime;
+    const double duration = frames*1.0/h.sampleRate;
+    std::cout << "Replayed " << cycles << " cycles (" << duration << " sec) in "
+              << elapsed << " sec, " << duration/elapsed << "x realtime" << std::endl;
+    for (const ProcessGraph::Timing& t : getStageTimings()) {
+        std::cout << "    " << t.name << ": " << t.total*1e6/std::max<uint64_t>(t.runs, 1)
+                  << " usec/cycle, max " << t.max*1e6 << " usec" << std::endl;
+    }
     return 0;
 }
@@ -1,11 +1,31 @@
 #pragma once
 
+#include "Equalizer.h"
+#include "Mailbox.h"
+#include "ProcessGraph.h"
+#include "RoomSimulator.h"
+
+#include <array>
 #include <atomic>
+#include <fstream>
+#include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <vector>
 
+class ActivityDetector;
+class Buffer;
+class Drum;
+class GainModel;
+class Limiter;
+class LoudnessMeter;
+class Spectrogram;
+class Stretcher;
+class WaveOverview;
+class WorkerPool;
+
 class Repeater {
 public:
     //! Gain mode
@@ -13,25 +33,86 @@ public:
         M_GAIN, //!< Simple gain
         M_TARGET, //!< Target power level
         M_FEEDBACK, //!< Dynamic feedback level
+        M_LIMITER, //!< Simple gain with a lookahead peak limiter
+        M_COMPRESSOR, //!< RMS compressor
+        M_COUNT
+    };
+
+    //! Human-readable name of a mode
+    static const char *modeName(Mode);
+
+    //! Look up a mode by name; returns false if there's no such mode
+    static bool parseMode(const std::string& name, Mode& mode);
+
+    //! Where the volume models get the recorded and expected levels from
+    enum PowerSource {
+        P_RMS, //!< Plain RMS over each cycle
+        P_MOMENTARY, //!< K-weighted loudness over the last 400ms
+        P_SHORT_TERM, //!< K-weighted loudness over the last 3 seconds
+        P_COUNT
     };
+
+    //! Human-readable name of a power source
+    static const char *powerSourceName(PowerSource);
+
+    //! Look up a power source by name; returns false if there's no such source
+    static bool parsePowerSource(const std::string& name, PowerSource& source);
     
     //! startup options
     struct Options {
         unsigned int sampleRate;
         size_t bufSize;
         size_t historySize;
+        //! The loop delay to start with, in seconds
         double loopDelay;
+        //! The longest the loop delay can be turned up to while running, in seconds; 0 for loopDelay
+        double maxLoopDelay;
         int latencyALSA;
         std::string captureDevice, playbackDevice;
-        std::string recDumpFile, listenDumpFile;
+        std::string recDumpFile, listenDumpFile, playDumpFile;
+        bool driftCompensation;
+        bool latencyTracking;
+        int controlPort;
+        std::string metricsName;
+        std::string traceFile;
+        //! How far ahead the output limiter looks, in seconds
+        double limiterLookahead;
+        //! Where to cache calibration results; empty to always calibrate
+        std::string calibrationCache;
+        //! Do a full calibration even if there's a cached one
+        bool recalibrate;
+        //! Analyze the spectrum for the visualizer
+        bool spectrogram;
+        //! Look for the lowest period and latency that run without xruns
+        bool autoTune;
+        //! How long a setting has to run cleanly before auto-tuning settles on it, in seconds
+        double autoTuneSettle;
+        //! Run as a JACK client with this name instead of through ALSA; empty for ALSA
+        std::string jackClient;
+        //! How many EQ filter sections each channel gets; 0 for no EQ
+        size_t eqSections;
+        //! Play the loop through the time stretcher, so that the speed and pitch can be changed
+        bool stretch;
         Options():
             sampleRate(44100),
             bufSize(1024),
             historySize(2048),
             loopDelay(10.0),
+            maxLoopDelay(0),
             latencyALSA(120000),
             captureDevice("default"),
-            playbackDevice("default")
+            playbackDevice("default"),
+            driftCompensation(false),
+            latencyTracking(true),
+            controlPort(0),
+            metricsName("/whatwesaidwillbe"),
+            limiterLookahead(0.005),
+            recalibrate(false),
+            spectrogram(true),
+            autoTune(false),
+            autoTuneSettle(30),
+            eqSections(0),
+            stretch(false)
         {}
     };
 
@@ -41,27 +122,138 @@ public:
         double feedbackThreshold;
         double limitPower;
         Mode mode;
-        std::map<Mode, double> levels;
+        //! The main setting for each mode
+        std::array<double, M_COUNT> levels;
+
+        //! Output ceiling, as a fraction of full scale
+        double ceiling;
+        //! Peak limiter lookahead, in seconds
+        double lookahead;
+
+        //! Compressor ratio
+        double ratio;
+        //! Compressor attack and release times, in seconds
+        double attack, release;
+
+        //! Loop delay, in seconds; 0 for the startup setting
+        double loopDelay;
+
+        //! EQ on the way into the drum, as many of them as there are sections for
+        std::array<Equalizer::Band, Equalizer::MAX_SECTIONS> eq;
+
+        //! Where the volume models get their levels from
+        PowerSource power;
+        //! Loudness below this, in LUFS, doesn't count towards the level
+        double loudnessGate;
+
+        //! Playback speed, as a ratio, and pitch shift, in semitones (with --stretch)
+        double speed, pitch;
+        //! How far the stretched playback can drift from the loop delay before it's pulled back, in seconds
+        double stretchRange;
+
+        //! Power that counts as someone being in the room; -1 to go by calibration
+        double idleLevel;
+        //! How long the room has to be silent before the optional processing stops, in seconds; 0 for never
+        double idleAfter;
 
         Knobs():
             dampen(0.9),
             feedbackThreshold(-1),
             limitPower(0.2),
-            mode(M_GAIN)
+            mode(M_GAIN),
+            ceiling(0.9),
+            lookahead(0.05),
+            ratio(4),
+            attack(0.01),
+            release(0.5),
+            loopDelay(0),
+            power(P_RMS),
+            loudnessGate(-70),
+            speed(1),
+            pitch(0),
+            stretchRange(1),
+            idleLevel(-1),
+            idleAfter(0)
         {
             levels[M_GAIN] = 1;
             levels[M_TARGET] = 0.1;
             levels[M_FEEDBACK] = 0.5;
+            levels[M_LIMITER] = 1;
+            levels[M_COMPRESSOR] = 0.1;
         }
     };
 
     Repeater(const Options&, const Knobs&);
+    ~Repeater();
 
     typedef std::shared_ptr<Repeater> Ptr;
 
     //! Run indefinitely or until we quit
     int run();
 
+    /*! @brief Run against a simulated room's devices instead of ALSA's
+     *
+     *  Everything else is just as run() does it.
+     */
+    int run(RoomSimulator& room);
+
+    /*! @brief Run several loops on their ALSA devices from the calling thread
+     *
+     *  Each time round, every loop with a period's worth of capture waiting
+     *  gets it read and its DSP work submitted to the worker pool, and only
+     *  then does anything wait on the pool, so the loops that are due
+     *  together get processed side by side. Nothing waits on the workers
+     *  other than this thread, so it should run at a higher real-time
+     *  priority than they do.
+     */
+    static int runAll(const std::vector<Repeater *>& loops);
+
+    /*! @brief Get ready to be driven by someone else's audio callback
+     *
+     *  For audio APIs that call us rather than the other way around, like
+     *  JACK. From then on callback() does everything a cycle of run() would,
+     *  other than tracing and resampling, without locking or allocating.
+     *
+     *  @param channels How many channels there are
+     *  @param latency The round-trip latency, in frames
+     */
+    void startCallback(size_t channels, int latency);
+
+    //! Process a callback's worth of non-interleaved float audio (audio thread only)
+    void callback(const float *const *in, float *const *out, size_t frames);
+
+    //! Process a callback's worth of interleaved audio, at most bufSize frames (audio thread only)
+    void callback(const Buffer& in, Buffer& out, size_t frames);
+
+    //! Stop what startCallback() started
+    void stopCallback();
+
+    //! Run the per-cycle DSP work on a shared pool instead of in run()'s thread
+    void setWorkerPool(WorkerPool *pool) { mWorkerPool = pool; }
+
+    /*! @brief Run the loop in a simulated room, as fast as possible
+     *
+     *  For soak-testing: the loop goes through everything run() does,
+     *  calibration, xruns and all, against RoomSimulator's devices instead of
+     *  ALSA. Prints gain and clipping statistics every so often, and for the
+     *  whole run at the end.
+     *
+     *  @param room The room to simulate
+     *  @param duration How long to simulate, in seconds
+     *  @param reportInterval How often to print statistics, in simulated seconds
+     */
+    int simulate(const RoomSimulator::Params& room, double duration, double reportInterval);
+
+    /*! @brief Re-run the processing on a recorded trace, as fast as possible
+     *
+     *  @param traceFile The trace to replay
+     *  @param outFile Where to write the output audio (raw PCM), if anywhere
+     *  @param historyFile Where to write the per-cycle statistics (CSV), if anywhere
+     */
+    int replay(const std::string& traceFile,
+               const std::string& outFile,
+               const std::string& historyFile);
+
     enum State {
         S_STARTUP,
         S_RUNNING,
@@ -76,30 +268,58 @@ public:
 
     const Options& getOptions() const { return mOptions; }
 
-    const Knobs& getKnobs() const { return mKnobs; }
+    //! Get the knobs as most recently set
+    Knobs getKnobs() const;
+
+    //! Set the knobs, from any thread but the audio thread
     void setKnobs(const Knobs&);
 
+    //! Atomically modify the knobs, from any thread but the audio thread
+    void changeKnobs(const std::function<void(Knobs&)>&);
+
+    /*! @brief Pick up the most recent knob change (audio thread only)
+     *  @returns whether the knobs changed
+     */
+    bool receiveKnobs();
+
+    //! The knobs currently in effect (audio thread only)
+    const Knobs& activeKnobs() const { return mKnobsMailbox.current().knobs; }
+
+    //! How long the most recent knob change took to reach the audio thread, in seconds
+    double getControlLatency() const { return mControlLatency; }
+
     struct History {
+        //! The most channels that get tracked individually
+        static constexpr size_t MAX_CHANNELS = 8;
+
         //! Information about a single point in time
         struct DataPoint {
             //! The specified mode at the time
             Mode mode;
 
-            //! Recorded power level
+            //! Recorded power level, over all channels
             double recordedPower;
 
-            //! Expected power level
+            //! Expected power level, over all channels
             double expectedPower;
 
             //! Limiter level
             double limitPower;
 
-            //! Target gain (per model)
+            //! Target gain (per model), averaged over channels
             double targetGain;
 
-            //! Actual gain (per limiter and damping)
+            //! Actual gain (per limiter and damping), averaged over channels
             double actualGain;
 
+            //! The same, for each channel on its own
+            struct Channel {
+                float recordedPower, expectedPower;
+                float targetGain, actualGain;
+                Channel();
+            };
+            std::array<Channel, MAX_CHANNELS> channel;
+
             DataPoint();
         };
 
@@ -114,20 +334,73 @@ public:
         //! Record head index
         DataPoints::size_type recordPos;
 
+        //! Capture clock drift relative to playback, in parts per million
+        double clockDrift;
+
+        //! Current round-trip latency estimate, in frames
+        int latency;
+
+        //! Confidence of the most recent latency measurement (0-1)
+        double latencyConfidence;
+
+        //! How long the most recent knob change took to reach the audio thread
+        double controlLatency;
+
+        //! How many entries of DataPoint::channel are in use
+        size_t channels;
+
+        //! Whether the room's been silent long enough for the optional processing to stop
+        bool idle;
+
 	History();
     };
 
     //! Get a copy of the current history snapshot
     void getHistory(History&) const;
 
+    //! The live spectrogram, if it's enabled
+    const Spectrogram *getSpectrogram() const { return mSpectrogram.get(); }
+
+    //! The overview of the drum's waveform, for drawing the whole loop
+    const WaveOverview *getOverview() const { return mOverview.get(); }
+
+    //! How long each stage of the processing has been taking, in the order they run
+    std::vector<ProcessGraph::Timing> getStageTimings() const;
+
+    //! Whether the room's been silent long enough for the optional processing to stop
+    bool isIdle() const;
+
 private:
     Options mOptions;
 
-    Knobs mKnobs, mKnobsNext;
-    std::atomic_flag mKnobsCurrent;
+    //! The knobs as most recently set
+    Knobs mKnobs;
+    mutable std::mutex mKnobsMutex;
+
+    struct KnobsUpdate {
+        Knobs knobs;
+        //! When the change was posted
+        double sent;
+    };
+    //! Hands knob changes over to the audio thread
+    Mailbox<KnobsUpdate> mKnobsMailbox;
+    std::atomic<double> mControlLatency;
+
+    void postKnobs();
 
     std::atomic<State> mState;
 
+    WorkerPool *mWorkerPool;
+
+    std::unique_ptr<Spectrogram> mSpectrogram;
+    std::unique_ptr<WaveOverview> mOverview;
+
+    //! Size of the drum, in frames
+    size_t drumFrames() const;
+
+    //! The longest the loop delay can be set to, in seconds
+    double maxLoopDelay() const;
+
     mutable std::mutex mHistoryMutex;
     History mHistory;
 
@@ -137,5 +410,166 @@ private:
     History::DataPoint mCurData;
     //! Number of data points
     size_t mCurDataSamples;
+
+    //! The loop itself
+    std::unique_ptr<Drum> mDrum;
+    //! Drum positions
+    size_t mRecPos, mPlayPos;
+    //! How much further behind the play head each channel's microphone hears it
+    std::vector<int> mChannelOffsets;
+    //! Frames per cycle, which auto-tuning can bring down below bufSize
+    size_t mPeriod;
+    //! Frames left to fade in after a resync, on the record and play sides
+    size_t mRecFade, mPlayFade;
+    //! Gain at the start and end of the current cycle, per channel
+    std::vector<double> mCurGain, mNextGain;
+    //! Keeps the output under the ceiling
+    std::unique_ptr<Limiter> mLimiter;
+
+    //! The loop delay currently in effect, in frames
+    size_t mLoopFrames;
+    //! The old play head's own limiter, position and output while a delay change crossfades
+    std::unique_ptr<Limiter> mFadeLimiter;
+    size_t mFadePos;
+    //! Frames left in the crossfade, and how long the whole thing is
+    size_t mDelayFade, mDelayFadeFrames;
+    //! How far the play head jumped, and for how many more frames the room is still hearing the old one
+    int mListenShift;
+    size_t mListenHold;
+
+    /*! @brief Follow the loop delay knob (audio thread only)
+     *
+     *  Moves the play head to the new delay and starts crossfading over to
+     *  it; nothing gets allocated, and the drum is already big enough.
+     */
+    void changeLoopDelay(int latency);
+
+    //! An instance of every volume model, for each channel
+    std::vector<std::array<std::unique_ptr<GainModel>, M_COUNT>> mGainModels;
+    //! The ones for the current mode
+    std::vector<GainModel *> mGainModel;
+
+    //! Switch to and configure the volume model for the active knobs
+    void configureGainModel();
+
+    //! K-weighted loudness of what was recorded, and of what should have been
+    std::unique_ptr<LoudnessMeter> mRecMeter, mListenMeter;
+    //! What the meters were last set up for
+    PowerSource mMeterSource;
+
+    //! Set the meters up for the active knobs
+    void configureMeters();
+
+    //! Plays the loop back at a different speed or pitch, if it's enabled
+    std::unique_ptr<Stretcher> mStretcher;
+    //! Where the stretched audio is being played from
+    size_t mStretchPos;
+
+    //! Notices when the room goes silent, and when it comes back
+    std::unique_ptr<ActivityDetector> mActivity;
+
+    //! Say so when it goes idle or wakes up, and how much CPU it was using (not the audio thread)
+    void reportActivity(bool& wasIdle);
+
+    //! Filters the capture before it goes into the drum
+    std::unique_ptr<Equalizer> mEqualizer;
+    std::ofstream mRecDump, mListenDump, mPlayDump;
+
+    /*! @brief Set up the processing state for a given latency
+     *
+     *  @param channels How many channels there are
+     *  @param latency The round-trip latency, in frames
+     *  @param channelOffsets How much longer each channel's round trip takes,
+     *      in frames (see Calibrator::getChannelOffsets()); empty if they're all the same
+     */
+    void prepare(size_t channels, int latency, const std::vector<int>& channelOffsets);
+
+    /*! @brief What the stages work on during a cycle
+     *
+     *  The stages hand their results to each other through here, rather
+     *  than through the graph: each one reads what the stages it comes after
+     *  have filled in, and fills in its own part. Nothing else touches it
+     *  while a cycle's running.
+     */
+    struct Cycle {
+        //! What was captured, and the same after the EQ
+        const Buffer *captured, *in;
+        //! What gets played
+        Buffer *play;
+        size_t frames;
+        //! The round-trip latency, and how far behind the room the filtered capture is
+        int latency, heard;
+        //! Recorded and expected levels, per channel
+        std::array<double, History::MAX_CHANNELS> actual, expected;
+        History::DataPoint stats;
+        Cycle();
+    };
+    Cycle mCycle;
+
+    //! The stages of process(), set up by prepare()
+    std::unique_ptr<ProcessGraph> mGraph;
+
+    //! Put together the processing stages for a given channel count
+    void buildGraph(size_t channels);
+
+    //! Add the stages that bring run()'s capture in, ahead of all the others
+    void addInputStages(ProcessGraph& graph);
+
+    //! Add the stages that pass what was played and heard on to the latency tracker and the spectrogram
+    void addOutputStages(ProcessGraph& graph);
+
+    /*! @brief Process one cycle
+     *
+     *  @param in What was just captured
+     *  @param frames How many frames were captured
+     *  @param out Where to put what gets played back
+     *  @param latency The current round-trip latency estimate
+     *  @returns the statistics for this cycle
+     */
+    History::DataPoint process(const Buffer& in, size_t frames, Buffer& out, int latency);
+
+    /*! @brief Move the heads to make up for frames lost in xruns
+     *
+     *  @param captureLost Frames the capture device missed
+     *  @param playbackLost Frames the playback device missed
+     */
+    void resync(int captureLost, int playbackLost);
+
+    //! Everything run() keeps from one cycle to the next; there while it's running
+    struct Session;
+    std::unique_ptr<Session> mSession;
+
+    //! The simulated room for run() to open instead of the ALSA devices, if any
+    RoomSimulator *mRoom;
+    //! Called at the end of every cycle of run(), with its stats and what it played
+    std::function<void(const History::DataPoint&, const Buffer&, size_t)> mCycleObserver;
+
+    //! Open the devices, calibrate, and get the session ready; false if the devices wouldn't open
+    bool open();
+
+    //! Finish up the session
+    void close();
+
+    //! Stop the devices and start them again from empty, without losing track of anything
+    void restartDevices();
+
+    //! Change the device buffering, e.g. for auto-tuning
+    void reconfigureDevices(int latencyALSA);
+
+    //! Whether a read would go straight through, without waiting for the device
+    bool captureReady() const;
+
+    //! Read the next cycle's worth, make up for xruns, and get its DSP work going
+    void startCycle();
+
+    //! Wait for the DSP work, play the result, and see to everything that follows from it
+    void finishCycle();
+
+    //! Everything callback() needs, set up ahead of time
+    struct CallbackState;
+    std::unique_ptr<CallbackState> mCallback;
+
+    //! run(), as a JACK client
+    int runJack();
 };
 
@@ -0,0 +1,136 @@
+#include "Resampler.h"
+
+#include <boost/throw_exception.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+constexpr double Resampler::MAX_DEVIATION;
+
+Resampler::Resampler(size_t channels, size_t maxInput, size_t taps, size_t phases):
+    mChannels(channels),
+    mTaps(taps),
+    mPhases(phases),
+    mFilter((phases + 1)*taps),
+    mHistory(channels),
+    mStep(1),
+    mRatio(1),
+    mKernel(taps)
+{
+    if (taps < 2 || taps % 2) {
+        BOOST_THROW_EXCEPTION(std::runtime_error("Resampler needs an even number of taps"));
+    }
+
+    // windowed sinc, cut off a little below Nyquist so that a ratio slightly
+    // below 1 doesn't alias
+    const double cutoff = 0.9;
+    const double half = taps/2.0;
+    for (size_t p = 0; p <= phases; p++) {
+        const double frac = p*1.0/phases;
+        float *row = &mFilter[p*taps];
+        double sum = 0;
+        for (size_t k = 0; k < taps; k++) {
+            double d = k - (half - 1) - frac;
+            double x = M_PI*cutoff*d;
+            double sinc = (d == 0) ? 1 : sin(x)/x;
+            double w = 0.42 + 0.5*cos(M_PI*d/half) + 0.08*cos(2*M_PI*d/half);
+            row[k] = sinc*w;
+            sum += row[k];
+        }
+        // normalize for unity DC gain in every phase
+        for (size_t k = 0; k < taps; k++) {
+            row[k] /= sum;
+        }
+    }
+
+    // prime the history so that the first output lines up with the first input;
+    // what's left over between calls is never more than a couple of filters'
+    // worth, so the history can be sized once and for all
+    mHistLen = mTaps/2 - 1;
+    for (auto& h : mHistory) {
+        h.assign(maxInput + 2*mTaps, 0);
+    }
+    mPos = mHistLen;
+}
+
+void Resampler::setRatio(double ratio) {
+    mRatio = std::max(1 - MAX_DEVIATION, std::min(1 + MAX_DEVIATION, ratio));
+    mStep = 1/mRatio;
+}
+
+size_t Resampler::maxOutput(size_t n) const {
+    return n*(1 + MAX_DEVIATION) + 2;
+}
+
+size_t Resampler::process(const Buffer& in, size_t n, Buffer& out) {
+    if (in.channels() != mChannels || out.channels() != mChannels) {
+        BOOST_THROW_EXCEPTION(std::runtime_error("Mismatched channel count"));
+    }
+    n = std::min(n, in.count());
+
+    if (mHistLen + n > mHistory[0].size()) {
+        BOOST_THROW_EXCEPTION(std::runtime_error("Too much input for the resampler"));
+    }
+
+    // append the new input, deinterleaved so the taps are contiguous
+    for (size_t c = 0; c < mChannels; c++) {
+        std::vector<float>& h = mHistory[c];
+        Buffer::const_iterator src = in.begin() + c;
+        for (size_t i = 0; i < n; i++) {
+            h[mHistLen + i] = *src*(1.0f/32768);
+            src += mChannels;
+        }
+    }
+    mHistLen += n;
+
+    const size_t maxOut = out.count();
+    const size_t lead = mTaps/2 - 1;
+    Buffer::iterator dst = out.begin();
+    size_t produced = 0;
+
+    while (produced < maxOut) {
+        const size_t i = mPos;
+        if (i + mTaps/2 >= mHistLen) {
+            break;
+        }
+
+        // interpolate between adjacent phases
+        const double phase = (mPos - i)*mPhases;
+        const size_t p = phase;
+        const float a = phase - p;
+        const float *h0 = &mFilter[p*mTaps];
+        const float *h1 = h0 + mTaps;
+        float *kernel = &mKernel[0];
+#pragma omp simd
+        for (size_t k = 0; k < mTaps; k++) {
+            kernel[k] = h0[k] + a*(h1[k] - h0[k]);
+        }
+
+        for (size_t c = 0; c < mChannels; c++) {
+            const float *x = &mHistory[c][i - lead];
+            float acc = 0;
+#pragma omp simd reduction(+:acc)
+            for (size_t k = 0; k < mTaps; k++) {
+                acc += x[k]*kernel[k];
+            }
+            long v = lrintf(acc*32768);
+            *dst++ = std::max(-32768L, std::min(32767L, v));
+        }
+
+        ++produced;
+        mPos += mStep;
+    }
+
+    // discard the history we no longer need
+    const size_t consumed = std::min(static_cast<size_t>(mPos) - lead, mHistLen);
+    if (consumed) {
+        for (auto& h : mHistory) {
+            std::copy(h.begin() + consumed, h.begin() + mHistLen, h.begin());
+        }
+        mHistLen -= consumed;
+        mPos -= consumed;
+    }
+
+    return produced;
+}
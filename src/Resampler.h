@@ -0,0 +1,63 @@
+#pragma once
+
+#include "Buffer.h"
+
+#include <vector>
+
+/*! @brief Streaming polyphase resampler for small rate corrections
+ *
+ *  Used on the capture path to pull the capture clock into line with the
+ *  playback clock. The ratio may be changed between calls without
+ *  discontinuities; filter state is carried across buffers.
+ */
+class Resampler {
+public:
+    //! Largest supported deviation of the ratio from 1.0
+    static constexpr double MAX_DEVIATION = 0.005;
+
+    /*! @param channels The number of channels
+     *  @param maxInput The most input frames that will be given to process() at once
+     *  @param taps Filter length
+     *  @param phases Filter phases to interpolate between
+     */
+    Resampler(size_t channels, size_t maxInput, size_t taps = 16, size_t phases = 32);
+
+    //! Set the ratio of output frames to input frames
+    void setRatio(double ratio);
+    double getRatio() const { return mRatio; }
+
+    //! Group delay of the filter, in frames
+    size_t latency() const { return mTaps/2; }
+
+    //! The most output frames that could be produced from n input frames
+    size_t maxOutput(size_t n) const;
+
+    /*! @brief Resample a block
+     *
+     *  @param in The input buffer
+     *  @param n The number of input frames; no more than maxInput
+     *  @param out The output buffer; must hold at least maxOutput(n) frames
+     *  @returns the number of output frames produced
+     */
+    size_t process(const Buffer& in, size_t n, Buffer& out);
+
+private:
+    size_t mChannels, mTaps, mPhases;
+
+    //! Filter bank; (mPhases + 1) rows of mTaps coefficients
+    std::vector<float> mFilter;
+
+    //! Per-channel input history, allocated up front for the most input
+    std::vector<std::vector<float>> mHistory;
+    //! Number of valid frames in each history
+    size_t mHistLen;
+
+    //! Input frames per output frame
+    double mStep;
+    double mRatio;
+    //! Position of the next output frame within the history
+    double mPos;
+
+    //! Scratch for the interpolated filter
+    std::vector<float> mKernel;
+};
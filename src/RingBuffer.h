@@ -0,0 +1,68 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/*! @brief Lock-free single-producer, single-consumer ring buffer
+ *
+ *  The producer and consumer may each be on their own thread; neither side
+ *  ever blocks or allocates.
+ */
+template<typename T>
+class RingBuffer {
+public:
+    //! Create a ring buffer holding at least the given number of elements
+    RingBuffer(size_t capacity): mHead(0), mTail(0) {
+        size_t size = 1;
+        while (size < capacity + 1) {
+            size <<= 1;
+        }
+        mData.resize(size);
+        mMask = size - 1;
+    }
+
+    //! The number of elements that can be written without overflowing
+    size_t writeAvailable() const {
+        return mMask - ((mHead.load(std::memory_order_relaxed)
+                         - mTail.load(std::memory_order_acquire)) & mMask);
+    }
+
+    //! The number of elements waiting to be read
+    size_t readAvailable() const {
+        return (mHead.load(std::memory_order_acquire)
+                - mTail.load(std::memory_order_relaxed)) & mMask;
+    }
+
+    /*! @brief Write elements (producer side)
+     *  @returns the number actually written
+     */
+    size_t write(const T *data, size_t n) {
+        n = std::min(n, writeAvailable());
+        size_t head = mHead.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < n; i++) {
+            mData[(head + i) & mMask] = data[i];
+        }
+        mHead.store((head + n) & mMask, std::memory_order_release);
+        return n;
+    }
+
+    /*! @brief Read elements (consumer side)
+     *  @returns the number actually read
+     */
+    size_t read(T *data, size_t n) {
+        n = std::min(n, readAvailable());
+        size_t tail = mTail.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < n; i++) {
+            data[i] = mData[(tail + i) & mMask];
+        }
+        mTail.store((tail + n) & mMask, std::memory_order_release);
+        return n;
+    }
+
+private:
+    std::vector<T> mData;
+    size_t mMask;
+    std::atomic<size_t> mHead, mTail;
+};
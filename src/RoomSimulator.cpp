@@ -0,0 +1,419 @@
+#include "RoomSimulator.h"
+
+#include <boost/throw_exception.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+#include <time.h>
+
+namespace {
+double getTime(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+}
+
+RoomSimulator::Params::Params():
+    delay(0.01),
+    gain(0.5),
+    crosstalk(0.3),
+    reverb(0.4),
+    reverbLevel(0.5),
+    noise(0.002),
+    resonance(120),
+    resonanceGain(6),
+    resonanceQ(4),
+    events(2),
+    stalls(1),
+    seed(1)
+{}
+
+RoomSimulator::RoomSimulator(const Params& params, unsigned int sampleRate, size_t channels,
+                             size_t blockSize):
+    mParams(params),
+    mSampleRate(sampleRate),
+    mChannels(channels),
+    mBlockSize(blockSize),
+    mDelay(params.delay*sampleRate),
+    mDelayLine(channels, std::vector<float>(mDelay + blockSize)),
+    mDelayPos(0),
+    mFFT(blockSize*2),
+    mFDLPos(0),
+    mPrevious((channels + 1)/2, std::vector<Complex>(blockSize)),
+    mWork(blockSize*2),
+    mAccum(blockSize*2),
+    mWet(channels, std::vector<float>(blockSize)),
+    mB0(1), mB1(0), mB2(0), mA1(0), mA2(0),
+    mX1(channels), mX2(channels), mY1(channels), mY2(channels),
+    mEventLevel(channels),
+    mEventDecay(exp(-1/(0.15*sampleRate))),
+    mRandom(params.seed),
+    mNoiseTable(1 << 16),
+    mClipped(0),
+    mPlayed(NULL, blockSize, channels),
+    mCaptured(NULL, blockSize, channels),
+    mTime(0),
+    mBufferSize(blockSize*2),
+    mPlaying(false),
+    mCaptureXrun(false),
+    mPlaybackXrun(false),
+    mStalling(false),
+    mPaceStart(0),
+    mCpuTime(0)
+{
+    std::normal_distribution<float> gaussian;
+    for (auto& n : mNoiseTable) {
+        n = gaussian(mRandom);
+    }
+
+    // split the impulse response up into block-sized partitions
+    const std::vector<float> ir = impulse();
+    const size_t partitions = (ir.size() + blockSize - 1)/blockSize;
+    mPartitions.resize(partitions, std::vector<Complex>(blockSize*2));
+    for (size_t p = 0; p < partitions; p++) {
+        for (size_t i = 0; i < blockSize && p*blockSize + i < ir.size(); i++) {
+            mPartitions[p][i] = ir[p*blockSize + i];
+        }
+        mFFT.forward(&mPartitions[p][0]);
+    }
+    mFDL.resize((channels + 1)/2,
+                std::vector<std::vector<Complex>>(partitions, std::vector<Complex>(blockSize*2)));
+
+    // the room mode is a peaking EQ (per the RBJ cookbook)
+    if (params.resonance > 0) {
+        const double A = pow(10, params.resonanceGain/40);
+        const double w0 = 2*M_PI*params.resonance/sampleRate;
+        const double alpha = sin(w0)/(2*params.resonanceQ);
+        const double a0 = 1 + alpha/A;
+        mB0 = (1 + alpha*A)/a0;
+        mB1 = -2*cos(w0)/a0;
+        mB2 = (1 - alpha*A)/a0;
+        mA1 = -2*cos(w0)/a0;
+        mA2 = (1 - alpha/A)/a0;
+    }
+}
+
+std::vector<float> RoomSimulator::impulse() const {
+    std::vector<float> ir;
+
+    if (!mParams.impulseFile.empty()) {
+        std::ifstream in(mParams.impulseFile, std::ios::binary);
+        if (!in) {
+            BOOST_THROW_EXCEPTION(std::runtime_error("Couldn't open impulse response "
+                                                     + mParams.impulseFile));
+        }
+        int16_t sample;
+        float peak = 0;
+        while (in.read(reinterpret_cast<char *>(&sample), sizeof(sample))) {
+            ir.push_back(sample);
+            peak = std::max(peak, std::abs(ir.back()));
+        }
+        if (peak == 0) {
+            BOOST_THROW_EXCEPTION(std::runtime_error("Impulse response " + mParams.impulseFile
+                                                     + " is silent"));
+        }
+        for (auto& s : ir) {
+            s /= peak;
+        }
+        return ir;
+    }
+
+    // the direct path, then an exponentially decaying noise tail after the
+    // first reflections arrive
+    ir.push_back(1);
+    const size_t length = mParams.reverb*mSampleRate;
+    const size_t predelay = mSampleRate/200;
+    if (length <= predelay || mParams.reverbLevel <= 0) {
+        return ir;
+    }
+
+    std::mt19937 rng(mParams.seed + 1);
+    std::normal_distribution<float> gaussian;
+    ir.resize(length);
+    double energy = 0;
+    for (size_t i = predelay; i < length; i++) {
+        // RT60 is the time it takes to drop by 60dB
+        ir[i] = gaussian(rng)*exp(-6.9*i/length);
+        energy += ir[i]*ir[i];
+    }
+    const double scale = mParams.reverbLevel/sqrt(energy);
+    for (size_t i = predelay; i < length; i++) {
+        ir[i] *= scale;
+    }
+    return ir;
+}
+
+void RoomSimulator::process(const Buffer& played, Buffer& captured) {
+    const size_t B = mBlockSize;
+    const size_t partitions = mPartitions.size();
+    const size_t delaySize = mDelayLine[0].size();
+
+    // each microphone hears its own speaker, and some of the others
+    for (size_t i = 0; i < B; i++) {
+        const size_t pos = (mDelayPos + mDelay + i) % delaySize;
+        auto in = played.at(i);
+        for (size_t c = 0; c < mChannels; c++) {
+            float mix = 0;
+            for (size_t s = 0; s < mChannels; s++) {
+                mix += in[s]*(s == c ? 1 : mParams.crosstalk);
+            }
+            mDelayLine[c][pos] = mix*mParams.gain/32768;
+        }
+    }
+
+    for (size_t pair = 0; pair < mFDL.size(); pair++) {
+        const size_t left = pair*2, right = left + 1;
+
+        // overlap-save: transform the previous block and this one together
+        std::copy(mPrevious[pair].begin(), mPrevious[pair].end(), mWork.begin());
+        for (size_t i = 0; i < B; i++) {
+            const size_t pos = (mDelayPos + i) % delaySize;
+            mPrevious[pair][i] = Complex(mDelayLine[left][pos],
+                                         right < mChannels ? mDelayLine[right][pos] : 0);
+        }
+        std::copy(mPrevious[pair].begin(), mPrevious[pair].end(), mWork.begin() + B);
+        mFFT.forward(&mWork[0]);
+        mFDL[pair][mFDLPos] = mWork;
+
+        // multiply each partition by the block that's as old as it is late
+        std::fill(mAccum.begin(), mAccum.end(), Complex(0));
+        float *acc = reinterpret_cast<float *>(&mAccum[0]);
+        for (size_t p = 0; p < partitions; p++) {
+            const float *x = reinterpret_cast<const float *>(
+                &mFDL[pair][(mFDLPos + partitions - p) % partitions][0]);
+            const float *h = reinterpret_cast<const float *>(&mPartitions[p][0]);
+#pragma omp simd
+            for (size_t i = 0; i < 2*B; i++) {
+                const float xr = x[2*i], xi = x[2*i + 1];
+                const float hr = h[2*i], hi = h[2*i + 1];
+                acc[2*i] += xr*hr - xi*hi;
+                acc[2*i + 1] += xr*hi + xi*hr;
+            }
+        }
+        mFFT.inverse(&mAccum[0]);
+
+        // the second half is the part that didn't wrap around
+        for (size_t i = 0; i < B; i++) {
+            mWet[left][i] = mAccum[B + i].real();
+            if (right < mChannels) {
+                mWet[right][i] = mAccum[B + i].imag();
+            }
+        }
+    }
+    mFDLPos = (mFDLPos + 1) % partitions;
+
+    const double eventChance = mParams.events/60*B/mSampleRate;
+    if (std::uniform_real_distribution<double>()(mRandom) < eventChance) {
+        mEventLevel[mRandom() % mChannels] = 0.3;
+    }
+
+    for (size_t c = 0; c < mChannels; c++) {
+        double x1 = mX1[c], x2 = mX2[c], y1 = mY1[c], y2 = mY2[c];
+        double event = mEventLevel[c];
+        // gaussian noise is expensive to make, so read it from a random spot in the table
+        const size_t noiseMask = mNoiseTable.size() - 1;
+        size_t noisePos = mRandom() & noiseMask;
+        for (size_t i = 0; i < B; i++) {
+            const double x = mWet[c][i];
+            const double y = mB0*x + mB1*x1 + mB2*x2 - mA1*y1 - mA2*y2;
+            x2 = x1;
+            x1 = x;
+            y2 = y1;
+            y1 = y;
+
+            double v = y + (mParams.noise + event)*mNoiseTable[noisePos++ & noiseMask];
+            event *= mEventDecay;
+
+            v = round(v*32768);
+            if (v > 32767 || v < -32768) {
+                v = std::max(-32768.0, std::min(32767.0, v));
+                ++mClipped;
+            }
+            captured.at(i)[c] = v;
+        }
+        mX1[c] = x1;
+        mX2[c] = x2;
+        mY1[c] = y1;
+        mY2[c] = y2;
+        mEventLevel[c] = event < 1e-4 ? 0 : event;
+    }
+
+    mDelayPos = (mDelayPos + B) % delaySize;
+}
+
+void RoomSimulator::step() {
+    const size_t n = mBlockSize*mChannels;
+
+    // the speakers play silence until playback has filled up, and run dry if
+    // it doesn't keep up after that
+    if (mPlaying && mPlayQueue.size() < n) {
+        mPlaybackXrun = true;
+        mPlaying = false;
+        mPlayQueue.clear();
+    }
+    if (mPlaying) {
+        std::copy(mPlayQueue.begin(), mPlayQueue.begin() + n, mPlayed.begin());
+        mPlayQueue.erase(mPlayQueue.begin(), mPlayQueue.begin() + n);
+    } else {
+        std::fill(mPlayed.begin(), mPlayed.end(), 0);
+    }
+
+    const double cpu = getTime(CLOCK_THREAD_CPUTIME_ID);
+    process(mPlayed, mCaptured);
+    // only the loop's thread writes it
+    mCpuTime.store(mCpuTime + getTime(CLOCK_THREAD_CPUTIME_ID) - cpu);
+    mTime += mBlockSize;
+
+    // and the microphones overrun if nobody reads them in time
+    if (!mCaptureXrun) {
+        mCaptureQueue.insert(mCaptureQueue.end(), mCaptured.begin(), mCaptured.end());
+        if (mCaptureQueue.size() > mBufferSize*mChannels) {
+            mCaptureXrun = true;
+            mCaptureQueue.clear();
+        }
+    }
+}
+
+void RoomSimulator::pace(bool paced) {
+    mPaceStart = paced ? getTime(CLOCK_MONOTONIC) - now() : 0;
+}
+
+void RoomSimulator::keepPace() const {
+    if (mPaceStart > 0) {
+        const double wait = mPaceStart + now() - getTime(CLOCK_MONOTONIC);
+        if (wait > 0) {
+            std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+        }
+    }
+}
+
+//! One side of the simulated sound card
+class RoomSimulator::Device final: public AudioDevice {
+public:
+    Device(RoomSimulator& room, bool capture): mRoom(room), mCapture(capture) {}
+
+    void configure(size_t channels, unsigned int sampleRate, unsigned int latency) override {
+        if (channels != mRoom.mChannels || sampleRate != mRoom.mSampleRate) {
+            BOOST_THROW_EXCEPTION(std::runtime_error("The simulated room has a different format"));
+        }
+        // a couple of blocks at least, or playback would run dry between them
+        mRoom.mBufferSize = std::max<size_t>(latency*1e-6*sampleRate, mRoom.mBlockSize*2);
+        drop();
+        prepare();
+    }
+
+    void wait() override {}
+
+    long read(int16_t *data, size_t frames) override {
+        const size_t n = frames*mRoom.mChannels;
+        if (!mCapture) {
+            return -EBADFD;
+        }
+
+        // now and then the loop gets held up for longer than the buffers last
+        const double stallChance = mRoom.mParams.stalls/60*frames/mRoom.mSampleRate;
+        if (mRoom.mStalling && std::uniform_real_distribution<double>()(mRoom.mRandom) < stallChance) {
+            const size_t stall = mRoom.mBufferSize + mRoom.mRandom() % mRoom.mBufferSize;
+            for (size_t t = 0; t < stall; t += mRoom.mBlockSize) {
+                mRoom.step();
+            }
+        }
+
+        while (mRoom.mCaptureQueue.size() < n && !mRoom.mCaptureXrun) {
+            mRoom.step();
+        }
+        mRoom.keepPace();
+        if (mRoom.mCaptureXrun) {
+            return -EPIPE;
+        }
+        std::copy(mRoom.mCaptureQueue.begin(), mRoom.mCaptureQueue.begin() + n, data);
+        mRoom.mCaptureQueue.erase(mRoom.mCaptureQueue.begin(), mRoom.mCaptureQueue.begin() + n);
+        return frames;
+    }
+
+    long write(const int16_t *data, size_t frames) override {
+        if (mCapture) {
+            return -EBADFD;
+        }
+        if (mRoom.mPlaybackXrun) {
+            return -EPIPE;
+        }
+        mRoom.mPlayQueue.insert(mRoom.mPlayQueue.end(), data, data + frames*mRoom.mChannels);
+        if (mRoom.mPlayQueue.size() >= mRoom.mBufferSize*mRoom.mChannels) {
+            mRoom.mPlaying = true;
+        }
+        return frames;
+    }
+
+    int recover(int err) override {
+        if (err != -EPIPE) {
+            return err;
+        }
+        drop();
+        prepare();
+        return 0;
+    }
+
+    void drop() override {
+        if (mCapture) {
+            mRoom.mCaptureQueue.clear();
+        } else {
+            mRoom.mPlayQueue.clear();
+            mRoom.mPlaying = false;
+        }
+    }
+
+    void prepare() override {
+        (mCapture ? mRoom.mCaptureXrun : mRoom.mPlaybackXrun) = false;
+    }
+
+    bool ready(size_t) override {
+        // the room waits for the loop, rather than the other way around
+        return true;
+    }
+
+    void pollDescriptors(std::vector<struct pollfd>&) override {}
+
+    bool params(long& bufferSize, long& periodSize) override {
+        bufferSize = mRoom.mBufferSize;
+        periodSize = mRoom.mBlockSize;
+        return true;
+    }
+
+    bool enableTimestamps() override {
+        return true;
+    }
+
+    bool timestamp(long& avail, double& time) override {
+        avail = mCapture ? queued() : mRoom.mBufferSize - queued();
+        time = now();
+        return true;
+    }
+
+    bool delay(long& frames) override {
+        frames = queued();
+        return true;
+    }
+
+    double now() const override {
+        return mRoom.now();
+    }
+
+private:
+    RoomSimulator& mRoom;
+    bool mCapture;
+
+    long queued() const {
+        return (mCapture ? mRoom.mCaptureQueue : mRoom.mPlayQueue).size()/mRoom.mChannels;
+    }
+};
+
+AudioDevice::Ptr RoomSimulator::device(bool capture) {
+    return AudioDevice::Ptr(new Device(*this, capture));
+}
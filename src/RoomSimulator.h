@@ -0,0 +1,180 @@
+#pragma once
+
+#include "AudioDevice.h"
+#include "Buffer.h"
+#include "FFT.h"
+
+#include <atomic>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+/*! @brief A stand-in for the speakers, the room and the microphones
+ *
+ *  Takes what would have been played, and works out what the microphones
+ *  would pick up: each speaker reaches each microphone after a delay, goes
+ *  through the room's impulse response and a resonant room mode, and gets
+ *  some background noise and the occasional loud event (a clap, a shout)
+ *  added to it.
+ *
+ *  The impulse response is applied with uniformly-partitioned overlap-save
+ *  convolution, one partition per block, so a long reverb tail only costs
+ *  a complex multiply-add per bin per partition. Channels are packed in
+ *  pairs into the real and imaginary parts of a single transform, since
+ *  they all share the same room.
+ *
+ *  The loop runs against the room through a capture and a playback
+ *  AudioDevice, which behave like a sound card: playback starts once its
+ *  buffer has filled, capture overruns if it isn't read in time, and so on.
+ *  The room only moves on when the loop reads from it, so it runs as fast
+ *  as the loop can go, and the devices tell the time by how far it's got.
+ *  It can be paced to the wall clock instead, for measuring the loop as it
+ *  would run against a sound card.
+ */
+class RoomSimulator {
+public:
+    struct Params {
+        //! Speaker to microphone delay, in seconds
+        double delay;
+        //! Level of the direct path from each speaker to its own microphone
+        double gain;
+        //! Level of the path from each speaker to the other microphones, relative to gain
+        double crosstalk;
+        //! Reverberation time (RT60), in seconds; 0 for none
+        double reverb;
+        //! Level of the reverb tail, relative to the direct path (by total energy)
+        double reverbLevel;
+        /*! @brief A measured impulse response to use instead of the synthetic one
+         *
+         *  Raw 16-bit mono PCM at the engine's sample rate; it gets scaled
+         *  so that its peak is 1.
+         */
+        std::string impulseFile;
+        //! Background noise level (RMS, as a fraction of full scale)
+        double noise;
+        //! Room mode frequency, in Hz; 0 for none
+        double resonance;
+        //! Room mode boost, in dB
+        double resonanceGain;
+        //! Room mode Q
+        double resonanceQ;
+        //! Average number of loud events per minute
+        double events;
+        //! Average number of times a minute the loop gets held up for long enough to cause xruns
+        double stalls;
+        //! Random seed, so that runs are repeatable
+        unsigned int seed;
+
+        Params();
+    };
+
+    /*! @param params The room
+     *  @param sampleRate The sample rate
+     *  @param channels Number of speakers, and of microphones
+     *  @param blockSize How many frames go through at a time
+     */
+    RoomSimulator(const Params& params, unsigned int sampleRate, size_t channels,
+                  size_t blockSize);
+
+    /*! @brief Run one block through the room
+     *
+     *  @param played What the speakers played; blockSize frames
+     *  @param captured Where to put what the microphones picked up
+     */
+    void process(const Buffer& played, Buffer& captured);
+
+    //! The delay from a speaker to a microphone, in frames, including the block
+    size_t latency() const { return mDelay + mBlockSize; }
+
+    //! How many captured samples had to be clipped
+    uint64_t clipped() const { return mClipped; }
+
+    //! The impulse response, with the direct path at 0
+    std::vector<float> impulse() const;
+
+    /*! @brief Make a capture or playback device for the loop to run against
+     *
+     *  There's one of each at a time, and they have to go before the room does.
+     */
+    AudioDevice::Ptr device(bool capture);
+
+    //! How long the room has been running for, in seconds
+    double now() const { return mTime*1.0/mSampleRate; }
+
+    //! Start or stop holding up the loop now and then (see Params::stalls)
+    void enableStalls(bool enable) { mStalling = enable; }
+
+    /*! @brief Keep to the wall clock, or go as fast as the loop can
+     *
+     *  When paced, a capture read blocks until the room would have got that
+     *  far in real time, the way a sound card's does.
+     */
+    void pace(bool paced);
+
+    //! CPU time the room itself has used, in seconds, to tell it apart from the loop's
+    double cpuTime() const { return mCpuTime; }
+
+private:
+    typedef FFT::Complex Complex;
+    class Device;
+
+    Params mParams;
+    unsigned int mSampleRate;
+    size_t mChannels;
+    size_t mBlockSize;
+
+    //! Delay line for each microphone's mix of the speakers
+    size_t mDelay;
+    std::vector<std::vector<float>> mDelayLine;
+    size_t mDelayPos;
+
+    //! Transform of each partition of the impulse response
+    FFT mFFT;
+    std::vector<std::vector<Complex>> mPartitions;
+    //! Transforms of recent input blocks for each channel pair, newest at mFDLPos
+    std::vector<std::vector<std::vector<Complex>>> mFDL;
+    size_t mFDLPos;
+    //! The previous input block for each pair (overlap-save)
+    std::vector<std::vector<Complex>> mPrevious;
+    std::vector<Complex> mWork, mAccum;
+    //! Each microphone's signal after the impulse response
+    std::vector<std::vector<float>> mWet;
+
+    //! Room mode (peaking biquad) coefficients and per-channel state
+    double mB0, mB1, mB2, mA1, mA2;
+    std::vector<double> mX1, mX2, mY1, mY2;
+
+    //! Events in progress, per channel
+    std::vector<double> mEventLevel;
+    double mEventDecay;
+
+    std::mt19937 mRandom;
+    //! Unit gaussian noise; the size is a power of two
+    std::vector<float> mNoiseTable;
+    uint64_t mClipped;
+
+    //! What's been played but hasn't gone through the room yet, and what has
+    //! but hasn't been captured yet (both interleaved)
+    std::vector<int16_t> mPlayQueue, mCaptureQueue;
+    //! One block going into the room, and coming out of it
+    Buffer mPlayed, mCaptured;
+    //! How many frames the room has run for
+    uint64_t mTime;
+    //! How much each device buffers, in frames
+    size_t mBufferSize;
+    //! Whether playback has filled up its buffer and started
+    bool mPlaying;
+    //! Whether each device has had an xrun and hasn't been recovered yet
+    bool mCaptureXrun, mPlaybackXrun;
+    //! Whether to hold the loop up now and then
+    bool mStalling;
+    //! When the room would have started, by the wall clock, if it's paced; 0 if not
+    double mPaceStart;
+    std::atomic<double> mCpuTime;
+
+    //! Run the next block of whatever's been played through the room
+    void step();
+    //! Wait for the wall clock to catch up with the room, if it's paced
+    void keepPace() const;
+};
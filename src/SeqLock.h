@@ -0,0 +1,88 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+
+/*! @brief Seqlock over a run of shared memory words
+ *
+ *  The one writer bumps a sequence number to odd, stores the words, and
+ *  bumps it back to even; readers copy the words and retry if the number
+ *  was odd or changed underneath them. The writer never waits on anyone.
+ *  Everything is copied a word at a time through relaxed atomics, so
+ *  readers can be in other processes and a torn copy is harmless.
+ */
+namespace SeqLock {
+
+//! How long a reader keeps retrying before deciding the writer died partway through
+const size_t MAX_TRIES = 100000;
+
+//! Words needed to hold a number of bytes
+inline size_t wordsFor(size_t bytes) {
+    return (bytes + sizeof(uint64_t) - 1)/sizeof(uint64_t);
+}
+
+//! Copy bytes into shared words
+inline void storeWords(std::atomic<uint64_t> *dst, const void *src, size_t bytes) {
+    const char *p = static_cast<const char *>(src);
+    for (size_t i = 0; i*sizeof(uint64_t) < bytes; i++) {
+        uint64_t w = 0;
+        memcpy(&w, p + i*sizeof(uint64_t), std::min(sizeof(uint64_t), bytes - i*sizeof(uint64_t)));
+        dst[i].store(w, std::memory_order_relaxed);
+    }
+}
+
+//! Copy bytes out of shared words
+inline void loadWords(void *dst, const std::atomic<uint64_t> *src, size_t bytes) {
+    char *p = static_cast<char *>(dst);
+    for (size_t i = 0; i*sizeof(uint64_t) < bytes; i++) {
+        const uint64_t w = src[i].load(std::memory_order_relaxed);
+        memcpy(p + i*sizeof(uint64_t), &w, std::min(sizeof(uint64_t), bytes - i*sizeof(uint64_t)));
+    }
+}
+
+/*! @brief Publish under the seqlock (writer only)
+ *
+ *  @param store Stores the words, with storeWords
+ */
+template<typename F>
+void write(std::atomic<uint64_t>& sequence, F store) {
+    const uint64_t seq = sequence.load(std::memory_order_relaxed);
+    sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    store();
+    sequence.store(seq + 2, std::memory_order_release);
+}
+
+/*! @brief Take a consistent copy (reader only)
+ *
+ *  @param load Copies the words out, with loadWords
+ *  @returns the sequence number the copy was taken at, which goes up by
+ *  two with every write; 0 if nothing has been written yet, or the writer
+ *  is stuck partway through writing
+ */
+template<typename F>
+uint64_t read(const std::atomic<uint64_t>& sequence, F load) {
+    uint64_t before, after = 0;
+    size_t tries = 0;
+    do {
+        if (++tries > MAX_TRIES) {
+            return 0;
+        }
+        before = sequence.load(std::memory_order_acquire);
+        if (before & 1) {
+            // no point copying it all while it's being written
+            std::this_thread::yield();
+            continue;
+        }
+        load();
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = sequence.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+    return before;
+}
+
+}
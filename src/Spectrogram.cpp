@@ -0,0 +1,117 @@
+#include "Spectrogram.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+constexpr double Spectrogram::FLOOR_DB;
+
+Spectrogram::Spectrogram(unsigned int sampleRate, size_t maxFrames,
+                         size_t hop, size_t rows, size_t fftSize):
+    mSampleRate(sampleRate),
+    mHop(std::max<size_t>(hop, 1)),
+    mRows(rows),
+    mFeed(sampleRate*2, maxFrames),
+    mFFT(fftSize),
+    mWindow(fftSize),
+    mRowData(rows*fftSize),
+    mRowCount(0),
+    mRunning(false),
+    mHistory(std::max(fftSize, mHop)),
+    mPending(0),
+    mWindowed(fftSize),
+    mSpectrum(fftSize/2 + 1)
+{
+    // Hann window
+    for (size_t i = 0; i < fftSize; i++) {
+        mWindow[i] = 0.5 - 0.5*cos(2*M_PI*i/fftSize);
+    }
+}
+
+Spectrogram::~Spectrogram() {
+    stop();
+}
+
+void Spectrogram::start() {
+    if (mRunning) {
+        return;
+    }
+    mRunning = true;
+    mThread = std::thread([this]() { worker(); });
+}
+
+void Spectrogram::stop() {
+    mRunning = false;
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+}
+
+void Spectrogram::push(const Buffer& played, const Buffer& recorded, size_t frames) {
+    mFeed.push(played, recorded, frames, 1.0f/(32768*played.channels()));
+}
+
+void Spectrogram::worker() {
+    const auto nap = std::chrono::microseconds(
+        std::max<size_t>(1000, mHop*500000/mSampleRate));
+
+    while (mRunning) {
+        std::this_thread::sleep_for(nap);
+        process();
+    }
+}
+
+size_t Spectrogram::process() {
+    if (mFeed.interrupted()) {
+        mPending = 0;
+    }
+
+    // slide each hop's worth onto the end of the history and analyze it
+    size_t produced = 0;
+    size_t avail;
+    while ((avail = mFeed.readAvailable()) > 0) {
+        const size_t n = std::min(avail, mHop - mPending);
+        if (!mPending) {
+            std::copy(mHistory.begin() + mHop, mHistory.end(), mHistory.begin());
+        }
+        mFeed.read(&mHistory[mHistory.size() - mHop + mPending], n);
+        mPending += n;
+        if (mPending == mHop) {
+            analyze();
+            mPending = 0;
+            ++produced;
+        }
+    }
+    return produced;
+}
+
+void Spectrogram::analyze() {
+    const size_t n = mFFT.size();
+    const Frame *latest = &mHistory[mHistory.size() - n];
+    float *row = &mRowData[(mRowCount.load(std::memory_order_relaxed) % mRows)*bins()*2];
+
+    levels(&latest->recorded, row, sizeof(Frame)/sizeof(float));
+    levels(&latest->played, row + 1, sizeof(Frame)/sizeof(float));
+
+    mRowCount.fetch_add(1, std::memory_order_release);
+}
+
+void Spectrogram::levels(const float *signal, float *out, size_t stride) {
+    const size_t n = mFFT.size();
+    const float *window = &mWindow[0];
+    float *windowed = &mWindowed[0];
+#pragma omp simd
+    for (size_t i = 0; i < n; i++) {
+        windowed[i] = signal[i*stride]*window[i];
+    }
+
+    mFFT.forward(windowed, &mSpectrum[0]);
+
+    // a full-scale sine comes out at n/4 through a Hann window
+    const float norm = 4.0f/n;
+    for (size_t b = 0; b < bins(); b++) {
+        const float mag = std::abs(mSpectrum[b])*norm;
+        const float db = 20*log10f(mag + 1e-9f);
+        out[b*2] = std::max(0.0f, std::min(1.0f, static_cast<float>(1 - db/FLOOR_DB)));
+    }
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "Buffer.h"
+#include "DuplexFeed.h"
+#include "FFT.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/*! @brief Streaming spectrogram of what's being played and recorded
+ *
+ *  The audio thread hands over each cycle's audio through a lock-free ring,
+ *  and a worker thread runs a windowed FFT every hop frames. Each result is
+ *  a row of log-magnitude levels, kept in a ring of rows for the visualizer
+ *  to pick up.
+ *
+ *  The rows ring isn't locked; a reader that falls a whole ring behind may
+ *  see a row being overwritten, which just looks like a glitch on screen.
+ */
+class Spectrogram {
+public:
+    //! Quietest level shown, in dB relative to full scale
+    static constexpr double FLOOR_DB = -90;
+
+    /*! @param sampleRate The sample rate
+     *  @param maxFrames The most frames that will be pushed in one cycle
+     *  @param hop Frames between rows
+     *  @param rows Rows to keep
+     *  @param fftSize Analysis window size; must be a power of two
+     */
+    Spectrogram(unsigned int sampleRate, size_t maxFrames,
+                size_t hop, size_t rows, size_t fftSize = 1024);
+    ~Spectrogram();
+
+    //! Start the worker thread
+    void start();
+
+    //! Stop the worker thread
+    void stop();
+
+    /*! @brief Hand over a cycle's worth of audio (audio thread only)
+     *
+     *  Never blocks; if the worker has fallen behind, the audio is dropped.
+     */
+    void push(const Buffer& played, const Buffer& recorded, size_t frames);
+
+    /*! @brief Analyze everything that's been pushed so far
+     *
+     *  This is what the worker thread does; it's only safe to call directly
+     *  when the worker isn't running.
+     *
+     *  @returns the number of rows produced
+     */
+    size_t process();
+
+    //! Frequency bins per row
+    size_t bins() const { return mFFT.size()/2; }
+
+    //! Rows in the ring
+    size_t rows() const { return mRows; }
+
+    //! Total rows produced so far; row n lives in slot n % rows()
+    size_t rowCount() const { return mRowCount.load(std::memory_order_acquire); }
+
+    /*! @brief A row's levels
+     *
+     *  bins() pairs of (recorded, played), each 0 at FLOOR_DB to 1 at full scale.
+     */
+    const float *row(size_t slot) const { return &mRowData[slot*bins()*2]; }
+
+private:
+    typedef DuplexFeed::Frame Frame;
+
+    unsigned int mSampleRate;
+    size_t mHop, mRows;
+
+    DuplexFeed mFeed;
+
+    FFT mFFT;
+    std::vector<float> mWindow;
+    std::vector<float> mRowData;
+    std::atomic<size_t> mRowCount;
+
+    std::atomic<bool> mRunning;
+    std::thread mThread;
+
+    //! Worker-side history and scratch
+    std::vector<Frame> mHistory;
+    //! Frames of the current hop received so far
+    size_t mPending;
+    std::vector<float> mWindowed;
+    std::vector<FFT::Complex> mSpectrum;
+
+    void worker();
+    void analyze();
+    void levels(const float *signal, float *out, size_t stride);
+};
@@ -0,0 +1,228 @@
+#include "Stretcher.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+constexpr double Stretcher::MIN_SPEED;
+constexpr double Stretcher::MAX_SPEED;
+constexpr double Stretcher::MAX_PITCH;
+constexpr double Stretcher::GRAIN;
+constexpr double Stretcher::TOLERANCE;
+
+Stretcher::Stretcher(unsigned int sampleRate, size_t channels, size_t frames):
+    mSampleRate(sampleRate),
+    mChannels(channels),
+    mHop(std::max<size_t>(1, lround(sampleRate*GRAIN/2))),
+    mGrain(mHop*2),
+    mTolerance(lround(sampleRate*TOLERANCE)),
+    mOut(std::max(frames, mGrain*4), channels),
+    mWritePos(0),
+    mReady(0),
+    mReadPos(0),
+    mPrimed(false),
+    mCarrying(false),
+    mNominal(0),
+    mDrift(0),
+    mWindow(mGrain),
+    mSource(channels, std::vector<float>(mGrain*pow(2, MAX_PITCH/12) + 5)),
+    mShaped(channels, std::vector<float>(mGrain)),
+    mTail(channels, std::vector<float>(mHop)),
+    mRef(mHop*channels),
+    mCandidates((mHop + 2*mTolerance)*channels)
+{
+    // periodic, so that overlapping by half adds up to exactly 1
+    for (size_t i = 0; i < mGrain; i++) {
+        mWindow[i] = 0.5 - 0.5*cos(2*M_PI*i/mGrain);
+    }
+    configure(1, 0, 1);
+}
+
+void Stretcher::configure(double speed, double pitch, double range) {
+    mSpeed = std::max(MIN_SPEED, std::min(MAX_SPEED, speed));
+    mRate = pow(2, std::max(-MAX_PITCH, std::min(MAX_PITCH, pitch))/12);
+    mRange = std::max(0.0, range)*mSampleRate;
+}
+
+void Stretcher::reset() {
+    mPrimed = false;
+}
+
+void Stretcher::render(const Drum& drum, size_t playPos, size_t recPos, size_t readPos, size_t n) {
+    const size_t outSize = mOut.count();
+    readPos %= outSize;
+    if (!mPrimed) {
+        mWritePos = mReadPos = readPos;
+        mReady = 0;
+        mNominal = mDrift = 0;
+        mCarrying = false;
+        mPrimed = true;
+    }
+
+    // whatever's been read since last time is used up; if reading somehow
+    // got ahead of the stretching, start again from where it's got to
+    // rather than play whatever was left in the way
+    const size_t used = (readPos + outSize - mReadPos) % outSize;
+    mReadPos = readPos;
+    if (used > mReady) {
+        mWritePos = readPos;
+        mReady = 0;
+        mCarrying = false;
+    } else {
+        mReady -= used;
+    }
+
+    const size_t drumSize = drum.count();
+    const ssize_t ahead = (recPos + drumSize - playPos) % drumSize;
+    n = std::min(n, outSize - mGrain);
+    while (mReady < n) {
+        grain(drum, playPos + mReady, ahead - static_cast<ssize_t>(mReady));
+    }
+}
+
+void Stretcher::gather(const Drum& drum, ssize_t pos, size_t n, float *out) {
+    const ssize_t drumSize = drum.count();
+    const size_t channels = drum.channels();
+    pos = (pos % drumSize + drumSize) % drumSize;
+    for (size_t i = 0; i < n; i++) {
+        Buffer::const_iterator frame = drum.at(pos);
+        for (size_t c = 0; c < channels; c++) {
+            out[c*n + i] = frame[c];
+        }
+        if (++pos == drumSize) {
+            pos = 0;
+        }
+    }
+}
+
+ssize_t Stretcher::align() const {
+    const size_t n = mHop, span = 2*mTolerance, stride = n + span;
+
+    // every channel counts, rather than a mix that could cancel out;
+    // normalized by the candidate's energy only, since the reference is the
+    // same for all of them, and slid along rather than summed from scratch
+    double energy = 0;
+    for (size_t c = 0; c < mChannels; c++) {
+        const float *cand = &mCandidates[c*stride];
+        for (size_t j = 0; j < n; j++) {
+            energy += cand[j]*cand[j];
+        }
+    }
+
+    // staying put wins a tie, so that there's no nudging when nothing's
+    // being stretched
+    ssize_t best = mTolerance;
+    double bestScore = -std::numeric_limits<double>::infinity();
+    for (size_t i = 0; i <= span; i++) {
+        float corr = 0;
+        for (size_t c = 0; c < mChannels; c++) {
+            const float *ref = &mRef[c*n], *cand = &mCandidates[c*stride + i];
+#pragma omp simd reduction(+:corr)
+            for (size_t j = 0; j < n; j++) {
+                corr += ref[j]*cand[j];
+            }
+        }
+
+        const double score = corr/sqrt(std::max(0.0, energy) + 1);
+        if (score > bestScore || (i == mTolerance && score >= bestScore)) {
+            best = i;
+            bestScore = score;
+        }
+        if (i < span) {
+            for (size_t c = 0; c < mChannels; c++) {
+                const float *cand = &mCandidates[c*stride];
+                energy += cand[i + n]*cand[i + n] - cand[i]*cand[i];
+            }
+        }
+    }
+    return best - static_cast<ssize_t>(mTolerance);
+}
+
+void Stretcher::grain(const Drum& drum, size_t source, ssize_t ahead) {
+    const ssize_t drumSize = drum.count();
+    const double span = mGrain*mRate + 3;
+
+    // the grain, and anywhere it might get nudged to, has to stay clear of
+    // the record head on both sides
+    const double hi = std::min(mRange, ahead - span - mTolerance - mGrain);
+    const double lo = std::max(-mRange, static_cast<double>(ahead - drumSize) + mTolerance + mGrain + 1);
+
+    // where the last grain would have carried on to, and where the speed
+    // says this one should start; the nudges don't count towards the
+    // latter, or they'd wander off in whatever direction they lean
+    const double carry = mDrift + mHop*(mRate - 1);
+    double target = mNominal + mHop*(mSpeed - 1);
+    bool pulled = false;
+    if (target > hi || target < lo) {
+        target = std::max(lo, std::min(hi, 0.0));
+        pulled = true;
+    }
+    mNominal = target;
+
+    // when the speed and pitch agree, carrying on is already seamless
+    double drift = target;
+    if (mCarrying && (pulled || std::fabs(target - carry) >= 0.5)) {
+        const ssize_t nearest = lround(target);
+        gather(drum, source + lround(carry), mHop, mRef.data());
+        gather(drum, source + nearest - mTolerance, mHop + 2*mTolerance, mCandidates.data());
+        drift = nearest + align();
+    }
+    mDrift = drift;
+
+    // de-interleave the grain's worth of source, with a frame either side
+    // for the interpolation
+    const double start = source + drift;
+    const double whole = floor(start);
+    const float frac = start - whole;
+    const float rate = mRate;
+    const size_t frames = std::min<size_t>(frac + (mGrain - 1)*mRate, mSource[0].size() - 4) + 4;
+    ssize_t pos = (static_cast<ssize_t>(whole) - 1) % drumSize;
+    if (pos < 0) {
+        pos += drumSize;
+    }
+    for (size_t k = 0; k < frames; k++) {
+        Buffer::const_iterator frame = drum.at(pos);
+        for (size_t c = 0; c < mChannels; c++) {
+            mSource[c][k] = frame[c];
+        }
+        if (++pos == drumSize) {
+            pos = 0;
+        }
+    }
+
+    // Catmull-Rom; right on a frame, it's exactly that frame
+    const size_t last = frames - 4;
+    for (size_t c = 0; c < mChannels; c++) {
+        const float *src = mSource[c].data();
+        float *out = mShaped[c].data();
+#pragma omp simd
+        for (size_t i = 0; i < mGrain; i++) {
+            const float x = frac + i*rate;
+            const size_t j = std::min<size_t>(x, last);
+            const float t = x - j;
+            const float ym = src[j], y0 = src[j + 1], y1 = src[j + 2], y2 = src[j + 3];
+            const float c1 = 0.5f*(y1 - ym);
+            const float c2 = ym - 2.5f*y0 + 2*y1 - 0.5f*y2;
+            const float c3 = 0.5f*(y2 - ym) + 1.5f*(y0 - y1);
+            out[i] = ((c3*t + c2)*t + c1)*t + y0;
+        }
+    }
+
+    // the first half goes onto the end of the last grain, and the second
+    // half waits for the next one; with nothing to carry on from, it starts
+    // at full level, just as the plain play head would
+    const size_t outSize = mOut.count();
+    for (size_t i = 0; i < mHop; i++) {
+        Drum::iterator frame = mOut.at((mWritePos + i) % outSize);
+        for (size_t c = 0; c < mChannels; c++) {
+            const float *shaped = mShaped[c].data();
+            const float v = mCarrying ? mTail[c][i] + mWindow[i]*shaped[i] : shaped[i];
+            frame[c] = std::max(-32768L, std::min(32767L, lrintf(v)));
+            mTail[c][i] = mWindow[i + mHop]*shaped[i + mHop];
+        }
+    }
+
+    mWritePos = (mWritePos + mHop) % outSize;
+    mReady += mHop;
+    mCarrying = true;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "Drum.h"
+
+#include <vector>
+
+/*! @brief Real-time time stretching and pitch shifting of the loop (WSOLA)
+ *
+ *  The output is built out of Hann-windowed grains, overlapping by half, so
+ *  that they add back up to exactly what went in when nothing's being
+ *  stretched. Each grain is read from the drum with a fractional read head:
+ *  the pitch sets how fast it moves within a grain (with cubic
+ *  interpolation in between frames), and the speed sets how far it moves
+ *  on from one grain to the next. Where those don't agree, the next grain
+ *  gets nudged to wherever it lines up best with what the last one would
+ *  have carried on with, which is what keeps the seams from being heard.
+ *
+ *  The read head is kept as a drift from where the plain play head would
+ *  be. It can only go so far ahead before it runs into the recording, or
+ *  so far behind before it runs out of loop, so once it drifts further
+ *  than that it gets pulled back to the play head, at the next seam.
+ *
+ *  The stretched audio goes into a drum of its own, far enough ahead of
+ *  whatever's reading it for the limiter and the volume models to see what's
+ *  coming, and far enough behind for the room to still be hearing it.
+ */
+class Stretcher {
+public:
+    //! How far the speed can be turned down or up, as a ratio
+    static constexpr double MIN_SPEED = 0.5, MAX_SPEED = 2;
+    //! How far the pitch can be shifted either way, in semitones
+    static constexpr double MAX_PITCH = 12;
+
+    //! Length of a grain, in seconds; they start half that far apart
+    static constexpr double GRAIN = 0.02;
+    //! How far a grain can be nudged either way to line it up, in seconds
+    static constexpr double TOLERANCE = 0.005;
+
+    /*! @param sampleRate The sample rate
+     *  @param channels Channel count
+     *  @param frames How much stretched audio to keep around, in frames
+     */
+    Stretcher(unsigned int sampleRate, size_t channels, size_t frames);
+
+    /*! @brief Set the speed and pitch; they take effect from the next grain
+     *
+     *  @param speed How fast to get through the loop, as a ratio
+     *  @param pitch How far to shift the pitch, in semitones
+     *  @param range How far the read head can drift from the play head, in seconds
+     */
+    void configure(double speed, double pitch, double range);
+
+    //! Start over from the play head, e.g. when the output jumps
+    void reset();
+
+    /*! @brief Stretch enough of the loop for some of the output to be read
+     *
+     *  @param drum The loop
+     *  @param playPos Where the plain play head is, in the drum
+     *  @param recPos Where the record head is, in the drum
+     *  @param readPos Where the output is being read from, in output(); it
+     *      goes along with playPos
+     *  @param n How much past readPos has to be ready
+     */
+    void render(const Drum& drum, size_t playPos, size_t recPos, size_t readPos, size_t n);
+
+    //! The stretched audio
+    const Drum& output() const { return mOut; }
+
+    //! How far the read head has drifted from the play head, in frames
+    double drift() const { return mDrift; }
+
+private:
+    unsigned int mSampleRate;
+    size_t mChannels;
+    size_t mHop, mGrain, mTolerance;
+    //! The stretched audio, and where the next grain goes
+    Drum mOut;
+    size_t mWritePos;
+    //! How much is ready past where it was last read from, and where that was
+    size_t mReady, mReadPos;
+    //! Whether there's been a read to go from, and a grain to carry on from
+    bool mPrimed, mCarrying;
+
+    double mSpeed, mRate, mRange;
+    //! Where the speed alone would have the read head, and where it actually is, relative to the play head
+    double mNominal, mDrift;
+
+    std::vector<float> mWindow;
+    //! Per-channel source frames for a grain, the grain itself, and the second half of the last one
+    std::vector<std::vector<float>> mSource, mShaped, mTail;
+    //! What to line grains up with, and where they might line up, a channel after another
+    std::vector<float> mRef, mCandidates;
+
+    //! Copy n frames of the drum from pos, a channel after another
+    static void gather(const Drum& drum, ssize_t pos, size_t n, float *out);
+
+    //! Find the nudge that best lines up the candidates with the reference
+    ssize_t align() const;
+
+    /*! @brief Add the next grain onto the output
+     *
+     *  @param drum The loop
+     *  @param source Where the plain play head is for it
+     *  @param ahead How far it is from there to the record head
+     */
+    void grain(const Drum& drum, size_t source, ssize_t ahead);
+};
@@ -0,0 +1,327 @@
+#include "Trace.h"
+
+#include <boost/throw_exception.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+//! The last byte is the version; only this one can be read
+const char MAGIC[8] = { 'W', 'W', 'S', 'W', 'B', 'T', 'R', '9' };
+
+template<typename T>
+void put(std::ostream& out, const T& val) {
+    out.write(reinterpret_cast<const char *>(&val), sizeof(val));
+}
+
+template<typename T>
+bool get(std::istream& in, T& val) {
+    return !!in.read(reinterpret_cast<char *>(&val), sizeof(val));
+}
+
+void writeHeader(std::ostream& out, const Trace::Header& h) {
+    out.write(MAGIC, sizeof(MAGIC));
+    put(out, h.sampleRate);
+    put(out, h.channels);
+    put(out, h.bufSize);
+    put(out, h.maxFrames);
+    put(out, h.loopDelay);
+    put(out, h.latency);
+    put(out, h.maxLoopDelay);
+    put(out, h.eqSections);
+    for (int32_t offset : h.channelOffsets) {
+        put(out, offset);
+    }
+    put(out, h.stretch);
+    put(out, h.limiterLookahead);
+}
+
+Trace::Header readHeader(std::istream& in) {
+    char magic[sizeof(MAGIC)];
+    if (!in.read(magic, sizeof(magic)) || memcmp(magic, MAGIC, sizeof(MAGIC))) {
+        BOOST_THROW_EXCEPTION(std::runtime_error("Not a trace file, or not this version of one"));
+    }
+
+    Trace::Header h;
+    bool ok = get(in, h.sampleRate) && get(in, h.channels) && get(in, h.bufSize)
+        && get(in, h.maxFrames) && get(in, h.loopDelay) && get(in, h.latency)
+        && get(in, h.maxLoopDelay) && get(in, h.eqSections);
+    for (int32_t& offset : h.channelOffsets) {
+        ok = ok && get(in, offset);
+    }
+    ok = ok && get(in, h.stretch) && get(in, h.limiterLookahead);
+    if (!ok) {
+        BOOST_THROW_EXCEPTION(std::runtime_error("Not a trace file"));
+    }
+
+    // the reader sizes its buffer from these, so they have to make sense
+    if (h.channels == 0 || h.channels > Repeater::History::MAX_CHANNELS
+        || h.bufSize == 0 || h.maxFrames < h.bufSize) {
+        BOOST_THROW_EXCEPTION(std::runtime_error("Corrupt trace file"));
+    }
+    return h;
+}
+
+//! An enum value from a trace, which has to be one of the ones there are
+template<typename E>
+E checkEnum(double value, E count) {
+    if (!(value >= 0 && value < count)) {
+        BOOST_THROW_EXCEPTION(std::runtime_error("Corrupt trace file"));
+    }
+    return static_cast<E>(value);
+}
+}
+
+namespace Trace {
+
+Header::Header():
+    sampleRate(0),
+    channels(0),
+    bufSize(0),
+    maxFrames(0),
+    loopDelay(0),
+    latency(0),
+    maxLoopDelay(0),
+    eqSections(0),
+    stretch(0),
+    limiterLookahead(0)
+{
+    std::fill(channelOffsets, channelOffsets + Repeater::History::MAX_CHANNELS, 0);
+}
+
+Writer::Writer(const std::string& path, const Header& h): mOut(path, std::ios::binary) {
+    if (!mOut) {
+        BOOST_THROW_EXCEPTION(std::runtime_error("Couldn't open trace file " + path));
+    }
+    writeHeader(mOut, h);
+}
+
+void Writer::knobs(const Repeater::Knobs& k) {
+    const std::string text = formatKnobs(k);
+    put(mOut, static_cast<char>(E_KNOBS));
+    put(mOut, static_cast<uint32_t>(text.size()));
+    mOut.write(text.data(), text.size());
+}
+
+void Writer::latency(int latency) {
+    put(mOut, static_cast<char>(E_LATENCY));
+    put(mOut, static_cast<int32_t>(latency));
+}
+
+void Writer::resync(int captureLost, int playbackLost) {
+    put(mOut, static_cast<char>(E_RESYNC));
+    put(mOut, static_cast<int32_t>(captureLost));
+    put(mOut, static_cast<int32_t>(playbackLost));
+}
+
+void Writer::period(size_t period) {
+    put(mOut, static_cast<char>(E_PERIOD));
+    put(mOut, static_cast<uint32_t>(period));
+}
+
+void Writer::shutdown() {
+    put(mOut, static_cast<char>(E_SHUTDOWN));
+}
+
+void Writer::cycle(const Buffer& in, size_t frames) {
+    put(mOut, static_cast<char>(E_CYCLE));
+    put(mOut, static_cast<uint32_t>(frames));
+    mOut.write(reinterpret_cast<const char *>(&*in.begin()),
+               frames*in.channels()*sizeof(int16_t));
+}
+
+Reader::Reader(const std::string& path):
+    mIn(path, std::ios::binary),
+    mHeader(readHeader(mIn)),
+    mLatency(mHeader.latency),
+    mCaptureLost(0),
+    mPlaybackLost(0),
+    mPeriod(mHeader.bufSize),
+    mBuffer(NULL, mHeader.maxFrames, mHeader.channels),
+    mFrames(0)
+{}
+
+Event Reader::next() {
+    char tag;
+    if (!get(mIn, tag)) {
+        return E_END;
+    }
+
+    switch (tag) {
+    case E_KNOBS: {
+        uint32_t len;
+        std::string text;
+        if (get(mIn, len)) {
+            text.resize(len);
+            mIn.read(&text[0], len);
+        }
+        if (!mIn) {
+            return E_END;
+        }
+        mKnobs = parseKnobs(text);
+        return E_KNOBS;
+    }
+
+    case E_LATENCY: {
+        int32_t latency;
+        if (!get(mIn, latency)) {
+            return E_END;
+        }
+        mLatency = latency;
+        return E_LATENCY;
+    }
+
+    case E_RESYNC: {
+        int32_t captureLost, playbackLost;
+        if (!get(mIn, captureLost) || !get(mIn, playbackLost)) {
+            return E_END;
+        }
+        mCaptureLost = captureLost;
+        mPlaybackLost = playbackLost;
+        return E_RESYNC;
+    }
+
+    case E_PERIOD: {
+        uint32_t period;
+        if (!get(mIn, period)) {
+            return E_END;
+        }
+        // auto-tuning only ever goes below the configured period
+        if (period == 0 || period > mHeader.bufSize) {
+            BOOST_THROW_EXCEPTION(std::runtime_error("Corrupt trace file"));
+        }
+        mPeriod = period;
+        return E_PERIOD;
+    }
+
+    case E_SHUTDOWN:
+        return E_SHUTDOWN;
+
+    case E_CYCLE: {
+        uint32_t frames;
+        if (!get(mIn, frames) || frames > mBuffer.count()) {
+            return E_END;
+        }
+        mIn.read(reinterpret_cast<char *>(&*mBuffer.begin()),
+                 frames*mBuffer.channels()*sizeof(int16_t));
+        if (!mIn) {
+            return E_END;
+        }
+        mFrames = frames;
+        return E_CYCLE;
+    }
+
+    default:
+        BOOST_THROW_EXCEPTION(std::runtime_error("Corrupt trace file"));
+    }
+}
+
+std::string formatKnobs(const Repeater::Knobs& k) {
+    std::ostringstream out;
+    out.precision(17);
+    out << "dampen " << k.dampen << '\n'
+        << "feedbackThreshold " << k.feedbackThreshold << '\n'
+        << "limitPower " << k.limitPower << '\n'
+        << "mode " << k.mode << '\n'
+        << "ceiling " << k.ceiling << '\n'
+        << "lookahead " << k.lookahead << '\n'
+        << "ratio " << k.ratio << '\n'
+        << "attack " << k.attack << '\n'
+        << "release " << k.release << '\n'
+        << "loopDelay " << k.loopDelay << '\n'
+        << "power " << k.power << '\n'
+        << "loudnessGate " << k.loudnessGate << '\n'
+        << "speed " << k.speed << '\n'
+        << "pitch " << k.pitch << '\n'
+        << "stretchRange " << k.stretchRange << '\n'
+        << "idleLevel " << k.idleLevel << '\n'
+        << "idleAfter " << k.idleAfter << '\n';
+    for (size_t m = 0; m < k.levels.size(); m++) {
+        out << "level." << m << ' ' << k.levels[m] << '\n';
+    }
+    for (size_t b = 0; b < k.eq.size(); b++) {
+        const Equalizer::Band& band = k.eq[b];
+        if (band.type != Equalizer::T_OFF) {
+            out << "eq." << b << ".type " << band.type << '\n'
+                << "eq." << b << ".channel " << band.channel << '\n'
+                << "eq." << b << ".freq " << band.freq << '\n'
+                << "eq." << b << ".gain " << band.gain << '\n'
+                << "eq." << b << ".q " << band.q << '\n';
+        }
+    }
+    return out.str();
+}
+
+Repeater::Knobs parseKnobs(const std::string& text) {
+    Repeater::Knobs k;
+    std::istringstream in(text);
+    std::string key;
+    double value;
+    while (in >> key >> value) {
+        if (key == "dampen") {
+            k.dampen = value;
+        } else if (key == "feedbackThreshold") {
+            k.feedbackThreshold = value;
+        } else if (key == "limitPower") {
+            k.limitPower = value;
+        } else if (key == "mode") {
+            k.mode = checkEnum(value, Repeater::M_COUNT);
+        } else if (key == "ceiling") {
+            k.ceiling = value;
+        } else if (key == "lookahead") {
+            k.lookahead = value;
+        } else if (key == "ratio") {
+            k.ratio = value;
+        } else if (key == "attack") {
+            k.attack = value;
+        } else if (key == "release") {
+            k.release = value;
+        } else if (key == "loopDelay") {
+            k.loopDelay = value;
+        } else if (key == "power") {
+            k.power = checkEnum(value, Repeater::P_COUNT);
+        } else if (key == "loudnessGate") {
+            k.loudnessGate = value;
+        } else if (key == "speed") {
+            k.speed = value;
+        } else if (key == "pitch") {
+            k.pitch = value;
+        } else if (key == "stretchRange") {
+            k.stretchRange = value;
+        } else if (key == "idleLevel") {
+            k.idleLevel = value;
+        } else if (key == "idleAfter") {
+            k.idleAfter = value;
+        } else if (key.compare(0, 6, "level.") == 0) {
+            size_t m = atoi(key.c_str() + 6);
+            if (m < k.levels.size()) {
+                k.levels[m] = value;
+            }
+        } else if (key.compare(0, 3, "eq.") == 0) {
+            char *field;
+            size_t b = strtoul(key.c_str() + 3, &field, 10);
+            if (b >= k.eq.size() || *field != '.') {
+                continue;
+            }
+            Equalizer::Band& band = k.eq[b];
+            const std::string name(field + 1);
+            if (name == "type") {
+                band.type = checkEnum(value, Equalizer::T_COUNT);
+            } else if (name == "channel") {
+                band.channel = value;
+            } else if (name == "freq") {
+                band.freq = value;
+            } else if (name == "gain") {
+                band.gain = value;
+            } else if (name == "q") {
+                band.q = value;
+            }
+        }
+    }
+    return k;
+}
+
+}
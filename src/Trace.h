@@ -0,0 +1,118 @@
+#pragma once
+
+#include "Buffer.h"
+#include "Repeater.h"
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+/*! @brief Recording of everything that drives the processing loop
+ *
+ *  A trace holds the captured audio for every cycle, along with every knob
+ *  and latency change, and the shutdown, at the point in the stream where
+ *  it took effect, so that the processing can be re-run offline and get
+ *  exactly the same results.
+ *
+ *  The file is a header followed by a sequence of events, each a one-byte
+ *  tag and its payload, in native byte order. The header is written a field
+ *  at a time, in the order they're declared, with no padding.
+ */
+namespace Trace {
+
+struct Header {
+    uint32_t sampleRate;
+    uint32_t channels;
+    uint32_t bufSize;
+    //! Most frames in a single cycle
+    uint32_t maxFrames;
+    double loopDelay;
+    //! Latency at the start of the trace
+    int32_t latency;
+    //! The longest the loop delay could be set to
+    double maxLoopDelay;
+    //! EQ sections per channel
+    uint32_t eqSections;
+    //! How far each channel's latency was off from the overall one
+    int32_t channelOffsets[Repeater::History::MAX_CHANNELS];
+    //! Whether playback went through the time stretcher
+    uint32_t stretch;
+    //! How far ahead the output limiter looked, in seconds
+    double limiterLookahead;
+
+    Header();
+};
+
+enum Event {
+    E_KNOBS = 'K', //!< The knobs changed
+    E_LATENCY = 'L', //!< The latency estimate changed
+    E_CYCLE = 'C', //!< A cycle's worth of captured audio
+    E_RESYNC = 'R', //!< The heads moved to make up for an xrun
+    E_PERIOD = 'P', //!< The period changed, e.g. by auto-tuning
+    E_SHUTDOWN = 'S', //!< The loop started fading out to stop
+    E_END = 0 //!< End of the trace
+};
+
+class Writer {
+public:
+    Writer(const std::string& path, const Header&);
+
+    void knobs(const Repeater::Knobs&);
+    void latency(int);
+    void resync(int captureLost, int playbackLost);
+    void period(size_t);
+    void shutdown();
+    void cycle(const Buffer& in, size_t frames);
+
+private:
+    std::ofstream mOut;
+};
+
+class Reader {
+public:
+    Reader(const std::string& path);
+
+    const Header& header() const { return mHeader; }
+
+    //! Read the next event
+    Event next();
+
+    //! The knobs from the last E_KNOBS
+    const Repeater::Knobs& knobs() const { return mKnobs; }
+
+    //! The latency from the last E_LATENCY
+    int latency() const { return mLatency; }
+
+    //! The capture frames lost, from the last E_RESYNC
+    int captureLost() const { return mCaptureLost; }
+
+    //! The playback frames lost, from the last E_RESYNC
+    int playbackLost() const { return mPlaybackLost; }
+
+    //! The period from the last E_PERIOD
+    size_t period() const { return mPeriod; }
+
+    //! The audio from the last E_CYCLE
+    const Buffer& buffer() const { return mBuffer; }
+
+    //! The frame count from the last E_CYCLE
+    size_t frames() const { return mFrames; }
+
+private:
+    std::ifstream mIn;
+    Header mHeader;
+    Repeater::Knobs mKnobs;
+    int mLatency;
+    int mCaptureLost, mPlaybackLost;
+    size_t mPeriod;
+    Buffer mBuffer;
+    size_t mFrames;
+};
+
+//! Serialize knobs as text, so that traces survive new knobs being added
+std::string formatKnobs(const Repeater::Knobs&);
+
+//! Parse knobs written by formatKnobs; unknown keys are ignored
+Repeater::Knobs parseKnobs(const std::string&);
+
+}
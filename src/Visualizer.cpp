@@ -1,9 +1,13 @@
 #include "Resource.h"
+#include "Spectrogram.h"
+#include "Stretcher.h"
 #include "Visualizer.h"
+#include "WaveOverview.h"
 
 #include <GL/freeglut.h>
 #include <GL/glew.h>
 
+#include <algorithm>
 #include <iostream>
 #include <cmath>
 #include <sstream>
@@ -24,14 +28,24 @@ void checkError(int line) {
         checkError(__LINE__);                   \
     } while (0)
 
+namespace {
+//! Where the spectrogram band goes, and how big the history plot gets
+const double SPECTRUM_INNER = 0.75, SPECTRUM_OUTER = 1.0;
+const double PLOT_RADIUS = 0.97;
+//! How wide the waveform band is, just inside the spectrogram
+const double WAVE_WIDTH = 0.1;
+}
+
 
-Visualizer::Visualizer(const Repeater::Ptr& rep): mRepeater(rep),
-                                                  mWidth(0),
-                                                  mHeight(0),
-                                                  mZoom(1),
-                                                  mVolume(0),
-                                                  mCurAdjustment(0),
-						  mLastAdjustTime(0)
+Visualizer::Visualizer(const Engine::Ptr& engine): mEngine(engine),
+                                                   mWidth(0),
+                                                   mHeight(0),
+                                                   mZoom(1),
+                                                   mVolume(0),
+                                                   mSpectrumTexture(0),
+                                                   mSpectrumRows(0),
+                                                   mCurAdjustment(0),
+						   mLastAdjustTime(0)
 {
     mAdjustments.insert(
         std::make_pair(
@@ -80,6 +94,30 @@ Visualizer::Visualizer(const Repeater::Ptr& rep): mRepeater(rep),
                 })
             )
         );
+    mAdjustments.insert(
+        std::make_pair(
+            'p', Adjustment(
+                "peak",
+                [](Repeater::Knobs& k, double a) -> double {
+                    k.mode = Repeater::M_LIMITER;
+                    double& tt = k.levels[k.mode];
+                    tt += a/25;
+                    return (tt = std::max(0.0, tt));
+                })
+            )
+        );
+    mAdjustments.insert(
+        std::make_pair(
+            'c', Adjustment(
+                "compressor",
+                [](Repeater::Knobs& k, double a) -> double {
+                    k.mode = Repeater::M_COMPRESSOR;
+                    double& tt = k.levels[k.mode];
+                    tt *= 1 + a/10;
+                    return (tt = std::max(1e-6, std::min(1.0, tt)));
+                })
+            )
+        );
     mAdjustments.insert(
         std::make_pair(
             'l', Adjustment(
@@ -102,6 +140,40 @@ Visualizer::Visualizer(const Repeater::Ptr& rep): mRepeater(rep),
                 })
             )
         );
+    mAdjustments.insert(
+        std::make_pair(
+            'D', Adjustment(
+                "delay",
+                [](Repeater::Knobs& k, double a) -> double {
+                    // the engine keeps it within what the drum can hold
+                    double& tt = k.loopDelay;
+                    tt += a/4;
+                    return (tt = std::max(0.25, tt));
+                })
+            )
+        );
+    mAdjustments.insert(
+        std::make_pair(
+            's', Adjustment(
+                "speed",
+                [](Repeater::Knobs& k, double a) -> double {
+                    double& tt = k.speed;
+                    tt *= pow(2, a/12);
+                    return (tt = std::max(Stretcher::MIN_SPEED, std::min(Stretcher::MAX_SPEED, tt)));
+                })
+            )
+        );
+    mAdjustments.insert(
+        std::make_pair(
+            'P', Adjustment(
+                "pitch",
+                [](Repeater::Knobs& k, double a) -> double {
+                    double& tt = k.pitch;
+                    tt += a;
+                    return (tt = std::max(-Stretcher::MAX_PITCH, std::min(Stretcher::MAX_PITCH, tt)));
+                })
+            )
+        );
 }
 
 void Visualizer::onInit() {
@@ -123,6 +195,25 @@ void Visualizer::onInit() {
     mSquareShader->attach(color);
     ERRORCHECK();
 
+    if (const Spectrogram *spec = mEngine->getSpectrogram()) {
+        mSpectrumShader = std::make_shared<ShaderProgram>();
+        mSpectrumShader->attach(std::make_shared<Shader>(GL_VERTEX_SHADER,
+                                                         LOAD_RESOURCE(src_spectrogram_vert)));
+        mSpectrumShader->attach(std::make_shared<Shader>(GL_FRAGMENT_SHADER,
+                                                         LOAD_RESOURCE(src_spectrogram_frag)));
+
+        glGenTextures(1, &mSpectrumTexture);
+        glBindTexture(GL_TEXTURE_2D, mSpectrumTexture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        std::vector<float> blank(spec->bins()*spec->rows()*2);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE8_ALPHA8, spec->bins(), spec->rows(), 0,
+                     GL_LUMINANCE_ALPHA, GL_FLOAT, &blank[0]);
+        ERRORCHECK();
+    }
+
     GLint numBufs, numSamples;
     glGetIntegerv(GL_SAMPLE_BUFFERS, &numBufs);
     glGetIntegerv(GL_SAMPLES, &numSamples);
@@ -130,7 +221,7 @@ void Visualizer::onInit() {
               << numSamples << " samples" << std::endl;
 
     // this is stupid and hacky
-    switch (mRepeater->getKnobs().mode) {
+    switch (mEngine->getKnobs().mode) {
     case Repeater::M_GAIN:
         mCurAdjustment = 'g';
         break;
@@ -140,6 +231,14 @@ void Visualizer::onInit() {
     case Repeater::M_FEEDBACK:
         mCurAdjustment = 'f';
         break;
+    case Repeater::M_LIMITER:
+        mCurAdjustment = 'p';
+        break;
+    case Repeater::M_COMPRESSOR:
+        mCurAdjustment = 'c';
+        break;
+    case Repeater::M_COUNT:
+        break;
     }
 }
 
@@ -210,14 +309,22 @@ void Visualizer::drawHistory() {
   struct timespec tv;
   clock_gettime(CLOCK_MONOTONIC, &tv);
   double time = tv.tv_sec + tv.tv_nsec*1e-9;
-  glRotatef(time*360/mRepeater->getOptions().loopDelay/4, 0, 0, -1);
+  glRotatef(time*360/mEngine->getOptions().loopDelay/4, 0, 0, -1);
 */
 
-    mRepeater->getHistory(mHistory);
+    mEngine->getHistory(mHistory);
+
+    drawSpectrogram();
 
     mRoundShader->bind();
     ERRORCHECK();
 
+    double radius = mSpectrumShader ? SPECTRUM_INNER - 0.02 : PLOT_RADIUS;
+    if (mEngine->getOverview()) {
+        drawWaveform(radius - WAVE_WIDTH, radius);
+        radius -= WAVE_WIDTH + 0.02;
+    }
+
     const size_t count = mHistory.history.size();
 
     double maxR = 1e-6;
@@ -252,7 +359,7 @@ void Visualizer::drawHistory() {
         }
     }
 
-    mZoom = mZoom*0.9 + 0.1*0.97/maxR;
+    mZoom = mZoom*0.9 + 0.1*radius/maxR;
     glScalef(mZoom, mZoom, mZoom);
 
     glEnableClientState(GL_VERTEX_ARRAY);
@@ -317,6 +424,82 @@ void Visualizer::drawHistory() {
     glPopMatrix();
 }
 
+void Visualizer::drawSpectrogram() {
+    const Spectrogram *spec = mEngine->getSpectrogram();
+    if (!spec || !mSpectrumShader) {
+        return;
+    }
+    const size_t rows = spec->rows();
+
+    // upload whatever's new since last time
+    glBindTexture(GL_TEXTURE_2D, mSpectrumTexture);
+    const size_t count = spec->rowCount();
+    for (size_t n = std::max(mSpectrumRows, count > rows ? count - rows : 0); n < count; n++) {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, n % rows, spec->bins(), 1,
+                        GL_LUMINANCE_ALPHA, GL_FLOAT, spec->row(n % rows));
+    }
+    mSpectrumRows = count;
+    ERRORCHECK();
+
+    const GLuint program = mSpectrumShader->bind();
+    glUniform1i(glGetUniformLocation(program, "spectrum"), 0);
+    glUniform1f(glGetUniformLocation(program, "minFreq"),
+                40.0/(mEngine->getSampleRate()/2));
+
+    // the newest row goes at the record head, so that time runs around the
+    // circle the same way as in the history plot
+    const double recordTurn = mHistory.recordPos*1.0/std::max<size_t>(1, mHistory.history.size());
+    const double offset = fmod((count - 0.5)/rows - recordTurn, 1.0);
+
+    const size_t segments = 256;
+    glEnable(GL_TEXTURE_2D);
+    glBegin(GL_TRIANGLE_STRIP);
+    for (size_t i = 0; i <= segments; i++) {
+        const double turn = i*1.0/segments;
+        glTexCoord2f(0, turn + offset);
+        glVertex3f(turn*2*M_PI, SPECTRUM_INNER, 0);
+        glTexCoord2f(1, turn + offset);
+        glVertex3f(turn*2*M_PI, SPECTRUM_OUTER, 0);
+    }
+    glEnd();
+    glDisable(GL_TEXTURE_2D);
+
+    ERRORCHECK();
+}
+
+void Visualizer::drawWaveform(double inner, double outer) {
+    const WaveOverview *overview = mEngine->getOverview();
+    const size_t channels = overview->channels();
+    if (!channels) {
+        return;
+    }
+
+    // about a point per pixel around the band, however long the loop is;
+    // each one comes from a handful of summary buckets
+    const size_t points = std::max<size_t>(64, M_PI*outer*mHeight);
+    const size_t frames = overview->frames();
+    const double mid = (inner + outer)/2, scale = (outer - inner)/2/32768;
+
+    glColor4f(0.2, 0.2, 0.4, 0.7);
+    glBegin(GL_TRIANGLE_STRIP);
+    for (size_t i = 0; i <= points; i++) {
+        const size_t p = i % points;
+        const size_t start = p*frames/points, end = (p + 1)*frames/points;
+        int lo = 0, hi = 0;
+        for (size_t c = 0; c < channels; c++) {
+            const WaveOverview::Range r = overview->range(c, start, end - start);
+            lo = std::min<int>(lo, r.min);
+            hi = std::max<int>(hi, r.max);
+        }
+        const double x = i*2*M_PI/points;
+        glVertex3f(x, mid + lo*scale, 0);
+        glVertex3f(x, mid + hi*scale, 0);
+    }
+    glEnd();
+
+    ERRORCHECK();
+}
+
 namespace {
 double getTime() {
     struct timespec ts;
@@ -325,14 +508,17 @@ double getTime() {
 }
 }
 
+bool Visualizer::idle() const {
+    return mHistory.idle && getTime() - mLastAdjustTime >= 3;
+}
+
 void Visualizer::onKeyboard(unsigned char c) {
     mLastAdjustTime = getTime();
     mCurAdjustment = c;
     auto adj = mAdjustments.find(c);
     if (adj != mAdjustments.end()) {
-        Repeater::Knobs k = mRepeater->getKnobs();
-        adj->second.cb(k, 0);
-        mRepeater->setKnobs(k);
+        const Adjustment::Callback& cb = adj->second.cb;
+        mEngine->changeKnobs([&cb](Repeater::Knobs& k) { cb(k, 0); });
         std::cout << "set mode to " << adj->second.name << std::endl;
     }
 }
@@ -352,9 +538,9 @@ void Visualizer::onSpecialKey(int c) {
 
     auto adj = mAdjustments.find(mCurAdjustment);
     if (adj != mAdjustments.end()) {
-        Repeater::Knobs k = mRepeater->getKnobs();
-        double r = adj->second.cb(k, adjust);
-        mRepeater->setKnobs(k);
+        const Adjustment::Callback& cb = adj->second.cb;
+        double r;
+        mEngine->changeKnobs([&](Repeater::Knobs& k) { r = cb(k, adjust); });
         std::cout << "adjusted " << adj->second.name << " to " << r << std::endl;
     }
 }
@@ -369,7 +555,7 @@ void Visualizer::drawBanner() {
             auto adj = mAdjustments.find(mCurAdjustment);
             if (adj != mAdjustments.end()) {
                 glColor4f(0,0,0.5,1);
-                Repeater::Knobs k = mRepeater->getKnobs();
+                Repeater::Knobs k = mEngine->getKnobs();
                 message << adj->second.name << ": " << adj->second.cb(k, 0.0f);
             } else {
                 glColor4f(0.5,0,0,1);
@@ -378,7 +564,7 @@ void Visualizer::drawBanner() {
                 }
             }
         } else {
-            switch (mRepeater->getState()) {
+            switch (mEngine->getState()) {
             case Repeater::S_STARTUP:
                 glColor4f(1, 0, 0, 1);
                 message << "acquiring signal";
@@ -403,20 +589,9 @@ void Visualizer::drawBanner() {
 
     if (0) {
         std::stringstream message;
-        const Repeater::Knobs& k = mRepeater->getKnobs();
-        message << "mode: ";
-        switch (k.mode) {
-        case Repeater::M_GAIN:
-            message << "gain";
-            break;
-        case Repeater::M_TARGET:
-            message << "target";
-            break;
-        case Repeater::M_FEEDBACK:
-            message << "feedback";
-            break;
-        }
-        message << " " << k.levels.find(k.mode)->second;
+        const Repeater::Knobs& k = mEngine->getKnobs();
+        message << "mode: " << Repeater::modeName(k.mode)
+                << " " << k.levels[k.mode];
         size_t width = glutBitmapLength(GLUT_BITMAP_HELVETICA_18,
                                         (const unsigned char *)message.str().c_str());
         glRasterPos2f((mWidth - 2*width)*1.0/mHeight, -1);
@@ -428,6 +603,14 @@ void Visualizer::drawBanner() {
 }
 
 bool Visualizer::onDisplay() {
+    draw();
+
+    glutSwapBuffers();
+
+    return mEngine->getState() == Repeater::S_GONE;
+}
+
+void Visualizer::draw(bool banner) {
     glViewport(0, 0, mWidth, mHeight);
 
     glClearColor(1, 1, 1, 1);
@@ -446,13 +629,11 @@ bool Visualizer::onDisplay() {
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
 
-    if (mRepeater->getState() != Repeater::S_STARTUP) {
+    if (mEngine->getState() != Repeater::S_STARTUP) {
         drawHistory();
     }
 
-    drawBanner();
-
-    glutSwapBuffers();
-
-    return mRepeater->getState() == Repeater::S_GONE;
+    if (banner) {
+        drawBanner();
+    }
 }
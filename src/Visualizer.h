@@ -1,6 +1,6 @@
 #pragma once
 
-#include "Repeater.h"
+#include "Engine.h"
 #include "ShaderProgram.h"
 
 #include <functional>
@@ -10,7 +10,7 @@ class Visualizer {
 public:
     typedef std::shared_ptr<Visualizer> Ptr;
 
-    Visualizer(const Repeater::Ptr&);
+    Visualizer(const Engine::Ptr&);
 
     //! initialize the context
     void onInit();
@@ -21,14 +21,23 @@ public:
     //! paint the screen
     bool onDisplay();
 
+    /*! @brief Draw everything into the current context, without swapping
+     *
+     *  @param banner Whether to draw the text banner, which needs GLUT
+     */
+    void draw(bool banner = true);
+
     //! normal key handler
     void onKeyboard(unsigned char c);
 
     //! special key handler
     void onSpecialKey(int k);
 
+    //! Whether there's nothing much to see: the engine's idle, and nothing's being adjusted
+    bool idle() const;
+
 private:
-    Repeater::Ptr mRepeater;
+    Engine::Ptr mEngine;
     Repeater::History mHistory;
 
     int mWidth, mHeight;
@@ -36,7 +45,12 @@ private:
 
     double mVolume;
 
-    ShaderProgram::Ptr mRoundShader, mSquareShader;
+    ShaderProgram::Ptr mRoundShader, mSquareShader, mSpectrumShader;
+
+    //! The spectrogram, as a texture of rows
+    GLuint mSpectrumTexture;
+    //! How many of the spectrogram's rows have been uploaded
+    size_t mSpectrumRows;
 
     struct Adjustment {
         std::string name;
@@ -50,5 +64,7 @@ private:
     double mLastAdjustTime;
 
     void drawHistory();
+    void drawSpectrogram();
+    void drawWaveform(double inner, double outer);
     void drawBanner();
 };
@@ -0,0 +1,127 @@
+#include "WaveOverview.h"
+#include "Buffer.h"
+
+#include <algorithm>
+
+constexpr size_t WaveOverview::BASE_FRAMES;
+constexpr size_t WaveOverview::FANOUT;
+
+WaveOverview::WaveOverview(size_t frames, size_t maxChannels):
+    mFrames(frames),
+    mMaxChannels(maxChannels),
+    mChannels(0),
+    mMin(maxChannels),
+    mMax(maxChannels)
+{
+    // keep going up until the whole drum fits in a FANOUT's worth of buckets
+    size_t bucketFrames = BASE_FRAMES;
+    do {
+        Level level;
+        level.bucketFrames = bucketFrames;
+        level.buckets = (frames + bucketFrames - 1)/bucketFrames;
+        level.data = std::vector<std::atomic<uint32_t>>(level.buckets*maxChannels);
+        mLevels.push_back(std::move(level));
+        bucketFrames *= FANOUT;
+    } while (mLevels.back().buckets > FANOUT);
+
+    reset(0);
+}
+
+void WaveOverview::reset(size_t channels) {
+    mChannels = std::min(channels, mMaxChannels);
+    for (auto& level : mLevels) {
+        for (auto& bucket : level.data) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+void WaveOverview::update(const Buffer& drum, size_t offset, size_t n) {
+    n = std::min(n, mFrames);
+    if (!n) {
+        return;
+    }
+
+    const size_t start = offset % mFrames;
+    const size_t end = start + n;
+
+    // finest first, since each level is built from the one below
+    for (size_t l = 0; l < mLevels.size(); l++) {
+        const size_t bf = mLevels[l].bucketFrames;
+        if (end > mFrames) {
+            refresh(drum, l, start/bf, mLevels[l].buckets - 1);
+            refresh(drum, l, 0, (end - mFrames - 1)/bf);
+        } else {
+            refresh(drum, l, start/bf, (end - 1)/bf);
+        }
+    }
+}
+
+void WaveOverview::refresh(const Buffer& drum, size_t l, size_t first, size_t last) {
+    const size_t channels = mChannels.load(std::memory_order_relaxed);
+    Level& level = mLevels[l];
+
+    for (size_t b = first; b <= last; b++) {
+        std::fill(mMin.begin(), mMin.end(), 32767);
+        std::fill(mMax.begin(), mMax.end(), -32768);
+
+        if (l == 0) {
+            const size_t end = std::min((b + 1)*level.bucketFrames, mFrames);
+            for (Buffer::const_iterator iter = drum.at(b*level.bucketFrames);
+                 iter != drum.at(end); iter += drum.channels()) {
+                for (size_t c = 0; c < channels; c++) {
+                    mMin[c] = std::min(mMin[c], iter[c]);
+                    mMax[c] = std::max(mMax[c], iter[c]);
+                }
+            }
+        } else {
+            const Level& below = mLevels[l - 1];
+            const size_t end = std::min((b + 1)*FANOUT, below.buckets);
+            for (size_t child = b*FANOUT; child < end; child++) {
+                for (size_t c = 0; c < channels; c++) {
+                    const uint32_t v = below.data[child*mMaxChannels + c].load(std::memory_order_relaxed);
+                    mMin[c] = std::min<int16_t>(mMin[c], v & 0xffff);
+                    mMax[c] = std::max<int16_t>(mMax[c], v >> 16);
+                }
+            }
+        }
+
+        for (size_t c = 0; c < channels; c++) {
+            level.data[b*mMaxChannels + c].store(pack(mMin[c], mMax[c]), std::memory_order_relaxed);
+        }
+    }
+}
+
+WaveOverview::Range WaveOverview::range(size_t channel, size_t offset, size_t n) const {
+    Range r = { 0, 0 };
+    n = std::min(n, mFrames);
+    if (!n || channel >= mChannels) {
+        return r;
+    }
+
+    size_t l = 0;
+    while (l + 1 < mLevels.size() && mLevels[l + 1].bucketFrames <= n) {
+        ++l;
+    }
+    const Level& level = mLevels[l];
+
+    r.min = 32767;
+    r.max = -32768;
+    auto scan = [&](size_t first, size_t last) {
+        for (size_t b = first; b <= last; b++) {
+            const uint32_t v = level.data[b*mMaxChannels + channel].load(std::memory_order_relaxed);
+            r.min = std::min<int16_t>(r.min, v & 0xffff);
+            r.max = std::max<int16_t>(r.max, v >> 16);
+        }
+    };
+
+    const size_t start = offset % mFrames;
+    const size_t end = start + n;
+    if (end > mFrames) {
+        scan(start/level.bucketFrames, level.buckets - 1);
+        scan(0, (end - mFrames - 1)/level.bucketFrames);
+    } else {
+        scan(start/level.bucketFrames, (end - 1)/level.bucketFrames);
+    }
+    return r;
+}
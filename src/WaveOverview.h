@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Buffer;
+
+/*! @brief Per-channel min/max summaries of the drum, at a few zoom levels
+ *
+ *  The drum is far too big to scan every time the screen gets drawn, so it
+ *  keeps these up to date as audio gets written to it. The finest level
+ *  summarizes runs of BASE_FRAMES frames, and each level up combines FANOUT
+ *  of the level below; any range can then be summarized from a handful of
+ *  buckets, whatever its size.
+ *
+ *  Each bucket is a single atomic word, so one thread can update while
+ *  another reads without any locking; a reader might see a mix of old and
+ *  new buckets, but never half of one.
+ */
+class WaveOverview {
+public:
+    //! Frames per bucket at the finest level
+    static constexpr size_t BASE_FRAMES = 256;
+    //! How many buckets get combined into one at the next level up
+    static constexpr size_t FANOUT = 8;
+
+    //! The extremes of a run of samples
+    struct Range {
+        int16_t min, max;
+    };
+
+    /*! @param frames The size of the drum
+     *  @param maxChannels The most channels it'll ever have
+     */
+    WaveOverview(size_t frames, size_t maxChannels);
+
+    //! Start over with an empty (silent) drum (writer only)
+    void reset(size_t channels);
+
+    /*! @brief Account for a run of the drum having changed (writer only)
+     *
+     *  @param drum The drum's contents
+     *  @param offset Where the change starts; it can wrap around the end
+     *  @param n How many frames changed
+     */
+    void update(const Buffer& drum, size_t offset, size_t n);
+
+    //! The size of the drum
+    size_t frames() const { return mFrames; }
+
+    size_t channels() const { return mChannels; }
+
+    /*! @brief The extremes of one channel over a run of the drum
+     *
+     *  Works from the coarsest level whose buckets are no bigger than the
+     *  run, so it reads at most a couple of FANOUTs' worth of buckets. The
+     *  run is rounded out to whole buckets.
+     *
+     *  @param channel The channel
+     *  @param offset The start of the run; it can wrap around the end
+     *  @param n How many frames
+     */
+    Range range(size_t channel, size_t offset, size_t n) const;
+
+private:
+    size_t mFrames;
+    size_t mMaxChannels;
+    std::atomic<size_t> mChannels;
+
+    struct Level {
+        size_t bucketFrames;
+        size_t buckets;
+        //! Bucket-major, then channel; max in the high half, min in the low
+        std::vector<std::atomic<uint32_t>> data;
+    };
+    std::vector<Level> mLevels;
+
+    //! Scratch space for refresh()
+    std::vector<int16_t> mMin, mMax;
+
+    static uint32_t pack(int16_t min, int16_t max) {
+        return static_cast<uint16_t>(max) << 16 | static_cast<uint16_t>(min);
+    }
+
+    //! Recompute a run of buckets at a level
+    void refresh(const Buffer& drum, size_t level, size_t first, size_t last);
+};
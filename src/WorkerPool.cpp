@@ -0,0 +1,122 @@
+#include "WorkerPool.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include <algorithm>
+#include <iostream>
+
+namespace {
+double getTime() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+}
+
+WorkerPool::WorkerPool(size_t workers, int firstCore):
+    mLastReport(getTime()),
+    mStop(false)
+{
+    const int cores = std::max(1u, std::thread::hardware_concurrency());
+    mQueue.reserve(64);
+
+    bool warned = false;
+    for (size_t i = 0; i < workers; i++) {
+        mWorkers.emplace_back(new Worker);
+        Worker& w = *mWorkers.back();
+        w.core = (firstCore + i) % cores;
+        w.thread = std::thread([this, &w]() { worker(w); });
+
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(w.core, &cpus);
+        int err = pthread_setaffinity_np(w.thread.native_handle(), sizeof(cpus), &cpus);
+
+        struct sched_param param = {};
+        param.sched_priority = sched_get_priority_min(SCHED_FIFO) + 10;
+        err = pthread_setschedparam(w.thread.native_handle(), SCHED_FIFO, &param) || err;
+
+        if (err && !warned) {
+            std::cerr << "Couldn't pin workers or make them real-time; running them as normal threads"
+                      << std::endl;
+            warned = true;
+        }
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStop = true;
+    }
+    mWake.notify_all();
+    for (auto& w : mWorkers) {
+        w->thread.join();
+    }
+}
+
+bool WorkerPool::later(const Job *a, const Job *b) {
+    return a->deadline > b->deadline;
+}
+
+void WorkerPool::submit(Job& job, double deadline) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        job.deadline = deadline;
+        job.done = false;
+        mQueue.push_back(&job);
+        std::push_heap(mQueue.begin(), mQueue.end(), later);
+    }
+    mWake.notify_one();
+}
+
+void WorkerPool::wait(Job& job) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mDone.wait(lock, [&job]() { return job.done; });
+}
+
+void WorkerPool::worker(Worker& w) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    for (;;) {
+        mWake.wait(lock, [this]() { return mStop || !mQueue.empty(); });
+        if (mStop) {
+            return;
+        }
+
+        std::pop_heap(mQueue.begin(), mQueue.end(), later);
+        Job *job = mQueue.back();
+        mQueue.pop_back();
+        lock.unlock();
+
+        const double start = getTime();
+        job->work();
+        const double end = getTime();
+
+        w.busy += static_cast<uint64_t>((end - start)*1e9);
+        ++w.jobs;
+        if (end > job->deadline) {
+            ++w.missed;
+        }
+
+        lock.lock();
+        job->done = true;
+        mDone.notify_all();
+    }
+}
+
+std::vector<WorkerPool::CoreLoad> WorkerPool::load() {
+    const double now = getTime();
+    const double elapsed = std::max(1e-9, now - mLastReport);
+    mLastReport = now;
+
+    std::vector<CoreLoad> out;
+    for (auto& w : mWorkers) {
+        const uint64_t busy = w->busy;
+        out.push_back(CoreLoad{w->core, (busy - w->lastBusy)*1e-9/elapsed,
+                    w->jobs, w->missed});
+        w->lastBusy = busy;
+    }
+    return out;
+}
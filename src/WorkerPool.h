@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*! @brief A pool of real-time worker threads for the per-cycle DSP work
+ *
+ *  Each worker is pinned to its own core and run SCHED_FIFO (if we're
+ *  allowed to). Submitted jobs are run earliest-deadline-first, so when
+ *  several loops land on the pool at once the one whose buffer is due
+ *  soonest goes first.
+ *
+ *  Jobs are owned by whoever submits them and are reused every cycle, so
+ *  that submitting doesn't allocate.
+ */
+class WorkerPool {
+public:
+    struct Job {
+        //! The work itself; set once up front
+        std::function<void()> work;
+
+        Job(): deadline(0), done(true) {}
+
+    private:
+        friend class WorkerPool;
+        double deadline;
+        bool done;
+    };
+
+    //! How busy a core has been
+    struct CoreLoad {
+        int core;
+        //! Fraction of the time spent running jobs since the last report
+        double load;
+        //! Jobs run, and how many of those finished after their deadline, in total
+        size_t jobs, missed;
+    };
+
+    /*! @param workers How many workers to run
+     *  @param firstCore The core to pin the first worker to; the rest follow on
+     */
+    WorkerPool(size_t workers, int firstCore = 0);
+    ~WorkerPool();
+
+    /*! @brief Queue a job
+     *
+     *  @param deadline When it has to be done by (CLOCK_MONOTONIC seconds)
+     */
+    void submit(Job&, double deadline);
+
+    //! Wait for a submitted job to finish
+    void wait(Job&);
+
+    //! Load on each worker's core since the last call
+    std::vector<CoreLoad> load();
+
+    size_t size() const { return mWorkers.size(); }
+
+private:
+    struct Worker {
+        std::thread thread;
+        int core;
+        //! Time spent busy, in nanoseconds
+        std::atomic<uint64_t> busy;
+        std::atomic<size_t> jobs, missed;
+        uint64_t lastBusy;
+        Worker(): core(0), busy(0), jobs(0), missed(0), lastBusy(0) {}
+    };
+
+    std::vector<std::unique_ptr<Worker>> mWorkers;
+    double mLastReport;
+
+    std::mutex mMutex;
+    std::condition_variable mWake, mDone;
+    //! Pending jobs, as a heap ordered by deadline
+    std::vector<Job *> mQueue;
+    bool mStop;
+
+    void worker(Worker&);
+
+    //! Heap ordering, so the earliest deadline ends up at the front
+    static bool later(const Job *, const Job *);
+};
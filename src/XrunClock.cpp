@@ -0,0 +1,50 @@
+#include "PcmClock.h"
+#include "XrunClock.h"
+
+#include <cmath>
+
+XrunClock::XrunClock(const PcmClock& clock, bool capture, unsigned int sampleRate):
+    mClock(clock),
+    mCapture(capture),
+    mSampleRate(sampleRate),
+    mTransferred(0),
+    mXruns(0),
+    mHaveBase(false),
+    mBaseTime(0),
+    mBasePos(0),
+    mTotalLost(0)
+{}
+
+int XrunClock::update(int frames, size_t xruns) {
+    if (frames <= 0) {
+        // still recovering; measure from the next transfer that works
+        return 0;
+    }
+    mTransferred += frames;
+
+    long delay;
+    double now;
+    if (!mClock.read(delay, now)) {
+        return 0;
+    }
+
+    // where the hardware is: captured frames we haven't read yet are ahead
+    // of us, and played frames still queued are behind
+    const int64_t pos = mCapture ? mTransferred + delay : mTransferred - delay;
+
+    int lost = 0;
+    if (xruns != mXruns && mHaveBase) {
+        const int64_t elapsed = llround((now - mBaseTime)*mSampleRate);
+        const int64_t behind = elapsed - (pos - mBasePos);
+        if (behind > mClock.granularity()) {
+            lost = behind;
+            mTotalLost += lost;
+        }
+    }
+
+    mXruns = xruns;
+    mHaveBase = true;
+    mBaseTime = now;
+    mBasePos = pos;
+    return lost;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+class PcmClock;
+
+/*! @brief Measures how much of a stream went missing in an xrun
+ *
+ *  Recovering from an xrun restarts the stream, and whatever should have
+ *  been captured or played in the meantime is simply gone. After every
+ *  transfer this compares how far the stream has got (frames transferred,
+ *  adjusted by the device delay) against how much time has passed; the two
+ *  normally move together, so any difference between one transfer before
+ *  an xrun and the first one after it is how many frames were lost.
+ *
+ *  The delay and the time it goes with come from the device's timestamps
+ *  where it has them. Where it doesn't, the delay can be out by anything up
+ *  to its granularity either way, so a difference that small is put down
+ *  to that rather than counted as lost.
+ */
+class XrunClock {
+public:
+    /*! @param clock Where the device's delay comes from
+     *  @param capture Whether it's a capture device (otherwise playback)
+     *  @param sampleRate The sample rate
+     */
+    XrunClock(const PcmClock& clock, bool capture, unsigned int sampleRate);
+
+    /*! @brief Account for a transfer
+     *
+     *  @param frames What the transfer returned
+     *  @param xruns How many xruns the device has had so far
+     *  @returns how many frames were lost, if this is the first successful
+     *  transfer since an xrun; otherwise 0
+     */
+    int update(int frames, size_t xruns);
+
+    //! Start measuring over, e.g. after the device was deliberately stopped
+    void restart() { mHaveBase = false; }
+
+    //! Total frames lost so far
+    int64_t totalLost() const { return mTotalLost; }
+
+private:
+    const PcmClock& mClock;
+    bool mCapture;
+    unsigned int mSampleRate;
+
+    //! Frames transferred so far
+    int64_t mTransferred;
+    //! Xruns already accounted for
+    size_t mXruns;
+
+    //! Time and stream position as of the last successful transfer
+    bool mHaveBase;
+    double mBaseTime;
+    int64_t mBasePos;
+
+    int64_t mTotalLost;
+};
@@ -1,25 +1,131 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <stdexcept>
 
 #include <boost/program_options.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
 #include <thread>
+#include <vector>
 
 #include <alsa/asoundlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
 #include <GL/glew.h>
 #include <GL/freeglut.h>
 
+#include "Benchmark.h"
+#include "ControlServer.h"
+#include "Engine.h"
+#include "EngineLink.h"
+#include "Equalizer.h"
 #include "Repeater.h"
 #include "Visualizer.h"
+#include "WorkerPool.h"
 
 namespace {
 // why doesn't freeglut add user data hooks? ugh
 Repeater::Ptr rr;
+std::vector<Repeater::Ptr> loops;
+Engine::Ptr engine;
 Visualizer::Ptr vis;
 
+//! Set by SIGINT/SIGTERM when running headless
+volatile sig_atomic_t stopRequested = 0;
+
+void stopFunc(int) {
+    stopRequested = 1;
+}
+
+/*! @brief Parse an EQ band given as type:freq:gain:q[:channel]
+ *
+ *  @returns false if it doesn't make sense
+ */
+bool parseEqBand(const std::string& spec, Equalizer::Band& band) {
+    std::vector<std::string> fields;
+    size_t start = 0, end;
+    while ((end = spec.find(':', start)) != std::string::npos) {
+        fields.push_back(spec.substr(start, end - start));
+        start = end + 1;
+    }
+    fields.push_back(spec.substr(start));
+    if (fields.size() < 4 || fields.size() > 5
+        || !Equalizer::parseType(fields[0], band.type)) {
+        return false;
+    }
+    char *rest;
+    band.freq = strtod(fields[1].c_str(), &rest);
+    bool ok = !*rest && band.freq > 0;
+    band.gain = strtod(fields[2].c_str(), &rest);
+    ok = ok && !*rest;
+    band.q = strtod(fields[3].c_str(), &rest);
+    ok = ok && !*rest && band.q > 0;
+    if (fields.size() > 4) {
+        band.channel = strtol(fields[4].c_str(), &rest, 10);
+        ok = ok && !*rest && band.channel >= 0;
+    }
+    return ok;
+}
+
+/*! @brief Options for an additional loop
+ *
+ *  @param devices "capture|playback", or a single device for both
+ *  @param index Which loop this is; used to keep names and ports apart
+ */
+Repeater::Options instanceOptions(const Repeater::Options& base, const std::string& devices,
+                                  size_t index, bool autoDrift) {
+    Repeater::Options o = base;
+    const size_t split = devices.find('|');
+    o.captureDevice = devices.substr(0, split);
+    o.playbackDevice = split == std::string::npos ? o.captureDevice : devices.substr(split + 1);
+    if (autoDrift) {
+        o.driftCompensation = o.captureDevice != o.playbackDevice;
+    }
+    // only the first loop is ever on screen
+    o.spectrogram = false;
+
+    const std::string suffix = "-" + std::to_string(index);
+    if (!o.metricsName.empty()) {
+        o.metricsName += suffix;
+    }
+    if (!o.traceFile.empty()) {
+        o.traceFile += suffix;
+    }
+    if (!o.recDumpFile.empty()) {
+        o.recDumpFile += suffix;
+    }
+    if (!o.listenDumpFile.empty()) {
+        o.listenDumpFile += suffix;
+    }
+    if (!o.playDumpFile.empty()) {
+        o.playDumpFile += suffix;
+    }
+    if (o.controlPort > 0) {
+        o.controlPort += index;
+    }
+    if (!o.jackClient.empty()) {
+        o.jackClient += suffix;
+    }
+    return o;
+}
+
 void keyboardFunc(unsigned char key, int, int) {
     switch (key) {
     case 27:
-        rr->shutdown();
+        for (auto& loop : loops) {
+            loop->shutdown();
+        }
+        if (loops.empty()) {
+            // attached to an engine in another process
+            engine->shutdown();
+        }
         break;
     default:
         vis->onKeyboard(key);
@@ -35,9 +141,27 @@ void reshapeFunc(int x, int y) {
     vis->onResize(x, y);
 }
 
+//! How often to redraw while the engine's idle, in frames per second
+const unsigned int IDLE_FPS = 2;
+
+//! Whether there's an idle redraw timer waiting to go off
+bool redisplayPending = false;
+
+void redisplayFunc(int) {
+    redisplayPending = false;
+    glutPostRedisplay();
+}
+
 void displayFunc() {
     if (vis->onDisplay()) {
 	glutLeaveMainLoop();
+    } else if (vis->idle()) {
+        // nobody's there to see it, so save the GPU the trouble; other
+        // redraws (a resize, say) mustn't start timers of their own
+        if (!redisplayPending) {
+            redisplayPending = true;
+            glutTimerFunc(1000/IDLE_FPS, redisplayFunc, 0);
+        }
     } else {
         glutPostRedisplay();
     }
@@ -46,20 +170,30 @@ void displayFunc() {
 }
 
 int main(int argc, char *argv[]) try {
-    glutInitContextVersion(2, 0);
-    glutInitContextFlags (GLUT_FORWARD_COMPATIBLE);
-    glutInit(&argc, argv);
-    glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE | GLUT_MULTISAMPLE);
-    glutSetOption(GLUT_ACTION_ON_WINDOW_CLOSE, GLUT_ACTION_CONTINUE_EXECUTION);
-
     Repeater::Options opts;
     Repeater::Knobs knobs;
     bool fullScreen = true;
+    std::vector<Repeater::Options> loopOpts;
+    size_t workers = 0;
+    int firstCore = 0;
+    double loadInterval = 10;
+    std::string engineName = "/whatwesaidwillbe-engine";
+    RoomSimulator::Params room;
+    double simulate = 0, simulateReport = 3600;
+    bool headless = false, attach = false;
 
     {
         namespace po = boost::program_options;
 
-        std::string initMode;
+        std::string initMode, benchmark, benchmarkOutput;
+        std::string replayFile, replayOut, replayHistory;
+        std::vector<std::string> instances;
+        std::vector<std::string> eqBands;
+        std::string powerSource;
+
+        if (const char *home = getenv("HOME")) {
+            opts.calibrationCache = std::string(home) + "/.whatwesaidwillbe-calibration";
+        }
 
         po::options_description desc("General options");
         desc.add_options()
@@ -72,14 +206,93 @@ int main(int argc, char *argv[]) try {
              "Size of the history buffer")
             ("loopDelay,c", po::value<double>(&opts.loopDelay)->default_value(opts.loopDelay),
              "loop delay, in seconds")
+            ("maxLoopDelay", po::value<double>(&opts.maxLoopDelay)->default_value(opts.maxLoopDelay),
+             "longest the loop delay can be turned up to while running, in seconds (0 for --loopDelay)")
             ("latency,q", po::value<int>(&opts.latencyALSA)->default_value(opts.latencyALSA),
              "ALSA latency, in microseconds")
             ("capture", po::value<std::string>(&opts.captureDevice)->default_value(opts.captureDevice),
              "ALSA capture device")
             ("playback", po::value<std::string>(&opts.playbackDevice)->default_value(opts.playbackDevice),
              "ALSA playback device")
+            ("jack", po::value<std::string>(&opts.jackClient)->implicit_value("whatwesaidwillbe"),
+             "run as a JACK client with this name instead of through ALSA; --capture and --playback then match port names")
             ("recDump", po::value<std::string>(&opts.recDumpFile), "Recording dump file (raw PCM)")
-            ("listenDump", po::value<std::string>(&opts.listenDumpFile), "Play dump file (raw PCM)")
+            ("listenDump", po::value<std::string>(&opts.listenDumpFile),
+             "Dump of what the room should be hearing back (raw PCM)")
+            ("playDump", po::value<std::string>(&opts.playDumpFile), "Play dump file (raw PCM)")
+            ("drift", po::value<bool>(&opts.driftCompensation),
+             "compensate for clock drift between devices (default: only if capture and playback differ)")
+            ("trackLatency", po::value<bool>(&opts.latencyTracking)->default_value(opts.latencyTracking),
+             "keep tracking the round-trip latency in the background")
+            ("controlPort", po::value<int>(&opts.controlPort)->default_value(opts.controlPort),
+             "UDP port on localhost to accept OSC control messages on; 0 = disabled")
+            ("metrics", po::value<std::string>(&opts.metricsName)->default_value(opts.metricsName),
+             "shared memory segment to publish live metrics to; empty = disabled")
+            ("trace", po::value<std::string>(&opts.traceFile),
+             "record a replayable trace of the session to this file")
+            ("instance", po::value<std::vector<std::string>>(&instances)->composing(),
+             "run another loop on 'capture|playback' (or one device for both); may be repeated")
+            ("workers", po::value<size_t>(&workers)->default_value(workers),
+             "real-time worker threads to share the DSP between; 0 = one per loop if there's more than one")
+            ("firstCore", po::value<int>(&firstCore)->default_value(firstCore),
+             "core to pin the first worker thread to")
+            ("loadInterval", po::value<double>(&loadInterval)->default_value(loadInterval),
+             "how often to report worker load per core, in seconds; 0 = never")
+            ("calibrationCache", po::value<std::string>(&opts.calibrationCache)->default_value(opts.calibrationCache),
+             "file to remember calibration results in between runs; empty = disabled")
+            ("recalibrate", "ignore any cached calibration and do a full one")
+            ("autoTune", "look for the lowest period and latency that run without xruns")
+            ("autoTuneSettle", po::value<double>(&opts.autoTuneSettle)->default_value(opts.autoTuneSettle),
+             "how long a setting has to run cleanly before auto-tuning settles on it, in seconds")
+            ("spectrogram", po::value<bool>(&opts.spectrogram)->default_value(opts.spectrogram),
+             "show a live spectrogram around the visualization")
+            ("eq", po::value<std::vector<std::string>>(&eqBands)->composing(),
+             "EQ band on the capture, as type:freq:gain:q[:channel] (type is peak, lowshelf, highshelf, lowpass or highpass); may be repeated")
+            ("eqSections", po::value<size_t>(&opts.eqSections)->default_value(opts.eqSections),
+             "EQ filter sections per channel, to leave room for bands added while running; 0 = just enough for --eq")
+            ("limiterLookahead", po::value<double>(&opts.limiterLookahead)->default_value(opts.limiterLookahead),
+             "how far ahead the output limiter looks, in seconds")
+            ("stretch", "play the loop through the time stretcher, so that --speed and --pitch can be changed while running")
+            ("replay", po::value<std::string>(&replayFile),
+             "replay a trace file offline, as fast as possible, and exit")
+            ("replayOut", po::value<std::string>(&replayOut),
+             "where to write the replayed output audio (raw PCM)")
+            ("replayHistory", po::value<std::string>(&replayHistory),
+             "where to write the replayed per-cycle history (CSV)")
+            ("simulate", po::value<double>(&simulate),
+             "run the loop in a simulated room for this many (simulated) seconds, as fast as possible, and exit")
+            ("simulateReport", po::value<double>(&simulateReport)->default_value(simulateReport),
+             "how often to report statistics during a simulation, in simulated seconds")
+            ("roomDelay", po::value<double>(&room.delay)->default_value(room.delay),
+             "simulated speaker to microphone delay, in seconds")
+            ("roomGain", po::value<double>(&room.gain)->default_value(room.gain),
+             "simulated level of each speaker at its microphone")
+            ("roomCrosstalk", po::value<double>(&room.crosstalk)->default_value(room.crosstalk),
+             "simulated level of each speaker at the other microphones, relative to roomGain")
+            ("roomReverb", po::value<double>(&room.reverb)->default_value(room.reverb),
+             "simulated reverb time (RT60), in seconds")
+            ("roomReverbLevel", po::value<double>(&room.reverbLevel)->default_value(room.reverbLevel),
+             "simulated reverb level, relative to the direct sound")
+            ("roomImpulse", po::value<std::string>(&room.impulseFile),
+             "impulse response to simulate the room with instead (raw 16-bit mono PCM)")
+            ("roomNoise", po::value<double>(&room.noise)->default_value(room.noise),
+             "simulated background noise level")
+            ("roomResonance", po::value<double>(&room.resonance)->default_value(room.resonance),
+             "simulated room mode frequency, in Hz; 0 = none")
+            ("roomResonanceGain", po::value<double>(&room.resonanceGain)->default_value(room.resonanceGain),
+             "simulated room mode boost, in dB")
+            ("roomResonanceQ", po::value<double>(&room.resonanceQ)->default_value(room.resonanceQ),
+             "simulated room mode Q")
+            ("roomEvents", po::value<double>(&room.events)->default_value(room.events),
+             "simulated loud events (claps, shouts) per minute")
+            ("roomStalls", po::value<double>(&room.stalls)->default_value(room.stalls),
+             "simulated hold-ups long enough to cause xruns, per minute")
+            ("roomSeed", po::value<unsigned int>(&room.seed)->default_value(room.seed),
+             "random seed for the simulated room")
+            ("benchmark", po::value<std::string>(&benchmark),
+             "run a processing benchmark and exit ('list' to list them)")
+            ("benchmarkOutput", po::value<std::string>(&benchmarkOutput),
+             "where benchmarks save their output, e.g. the render benchmark's frames (as a filename prefix)")
             
             ("dampen,d", po::value<double>(&knobs.dampen)->default_value(knobs.dampen),
              "dampening factor")
@@ -87,7 +300,7 @@ int main(int argc, char *argv[]) try {
              "feedback adjustment threshold; < 0 = autodetect at startup")
             ("limiter,L", po::value<double>(&knobs.limitPower)->default_value(knobs.limitPower), "power limiter")
             ("mode,m", po::value<std::string>(&initMode)->default_value("gain"),
-             "initial volume model (gain, feedback, target)")
+             "initial volume model (gain, feedback, target, peak, compressor)")
             ("feedback,f", po::value<double>(&knobs.levels[Repeater::M_FEEDBACK])
              ->default_value(knobs.levels[Repeater::M_FEEDBACK]),
              "feedback factor")
@@ -97,8 +310,42 @@ int main(int argc, char *argv[]) try {
             ("gain,g", po::value<double>(&knobs.levels[Repeater::M_GAIN])
              ->default_value(knobs.levels[Repeater::M_GAIN]),
              "ordinary gain")
+            ("peakGain", po::value<double>(&knobs.levels[Repeater::M_LIMITER])
+             ->default_value(knobs.levels[Repeater::M_LIMITER]),
+             "gain for the lookahead peak limiter model")
+            ("ceiling", po::value<double>(&knobs.ceiling)->default_value(knobs.ceiling),
+             "output ceiling, as a fraction of full scale")
+            ("lookahead", po::value<double>(&knobs.lookahead)->default_value(knobs.lookahead),
+             "peak limiter lookahead, in seconds")
+            ("compress", po::value<double>(&knobs.levels[Repeater::M_COMPRESSOR])
+             ->default_value(knobs.levels[Repeater::M_COMPRESSOR]),
+             "compressor threshold power level")
+            ("ratio", po::value<double>(&knobs.ratio)->default_value(knobs.ratio),
+             "compressor ratio")
+            ("attack", po::value<double>(&knobs.attack)->default_value(knobs.attack),
+             "compressor attack time, in seconds")
+            ("release", po::value<double>(&knobs.release)->default_value(knobs.release),
+             "compressor release time, in seconds")
+            ("power", po::value<std::string>(&powerSource)->default_value("rms"),
+             "where the volume models get their levels from (rms, momentary, shortterm)")
+            ("loudnessGate", po::value<double>(&knobs.loudnessGate)->default_value(knobs.loudnessGate),
+             "loudness below this, in LUFS, doesn't count towards the momentary or short-term level")
+            ("speed", po::value<double>(&knobs.speed)->default_value(knobs.speed),
+             "playback speed, from 0.5 to 2 (turns on --stretch)")
+            ("pitch", po::value<double>(&knobs.pitch)->default_value(knobs.pitch),
+             "playback pitch shift, in semitones, up to 12 either way (turns on --stretch)")
+            ("stretchRange", po::value<double>(&knobs.stretchRange)->default_value(knobs.stretchRange),
+             "how far stretched playback can drift from the loop delay before it's pulled back, in seconds")
+            ("idleLevel", po::value<double>(&knobs.idleLevel)->default_value(knobs.idleLevel),
+             "power level that counts as someone being in the room; -1 = four times the calibrated quiet level")
+            ("idleAfter", po::value<double>(&knobs.idleAfter)->default_value(knobs.idleAfter),
+             "how long the room has to be silent before idling, in seconds; 0 = never")
             ("fullscreen,S", po::value<bool>(&fullScreen)->default_value(fullScreen),
              "fullscreen mode")
+            ("engine", po::value<std::string>(&engineName)->default_value(engineName),
+             "shared memory segment to share the engine with visualizers through; empty = disabled")
+            ("headless", "run just the audio engine, without the visualizer")
+            ("attach", "run just the visualizer, attached to an engine running with --headless")
             ;
 
         po::variables_map vm;
@@ -128,61 +375,272 @@ int main(int argc, char *argv[]) try {
 
         po::notify(vm);
 
-        if (initMode == "gain") {
-            knobs.mode = Repeater::M_GAIN;
-        } else if (initMode == "feedback") {
-            knobs.mode = Repeater::M_FEEDBACK;
-        } else if (initMode== "target") {
-            knobs.mode = Repeater::M_TARGET;
-        } else {
+        opts.recalibrate = vm.count("recalibrate") > 0;
+        opts.autoTune = vm.count("autoTune") > 0;
+        opts.stretch = vm.count("stretch") > 0 || knobs.speed != 1 || knobs.pitch != 0;
+        headless = vm.count("headless") > 0;
+        attach = vm.count("attach") > 0;
+        if (attach && headless) {
+            std::cerr << "--attach and --headless don't go together" << std::endl;
+            return 1;
+        }
+        if (attach && engineName.empty()) {
+            std::cerr << "--attach needs an --engine to attach to" << std::endl;
+            return 1;
+        }
+
+        if (!vm.count("drift")) {
+            opts.driftCompensation = opts.captureDevice != opts.playbackDevice;
+        }
+
+        if (eqBands.size() > knobs.eq.size()) {
+            std::cerr << "At most " << knobs.eq.size() << " --eq bands" << std::endl;
+            return 1;
+        }
+        for (size_t b = 0; b < eqBands.size(); b++) {
+            if (!parseEqBand(eqBands[b], knobs.eq[b])) {
+                std::cerr << "Bad --eq band '" << eqBands[b] << "'" << std::endl;
+                return 1;
+            }
+        }
+        if (!opts.eqSections) {
+            opts.eqSections = eqBands.size();
+        }
+        opts.eqSections = std::min(opts.eqSections, Equalizer::MAX_SECTIONS);
+
+        if (headless) {
+            // there's nothing in this process to show it
+            opts.spectrogram = false;
+        }
+        loopOpts.push_back(opts);
+        for (const auto& devices : instances) {
+            loopOpts.push_back(instanceOptions(opts, devices, loopOpts.size(), !vm.count("drift")));
+        }
+        if (!workers && loopOpts.size() > 1) {
+            workers = std::min<size_t>(loopOpts.size(), std::max(1u, std::thread::hardware_concurrency()));
+        }
+
+        if (!benchmark.empty()) {
+            return runBenchmark(benchmark, opts, benchmarkOutput);
+        }
+
+        if (!replayFile.empty()) {
+            opts.latencyTracking = false;
+            opts.metricsName.clear();
+            opts.spectrogram = false;
+            Repeater replayer(opts, knobs);
+            return replayer.replay(replayFile, replayOut, replayHistory);
+        }
+
+        if (!Repeater::parseMode(initMode, knobs.mode)) {
             std::cerr << "Unknown volume model '" << initMode << "'" << std::endl;
             return 1;
         }
+        if (!Repeater::parsePowerSource(powerSource, knobs.power)) {
+            std::cerr << "Unknown power source '" << powerSource << "'" << std::endl;
+            return 1;
+        }
+
+        if (simulate > 0) {
+            opts.metricsName.clear();
+            opts.spectrogram = false;
+            Repeater simulator(opts, knobs);
+            std::unique_ptr<WorkerPool> pool;
+            if (workers) {
+                pool.reset(new WorkerPool(workers, firstCore));
+                simulator.setWorkerPool(pool.get());
+            }
+            return simulator.simulate(room, simulate, simulateReport);
+        }
     }
 
-    int ret;
-    
-    rr = std::make_shared<Repeater>(opts, knobs);
-    vis = std::make_shared<Visualizer>(rr);
+    int ret = 0;
+
+    if (!attach) {
+        for (const auto& o : loopOpts) {
+            loops.push_back(std::make_shared<Repeater>(o, knobs));
+        }
+        rr = loops.front();
+    }
 
-    if (fullScreen) {
-        glutEnterGameMode();
-        glutSetCursor(GLUT_CURSOR_NONE);
+    if (headless) {
+        // keep the audio side out of swap; it's small enough now
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+            std::cerr << "Couldn't lock memory: " << strerror(errno) << std::endl;
+        }
+        signal(SIGINT, stopFunc);
+        signal(SIGTERM, stopFunc);
     } else {
-        glutCreateWindow("whatwesaidwillbe");
+        glutInitContextVersion(2, 0);
+        glutInitContextFlags (GLUT_FORWARD_COMPATIBLE);
+        glutInit(&argc, argv);
+        glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE | GLUT_MULTISAMPLE);
+        glutSetOption(GLUT_ACTION_ON_WINDOW_CLOSE, GLUT_ACTION_CONTINUE_EXECUTION);
+
+        engine = attach ? Engine::remote(engineName) : Engine::local(rr);
+        vis = std::make_shared<Visualizer>(engine);
+
+        if (fullScreen) {
+            glutEnterGameMode();
+            glutSetCursor(GLUT_CURSOR_NONE);
+        } else {
+            glutCreateWindow("whatwesaidwillbe");
+        }
+
+        int err = glewInit();
+        if (err != GLEW_OK) {
+            std::cerr << "Couldn't initialize GLEW: " << glewGetErrorString(err) << std::endl;
+            return 1;
+        }
+
+        glutReshapeFunc(reshapeFunc);
+        glutDisplayFunc(displayFunc);
+        glutKeyboardFunc(keyboardFunc);
+        glutSpecialFunc(specialFunc);
+
+        vis->onInit();
     }
 
-    int err = glewInit();
-    if (err != GLEW_OK) {
-        std::cerr << "Couldn't initialize GLEW: " << glewGetErrorString(err) << std::endl;
-        return 1;
+    std::unique_ptr<WorkerPool> pool;
+    if (workers && !attach) {
+        pool.reset(new WorkerPool(workers, firstCore));
+        for (auto& loop : loops) {
+            loop->setWorkerPool(pool.get());
+        }
+        std::cout << "Running " << loops.size() << " loop(s) on " << workers << " worker(s)" << std::endl;
     }
 
-    glutReshapeFunc(reshapeFunc);
-    glutDisplayFunc(displayFunc);
-    glutKeyboardFunc(keyboardFunc);
-    glutSpecialFunc(specialFunc);
+    std::vector<std::unique_ptr<ControlServer>> controls;
+    for (auto& loop : loops) {
+        const int port = loop->getOptions().controlPort;
+        if (port > 0) {
+            controls.emplace_back(new ControlServer(loop, port));
+            controls.back()->start();
+            std::cout << "Listening for OSC on port " << controls.back()->port() << std::endl;
+        }
+    }
 
-    vis->onInit();
-    
-    std::thread audioThread(
-        [&]() {
-            try {
-                ret = rr->run();
-            } catch (const std::exception& e) {
-                std::cerr << "Audio thread: " << e.what() << std::endl;
-                ret = 1;
+    std::mutex retMutex;
+    std::vector<std::thread> audioThreads;
+    auto startAudio = [&](const std::function<int()>& body, bool realTime) {
+        audioThreads.emplace_back(
+            [&ret, &retMutex, body]() {
+                int r;
+                try {
+                    r = body();
+                } catch (const std::exception& e) {
+                    std::cerr << "Audio thread: " << e.what() << std::endl;
+                    r = 1;
+                }
+                std::lock_guard<std::mutex> lock(retMutex);
+                ret = ret ? ret : r;
+            });
+        if (realTime) {
+            // above the workers, since it waits on them
+            struct sched_param param = {};
+            param.sched_priority = sched_get_priority_min(SCHED_FIFO) + 20;
+            if (pthread_setschedparam(audioThreads.back().native_handle(), SCHED_FIFO, &param)) {
+                std::cerr << "Couldn't switch the audio thread to real-time priority" << std::endl;
             }
-        });
+        }
+    };
+
+    // JACK drives its loops from its own thread; the ALSA ones all go round
+    // together on one thread, so they can share out the workers
+    std::vector<Repeater *> alsaLoops;
+    for (auto& loop : loops) {
+        if (loop->getOptions().jackClient.empty()) {
+            alsaLoops.push_back(loop.get());
+        } else {
+            startAudio([loop]() { return loop->run(); }, headless);
+        }
+    }
+    if (!alsaLoops.empty()) {
+        startAudio([alsaLoops]() { return Repeater::runAll(alsaLoops); }, headless || pool);
+    }
+
+    std::atomic<bool> running(true);
 
-    std::cout << "entering GLUT main loop..." << std::endl;
+    // share the first loop with visualizers in other processes
+    std::thread linkThread;
+    if (rr && !engineName.empty()) {
+        try {
+            std::shared_ptr<EngineLink> link = std::make_shared<EngineLink>(
+                engineName, true, rr->getOptions().historySize);
+            std::cout << "Publishing engine state to " << engineName << std::endl;
+            linkThread = std::thread(
+                [&running, link]() {
+                    while (running) {
+                        link->poll(*rr);
+                        link->publish(*rr);
+                        std::this_thread::sleep_for(std::chrono::milliseconds(rr->isIdle() ? 250 : 30));
+                    }
+                    // so that visualizers know we're gone
+                    link->publish(*rr);
+                });
+        } catch (const std::exception& e) {
+            std::cerr << "Not publishing engine state: " << e.what() << std::endl;
+        }
+    }
 
-    glutMainLoop();
+    // report how busy the workers are, for capacity planning
+    std::thread loadThread;
+    if (pool && loadInterval > 0) {
+        loadThread = std::thread(
+            [&]() {
+                double waited = 0;
+                while (running) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                    waited += 0.1;
+                    if (waited < loadInterval) {
+                        continue;
+                    }
+                    waited = 0;
+                    for (const auto& core : pool->load()) {
+                        std::cout << "core " << core.core << ": "
+                                  << core.load*100 << "% load, "
+                                  << core.jobs << " jobs, "
+                                  << core.missed << " missed deadlines" << std::endl;
+                    }
+                }
+            });
+    }
+
+    if (headless) {
+        std::cout << "running headless..." << std::endl;
+        bool stopping = false;
+        while (std::any_of(loops.begin(), loops.end(),
+                           [](const Repeater::Ptr& loop) { return loop->getState() != Repeater::S_GONE; })) {
+            if (stopRequested && !stopping) {
+                for (auto& loop : loops) {
+                    loop->shutdown();
+                }
+                stopping = true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    } else {
+        std::cout << "entering GLUT main loop..." << std::endl;
+        glutMainLoop();
+    }
 
     std::cout << "awaiting shutdown..." << std::endl;
-    audioThread.join();
+    for (auto& loop : loops) {
+        if (loop->getState() != Repeater::S_GONE) {
+            loop->shutdown();
+        }
+    }
+    for (auto& t : audioThreads) {
+        t.join();
+    }
+    running = false;
+    if (linkThread.joinable()) {
+        linkThread.join();
+    }
+    if (loadThread.joinable()) {
+        loadThread.join();
+    }
     return ret;
 } catch (const std::exception& e) {
     std::cerr << "Error: " << e.what() << std::endl;
 }
-
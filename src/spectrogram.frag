@@ -0,0 +1,15 @@
+// spectrogram levels; s runs across the band (mapped onto log frequency), t is time
+#version 120
+
+uniform sampler2D spectrum;
+
+// lowest frequency shown, as a fraction of Nyquist
+uniform float minFreq;
+
+void main() {
+    float s = minFreq*pow(1.0/minFreq, gl_TexCoord[0].s);
+    vec4 level = texture2D(spectrum, vec2(s, gl_TexCoord[0].t));
+
+    // recorded is in the luminance channel, played in alpha
+    gl_FragColor = vec4(level.r, 0.3*level.r, level.a, max(level.r, level.a));
+}
@@ -0,0 +1,12 @@
+/*
+ polar projection like polar.vert, with the texture coordinates passed through
+*/
+
+#version 120
+
+void main() {
+    gl_Position = gl_ModelViewProjectionMatrix
+        * vec4(cos(gl_Vertex.x)*gl_Vertex.y, sin(gl_Vertex.x)*gl_Vertex.y, gl_Vertex.zw);
+
+    gl_TexCoord[0] = gl_MultiTexCoord0;
+}
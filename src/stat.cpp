@@ -0,0 +1,90 @@
+// Command-line reader for the engine's shared-memory metrics
+
+#include "Metrics.h"
+
+#include <boost/program_options.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+int main(int argc, char *argv[]) try {
+    std::string name = "/whatwesaidwillbe";
+    std::string promFile;
+    double interval = 1;
+    bool once = false;
+
+    {
+        namespace po = boost::program_options;
+
+        po::options_description desc("whatwesaidwillbe-stat options");
+        desc.add_options()
+            ("help,h", "show this help")
+            ("name,n", po::value<std::string>(&name)->default_value(name), "metrics segment name")
+            ("prometheus,p", po::value<std::string>(&promFile),
+             "write Prometheus text format to this file instead of printing")
+            ("interval,i", po::value<double>(&interval)->default_value(interval),
+             "seconds between updates")
+            ("once,1", po::bool_switch(&once), "read once and exit")
+            ;
+
+        po::variables_map vm;
+        po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+        if (vm.count("help")) {
+            std::cerr << desc << std::endl;
+            return 1;
+        }
+        po::notify(vm);
+    }
+
+    Metrics metrics(name, false);
+    Metrics::Snapshot s;
+
+    for (;;) {
+        if (!metrics.read(s)) {
+            std::cerr << "No metrics available yet" << std::endl;
+        } else if (!promFile.empty()) {
+            // write then rename, so scrapers never see a partial file
+            const std::string tmp = promFile + ".tmp";
+            {
+                std::ofstream out(tmp);
+                out << Metrics::prometheus(s);
+            }
+            if (rename(tmp.c_str(), promFile.c_str()) < 0) {
+                perror(promFile.c_str());
+                return 1;
+            }
+        } else {
+            std::cout << "t=" << s.uptime
+                      << " mode=" << s.mode
+                      << " rec=" << s.recordedPower
+                      << " exp=" << s.expectedPower
+                      << " gain=" << s.actualGain << '/' << s.targetGain
+                      << " xruns=" << s.captureXruns << '/' << s.playbackXruns
+                      << " lost=" << s.captureLost << '/' << s.playbackLost
+                      << " cycle=" << s.cycleTime*1e3 << "ms (max " << s.cycleTimeMax*1e3
+                      << ", period " << s.period*1e3 << ")"
+                      << " latency=" << s.latency
+                      << " drift=" << s.clockDrift << "ppm"
+                      << (s.idle ? " idle" : " active")
+                      << " cpu=" << (s.activeSeconds > 0 ? s.activeCpuSeconds*100/s.activeSeconds : 0)
+                      << "%/" << (s.idleSeconds > 0 ? s.idleCpuSeconds*100/s.idleSeconds : 0) << '%';
+            if (s.dspLoad > 0) {
+                std::cout << " dsp=" << s.dspLoad << '%';
+            }
+            std::cout << std::endl;
+        }
+
+        if (once) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::duration<double>(interval));
+    }
+    return 0;
+} catch (const std::exception& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+}